@@ -1,89 +1,293 @@
+/*
+ *  Serial_Communication.c
+ *
+ *  Asynchronous command channel to the Mikrotron camera's serial control port.
+ *  See Serial_Communication.h for the protocol.
+ *
+ *  Compiled together with the capture program, e.g.:
+ *
+ *	    gcc -c Serial_Communication.c
+ *
+ *  Can be exercised without a camera by running ./fake_camera and passing the
+ *  pseudo-terminal it prints to the capture program with "-s /dev/pts/N".
+ */
+
+// C library
+#include <stdio.h>
+#include <string.h>
+
+// UNIX standard function definitions
+#include <unistd.h>
+
 // Serial communication
 #include <fcntl.h>      /* File control definitions */
 #include <errno.h>      /* Error number definitions */
 #include <termios.h>    /* POSIX terminal control definitions */
+#include <poll.h>
+
+#include "Serial_Communication.h"
+
+
+
+// ================================================================================================
+// Milliseconds elapsed since t
+// ================================================================================================
+static int ElapsedMs(struct timespec *t)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int)((now.tv_sec - t->tv_sec)*1000 + (now.tv_nsec - t->tv_nsec)/1000000);
+}
+
 
 
 // ================================================================================================
-// Serial communication between two computers
+// Map a numeric baud rate to its termios constant
 // ================================================================================================
-void SerialTalk(void)
+static speed_t BaudConstant(int baud)
 {
-    // ---------------------------------------------
-    // Open serial port
-    // ---------------------------------------------
-    int fd;
-    fd = open("/dev/ttyUSB0", O_RDWR | O_NOCTTY | O_NDELAY);    //0_RDWR:   Read/Write mode
-                                                                //0_NOCTTY: program doesn't want to be "controlling terminal" for port
-                                                                //0_NDELAY: program doesn't care what state the DCD signal line is in
-
-    // Check to see if serial port is opened
-    if (fd == -1) {
-        // Could not open the port
-        perror("open_port: Unable to open /dev/ttyUSB0 - ");
+    switch (baud) {
+      case 9600:    return B9600;
+      case 19200:   return B19200;
+      case 38400:   return B38400;
+      case 57600:   return B57600;
+      case 115200:  return B115200;
+      case 230400:  return B230400;
+      default:      return B9600;
     }
-    else
-        fcntl(fd, F_SETFL, 0);
+}
 
-    printf("File descriptor: %d\r\n",fd);
 
 
-    // ---------------------------------------------
-    // Configure serial port
-    // ---------------------------------------------
-    struct termios options;
+// ================================================================================================
+// Open and configure the serial port: raw 8N1, no flow control, non-blocking
+// ================================================================================================
+int SerialOpen(CameraSerial *cam, const char *device, int baud)
+{
+    memset(cam, 0, sizeof(*cam));
+    cam->fd = -1;
+    strncpy(cam->device, device, sizeof(cam->device)-1);
+
+    // O_NOCTTY: program doesn't want to be "controlling terminal" for port
+    // O_NONBLOCK: reads and writes never stall the caller; SerialPoll() waits with poll()
+    cam->fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (cam->fd == -1) {
+        perror("SerialOpen: unable to open serial port");
+        return(-1);
+    }
 
-    // Get current attributes
-    tcgetattr(fd, &options);
+    struct termios options;
+    if (tcgetattr(cam->fd, &options) == -1) {
+        perror("SerialOpen: tcgetattr");
+        SerialClose(cam);
+        return(-1);
+    }
 
-    // Canonical input - carriage return or line feed
-    options.c_lflag |= (ICANON | ECHO | ECHOE);
+    // Raw input and output - the camera's replies are single bytes, not lines
+    cfmakeraw(&options);
 
-    // 230400 baud rate
-    cfsetispeed(&options, B230400);
-    cfsetospeed(&options, B230400);
+    cfsetispeed(&options, BaudConstant(baud));
+    cfsetospeed(&options, BaudConstant(baud));
 
     // 8N1: 8 data bits, no parity, 1 stop bit
-    options.c_cflag &= ~PARENB
-    options.c_cflag &= ~CSTOPB
+    options.c_cflag &= ~PARENB;
+    options.c_cflag &= ~CSTOPB;
     options.c_cflag &= ~CSIZE;
     options.c_cflag |= CS8;
 
-    // Hardware flow control
-    //options.c_cflag |= CNEW_RTSCTS;
+    // No software flow control - ACK/NAK bytes must not be swallowed
+    options.c_iflag &= ~(IXON | IXOFF | IXANY);
 
-    // Software flow control
-    options.c_iflag |= (IXON | IXOFF | IXANY);
+    // Enable the receiver and set local mode
+    options.c_cflag |= (CLOCAL | CREAD);
 
-    // Input parity checking
-    options.c_iflag |= (INPCK | ISTRIP);
+    // Set the new options for the port immediately, discarding stale input
+    if (tcsetattr(cam->fd, TCSANOW, &options) == -1) {
+        perror("SerialOpen: tcsetattr");
+        SerialClose(cam);
+        return(-1);
+    }
+    tcflush(cam->fd, TCIOFLUSH);
+
+    printf("Camera serial port %s opened at %d baud.\r\n", device, baud);
+    return(0);
+}
 
-    // Processed output
-    options.c_oflag |= OPOST;
 
-    //Enable the receiver and set local mode
-    options.c_cflag |= (CLOCAL | CREAD);
 
-    //Set the new options for the port immediately
-    tcsetattr(fd, TCSANOW, &options);
+// ================================================================================================
+// Close the serial port, dropping any unsent commands
+// ================================================================================================
+void SerialClose(CameraSerial *cam)
+{
+    if (cam->fd != -1) {
+        close(cam->fd);
+    }
+    cam->fd = -1;
+    cam->count = 0;
+    cam->inflight = 0;
+}
 
 
-    // ---------------------------------------------
-    // Write to serial port
-    // ---------------------------------------------
-    n = write(fd, "ATZ\r", 4);  //4 bytes
-    if (n < 0)
-        fputs("write() of 4 bytes failed!\n", stderr);
 
+// ================================================================================================
+// Write the command at the head of the queue
+// ================================================================================================
+static int SerialSendHead(CameraSerial *cam)
+{
+    const char *command = cam->queue[cam->head];
+    size_t len = strlen(command);
 
-    // ---------------------------------------------
-    // Read from serial port
-    // ---------------------------------------------
-    fcntl(fd, F_SETFL, 0);
+    if (write(cam->fd, command, len) != (ssize_t)len) {
+        perror("SerialSendHead: write");
+        return(-1);
+    }
+    cam->inflight = 1;
+    clock_gettime(CLOCK_MONOTONIC, &cam->sent);
+    return(0);
+}
 
 
-    // ---------------------------------------------
-    // Close serial port
-    // ---------------------------------------------
-    close(fd);
+
+// ================================================================================================
+// Retire the command at the head of the queue and start the next one
+// ================================================================================================
+static void SerialRetireHead(CameraSerial *cam)
+{
+    cam->head = (cam->head + 1) % SERIAL_QUEUE_LEN;
+    cam->count--;
+    cam->inflight = 0;
+
+    while (cam->count > 0 && SerialSendHead(cam) < 0) {
+        cam->errors++;
+        cam->head = (cam->head + 1) % SERIAL_QUEUE_LEN;
+        cam->count--;
+    }
+}
+
+
+
+// ================================================================================================
+// Queue a command (without the trailing "\r") and send it if the port is idle
+// ================================================================================================
+int SerialSubmit(CameraSerial *cam, const char *command)
+{
+    if (cam->fd == -1) {
+        return(-1);
+    }
+    if (cam->count == SERIAL_QUEUE_LEN || strlen(command) + 2 > SERIAL_CMD_LEN) {
+        fprintf(stderr, "SerialSubmit: command '%s' dropped\n", command);
+        cam->errors++;
+        return(-1);
+    }
+
+    int slot = (cam->head + cam->count) % SERIAL_QUEUE_LEN;
+    snprintf(cam->queue[slot], SERIAL_CMD_LEN, "%s\r", command);
+    cam->count++;
+
+    if (!cam->inflight && SerialSendHead(cam) < 0) {
+        cam->errors++;
+        SerialRetireHead(cam);
+        return(-1);
+    }
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Process replies for up to timeoutms; returns the number of commands still pending
+// ================================================================================================
+int SerialPoll(CameraSerial *cam, int timeoutms)
+{
+    if (cam->fd == -1) {
+        return(0);
+    }
+
+    struct pollfd pfd;
+    pfd.fd = cam->fd;
+    pfd.events = POLLIN;
+
+    if (cam->inflight) {
+        int left = SERIAL_TIMEOUT_MS - ElapsedMs(&cam->sent);
+        if (left < timeoutms) {
+            timeoutms = left > 0 ? left : 0;
+        }
+    }
+
+    if (cam->count > 0 && poll(&pfd, 1, timeoutms) > 0 && (pfd.revents & POLLIN)) {
+        unsigned char reply[SERIAL_CMD_LEN];
+        ssize_t n = read(cam->fd, reply, sizeof(reply));
+        ssize_t i;
+        for (i = 0; i < n && cam->inflight; i++) {
+            if (reply[i] == SERIAL_NAK) {
+                fprintf(stderr, "Camera rejected command '%.*s'\n", (int)strcspn(cam->queue[cam->head], "\r"), cam->queue[cam->head]);
+                cam->errors++;
+                SerialRetireHead(cam);
+            }
+            else if (reply[i] == SERIAL_ACK) {
+                SerialRetireHead(cam);
+            }
+        }
+    }
+
+    // No answer in time - count it as an error and move on so one lost byte can't stall a trial
+    if (cam->inflight && ElapsedMs(&cam->sent) >= SERIAL_TIMEOUT_MS) {
+        fprintf(stderr, "Camera did not answer command '%.*s'\n", (int)strcspn(cam->queue[cam->head], "\r"), cam->queue[cam->head]);
+        cam->errors++;
+        SerialRetireHead(cam);
+    }
+
+    return(cam->count);
+}
+
+
+
+// ================================================================================================
+// Block until every queued command is answered or timeoutms passes; returns the error count
+// ================================================================================================
+int SerialWait(CameraSerial *cam, int timeoutms)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (SerialPoll(cam, 10) > 0) {
+        if (ElapsedMs(&start) >= timeoutms) {
+            fprintf(stderr, "SerialWait: %d camera command(s) still pending\n", cam->count);
+            cam->errors += cam->count;
+            cam->count = 0;
+            cam->inflight = 0;
+            break;
+        }
+    }
+
+    int errors = cam->errors;
+    cam->errors = 0;
+    return(errors);
+}
+
+
+
+// ================================================================================================
+// Camera settings - each queues one command
+// ================================================================================================
+int SerialSetFrameRate(CameraSerial *cam, int fps)
+{
+    char command[SERIAL_CMD_LEN];
+    snprintf(command, sizeof(command), ":q%06x", fps);
+    return SerialSubmit(cam, command);
+}
+
+int SerialSetExposure(CameraSerial *cam, int microseconds)
+{
+    char command[SERIAL_CMD_LEN];
+    snprintf(command, sizeof(command), ":t%06x", microseconds);
+    return SerialSubmit(cam, command);
+}
+
+int SerialSetROI(CameraSerial *cam, int x, int y, int width, int height)
+{
+    char command[SERIAL_CMD_LEN];
+    snprintf(command, sizeof(command), ":d%03x%03x%03x%03x", x, y, width, height);
+    return SerialSubmit(cam, command);
 }
@@ -0,0 +1,57 @@
+/*
+ *  Serial_Communication.h
+ *
+ *  Asynchronous command channel to the Mikrotron camera's serial control port.
+ *
+ *  The camera accepts ASCII commands of the form ":<letter><hex value>\r" and
+ *  answers each one with a single ACK (0x06) or NAK (0x15) byte. These are the
+ *  same commands XCAP stores in the pxcamcntl.cntldata section of a saved .fmt
+ *  file, e.g. ":q0001f4\r" (500 FPS) and ":t000032\r" (50 us exposure).
+ *
+ *  Commands are queued with SerialSubmit() and written one at a time as the
+ *  previous one is acknowledged, so the caller can keep working (allocating
+ *  buffers, opening the frame grabber) while the camera is reconfigured and
+ *  only block in SerialWait() right before arming the capture.
+ */
+#ifndef SERIAL_COMMUNICATION_H
+#define SERIAL_COMMUNICATION_H
+
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SERIAL_QUEUE_LEN    16      // max commands waiting to be sent
+#define SERIAL_CMD_LEN      32      // max length of one command, including "\r"
+#define SERIAL_TIMEOUT_MS   500     // time allowed for the camera to answer one command
+
+#define SERIAL_ACK          0x06
+#define SERIAL_NAK          0x15
+
+typedef struct {
+    int     fd;                                     // -1 if the port is not open
+    char    device[64];
+    char    queue[SERIAL_QUEUE_LEN][SERIAL_CMD_LEN];
+    int     head, count;                            // ring of pending commands
+    int     inflight;                               // 1 if queue[head] was written and awaits ACK/NAK
+    struct timespec sent;                           // when queue[head] was written
+    int     errors;                                 // NAKs and timeouts since the last SerialWait()
+} CameraSerial;
+
+int  SerialOpen(CameraSerial *cam, const char *device, int baud);
+void SerialClose(CameraSerial *cam);
+
+int  SerialSubmit(CameraSerial *cam, const char *command);
+int  SerialPoll(CameraSerial *cam, int timeoutms);
+int  SerialWait(CameraSerial *cam, int timeoutms);
+
+int  SerialSetFrameRate(CameraSerial *cam, int fps);
+int  SerialSetExposure(CameraSerial *cam, int microseconds);
+int  SerialSetROI(CameraSerial *cam, int x, int y, int width, int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -12,10 +12,25 @@
   #define FORMATFILE	"ExTrigger_1024_150_0_05ms.fmt"	  // using format file saved by XCAP
 #endif
 
+#if !defined(FORMATFILE)
+  #define FORMATFILE	""	  // predefined FORMAT in use - no format file
+#endif
+
+/*
+ *  1b) Directory scanned for .fmt files at start-up (override with "-f dir").
+ *  Machine A picks one per trial with "fmt=<name>"; FORMATFILE is used otherwise.
+ */
+#if !defined(FORMATDIR)
+  #define FORMATDIR	"."
+#endif
+
 
 /*
  *  2) Set number of expected PIXCI(R) image boards.
- *  This example expects only one unit.
+ *  With more than one unit all of them are armed by the same pxd_goLiveSeq(),
+ *  each is drained by its own thread (give each its own capture_cpu), and one
+ *  AVI is written per unit with the frames aligned by field count.
+ *  The units are expected to share the camera trigger.
  */
 #if !defined(UNITS)
     #define UNITS	1
@@ -49,7 +64,10 @@
 /*
  *  5a) Compile with GCC w/out PXIPL for 64 bit Linux as:
  *
- *	    gcc `pkg-config --cflags opencv` `pkg-config --libs opencv` -DC_GNU64=400 -DOS_LINUX -I../.. capture_avi_sequence.c ../../xclib_x86_64.a -lm
+ *	    gcc `pkg-config --cflags opencv` `pkg-config --libs opencv` -DC_GNU64=400 -DOS_LINUX -I../.. capture_avi_sequence.c Serial_Communication.c format_profiles.c sequence_plan.c rt_config.c telemetry.c trial_catalog.c sparse_store.c encode_pool.c phase_average.c frame_stats.c preview.c proxy.c trajectory.c drop_events.c frame_ranges.c pixel_kernels.c disk_writer.c raw_store.c frame_journal.c ../../xclib_x86_64.a -llz4 -lzstd -luring -lsqlite3 -lm -lpthread
+ *
+ *	Without liblz4, libzstd, liburing or libsqlite3 add -DUSE_LZ4=0, -DUSE_ZSTD=0, -DUSE_URING=0 or -DUSE_SQLITE=0
+ *	and drop the library.
  *
  *	Compile with GCC with PXIPL (do not have at this time) for 64 bit Linux as :
  *
@@ -58,7 +76,9 @@
  *
  *  5b) Run the output file from GCC (must be super-user or sudo permission):
  *
- *	    ./a.out
+ *	    ./a.out [-s camera_serial_device] [-f format_file_dir] [-c rt_config_file] [-r key=value]... [-t telemetry_log]
+ *
+ *	See rt_config.h for the real-time settings (capture core, SCHED_FIFO priority, worker cores, mlock).
  *
  */
 
@@ -104,8 +124,144 @@
 #include <sys/socket.h>
 
 #define SERVERA "129.105.69.211"    // server IP address (Machine A - Windows & TrackCam)
-#define DEFAULT_ PORT 27015              // port on which to listen for incoming data (Machine B)
-#define BUFLEN 512                // max length of buffer
+#define PORTA    9090               // port on which to send data (Machine A)
+#define PORTB    51717              // port on which to listen for incoming data (Machine B)
+#define BUFLEN   512                // max length of buffer
+
+// Camera serial control - override at run time with "-s /dev/pts/N" to talk to ./fake_camera
+#include "Serial_Communication.h"
+
+// Format files parsed at start-up
+#include "format_profiles.h"
+
+// Sequence length checked against grabber memory, host RAM and disk before arming
+#include "sequence_plan.h"
+
+#if !defined(OUTPUTDIR)
+    #define OUTPUTDIR   "/home/maciver/Documents/High Speed Videos"
+#endif
+#define FILENAMELEN 256             // output file paths - OUTPUTDIR and the trial's parameters
+
+// Real-time scheduling of the drain thread, worker core pinning, jitter statistics
+#include <pthread.h>
+#include <sched.h>
+#include "rt_config.h"
+
+RtConfig rtconfig;
+
+// Per-trial performance record, appended to TELEMETRYLOG and queryable with "Q [trial]"
+#include <sys/stat.h>
+#include "telemetry.h"
+
+#if !defined(TELEMETRYLOG)
+    #define TELEMETRYLOG    "mikrotron_telemetry.jsonl"
+#endif
+
+TrialTelemetry telemetry;
+double trialreceivedms;     // when the current trial's message arrived
+
+// Every trial's parameters, files, events and telemetry, queryable with trial_query
+#include "trial_catalog.h"
+
+#if !defined(TRIALCATALOG)
+    #define TRIALCATALOG    OUTPUTDIR "/" CATALOG_FILE
+#endif
+
+long catalogtrial;          // the current trial's catalog row, 0 = none
+
+#if !defined(CAMERA_SERIAL)
+    #define CAMERA_SERIAL   "/dev/ttyUSB0"
+#endif
+#if !defined(CAMERA_BAUD)
+    #define CAMERA_BAUD     9600
+#endif
+
+CameraSerial camera;
+
+// Background-subtracted sparse storage for static-scene trials ("store=sparse"), optionally
+// compressed ("codec=lz4" or "codec=zstd:<level>") on a pool of encoder threads
+#include "sparse_store.h"
+#include "encode_pool.h"
+
+#if !defined(BGFRAMES)
+    #define BGFRAMES        15          // frames the background median is taken over
+#endif
+
+// Uncompressed sequences ("store=raw") streamed to disk as they are drained, through a preallocated
+// O_DIRECT writer keeping "iodepth=N" writes in flight, so continuous capture runs at disk speed;
+// striped over one directory per disk ("stripe=/mnt/d1,/mnt/d2") where one disk can't keep up
+#include "raw_store.h"
+
+#if !defined(STRIPEDIRS)
+    #define STRIPEDIRS      ""          // default "stripe=" list, "" = one file in OUTPUTDIR
+#endif
+
+// Exposure statistics of every frame, gathered as it is read out, kept in the frame index
+#include "frame_stats.h"
+
+#if !defined(READBANDBYTES)
+    #define READBANDBYTES   65536       // frames are read out in bands of about this size
+#endif
+
+// Calibration ("C <FPS> [cal=profile,...] [burst=N]"): snap a burst per format profile and keep
+// the one with the most drop contrast that doesn't saturate, plus a drop threshold to go with it
+#if !defined(DROPTHRESHOLD)
+    #define DROPTHRESHOLD   220         // grey level separating drops from background until calibrated
+#endif
+#if !defined(CALBURST)
+    #define CALBURST        10          // frames snapped per profile
+#endif
+#if !defined(CALTIMEOUTMS)
+    #define CALTIMEOUTMS    1000        // pxd_doSnap() wait - the camera is externally triggered
+#endif
+#if !defined(CALSATURATEDPCT)
+    #define CALSATURATEDPCT 0.05        // profiles saturating more of the pixels than this are not picked
+#endif
+
+int dropthreshold = DROPTHRESHOLD;
+char calibratedformat[64] = "";         // default format profile once calibrated, "" = FORMATFILE
+
+// Phase-locked mean and variance images against the shaker drive ("phase=<bins>")
+#include "phase_average.h"
+
+// Drop trajectories of unit 1, tracked as it is drained and written to <base>.traj.csv ("track=0" = off),
+// and the impacts, rebounds and coalescences in them, tagged in the sequence index ("window=pre,post")
+#include "trajectory.h"
+#include "drop_events.h"
+
+// Export of chosen frame ranges only - the drop events' windows or a list sent with the trial
+#include "frame_ranges.h"
+
+// Pixel-transfer kernels at the widest vector width the cpu has (frames into IplImages)
+#include "pixel_kernels.h"
+
+#if !defined(TRACKDROPS)
+    #define TRACKDROPS      1
+#endif
+
+// Decimated live preview streamed over TCP while a trial is captured (view with preview_viewer)
+#include "preview.h"
+
+#if !defined(PREVIEWPORT)
+    #define PREVIEWPORT     51718       // 0 = no preview
+#endif
+#if !defined(PREVIEWEVERY)
+    #define PREVIEWEVERY    10          // offer every Nth frame
+#endif
+#if !defined(PREVIEWSCALE)
+    #define PREVIEWSCALE    4           // box filtered down by this much in each direction
+#endif
+
+// Low resolution proxy of unit 1 and a contact sheet, written as it is drained and kept in the catalog
+// ("proxy=N": every Nth frame, 0 = none), so a sweep can be browsed with trial_browse
+#include "proxy.h"
+
+#if !defined(PROXYEVERY)
+    #define PROXYEVERY      10          // default "proxy=", 0 = no proxies
+#endif
+#if !defined(PROXYSCALE)
+    #define PROXYSCALE      4           // box filtered down by this much in each direction
+#endif
 
 
 // Create UDP socket structures for Machine A and Machine B
@@ -117,11 +273,30 @@ struct sockaddr_in AddrMachineA, AddrMachineB;
 // ================================================================================================
 // SUPPORT STUFF:
 // Catch CTRL+C and floating point exceptions so that once opened, the PIXCI(R) driver
-// and frame grabber are always closed before exit
+// and frame grabber are always closed before exit.
+// CTRL+C during a trial only sets 'interrupted': the drain threads stop the grabber and the
+// trial's writers finish with the frames read out so far, then the program exits. A second
+// CTRL+C, or one between trials, exits at once, leaving a .raw or .bgs being written with its
+// journal for seq_recover to finish
 // ================================================================================================
+volatile sig_atomic_t capturing = 0;    // a trial's sequence is being captured or written
+volatile sig_atomic_t interrupted = 0;
+
 void sigintfunc(int sig)
 {
+    static const char stopping[] = "Interrupted - stopping capture and finishing the sequence (CTRL+C again to quit now).\r\n";
+    static const char note[] = "Interrupted - finish sequences left open with: seq_recover -d \"" OUTPUTDIR "\"\r\n";
+    ssize_t n;
+
+    if (sig == SIGINT && capturing && !interrupted) {
+        interrupted = 1;
+        n = write(STDOUT_FILENO, stopping, sizeof(stopping) - 1);
+        (void)n;
+        return;
+    }
     pxd_PIXCIclose();
+    n = write(STDOUT_FILENO, note, sizeof(note) - 1);
+    (void)n;                            // nothing more a handler can do about a failed write
     exit(1);
 }
 
@@ -207,10 +382,11 @@ void ReceiveSocket(int sock, char buf[], int slen)
     fflush(stdout);
 
     int recv_len;
-    if( (recv_len = recvfrom(sock, buf, BUFLEN, 0, (struct sockaddr *) &AddrMachineA, &slen)) == -1 )
+    if( (recv_len = recvfrom(sock, buf, BUFLEN-1, 0, (struct sockaddr *) &AddrMachineA, &slen)) == -1 )
     {
         die("recvfrom()");
     }
+    buf[recv_len] = 0;    // terminate so the message can be searched for trial options
 }
 
 
@@ -242,10 +418,156 @@ void CloseSocket(int sock)
 
 
 
+// ================================================================================================
+// Optional "key=value" trial settings following the fixed fields, e.g. "..., 0.5 exp=50 roi=0,0,1024,150"
+// ================================================================================================
+struct TrialOptions {
+    char format[64];    // format profile name, "" = FORMATFILE
+    int exposure;       // camera exposure time in microseconds, 0 = keep the format file's setting
+    int roi[4];         // camera window x, y, width, height; width 0 = keep the format file's window
+    int rejectoversize; // "plan=reject": refuse trials that don't fit instead of shortening them
+    int sparse;         // "store=sparse": write a background-subtracted .bgs file instead of the AVI
+    int raw;            // "store=raw": write the frames uncompressed to a .raw file instead of the AVI
+    int iodepth;        // "iodepth=N": .raw writes in flight, 0 = DISK_DEPTH
+    char stripes[192];  // "stripe=dir,dir,...": .raw frames striped over these directories, "" = not striped
+    int bgframes;       // "bgframes=K": background is the median of the first K frames
+    int bgthreshold;    // "bgthresh=T": tiles within +-T of the background are stored as 4 bit residuals
+    int codec, level;   // "codec=none|lz4|zstd[:level]": compression of the .bgs tile rows, implies store=sparse
+    int encoders;       // "encoders=N": encoder threads, 0 = one per worker cpu
+    int phasebins;      // "phase=N": average unit 1's frames in N bins of the drive cycle, 0 = off
+    int track;          // "track=0|1": track unit 1's drops into <base>.traj.csv
+    int window[2];      // "window=P,Q": frames tagged before and after each drop event
+    int proxyevery;     // "proxy=N": every Nth frame into <base>.proxy.pgm and the contact sheet, 0 = no proxy
+    char exportranges[192];// "export=events[:K]|a-b,c-d,...": frames written to the AVI, "" = all
+    char calibrate[192];// "cal=a,b,...": profiles a calibration compares, "" = all the size of the default
+    int burst;          // "burst=N": frames snapped per profile when calibrating
+};
+
+char *FindOption(char buf[], const char *key)
+{
+    size_t len = strlen(key);
+    char *p = buf;
+
+    while ((p = strstr(p, key)) != NULL) {
+        if ((p == buf || p[-1] == ' ') && p[len] == '=') {
+            return p + len + 1;
+        }
+        p += len;
+    }
+    return NULL;
+}
+
+void ParseTrialOptions(char buf[], struct TrialOptions *opts)
+{
+    char *value;
+
+    memset(opts, 0, sizeof(*opts));
+
+    if ((value = FindOption(buf, "fmt")) != NULL) {
+        sscanf(value, "%63s", opts->format);
+    }
+    if ((value = FindOption(buf, "exp")) != NULL) {
+        sscanf(value, "%d", &opts->exposure);
+    }
+    if ((value = FindOption(buf, "roi")) != NULL) {
+        sscanf(value, "%d,%d,%d,%d", &opts->roi[0], &opts->roi[1], &opts->roi[2], &opts->roi[3]);
+    }
+    if ((value = FindOption(buf, "plan")) != NULL) {
+        opts->rejectoversize = (strncmp(value, "reject", 6) == 0);
+    }
+
+    opts->bgframes = BGFRAMES;
+    opts->bgthreshold = SPARSE_MAX_THRESHOLD;
+    if ((value = FindOption(buf, "store")) != NULL) {
+        opts->sparse = (strncmp(value, "sparse", 6) == 0);
+        opts->raw = (strncmp(value, "raw", 3) == 0);
+    }
+    if ((value = FindOption(buf, "iodepth")) != NULL) {
+        sscanf(value, "%d", &opts->iodepth);
+    }
+    snprintf(opts->stripes, sizeof(opts->stripes), "%s", STRIPEDIRS);
+    if ((value = FindOption(buf, "stripe")) != NULL) {
+        sscanf(value, "%191s", opts->stripes);
+    }
+    if ((value = FindOption(buf, "bgframes")) != NULL) {
+        sscanf(value, "%d", &opts->bgframes);
+    }
+    if ((value = FindOption(buf, "bgthresh")) != NULL) {
+        sscanf(value, "%d", &opts->bgthreshold);
+    }
+    if ((value = FindOption(buf, "codec")) != NULL) {
+        if (SparseParseCodec(value, &opts->codec, &opts->level) == 0) {
+            opts->sparse = 1;
+        }
+        else {
+            printf("Unknown codec '%.8s' - frames stored uncompressed.\r\n", value);
+        }
+    }
+    if ((value = FindOption(buf, "encoders")) != NULL) {
+        sscanf(value, "%d", &opts->encoders);
+    }
+    if ((value = FindOption(buf, "phase")) != NULL) {
+        sscanf(value, "%d", &opts->phasebins);
+    }
+    opts->track = TRACKDROPS;
+    if ((value = FindOption(buf, "track")) != NULL) {
+        sscanf(value, "%d", &opts->track);
+    }
+    opts->window[0] = EVENT_PRE;
+    opts->window[1] = EVENT_POST;
+    if ((value = FindOption(buf, "window")) != NULL) {
+        sscanf(value, "%d,%d", &opts->window[0], &opts->window[1]);
+    }
+    opts->proxyevery = PROXYEVERY;
+    if ((value = FindOption(buf, "proxy")) != NULL) {
+        sscanf(value, "%d", &opts->proxyevery);
+    }
+    if ((value = FindOption(buf, "export")) != NULL) {
+        sscanf(value, "%191s", opts->exportranges);
+    }
+    opts->burst = CALBURST;
+    if ((value = FindOption(buf, "cal")) != NULL) {
+        sscanf(value, "%191s", opts->calibrate);
+    }
+    if ((value = FindOption(buf, "burst")) != NULL) {
+        sscanf(value, "%d", &opts->burst);
+    }
+}
+
+
+
+// ================================================================================================
+// Queue camera settings for this trial on the serial port - SerialWait() before arming collects the replies
+// ================================================================================================
+void ConfigureCamera(int FPS, struct TrialOptions *opts)
+{
+    if (camera.fd == -1) {
+        return;
+    }
+
+    if (FPS > 0) {
+        SerialSetFrameRate(&camera, FPS);
+    }
+    if (opts->exposure > 0) {
+        SerialSetExposure(&camera, opts->exposure);
+    }
+    if (opts->roi[2] > 0 && opts->roi[3] > 0) {
+        SerialSetROI(&camera, opts->roi[0], opts->roi[1], opts->roi[2], opts->roi[3]);
+
+        // The frame grabber still captures the format file's window
+        if (opts->roi[2] != pxd_imageXdim() || opts->roi[3] != pxd_imageYdim()) {
+            printf("Warning: camera ROI %dx%d does not match the format file's %dx%d.\r\n", opts->roi[2], opts->roi[3], pxd_imageXdim(), pxd_imageYdim());
+        }
+    }
+    printf("Camera settings queued: %d FPS, %d us exposure.\r\n", FPS, opts->exposure);
+}
+
+
+
 // ================================================================================================
 // Open and initialize frame grabber
 // ================================================================================================
-int InitializationFrameGrabber(void)
+int InitializationFrameGrabber(const char *formatfile)
 {
     // Open the XCLIB C Library for use
     int i;
@@ -257,8 +579,8 @@ int InitializationFrameGrabber(void)
 	printf("using predefined format '%s'.\n", FORMAT);
 	i = pxd_PIXCIopen(DRIVERPARMS, FORMAT, "");
     #elif defined(FORMATFILE)
-	printf("using format file '%s'.\n", FORMATFILE);
-	i = pxd_PIXCIopen(DRIVERPARMS, "", FORMATFILE);
+	printf("using format file '%s'.\n", formatfile);
+	i = pxd_PIXCIopen(DRIVERPARMS, "", formatfile);
     #endif
 
     // Open Error
@@ -280,200 +602,884 @@ int InitializationFrameGrabber(void)
 
 
 // ================================================================================================
-// Capture sequence AVI
+// Drain thread: copies each frame out of grabber memory as soon as it is captured
+// Runs on the real-time capture core; records the interval between drained frames.
+// Nothing is printed per frame - the frames captured are reported once the drain ends
 // ================================================================================================
-void CaptureSequenceAVI(int NUMIMAGES, int FPS, int PULSETIME, float DELAYTIME, int HORIZ_AMPL, int VERT_AMPL, int FREQ, int PHASE_OFFSET, char IDENTIFIER, int SAVEDSIGNAL, int sock)
+struct DrainContext {
+    int unit;                   // 0 based unit number, also picks the capture cpu
+    int unitmap;                // 1<<unit
+    int frames;                 // frame buffers 1..frames are in the sequence - lowered if interrupted
+    unsigned char **buf;        // buf[j] receives frame buffer j+1
+    int xdim, ydim;
+    pxvbtime_t *fieldcount;     // fieldcount[j] is pxd_buffersFieldCount() of frame buffer j+1
+    FrameStats *stats;          // stats[j] is the exposure of frame buffer j+1
+    FrameHistogram histogram;   // of the frame being read out
+    size_t framesize;
+    pxvbtime_t startfield;      // pxd_capturedFieldCount() before arming - older buffers are stale
+    int captured;               // frame buffers filled by the grabber
+    volatile int readout;       // buf[0..readout-1] hold their frames - what the encode pool waits on;
+                                // stored with release, loaded with acquire, so the frame is seen before the count
+    double readoutus;           // time spent in pxd_readuchar()
+    JitterStats jitter;
+};
+
+// Read frame buffer j+1 out a band at a time, building its histogram while each band is in cache
+void ReadFrame(struct DrainContext *ctx, int j)
 {
-
-    // Initialize last buffer 
-    pxbuffer_t lastbuf=0;
-
-    // Allocate memory for buf array to store pointers to images
-    unsigned char* buf[30000];
-    int i;
-    for(i=0; i<30000; i++)
-    {
-        buf[i] = (unsigned char*)malloc( pxd_imageXdim()*pxd_imageYdim()*sizeof(unsigned char) );
+    int rows = READBANDBYTES / ctx->xdim > 0 ? READBANDBYTES / ctx->xdim : 1;
+    int y, n;
+
+    FrameHistogramClear(&ctx->histogram);
+    for (y = 0; y < ctx->ydim; y += n) {
+        unsigned char *band = ctx->buf[j] + (size_t)y * ctx->xdim;
+        n = ctx->ydim - y < rows ? ctx->ydim - y : rows;
+        pxd_readuchar(ctx->unitmap, j+1, 0, y, -1, y+n, band, (size_t)n * ctx->xdim, "Grey");
+        FrameHistogramAdd(&ctx->histogram, band, (size_t)n * ctx->xdim);
     }
+    FrameHistogramStats(&ctx->histogram, &ctx->stats[j]);
+    ctx->fieldcount[j] = pxd_buffersFieldCount(ctx->unitmap, j+1);
+}
 
-    // Initialize tempbuf for live image processing and allocate memory for one frame
-    unsigned char* tempbuf;
-
-    tempbuf = (unsigned char*) malloc( pxd_imageXdim()*pxd_imageYdim()*sizeof(unsigned char) );
-
-
-    // Send UDP message to Machine A to start sequence AVI - otherwise Machine A starts before Machine B is ready to capture
-    int slen=sizeof(AddrMachineA);
-    char message[BUFLEN];
-
-    AddrMachineA.sin_port = htons(PORTA);    // specify PortA to send message back to
-    strcpy(message, "Start sequence AVI.");
-    SendSocket(sock, message, slen);
-
-
-    // For a camera in asynchronous trigger mode, with an external trigger, sequence capture is simply:
-    printf("Ready to capture sequence AVI.\r\n\n");
-    // The pxd_goLiveSeq initiates sequence capture of images into startbuf through endbuf.
-    // The sequence capture starts into startbuf and continues into frame buffers startbuf+incbuf*1, startbuf+incbuf*2, etc., 
-    // wrapping around from the endbuf back to the startbuf.
-    pxd_goLiveSeq(UNITSMAP,         // select PIXCI(R) unit 1
-                  1,                // select start frame buffer
-                  (NUMIMAGES-1),    // select last frame buffer
-                  1,                // incrementing by one buffer
-                  (NUMIMAGES-1),    // for this many captures
-                  1);               // advancing to next buffer after each 1 frame
+void *DrainThread(void *arg)
+{
+    struct DrainContext *ctx = (struct DrainContext *)arg;
+    pxbuffer_t next = 1, lastbuf;
+    double last = 0, now;
 
+    RtEnterCapture(&rtconfig, ctx->unit);
 
-/*
     // Infinite for loop
     for (;;) {
 
-        // If a new buffer was not yet captured, continue with the for(;;) loop
-        if (pxd_capturedBuffer(1) == lastbuf) {
+        // CTRL+C: end the sequence here - the buffers already filled are still drained below
+        if (interrupted) {
+            pxd_goAbortLive(ctx->unitmap);
+        }
 
-            // Might be able to solve the blocking function call problem when frame grabber misses frames stalling the program
-            if(lastbuf > 10) {
+        // Check if video capture has ceased before looking at the buffers, so the last frames are still drained
+        int live = pxd_goneLive(ctx->unitmap, 0);
 
-                // Have some counter in here that would call pxd_goAbortLive() if the time after 
-                // current frame but before the next frame is much greater than 1/FPS_Side
+        // The grabber stays open between trials - nothing captured yet means capturedBuffer() is last trial's
+        lastbuf = 0;
+        if (pxd_capturedFieldCount(ctx->unitmap) != ctx->startfield) {
+            lastbuf = pxd_capturedBuffer(ctx->unitmap);
+            if (lastbuf > ctx->frames) {
+                lastbuf = ctx->frames;
+            }
+        }
 
+        // Read out every buffer filled since the last pass
+        while (next <= lastbuf) {
+            now = RtNowUs();
+            if (next > 1) {
+                JitterAdd(&ctx->jitter, now - last);
             }
+            last = now;
 
-            // Skips the remaining code in the for loop (will start over at the top)
-            continue;
+            ReadFrame(ctx, (int)next - 1);
+            ctx->readoutus += RtNowUs() - now;
+            __atomic_store_n(&ctx->readout, (int)next, __ATOMIC_RELEASE);
+            if (ctx->unit == 0) {
+                PreviewOffer(ctx->buf[next-1], ctx->xdim, ctx->ydim, (long)next);
+            }
+            next++;
         }
+        ctx->captured = (int)(next - 1);
 
-        // Update lastbuf with new buffer
-        lastbuf = pxd_capturedBuffer(1);
-        printf("Frame number captured: %d\r\n", lastbuf);
+        if (live == 0) {
+            break;
+        }
 
+        // Drain threads of several units may share a core at the same SCHED_FIFO priority
+        sched_yield();
+    }
 
+    // Run on the main thread when its thread couldn't be created - which mustn't stay pinned at SCHED_FIFO
+    RtLeaveCapture();
+    return NULL;
+}
 
-// UNTESTED - For live video analysis
-// Once a new frame has filled the buffer, convert the frame buffer to OpenCV IplImage* (array)
-// With the IplImage*, threshold the array, perform cvHoughCircles to locate the drop
-// If more than one drop, either threshold with better parameters or try adding other filters (GaussianBlur, etc.)
-// If necessary, can also terminate the pxd_goLiveSeq() call [i.e., drop coalesce and want to restart]
 
 
-        //Store pointer to lastbuf frame in tempbuf
-        pxd_readuchar(UNITSMAP, lastbuf, 0, 0, -1, -1, tempbuf, pxd_imageXdim()*pxd_imageYdim()*sizeof(unsigned char), "Grey");
+// ================================================================================================
+// Analysis thread: follows a drain thread, adds each frame to its bin of the drive cycle, tracks
+// the drops in it, looking for bounce events, and keeps every Nth one for the proxy.
+// A frame's time is its field count since the first frame, at the camera's frame rate.
+// ================================================================================================
+struct AnalysisContext {
+    struct DrainContext *drain;
+    PhaseAverage average;       // used when phasing
+    int phasing;
+    Tracker *tracker;           // NULL = not tracking
+    EventDetector events;       // fed by the tracker
+    ProxyWriter *proxy;         // NULL = no proxy
+    int proxyfailed;            // a proxy frame couldn't be written - no more are added
+    int fieldsperframe;
+    double fps;
+    int analysed;
+    int skipped;                // buffers the grabber did not fill this trial
+};
+
+void *AnalysisThread(void *arg)
+{
+    struct AnalysisContext *ctx = (struct AnalysisContext *)arg;
+    struct DrainContext *drain = ctx->drain;
+    pxvbtime_t first = 0, last = drain->startfield;
+    TrackPoint linked[TRACK_MAXBLOBS];
+    double seconds;
+    int k, n;
+
+    for (k = 0; k < __atomic_load_n(&drain->frames, __ATOMIC_ACQUIRE); k++) {
+        while (__atomic_load_n(&drain->readout, __ATOMIC_ACQUIRE) <= k && k < __atomic_load_n(&drain->frames, __ATOMIC_ACQUIRE)) {
+            usleep(500);
+        }
+        if (k >= __atomic_load_n(&drain->frames, __ATOMIC_ACQUIRE)) {
+            break;
+        }
 
+        // Buffers left over from an earlier trial have older field counts
+        if (drain->fieldcount[k] <= last) {
+            ctx->skipped++;
+            continue;
+        }
+        if (ctx->analysed++ == 0) {
+            first = drain->fieldcount[k];
+        }
+        last = drain->fieldcount[k];
+        seconds = (double)(last - first) / ctx->fieldsperframe / ctx->fps;
 
-        // Create IplImage* TempImg in order to write the frame buffers to avi object
-        IplImage* TempImg33;
-        TempImg33 = cvCreateImage(cvSize(pxd_imageXdim(),pxd_imageYdim()), IPL_DEPTH_8U, 1);
+        if (ctx->phasing) {
+            PhaseAverageAdd(&ctx->average, drain->buf[k], seconds);
+        }
+        if (ctx->tracker != NULL) {
+            n = TrackerAdd(ctx->tracker, drain->buf[k], drain->xdim, drain->ydim, k+1, seconds, linked);
+            EventDetectorAdd(&ctx->events, linked, n, k+1, seconds);
+        }
+        if (ctx->proxy != NULL && !ctx->proxyfailed && ProxyAdd(ctx->proxy, drain->buf[k], k) < 0) {
+            ctx->proxyfailed = 1;
+        }
+    }
+    return NULL;
+}
 
-        // CvScalar tuple for setting pixel values from frame buffer
-        CvScalar s;
 
-        // Reads each image from respective buffers in memory, storing as IplImage* (necessary for cvWriteFrame)
-        int l, m, counter=0;
-        for(l=0; l < pxd_imageYdim(); l++){
-            for (m=0; m < pxd_imageXdim(); m++) {
-                s.val[0] = tempbuf[counter];
-                cvSet2D(TempImg33, l, m, s); // set the (l,m) pixel value using s.val[0]
-                counter++;
-            }
-        }
 
+// ================================================================================================
+// Frames a unit dropped: the gaps in its buffers' field counts, at pxd_videoFieldsPerFrame() fields
+// a frame. Buffers older than the one before them are stale and skipped, as in AnalysisThread
+// ================================================================================================
+int CountDrops(const struct DrainContext *drain, int frames)
+{
+    int fieldsperframe = pxd_videoFieldsPerFrame() > 0 ? pxd_videoFieldsPerFrame() : 1;
+    pxvbtime_t last = drain->startfield;
+    int j, seen = 0, drops = 0;
 
-        // Threshold TempImg33
-        // http://docs.opencv.org/2.4/modules/imgproc/doc/miscellaneous_transformations.html?highlight=threshold#threshold
-        IplImage* TempImg33_Thres;
-        TempImg33_Thres = cvCreateImage(cvSize(pxd_imageXdim(),pxd_imageYdim()), IPL_DEPTH_8U, 1);
+    for (j = 0; j < frames; j++) {
+        if (drain->fieldcount[j] <= last) {
+            continue;
+        }
+        if (seen++ > 0 && (pxvbtime_t)(drain->fieldcount[j] - last) / fieldsperframe > 1) {
+            drops += (int)((pxvbtime_t)(drain->fieldcount[j] - last) / fieldsperframe) - 1;
+        }
+        last = drain->fieldcount[j];
+    }
+    return drops;
+}
 
-        double threshold=220;  //threshold value
-        double max_value=255;  //maximum value to use with the THRESH_BINARY and THRESH_BINARY_INV thresholding types.
-        int threshold_type=THRESH_BINARY;  //thresholding type
 
-        cvThreshold( TempImg33, TempImg33_Thres, threshold, max-value, threshold_type );
 
-        //cvNamedWindow("thres", 1);
-        //cvShowImage("thres", TempImg33_Thres);
-        //cvWaitKey(0);
+// ================================================================================================
+// Align the units' sequences by field count
+// Each unit counts fields on its own, so counts are taken relative to each unit's first frame.
+// Returns order[u*nslots + k] = frame of unit u captured in slot k, or -1 if that unit dropped it
+// ================================================================================================
+int *AlignUnits(struct DrainContext *drain, int units, int frames, int *nslots)
+{
+    int fieldsperframe = pxd_videoFieldsPerFrame() > 0 ? pxd_videoFieldsPerFrame() : 1;
+    int maxslots = 2*frames;        // far more than a real drop rate; anything past it is discarded
+    int u, j, k, slots = 0;
+    int *order;
+
+    order = (int *)malloc((size_t)units * maxslots * sizeof(int));
+    if (order == NULL) {
+        *nslots = 0;
+        return NULL;
+    }
+    for (k = 0; k < units*maxslots; k++) {
+        order[k] = -1;
+    }
 
+    for (u = 0; u < units; u++) {
+        for (j = 0; j < frames; j++) {
+            // A stale buffer, left from an earlier trial, counts from before the sequence started
+            if (drain[u].fieldcount[j] < drain[u].fieldcount[0]) {
+                printf("Unit %d frame %d is from before the start of the sequence - not aligned.\r\n", u+1, j+1);
+                continue;
+            }
+            k = (int)((pxvbtime_t)(drain[u].fieldcount[j] - drain[u].fieldcount[0]) / fieldsperframe);
+            if (k < 0 || k >= maxslots) {
+                printf("Unit %d frame %d is %d frames past the start of the sequence - not aligned.\r\n", u+1, j+1, k);
+                continue;
+            }
+            order[u*maxslots + k] = j;
+            if (k >= slots) {
+                slots = k + 1;
+            }
+        }
+    }
 
-        // Locate circles in TempImg33_Thres using cvHoughCircles
-        // http://docs.opencv.org/2.4/modules/imgproc/doc/feature_detection.html?highlight=houghcircles#houghcircles
-        CvMemStorage* storage = cvCreateMemStorage(0);  //memory storage that will contain the output sequence of found circles
-        double dp=4;                                    //inverse ratio of the accumulator resolution to the image resolution
-        double min_dist=TempImg33->width/3;             //minimum distance between the centers of the detected circles
-        double param1=100;                              //higher threshold of the two passed to the Canny() edge detector
-        double param2=100;                              //accumulator threshold for the circle centers at the detection stage
-        int min_radius=0;                               //minimum circle radius
-        int max_radius=0;                               //maximum circle radius
+    // Pack the rows down to nslots entries each
+    for (u = 1; u < units; u++) {
+        memmove(order + u*slots, order + u*maxslots, slots * sizeof(int));
+    }
+    *nslots = slots;
+    return order;
+}
 
-        CvSeq* results = cvHoughCircles( TempImg33_Thres, storage, CV_HOUGH_GRADIENT, dp, min_dist, param1, param2, min_radius, max_radius );
 
-        std::cout << "Number of circles detected: " << results->total << std::endl;
 
+// ================================================================================================
+// Write the alignment next to the AVIs: one row per slot, buffer and field count of each unit
+// ================================================================================================
+void WriteSyncTable(const char *filename, struct DrainContext *drain, int units, const int *order, int nslots)
+{
+    char syncname[FILENAMELEN+16];
+    FILE *fp;
+    int u, k;
+
+    snprintf(syncname, sizeof(syncname), "%.*s.sync.csv", (int)strlen(filename)-4, filename);
+    if ((fp = fopen(syncname, "w")) == NULL) {
+        perror(syncname);
+        return;
+    }
 
-        // Draw detected circles on TempImg33
-        for( int i=0; i<results->total; i++ ) 
-        {
-            float* p = (float*) cvGetSeqElem( results, i );
-            CvPoint pt = cvPoint( cvRound( p[0] ), cvRound( p[1] ) );
-            cvCircle( TempImg33, pt, cvRound( p[2] ), CV_RGB(0xff,0,0) );
+    fprintf(fp, "slot");
+    for (u = 0; u < units; u++) {
+        fprintf(fp, ",unit%d_buffer,unit%d_field", u+1, u+1);
+    }
+    fprintf(fp, "\n");
+
+    for (k = 0; k < nslots; k++) {
+        fprintf(fp, "%d", k);
+        for (u = 0; u < units; u++) {
+            int j = order[u*nslots + k];
+            if (j < 0) {
+                fprintf(fp, ",,");      // dropped - black frame in this unit's AVI
+            }
+            else {
+                fprintf(fp, ",%d,%lu", j+1, (unsigned long)drain[u].fieldcount[j]);
+            }
         }
-
-        cvNamedWindow("HoughCircles", 1);
-        cvShowImage("HoughCircles", TempImg33);
-        cvWaitKey(0);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    CatalogAddFile(catalogtrial, "sync", syncname);
+}
 
 
-        // Analysis of detected circles
 
+// ================================================================================================
+// Write one unit's frame index next to its sequence file: buffer, field count and exposure of every frame
+// ================================================================================================
+void WriteFrameIndex(const char *filename, struct DrainContext *drain, const EventDetector *events)
+{
+    char indexname[FILENAMELEN+16], row[96], tags[64];
+    FILE *fp;
+    int j;
 
+    snprintf(indexname, sizeof(indexname), "%.*s.index.csv", (int)strlen(filename)-4, filename);
+    if ((fp = fopen(indexname, "w")) == NULL) {
+        perror(indexname);
+        return;
+    }
+    fprintf(fp, "buffer,field," FRAME_STATS_COLUMNS ",events\n");
+    for (j = 0; j < drain->frames; j++) {
+        FrameStatsFormat(&drain->stats[j], row, sizeof(row));
+        tags[0] = '\0';
+        if (events != NULL) {
+            EventTags(events, j+1, tags, sizeof(tags));
+        }
+        fprintf(fp, "%d,%lu,%s,%s\n", j+1, (unsigned long)drain->fieldcount[j], row, tags);
+    }
+    fclose(fp);
+    CatalogAddFile(catalogtrial, "index", indexname);
+}
 
 
 
-        // Check if video capture has ceased, if so, break from the infinite for loop
-        if (pxd_goneLive(UNITSMAP, 0)==0) {
-            break;
+// ================================================================================================
+// Write frames[] to an AVI file; a NULL frame is written black so every unit's file stays in step
+// ================================================================================================
+void WriteAVI(const char *filename, unsigned char **frames, int nframes)
+{
+    // Create VideoWriter using Huffyuv encoding at 5 fps - save to MacIver->Documents->High Speed Videos
+    int fourcc = CV_FOURCC('H','F','Y','U');
+    double fps = 5;
+    CvSize frame_size;
+    frame_size = cvSize( pxd_imageXdim(), pxd_imageYdim() );
+    int is_color = 0;
+
+    double openms = TelemetryNowMs();
+    CvVideoWriter* writer;
+    writer = cvCreateVideoWriter(filename, fourcc, fps, frame_size, is_color);
+    printf("VideoWriter created.\r\n");
+
+    // Create IplImage* TempImg in order to write the frame buffers to avi object
+    IplImage* TempImg;
+    TempImg = cvCreateImage(cvSize(pxd_imageXdim(),pxd_imageYdim()), IPL_DEPTH_8U, 1);
+
+
+    // Loop through each frame, writing them to the avi file
+    printf("Starting to write frames to %s.\r\n", filename);
+    int k;
+    for(k=0; k<nframes; k++)
+    {
+        // Copy each image into the IplImage's rows (necessary for cvWriteFrame) with the widest kernel the cpu has
+        if (frames[k] != NULL) {
+            PxCopyRows(PxBest(), frames[k], pxd_imageXdim(), pxd_imageYdim(), (unsigned char *)TempImg->imageData, TempImg->widthStep);
+        }
+        else {
+            memset(TempImg->imageData, 0, (size_t)TempImg->widthStep * pxd_imageYdim());
         }
 
-        // Either of these functions can be used to terminate the pxd_goLiveSeq().
-        //int pxd_goUnLive(unitmap);     // terminates pxd_goLiveSeq after the current field or frame
-        //int pxd_goAbortLive(unitmap);  // terminates pxd_goLiveSeq immediately, even if in the middle of a field, line, or pixel
+        // Write frame to avi object
+        cvWriteFrame(writer, TempImg);
     }
-*/
 
 
-    int actualFrameCounter = 0;
-    
+    // Release VideoWriter
+    cvReleaseImage(&TempImg);
+    cvReleaseVideoWriter(&writer);
+    telemetry.disks += (TelemetryNowMs() - openms) / 1e3;
+}
+
+
+
+// ================================================================================================
+// Background-subtracted sparse sequence (.bgs) encoded on the worker cores - see encode_pool.h
+// Started before capture ends, 'available' is the drain thread's count of frames read out
+// ================================================================================================
+EncodePool *StartSparse(const char *filename, unsigned char **frames, int nframes, volatile const int *available, struct TrialOptions *opts)
+{
+    EncodeSettings settings;
+
+    settings.xdim = pxd_imageXdim();
+    settings.ydim = pxd_imageYdim();
+    settings.threshold = opts->bgthreshold;
+    settings.bgframes = opts->bgframes;
+    settings.codec = opts->codec;
+    settings.level = opts->level;
+    settings.workers = opts->encoders;
+    return EncodePoolStart(filename, frames, nframes, available, &settings, &rtconfig);
+}
+
+void FinishSparse(EncodePool *pool, const char *filename)
+{
+    EncodeReport report;
+    char line[BUFLEN];
+
+    if (pool == NULL) {
+        printf("Out of memory for the encoder pool - %s not written.\r\n", filename);
+        return;
+    }
+    if (EncodePoolFinish(pool, &report) < 0) {
+        printf("Error writing %s.\r\n", filename);
+    }
+    EncodeReportFormat(&report, line, sizeof(line));
+    printf("Sparse sequence %s: %s.\r\n", filename, line);
+    telemetry.disks += report.seconds;
+
+    // Telemetry keeps the worst unit
+    if (telemetry.compressratio == 0 || report.ratio < telemetry.compressratio) {
+        telemetry.compressratio = report.ratio;
+    }
+    if (telemetry.encodembpscore == 0 || report.encodembpscore < telemetry.encodembpscore) {
+        telemetry.encodembpscore = report.encodembpscore;
+    }
+    if (telemetry.decodembps == 0 || report.decodembps < telemetry.decodembps) {
+        telemetry.decodembps = report.decodembps;
+    }
+}
+
+
+
+// ================================================================================================
+// Uncompressed sequence (.raw) streamed out by its own thread - see raw_store.h
+// Started before capture, so the files are preallocated before the first frame arrives;
+// with "stripe=" the file named is the manifest and the frames go to one file per directory
+// ================================================================================================
+RawStream *StartRaw(const char *filename, unsigned char **frames, int nframes, volatile const int *available, int fps, struct TrialOptions *opts)
+{
+    DiskSettings settings;
+    char list[sizeof(opts->stripes)];
+    const char *dirs[RAW_MAXSTRIPES];
+    int ndirs;
+
+    DiskSettingsDefaults(&settings);
+    if (opts->iodepth > 0) {
+        settings.depth = opts->iodepth;
+    }
+    snprintf(list, sizeof(list), "%s", opts->stripes);
+    ndirs = RawParseStripes(list, dirs, RAW_MAXSTRIPES);
+    return RawStreamStart(filename, frames, nframes, available, pxd_imageXdim(), pxd_imageYdim(), fps,
+                          dirs, ndirs, &settings, &rtconfig);
+}
+
+// Throughput of every stripe, so a slow disk stands out
+void PrintStripes(RawStream *stream, int nstripes, char paths[][256], const DiskReport *stripes)
+{
+    char line[BUFLEN];
+    int i;
+
+    for (i = 0; i < nstripes; i++) {
+        DiskReportFormat(&stripes[i], line, sizeof(line));
+        printf("    stripe %d %s: %s\r\n", i, stream != NULL ? RawStreamStripePath(stream, i) : paths[i], line);
+    }
+}
+
+void FinishRaw(RawStream *stream, const char *filename)
+{
+    DiskReport report, stripes[RAW_MAXSTRIPES];
+    char line[BUFLEN], paths[RAW_MAXSTRIPES][256];
+    int i, nstripes;
+
+    if (stream == NULL) {
+        printf("Cannot create %s - sequence not written.\r\n", filename);
+        return;
+    }
+    nstripes = RawStreamStripes(stream);
+    for (i = 0; i < nstripes; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s", RawStreamStripePath(stream, i));
+        CatalogAddFile(catalogtrial, "stripe", paths[i]);
+    }
+    if (RawStreamFinish(stream, &report, stripes) < 0) {
+        printf("Error writing %s.\r\n", filename);
+    }
+    DiskReportFormat(&report, line, sizeof(line));
+    printf("Raw sequence %s: %s.\r\n", filename, line);
+    PrintStripes(NULL, nstripes, paths, stripes);
+    telemetry.disks += report.seconds;
+
+    // Telemetry keeps the slowest unit
+    if (telemetry.writembps == 0 || report.mbps < telemetry.writembps) {
+        telemetry.writembps = report.mbps;
+        telemetry.writedepth = report.meaninflight;
+    }
+}
+
+
+
+// ================================================================================================
+// Write one unit's sequence in the format the trial asked for
+// ================================================================================================
+void WriteSequence(const char *filename, unsigned char **frames, int nframes, struct TrialOptions *opts)
+{
+    CatalogAddFile(catalogtrial, "sequence", filename);
+    if (opts->sparse) {
+        printf("Starting to write frames to %s.\r\n", filename);
+        FinishSparse(StartSparse(filename, frames, nframes, NULL, opts), filename);
+    }
+    else if (opts->raw) {
+        printf("Starting to write frames to %s.\r\n", filename);
+        FinishRaw(StartRaw(filename, frames, nframes, NULL, 0, opts), filename);
+    }
+    else {
+        WriteAVI(filename, frames, nframes);
+    }
+}
+
+
+
+// ================================================================================================
+// Frames to export: "export=events" takes the drop events' tagged windows, "export=events:K"
+// each event's frame +-K, anything else is a list of ranges. Returns the number of frames
+// selected, 0 = export every frame
+// ================================================================================================
+int ExportRanges(const struct TrialOptions *opts, const EventDetector *events, int nframes, FrameRanges *ranges)
+{
+    int i, margin = -1;
+
+    FrameRangesInit(ranges);
+    if (opts->exportranges[0] == '\0' || strcmp(opts->exportranges, "all") == 0) {
+        return(0);
+    }
+    if (strncmp(opts->exportranges, "events", 6) == 0) {
+        sscanf(opts->exportranges + 6, ":%d", &margin);
+        if (events == NULL) {
+            printf("No drop events without tracking - exporting every frame.\r\n");
+            return(0);
+        }
+        for (i = 0; i < events->nevents; i++) {
+            const DropEvent *e = &events->events[i];
+            if (margin >= 0) {
+                FrameRangesAdd(ranges, e->frame - margin, e->frame + margin);
+            }
+            else {
+                FrameRangesAdd(ranges, e->first, e->last);
+            }
+        }
+    }
+    else if (FrameRangesParse(ranges, opts->exportranges) < 0) {
+        printf("Bad export ranges '%s' - exporting every frame.\r\n", opts->exportranges);
+        FrameRangesFree(ranges);
+        return(0);
+    }
+    FrameRangesNormalize(ranges, nframes);
+    if (FrameRangesCount(ranges) == 0) {
+        printf("No frames in the export ranges - exporting every frame.\r\n");
+    }
+    return FrameRangesCount(ranges);
+}
+
+
+
+// ================================================================================================
+// Capture sequence AVI
+// Returns 0 if the trial was rejected before it was armed, with the reason in telemetry.rejected
+// ================================================================================================
+int CaptureSequenceAVI(int NUMIMAGES, int FPS, int PULSETIME, float DELAYTIME, int HORIZ_AMPL, int VERT_AMPL, int FREQ, int PHASE_OFFSET, char IDENTIFIER, int SAVEDSIGNAL, int sock, struct TrialOptions *opts)
+{
+    int slen=sizeof(AddrMachineA);
+    char message[BUFLEN];
+
+
+    // Check the request against grabber memory, host RAM and disk before anything is armed
+    SequencePlan plan;
+    char summary[BUFLEN-32];
+
+    PlanSequence(&plan, NUMIMAGES-1, FPS, pxd_imageXdim(), pxd_imageYdim(), pxd_imageBdim(),
+                 pxd_imageZdim(), (double)pxd_infoMemsize(1), UNITS, OUTPUTDIR, !opts->rejectoversize);
+    PlanSummary(&plan, summary, sizeof(summary));
+    printf("%s\r\n\n", summary);
+
+    telemetry.expected = plan.frames * UNITS;
+
+    if (plan.rejected) {
+        AddrMachineA.sin_port = htons(PORTA);    // specify PortA to send message back to
+        snprintf(message, sizeof(message), "Trial rejected. %s", summary);
+        SendSocket(sock, message, slen);
+        snprintf(telemetry.rejected, sizeof(telemetry.rejected), "%s", summary);
+        return(0);
+    }
+    int NUMFRAMES = plan.frames;    // frame buffers 1..NUMFRAMES are captured
+
+
+    // Initialize last buffer 
+    pxbuffer_t lastbuf=0;
+
+    // Allocate one block for the whole sequence of every unit and point buf[] at each frame in it
+    // Frame buffer j+1 of unit u -> buf[u*NUMFRAMES + j]
+    size_t framesize = plan.hostbytes;
+    size_t sequencebytes = (size_t)UNITS*NUMFRAMES*framesize;
+    unsigned char* framedata = (unsigned char*)malloc( sequencebytes );
+    unsigned char** buf = (unsigned char**)malloc( UNITS*NUMFRAMES*sizeof(unsigned char*) );
+    pxvbtime_t* fieldcount = (pxvbtime_t*)calloc( UNITS*NUMFRAMES, sizeof(pxvbtime_t) );
+    FrameStats* framestats = (FrameStats*)calloc( UNITS*NUMFRAMES, sizeof(FrameStats) );
+    if (framedata == NULL || buf == NULL || fieldcount == NULL || framestats == NULL) {
+        free(framedata);
+        free(buf);
+        free(fieldcount);
+        free(framestats);
+        AddrMachineA.sin_port = htons(PORTA);
+        snprintf(message, sizeof(message), "Trial rejected. Out of memory for %d frames.", NUMFRAMES);
+        SendSocket(sock, message, slen);
+        snprintf(telemetry.rejected, sizeof(telemetry.rejected), "Out of memory for %d frames.", NUMFRAMES);
+        return(0);
+    }
+    int i;
+    for(i=0; i<UNITS*NUMFRAMES; i++)
+    {
+        buf[i] = framedata + i*framesize;
+    }
+    RtLockMemory(&rtconfig, framedata, sequencebytes);
+
+    // Initialize tempbuf for live image processing and allocate memory for one frame
+    unsigned char* tempbuf;
+
+    tempbuf = (unsigned char*) malloc( pxd_imageXdim()*pxd_imageYdim()*sizeof(unsigned char) );
+
+
+    // Send UDP message to Machine A to start sequence AVI - otherwise Machine A starts before Machine B is ready to capture
+    // The plan follows in the same datagram so Machine A learns of a shortened trial without an extra round-trip
+    AddrMachineA.sin_port = htons(PORTA);    // specify PortA to send message back to
+    snprintf(message, sizeof(message), "Start sequence AVI. %s", summary);
+    SendSocket(sock, message, slen);
+
+
+    // Camera settings were queued right after the frame grabber opened - collect the replies before arming
+    if (SerialWait(&camera, 2000) > 0) {
+        printf("Warning: camera did not accept all settings for this trial.\r\n");
+    }
+
+
+    // Drain thread state, one per unit - set up before arming so the threads start the moment capture does
+    struct DrainContext drain[UNITS];
+    pthread_t drainthread[UNITS];
+    int u, threads;
+
+    for (u = 0; u < UNITS; u++) {
+        drain[u].unit = u;
+        drain[u].unitmap = 1<<u;
+        drain[u].frames = NUMFRAMES;
+        drain[u].buf = buf + u*NUMFRAMES;
+        drain[u].xdim = pxd_imageXdim();
+        drain[u].ydim = pxd_imageYdim();
+        drain[u].fieldcount = fieldcount + u*NUMFRAMES;
+        drain[u].stats = framestats + u*NUMFRAMES;
+        drain[u].framesize = framesize;
+        drain[u].captured = 0;
+        drain[u].readout = 0;
+        drain[u].readoutus = 0;
+        drain[u].startfield = pxd_capturedFieldCount(1<<u);
+        JitterInit(&drain[u].jitter, NUMFRAMES);
+    }
+
+    // Output file name - with several units, each unit's file gets a _unit<n> suffix
+    char filename[FILENAMELEN];
+    const char *extension = opts->sparse ? ".bgs" : opts->raw ? ".raw" : ".avi";
+
+    if (IDENTIFIER == 'S') {
+        snprintf(filename, sizeof(filename), OUTPUTDIR "/Mikrotron_%c_%d_%dHz_%fDelayTime_%dFPS_%dPulseTime%s", IDENTIFIER, SAVEDSIGNAL, FREQ, DELAYTIME, FPS, PULSETIME, extension);
+    }
+    else if (IDENTIFIER == 'E') {
+        snprintf(filename, sizeof(filename), OUTPUTDIR "/Mikrotron_%c_%dHz_%dA_%dA_%03dDPhase_%fDelayTime_%dFPS_%dPulseTime%s", IDENTIFIER, FREQ, HORIZ_AMPL, VERT_AMPL, PHASE_OFFSET, DELAYTIME, FPS, PULSETIME, extension);
+    }
+
+    // With one unit a sparse sequence is encoded as it is drained, on the worker cores
+    EncodePool *pool = NULL;
+    if (UNITS == 1 && opts->sparse) {
+        pool = StartSparse(filename, buf, NUMFRAMES, &drain[0].readout, opts);
+    }
+
+    // and an uncompressed one is written out as it is drained, preallocated now
+    RawStream *stream = NULL;
+    if (UNITS == 1 && opts->raw && opts->exportranges[0] == '\0') {
+        if ((stream = StartRaw(filename, buf, NUMFRAMES, &drain[0].readout, FPS, opts)) == NULL) {
+            printf("Cannot stream to %s - writing it after capture.\r\n", filename);
+        }
+    }
+
+    // Phase-locked averaging, drop tracking and the proxy of unit 1, also as it is drained
+    struct AnalysisContext analysis;
+    pthread_t analysisthread;
+    char base[sizeof(filename)];
+    int analysing = 0;
+
+    snprintf(base, sizeof(base), "%.*s", (int)strlen(filename)-4, filename);
+    memset(&analysis, 0, sizeof(analysis));
+    analysis.drain = &drain[0];
+    analysis.fieldsperframe = pxd_videoFieldsPerFrame() > 0 ? pxd_videoFieldsPerFrame() : 1;
+    analysis.fps = FPS > 0 ? FPS : 1;
+    if (opts->phasebins > 0) {
+        if (FPS <= 0 || PhaseAverageInit(&analysis.average, opts->phasebins, pxd_imageXdim(), pxd_imageYdim(), FREQ, PHASE_OFFSET) < 0) {
+            printf("No phase-locked average: needs FREQ and FPS, and memory for %d bins.\r\n", opts->phasebins);
+        }
+        else {
+            analysis.phasing = 1;
+        }
+    }
+    if (opts->track) {
+        char trajpath[sizeof(filename) + 16];
+
+        snprintf(trajpath, sizeof(trajpath), "%s.traj.csv", base);
+        if ((analysis.tracker = TrackerOpen(trajpath, dropthreshold)) == NULL) {
+            printf("No drop tracking: cannot write %s.\r\n", trajpath);
+        }
+        else {
+            CatalogAddFile(catalogtrial, "trajectory", trajpath);
+        }
+        EventDetectorInit(&analysis.events, opts->window[0], opts->window[1]);
+    }
+    if (opts->proxyevery > 0) {
+        analysis.proxy = ProxyCreate(base, pxd_imageXdim(), pxd_imageYdim(), PROXYSCALE, opts->proxyevery, NUMFRAMES);
+    }
+    if (analysis.phasing || analysis.tracker != NULL || analysis.proxy != NULL) {
+        if (pthread_create(&analysisthread, NULL, AnalysisThread, &analysis) != 0) {
+            perror("pthread_create");
+        }
+        else {
+            analysing = 1;
+        }
+    }
+
+
+    // For a camera in asynchronous trigger mode, with an external trigger, sequence capture is simply:
+    printf("Ready to capture sequence AVI.\r\n\n");
+    capturing = 1;
+    // The pxd_goLiveSeq initiates sequence capture of images into startbuf through endbuf.
+    // The sequence capture starts into startbuf and continues into frame buffers startbuf+incbuf*1, startbuf+incbuf*2, etc., 
+    // wrapping around from the endbuf back to the startbuf.
+    pxd_goLiveSeq(UNITSMAP,         // select all PIXCI(R) units, so they start together
+                  1,                // select start frame buffer
+                  NUMFRAMES,        // select last frame buffer
+                  1,                // incrementing by one buffer
+                  NUMFRAMES,        // for this many captures
+                  1);               // advancing to next buffer after each 1 frame
+
+
+/*
     // Infinite for loop
     for (;;) {
-                
- 	// Check if video capture has ceased, if so, break from the infinite for loop
-        if (pxd_goneLive(UNITSMAP, 0)==0) {
-          //printf("pxd_goneLive(UNITSMAP, 0): %d\r\n", pxd_goneLive(UNITSMAP, 0)); // 17-02-26 By Mengjiao
-           break;
-        }
-	  //printf("pxd_goneLive(UNITSMAP, 0): %d\r\n", pxd_goneLive(UNITSMAP, 0)); // 17-02-26 By Mengjiao
-         
+
         // If a new buffer was not yet captured, continue with the for(;;) loop
         if (pxd_capturedBuffer(1) == lastbuf) {
-	
-        //printf("pxd_capturedBuffer(1)/Num: %d/%d\r\n", pxd_capturedBuffer(1),(NUMIMAGES-1)); // 17-02-26 By Mengjiao
-            continue; // skips the remaining code in the for loop (will start over at the top)
+
+            // Might be able to solve the blocking function call problem when frame grabber misses frames stalling the program
+            if(lastbuf > 10) {
+
+                // Have some counter in here that would call pxd_goAbortLive() if the time after 
+                // current frame but before the next frame is much greater than 1/FPS_Side
+
+            }
+
+            // Skips the remaining code in the for loop (will start over at the top)
+            continue;
         }
 
         // Update lastbuf with new buffer
         lastbuf = pxd_capturedBuffer(1);
-        actualFrameCounter = actualFrameCounter + 1;
         printf("Frame number captured: %d\r\n", lastbuf);
 
 
+
+// UNTESTED - For live video analysis
+// Once a new frame has filled the buffer, convert the frame buffer to OpenCV IplImage* (array)
+// With the IplImage*, threshold the array, perform cvHoughCircles to locate the drop
+// If more than one drop, either threshold with better parameters or try adding other filters (GaussianBlur, etc.)
+// If necessary, can also terminate the pxd_goLiveSeq() call [i.e., drop coalesce and want to restart]
+
+
+        //Store pointer to lastbuf frame in tempbuf
+        pxd_readuchar(UNITSMAP, lastbuf, 0, 0, -1, -1, tempbuf, pxd_imageXdim()*pxd_imageYdim()*sizeof(unsigned char), "Grey");
+
+
+        // Create IplImage* TempImg in order to write the frame buffers to avi object
+        IplImage* TempImg33;
+        TempImg33 = cvCreateImage(cvSize(pxd_imageXdim(),pxd_imageYdim()), IPL_DEPTH_8U, 1);
+
+        // Copy the image into the IplImage's rows
+        PxCopyRows(PxBest(), tempbuf, pxd_imageXdim(), pxd_imageYdim(), (unsigned char *)TempImg33->imageData, TempImg33->widthStep);
+
+
+        // Threshold TempImg33
+        // http://docs.opencv.org/2.4/modules/imgproc/doc/miscellaneous_transformations.html?highlight=threshold#threshold
+        IplImage* TempImg33_Thres;
+        TempImg33_Thres = cvCreateImage(cvSize(pxd_imageXdim(),pxd_imageYdim()), IPL_DEPTH_8U, 1);
+
+        double threshold=dropthreshold;  //threshold value - DROPTHRESHOLD until a calibration sets it
+        double max_value=255;  //maximum value to use with the THRESH_BINARY and THRESH_BINARY_INV thresholding types.
+        int threshold_type=THRESH_BINARY;  //thresholding type
+
+        cvThreshold( TempImg33, TempImg33_Thres, threshold, max-value, threshold_type );
+
+        //cvNamedWindow("thres", 1);
+        //cvShowImage("thres", TempImg33_Thres);
+        //cvWaitKey(0);
+
+
+        // Locate circles in TempImg33_Thres using cvHoughCircles
+        // http://docs.opencv.org/2.4/modules/imgproc/doc/feature_detection.html?highlight=houghcircles#houghcircles
+        CvMemStorage* storage = cvCreateMemStorage(0);  //memory storage that will contain the output sequence of found circles
+        double dp=4;                                    //inverse ratio of the accumulator resolution to the image resolution
+        double min_dist=TempImg33->width/3;             //minimum distance between the centers of the detected circles
+        double param1=100;                              //higher threshold of the two passed to the Canny() edge detector
+        double param2=100;                              //accumulator threshold for the circle centers at the detection stage
+        int min_radius=0;                               //minimum circle radius
+        int max_radius=0;                               //maximum circle radius
+
+        CvSeq* results = cvHoughCircles( TempImg33_Thres, storage, CV_HOUGH_GRADIENT, dp, min_dist, param1, param2, min_radius, max_radius );
+
+        std::cout << "Number of circles detected: " << results->total << std::endl;
+
+
+        // Draw detected circles on TempImg33
+        for( int i=0; i<results->total; i++ ) 
+        {
+            float* p = (float*) cvGetSeqElem( results, i );
+            CvPoint pt = cvPoint( cvRound( p[0] ), cvRound( p[1] ) );
+            cvCircle( TempImg33, pt, cvRound( p[2] ), CV_RGB(0xff,0,0) );
+        }
+
+        cvNamedWindow("HoughCircles", 1);
+        cvShowImage("HoughCircles", TempImg33);
+        cvWaitKey(0);
+
+
+        // Analysis of detected circles
+
+
+
+
+
+        // Check if video capture has ceased, if so, break from the infinite for loop
+        if (pxd_goneLive(UNITSMAP, 0)==0) {
+            break;
+        }
+
+        // Either of these functions can be used to terminate the pxd_goLiveSeq().
+        //int pxd_goUnLive(unitmap);     // terminates pxd_goLiveSeq after the current field or frame
+        //int pxd_goAbortLive(unitmap);  // terminates pxd_goLiveSeq immediately, even if in the middle of a field, line, or pixel
     }
+*/
 
-    printf("\r\nTotal # of frames captured: %d/%d\r\n", actualFrameCounter, (NUMIMAGES-1) );
+
+    telemetry.armms = TelemetryNowMs() - trialreceivedms;
+    double livestart = TelemetryNowMs();
+
+    // Poll and drain on the real-time threads; this thread only waits for them
+    for (threads = 0; threads < UNITS; threads++) {
+        if (pthread_create(&drainthread[threads], NULL, DrainThread, &drain[threads]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+    }
+    for (u = threads; u < UNITS; u++) {
+        DrainThread(&drain[u]);
+    }
+    for (u = 0; u < threads; u++) {
+        pthread_join(drainthread[u], NULL);
+    }
+
+    telemetry.captures = (TelemetryNowMs() - livestart) / 1e3;
+    telemetry.captured = 0;
+    for (u = 0; u < UNITS; u++) {
+        printf("\r\nUnit %d total # of frames captured: %d/%d\r\n", u+1, drain[u].captured, NUMFRAMES );
+        telemetry.captured += drain[u].captured;
+    }
 
     // Wait for capture to cease
     while (pxd_goneLive(UNITSMAP, 0)) {  // The pxd_goneLive returns 0 if video capture is not currently in effect. 
         ;                                // Otherwise, a non-zero value is returned. 
     }
     printf("Sequence AVI captured.\r\n");
+
+    // Interrupted: the sequence is the frames every unit captured, and the writers following it end there
+    if (interrupted) {
+        int kept = drain[0].captured;
+
+        for (u = 1; u < UNITS; u++) {
+            if (drain[u].captured < kept) {
+                kept = drain[u].captured;
+            }
+        }
+        printf("Interrupted after %d of %d frames - finishing the sequence with those.\r\n", kept, NUMFRAMES);
+        NUMFRAMES = kept;
+        for (u = 0; u < UNITS; u++) {
+            __atomic_store_n(&drain[u].frames, kept, __ATOMIC_RELEASE);
+        }
+        RawStreamStop(stream, kept);
+        EncodePoolStop(pool, kept);
+    }
+    if (stream != NULL) {
+        DiskReport progress, stripes[RAW_MAXSTRIPES];
+        char line[BUFLEN];
+
+        RawStreamStatus(stream, &progress, stripes);
+        DiskReportFormat(&progress, line, sizeof(line));
+        printf("Raw sequence so far: %s.\r\n", line);
+        PrintStripes(stream, RawStreamStripes(stream), NULL, stripes);
+    }
     
     // 17-02-26 by Mengjiao
     slen=sizeof(AddrMachineA);
@@ -481,14 +1487,67 @@ void CaptureSequenceAVI(int NUMIMAGES, int FPS, int PULSETIME, float DELAYTIME,
     strcpy(message, "Sequence AVI captured.\r\n");
     SendSocket(sock, message, slen);
 
-    // Store pointers to images in buf[]
+    // Frames up to drain[u].captured were read out during capture - read any remaining buffers into buf[]
     int j;
-    for(j=0; j<(NUMIMAGES-1); j++)
-    {
-        //j+1th frame -> buf[j]
-        pxd_readuchar(UNITSMAP, j+1, 0, 0, -1, -1, buf[j], pxd_imageXdim()*pxd_imageYdim()*sizeof(unsigned char), "Grey"); 
+    double readoutus = 0;
+    for (u = 0; u < UNITS; u++) {
+        double readoutstart = RtNowUs();
+        for(j=drain[u].captured; j<NUMFRAMES; j++)
+        {
+            //j+1th frame of unit u -> drain[u].buf[j]
+            ReadFrame(&drain[u], j);
+        }
+        __atomic_store_n(&drain[u].readout, NUMFRAMES, __ATOMIC_RELEASE);
+        drain[u].readoutus += RtNowUs() - readoutstart;
+        readoutus += drain[u].readoutus;
+    }
+
+    // Every buffer of the sequence has its field count now - an interrupted trial's unfilled ones aren't drops
+    telemetry.drops = 0;
+    for (u = 0; u < UNITS; u++) {
+        telemetry.drops += CountDrops(&drain[u], NUMFRAMES);
     }
     printf("Pointers to frame buffers stored in buf[].\r\n\n");
+    if (readoutus > 0) {
+        telemetry.readoutmbps = (double)UNITS*NUMFRAMES*framesize / readoutus;
+    }
+
+    // Did the OS let the drain threads keep up? Telemetry keeps the worst unit
+    char jitterreport[160];
+    double jitterp50, jitterp99, jitterp999, jittermax;
+    for (u = 0; u < UNITS; u++) {
+        JitterReport(&drain[u].jitter, FPS > 0 ? 1e6/FPS : 0, jitterreport, sizeof(jitterreport));
+        printf("Unit %d: %s\r\n\n", u+1, jitterreport);
+        JitterPercentiles(&drain[u].jitter, &jitterp50, &jitterp99, &jitterp999, &jittermax);
+        if (u == 0 || jitterp99 > telemetry.jitterp99) {
+            telemetry.jitterp50 = jitterp50;
+            telemetry.jitterp99 = jitterp99;
+        }
+        if (jittermax > telemetry.jittermax) {
+            telemetry.jittermax = jittermax;
+        }
+        JitterFree(&drain[u].jitter);
+    }
+
+    // Catch bad exposure now rather than when the video is opened
+    char exposure[BUFLEN];
+    double meanlevel;
+    int saturatedframes;
+    for (u = 0; u < UNITS; u++) {
+        FrameStatsSummary(drain[u].stats, NUMFRAMES, (size_t)drain[u].xdim*drain[u].ydim, exposure, sizeof(exposure),
+                          &meanlevel, &saturatedframes);
+        printf("Unit %d: %s\r\n\n", u+1, exposure);
+        if (u == 0 || meanlevel < telemetry.meanlevel) {
+            telemetry.meanlevel = meanlevel;
+        }
+        telemetry.saturatedframes += saturatedframes;
+    }
+
+    // Unit 1's analysis is done once its last frame is; the events go in its index
+    if (analysing) {
+        pthread_join(analysisthread, NULL);
+    }
+    const EventDetector *events = analysis.tracker != NULL ? &analysis.events : NULL;
     
 
 /*
@@ -516,61 +1575,319 @@ void CaptureSequenceAVI(int NUMIMAGES, int FPS, int PULSETIME, float DELAYTIME,
     printf("Image1 from buffer -> saved.\r\n");
 */
 
-    // Create VideoWriter using Huffyuv encoding at 5 fps - save to MacIver->Documents->High Speed Videos
-    char filename[64];
-    int fourcc = CV_FOURCC('H','F','Y','U');
-    double fps = 5;
-    CvSize frame_size;
-    frame_size = cvSize( pxd_imageXdim(), pxd_imageYdim() );
-    int is_color = 0;
+    double writestart = TelemetryNowMs();
+    struct stat st;
+    int frameswritten = 0;
+    telemetry.byteswritten = 0;
+    telemetry.disks = 0;
 
-    if (IDENTIFIER == 'S') {
-        sprintf(filename, "/home/maciver/Documents/High Speed Videos/Mikrotron_%c_%d_%dHz_%fDelayTime_%dFPS_%dPulseTime.avi", IDENTIFIER, SAVEDSIGNAL, FREQ, DELAYTIME, FPS, PULSETIME);
+    if (UNITS == 1) {
+        WriteFrameIndex(filename, &drain[0], events);
     }
-    else if (IDENTIFIER == 'E') {
-        sprintf(filename, "/home/maciver/Documents/High Speed Videos/Mikrotron_%c_%dHz_%dA_%dA_%03dDPhase_%fDelayTime_%dFPS_%dPulseTime.avi", IDENTIFIER, FREQ, HORIZ_AMPL, VERT_AMPL, PHASE_OFFSET, DELAYTIME, FPS, PULSETIME);
+    if (opts->exportranges[0] != '\0' && (pool != NULL || UNITS > 1)) {
+        printf("Export ranges apply to a single unit's AVI - every frame is written.\r\n");
+    }
+    if (pool != NULL) {
+        CatalogAddFile(catalogtrial, "sequence", filename);
+        FinishSparse(pool, filename);
+        frameswritten = NUMFRAMES;
+        telemetry.byteswritten = (stat(filename, &st) == 0) ? (double)st.st_size : 0;
+    }
+    else if (stream != NULL) {
+        CatalogAddFile(catalogtrial, "sequence", filename);
+        FinishRaw(stream, filename);
+        frameswritten = NUMFRAMES;
+        telemetry.byteswritten = (stat(filename, &st) == 0) ? (double)st.st_size : 0;
     }
+    else if (UNITS == 1) {
+        // Only the frames in the export ranges, if any, with <base>.ranges.csv mapping them back
+        FrameRanges ranges;
+        int nexport = ExportRanges(opts, events, NUMFRAMES, &ranges);
+        unsigned char **selected = nexport > 0 ? (unsigned char **)malloc(nexport * sizeof(unsigned char *)) : NULL;
+
+        if (selected != NULL) {
+            char rangesname[sizeof(filename)+16];
+            int r, b, n = 0;
+
+            for (r = 0; r < ranges.n; r++) {
+                for (b = ranges.ranges[r].first; b <= ranges.ranges[r].last; b++) {
+                    selected[n++] = buf[b-1];
+                }
+            }
+            printf("Exporting %d of %d frames in %d ranges.\r\n", nexport, NUMFRAMES, ranges.n);
+            WriteSequence(filename, selected, nexport, opts);
+            snprintf(rangesname, sizeof(rangesname), "%.*s.ranges.csv", (int)strlen(filename)-4, filename);
+            FrameRangesWrite(&ranges, rangesname);
+            CatalogAddFile(catalogtrial, "ranges", rangesname);
+            frameswritten = nexport;
+            free(selected);
+        }
+        else {
+            WriteSequence(filename, buf, NUMFRAMES, opts);
+            frameswritten = NUMFRAMES;
+        }
+        FrameRangesFree(&ranges);
+        telemetry.byteswritten = (stat(filename, &st) == 0) ? (double)st.st_size : 0;
+    }
+    else {
+        // Frame k of every unit's file comes from the same trigger; a unit's dropped frames are written black
+        int nslots;
+        int *order = AlignUnits(drain, UNITS, NUMFRAMES, &nslots);
+        unsigned char **frames = (unsigned char **)malloc( (nslots > 0 ? nslots : 1)*sizeof(unsigned char*) );
+        char unitfile[sizeof(filename)+8];
+        int k;
+
+        if (order == NULL || frames == NULL) {
+            printf("Out of memory aligning units - sequence files not written.\r\n");
+            nslots = 0;
+        }
+        printf("Units aligned over %d frames.\r\n", nslots);
 
-    CvVideoWriter* writer;
-    writer = cvCreateVideoWriter(filename, fourcc, fps, frame_size, is_color);
-    printf("VideoWriter created.\r\n");
+        for (u = 0; u < UNITS && nslots > 0; u++) {
+            for (k = 0; k < nslots; k++) {
+                frames[k] = order[u*nslots + k] >= 0 ? drain[u].buf[order[u*nslots + k]] : NULL;
+            }
+            snprintf(unitfile, sizeof(unitfile), "%.*s_unit%d%s", (int)strlen(filename)-4, filename, u+1, extension);
+            WriteSequence(unitfile, frames, nslots, opts);
+            WriteFrameIndex(unitfile, &drain[u], u == 0 ? events : NULL);
+            frameswritten += nslots;
+            telemetry.byteswritten += (stat(unitfile, &st) == 0) ? (double)st.st_size : 0;
+        }
+        if (nslots > 0) {
+            WriteSyncTable(filename, drain, UNITS, order, nslots);
+        }
+        free(frames);
+        free(order);
+    }
 
+    double encodems = TelemetryNowMs() - writestart;
+    telemetry.encodefps = encodems > 0 ? frameswritten * 1e3 / encodems : 0;
 
-    // Loop through each frame, writing them to the avi file
-    printf("Starting to write frames to AVI file.\r\n");
-    int k;
-    for(k=0; k<(NUMIMAGES-1); k++)
-    {
-        // Create IplImage* TempImg in order to write the frame buffers to avi object
-        IplImage* TempImg;
-        TempImg = cvCreateImage(cvSize(pxd_imageXdim(),pxd_imageYdim()), IPL_DEPTH_8U, 1);
-
-        // CvScalar tuple for setting pixel values from frame buffer
-        CvScalar s;
-
-        // Reads each image from respective buffers in memory, storing as IplImage* (necessary for cvWriteFrame)
-        int l, m, counter=0;
-        for(l=0; l < pxd_imageYdim(); l++){
-            for (m=0; m < pxd_imageXdim(); m++) {
-                s.val[0] = buf[k][counter];
-                cvSet2D(TempImg, l, m, s); // set the (l,m) pixel value using s.val[0]
-                counter++;
+    // Per-phase mean and variance images, the drop trajectories and their events and the proxy, next to the sequence file
+    if (analysis.phasing && analysing) {
+        int b, fewest = -1, most = 0;
+
+        for (b = 0; b < analysis.average.bins; b++) {
+            if (fewest < 0 || analysis.average.count[b] < fewest) {
+                fewest = (int)analysis.average.count[b];
+            }
+            if (analysis.average.count[b] > most) {
+                most = (int)analysis.average.count[b];
             }
         }
+        char phasepath[sizeof(base) + 16];
 
-        // Write frame to avi object
-        cvWriteFrame(writer, TempImg);
+        snprintf(phasepath, sizeof(phasepath), "%s.phase.csv", base);
+        if (PhaseAverageWrite(&analysis.average, base) < 0) {
+            printf("Error writing the phase-locked average %s.phase*.\r\n", base);
+        }
+        CatalogAddFile(catalogtrial, "phase", phasepath);
+        printf("Phase-locked average at %d Hz: %ld frames in %d bins, %d to %d per bin, %d stale buffers skipped.\r\n",
+               FREQ, analysis.average.frames, analysis.average.bins, fewest, most, analysis.skipped);
     }
+    if (analysis.phasing) {
+        PhaseAverageFree(&analysis.average);
+    }
+    if (analysis.tracker != NULL) {
+        long points;
+        int tracks;
 
+        if (TrackerClose(analysis.tracker, &points, &tracks) < 0) {
+            printf("Error writing the trajectories %s.traj.csv.\r\n", base);
+        }
+        printf("Trajectories: %ld drop positions in %d tracks at threshold %d, in %s.traj.csv.\r\n",
+               points, tracks, dropthreshold, base);
 
-    // Release VideoWriter
-    cvReleaseVideoWriter(&writer);
+        char eventpath[sizeof(filename) + 16];
+        snprintf(eventpath, sizeof(eventpath), "%s.events.csv", base);
+        if (EventsWrite(&analysis.events, eventpath, NUMFRAMES) < 0) {
+            printf("Error writing the drop events %s.\r\n", eventpath);
+        }
+        CatalogAddFile(catalogtrial, "events", eventpath);
+        CatalogAddEvents(catalogtrial, &analysis.events);
+        printf("Events: %d impacts, %d rebounds, %d coalescences, frames -%d..+%d tagged in the index.\r\n",
+               analysis.events.counts[EVENT_IMPACT], analysis.events.counts[EVENT_REBOUND],
+               analysis.events.counts[EVENT_COALESCENCE], analysis.events.pre, analysis.events.post);
+        EventDetectorFree(&analysis.events);
+    }
+    if (analysis.proxy != NULL) {
+        char proxypath[sizeof(base) + 16], sheetpath[sizeof(base) + 16];
+
+        if (ProxyClose(analysis.proxy, proxypath, sheetpath, sizeof(proxypath)) == 0) {
+            CatalogAddFile(catalogtrial, "proxy", proxypath);
+            CatalogAddFile(catalogtrial, "sheet", sheetpath);
+        }
+    }
+
+    // Release the sequence
+    capturing = 0;
+    PreviewEndSequence();
+    RtUnlockMemory(&rtconfig, framedata, sequencebytes);
+    free(buf);
+    free(fieldcount);
+    free(framestats);
+    free(framedata);
+    free(tempbuf);
 
 
 
     // Check for faults, such as erratic sync or insufficient PCI bus bandwidth
-    pxd_mesgFault(UNITSMAP);
+    telemetry.fault = pxd_mesgFault(UNITSMAP);
     printf("AVI file written.\r\n\n");
+    return(1);
+}
+
+
+
+// ================================================================================================
+// Monitoring thread: ping-pong capture into frame buffers 1 and 2 for as long as Machine A likes
+// Each captured frame is read out and processed while the other buffer fills; the time that
+// leaves before the next frame is the processing headroom, reported once a second
+// ================================================================================================
+struct MonitorContext {
+    volatile int stop;          // set by the main thread when Machine A ends monitoring
+    int fps;
+    unsigned char *frame;       // host copy of the buffer being processed
+    size_t framesize;
+    long processed;             // frames read out and processed
+    long missed;                // frames captured while the previous one was still being processed
+    long overruns;              // readouts the grabber may have overwritten - processing took > 1 frame
+    double worstheadroomus;     // over the whole session
+};
+
+void *MonitorThread(void *arg)
+{
+    struct MonitorContext *ctx = (struct MonitorContext *)arg;
+    int fieldsperframe = pxd_videoFieldsPerFrame() > 0 ? pxd_videoFieldsPerFrame() : 1;
+    double periodus = ctx->fps > 0 ? 1e6/ctx->fps : 0;
+    double start, processus, lastreport = RtNowUs(), lastcapture = 0;
+    pxvbtime_t lastfield = pxd_capturedFieldCount(1), field;
+    long windowmissed = 0, windowoverruns = 0;
+    double p50, p99, p999, worst;
+    JitterStats processing;     // per frame processing time, for the current one second window
+
+    RtEnterCapture(&rtconfig, 0);
+    JitterInit(&processing, ctx->fps > 0 ? 2*ctx->fps : 100000);
+    ctx->worstheadroomus = periodus;
+
+    while (!ctx->stop) {
+
+        // Wait for the pair to complete another frame
+        field = pxd_capturedFieldCount(1);
+        if (field == lastfield) {
+            sched_yield();
+            continue;
+        }
+        start = RtNowUs();
+        if (periodus == 0 && lastcapture > 0) {
+            periodus = start - lastcapture;     // no FPS given - go by the capture interval
+        }
+        lastcapture = start;
+        if ((pxvbtime_t)(field - lastfield) / fieldsperframe > 1) {
+            windowmissed += (pxvbtime_t)(field - lastfield) / fieldsperframe - 1;
+        }
+        lastfield = field;
+
+        // Read out the buffer just completed - the grabber is filling the other one meanwhile
+        pxd_readuchar(1, pxd_capturedBuffer(1), 0, 0, -1, -1, ctx->frame, ctx->framesize, "Grey");
+        if (pxd_capturedFieldCount(1) != field) {
+            windowoverruns++;       // the other buffer is done and capture has come back to this one
+        }
+
+        // Processing - the live preview for now, analysis stages hook in here
+        ctx->processed++;
+        PreviewOffer(ctx->frame, pxd_imageXdim(), pxd_imageYdim(), ctx->processed);
+
+        processus = RtNowUs() - start;
+        JitterAdd(&processing, processus);
+        if (periodus > 0 && periodus - processus < ctx->worstheadroomus) {
+            ctx->worstheadroomus = periodus - processus;
+        }
+
+        // Once a second: how much of each frame period the processing used
+        if (start - lastreport >= 1e6) {
+            JitterPercentiles(&processing, &p50, &p99, &p999, &worst);
+            printf("Monitor: %5d frames/s  processing p50 %.0f p99 %.0f max %.0f us  headroom %.0f us (%.0f%%)  missed %ld  overruns %ld\r\n",
+                   processing.count, p50, p99, worst, periodus - worst,
+                   periodus > 0 ? 100*(periodus - worst)/periodus : 0, windowmissed, windowoverruns);
+            ctx->missed += windowmissed;
+            ctx->overruns += windowoverruns;
+            windowmissed = windowoverruns = 0;
+            JitterReset(&processing);
+            lastreport = start;
+        }
+    }
+    ctx->missed += windowmissed;
+    ctx->overruns += windowoverruns;
+    JitterFree(&processing);
+    return NULL;
+}
+
+
+
+// ================================================================================================
+// Continuous monitoring for tuning sessions - runs until the next message from Machine A
+// Only two frame buffers are used, however long it runs; the camera settings queued for it are
+// collected first, as before a capture, and Machine A is told if any were refused
+// ================================================================================================
+void MonitorLive(int FPS, int sock)
+{
+    int slen=sizeof(AddrMachineA);
+    char message[BUFLEN];
+    char buf[BUFLEN];
+    struct MonitorContext monitor;
+    pthread_t monitorthread;
+    int refused;
+
+    if ((refused = SerialWait(&camera, 2000)) > 0) {
+        printf("Warning: camera did not accept all settings for monitoring.\r\n");
+    }
+
+    memset(&monitor, 0, sizeof(monitor));
+    monitor.fps = FPS;
+    monitor.framesize = (size_t)pxd_imageXdim()*pxd_imageYdim();
+    monitor.frame = (unsigned char*)malloc(monitor.framesize);
+    if (monitor.frame == NULL) {
+        AddrMachineA.sin_port = htons(PORTA);
+        strcpy(message, "Monitoring not started. Out of memory.");
+        SendSocket(sock, message, slen);
+        return;
+    }
+
+    // Capture alternates between buffers 1 and 2 until pxd_goUnLive()
+    pxd_goLivePair(UNITSMAP, 1L, 2L);
+    if (pthread_create(&monitorthread, NULL, MonitorThread, &monitor) != 0) {
+        perror("pthread_create");
+        pxd_goUnLive(UNITSMAP);
+        free(monitor.frame);
+        return;
+    }
+    printf("Monitoring live - any message from Machine A stops it.\r\n\n");
+    AddrMachineA.sin_port = htons(PORTA);
+    if (refused > 0) {
+        snprintf(message, sizeof(message), "Monitoring started. Camera did not accept %d settings.", refused);
+    }
+    else {
+        strcpy(message, "Monitoring started.");
+    }
+    SendSocket(sock, message, slen);
+
+    // Block until Machine A is done
+    ReceiveSocket(sock, buf, slen);
+    monitor.stop = 1;
+    pthread_join(monitorthread, NULL);
+    pxd_goUnLive(UNITSMAP);
+    while (pxd_goneLive(UNITSMAP, 0)) {
+        ;
+    }
+    PreviewEndSequence();
+    free(monitor.frame);
+
+    snprintf(message, sizeof(message), "Monitoring stopped. %ld frames processed, %ld missed, %ld overruns, worst headroom %.0f us.",
+             monitor.processed, monitor.missed, monitor.overruns, monitor.worstheadroomus);
+    printf("%s\r\n\n", message);
+    AddrMachineA.sin_port = htons(PORTA);
+    SendSocket(sock, message, slen);
 }
 
 
@@ -586,6 +1903,154 @@ void CloseFrameGrabber(void)
 
 
 
+// ================================================================================================
+// Open the frame grabber with formatfile - reopened only when the format changes, otherwise it
+// stays open between trials. Returns < 0 if it did not open after two attempts
+// ================================================================================================
+char openformat[256] = "";    // format file the frame grabber currently has open
+int grabberopen = 0;
+
+int LoadFormat(const char *formatfile)
+{
+    int statusFrameGrabber;
+
+    if (grabberopen && strcmp(formatfile, openformat) == 0) {
+        printf("Format '%s' already loaded.\r\n\n", formatfile);
+        return(0);
+    }
+    if (grabberopen) {
+        CloseFrameGrabber();
+        grabberopen = 0;
+    }
+
+    // Open and initialize frame grabber
+    double openstart = TelemetryNowMs();
+    statusFrameGrabber = InitializationFrameGrabber(formatfile);
+
+    // Try opening again if did not work the first time - happens every once in a while
+    if (statusFrameGrabber < 0) {
+        printf("\nTrying to open frame grabber one more time.\r\n\n");
+        statusFrameGrabber = InitializationFrameGrabber(formatfile);
+    }
+    if (statusFrameGrabber < 0) {
+        return(statusFrameGrabber);
+    }
+    snprintf(openformat, sizeof(openformat), "%s", formatfile);
+    grabberopen = 1;
+    telemetry.openms = TelemetryNowMs() - openstart;
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Calibration: snap a burst with each candidate profile, score the histogram of unit 1's frames
+// and report the best profile and drop threshold to Machine A. Both become the defaults
+// ================================================================================================
+void Calibrate(int FPS, int sock, struct TrialOptions *opts)
+{
+    int slen=sizeof(AddrMachineA);
+    char message[BUFLEN];
+    const FormatProfile *candidates[MAX_PROFILES];
+    const FormatProfile *reference, *prof;
+    ExposureScore score, bestscore;
+    FrameHistogram histogram;
+    int ncandidates = 0, best = -1, bestsaturates = 1, i, k;
+
+    // Candidates: the "cal=" list, or every profile the size of the default one
+    if (opts->calibrate[0]) {
+        char list[sizeof(opts->calibrate)];
+        char *name;
+        snprintf(list, sizeof(list), "%s", opts->calibrate);
+        for (name = strtok(list, ","); name != NULL && ncandidates < MAX_PROFILES; name = strtok(NULL, ",")) {
+            if ((prof = FormatProfileFind(name)) != NULL) {
+                candidates[ncandidates++] = prof;
+            }
+            else {
+                printf("Unknown format profile '%s' -- not calibrated.\r\n", name);
+            }
+        }
+    }
+    else {
+        reference = FormatProfileFind(calibratedformat[0] ? calibratedformat : FORMATFILE);
+        for (i = 0; (prof = FormatProfileAt(i)) != NULL && ncandidates < MAX_PROFILES; i++) {
+            if (reference == NULL || (prof->xdim == reference->xdim && prof->ydim == reference->ydim)) {
+                candidates[ncandidates++] = prof;
+            }
+        }
+    }
+    printf("Calibrating %d format profiles, %d frames each.\r\n\n", ncandidates, opts->burst);
+    memset(&bestscore, 0, sizeof(bestscore));
+
+    for (k = 0; k < ncandidates; k++) {
+        size_t framesize;
+        unsigned char *frame;
+        int snapped = 0, err = 0, saturates;
+
+        prof = candidates[k];
+        if (LoadFormat(prof->path) < 0) {
+            printf("%s: frame grabber did not open -- skipped.\r\n", prof->name);
+            continue;
+        }
+        ConfigureCamera(FPS, opts);
+        if (SerialWait(&camera, 2000) > 0) {
+            printf("Warning: camera did not accept all settings for %s.\r\n", prof->name);
+        }
+
+        framesize = (size_t)pxd_imageXdim()*pxd_imageYdim();
+        if ((frame = (unsigned char*)malloc(framesize)) == NULL) {
+            continue;
+        }
+        FrameHistogramClear(&histogram);
+        for (i = 0; i < opts->burst; i++) {
+            // Each snap waits for the next external trigger
+            if ((err = pxd_doSnap(1, 1, CALTIMEOUTMS)) < 0) {
+                break;
+            }
+            pxd_readuchar(1, 1, 0, 0, -1, -1, frame, framesize, "Grey");
+            FrameHistogramAdd(&histogram, frame, framesize);
+            snapped++;
+        }
+        free(frame);
+        if (snapped == 0) {
+            printf("%s: pxd_doSnap: %s -- skipped.\r\n", prof->name, pxd_mesgErrorCode(err));
+            pxd_mesgFault(1);
+            continue;
+        }
+
+        FrameHistogramScore(&histogram, &score);
+        saturates = score.saturatedpct > CALSATURATEDPCT;
+        printf("%-32s %5d us  background %3.0f  drops %3.0f  contrast %3.0f  %.3f%% saturated  threshold %d%s\r\n",
+               prof->name, prof->exposure, score.background, score.bright, score.contrast,
+               score.saturatedpct, score.threshold, saturates ? "  (saturates)" : "");
+
+        // Most contrast among the profiles that don't saturate; least saturation if they all do
+        if (best < 0 || (bestsaturates && !saturates)
+            || (!bestsaturates && !saturates && score.contrast > bestscore.contrast)
+            || (bestsaturates && saturates && score.saturatedpct < bestscore.saturatedpct)) {
+            best = k;
+            bestscore = score;
+            bestsaturates = saturates;
+        }
+    }
+
+    AddrMachineA.sin_port = htons(PORTA);    // specify PortA to send message back to
+    if (best < 0) {
+        snprintf(message, sizeof(message), "Calibration failed. No frames snapped from %d profiles - is the camera being triggered?", ncandidates);
+    }
+    else {
+        snprintf(calibratedformat, sizeof(calibratedformat), "%s", candidates[best]->name);
+        dropthreshold = bestscore.threshold;
+        snprintf(message, sizeof(message), "Calibration: fmt=%s threshold=%d (exposure %d us, background %.0f, drops %.0f, %.3f%% saturated%s, best of %d profiles).",
+                 calibratedformat, dropthreshold, candidates[best]->exposure, bestscore.background, bestscore.bright,
+                 bestscore.saturatedpct, bestsaturates ? ", every profile saturates" : "", ncandidates);
+    }
+    printf("\r\n%s\r\n\n", message);
+    SendSocket(sock, message, slen);
+}
+
+
+
 
 
 
@@ -594,13 +2059,49 @@ void CloseFrameGrabber(void)
 // ================================================================================================
 // Main function
 // ================================================================================================
-main(void)
+main(int argc, char *argv[])
 {
     // Catch signals
     signal(SIGINT, sigintfunc);
     signal(SIGFPE, sigintfunc);
 
 
+    // Command line options
+    const char *serialdevice = CAMERA_SERIAL;
+    int opt;
+    const char *formatdir = FORMATDIR;
+    const char *telemetrylog = TELEMETRYLOG;
+    const char *catalogpath = TRIALCATALOG;
+    int previewport = PREVIEWPORT;
+    RtConfigDefaults(&rtconfig);
+    while ((opt = getopt(argc, argv, "s:f:c:r:t:d:p:")) != -1) {
+        switch (opt) {
+          case 's': serialdevice = optarg;  break;
+          case 'f': formatdir = optarg;     break;
+          case 't': telemetrylog = optarg;  break;
+          case 'd': catalogpath = optarg;   break;
+          case 'p': previewport = atoi(optarg); break;
+          case 'c':
+            if (RtConfigLoad(&rtconfig, optarg) < 0) {
+                return(1);
+            }
+            break;
+          case 'r':
+            if (RtConfigOption(&rtconfig, optarg) < 0) {
+                return(1);
+            }
+            break;
+          default:
+            fprintf(stderr, "usage: %s [-s camera_serial_device] [-f format_file_dir] [-c rt_config_file] [-r key=value]... [-t telemetry_log] [-d trial_catalog] [-p preview_port]\n", argv[0]);
+            return(1);
+        }
+    }
+
+    // Keep this thread (UDP, AVI encoding) off the capture core; the drain thread moves itself there
+    RtConfigPrint(&rtconfig);
+    RtPinWorkers(&rtconfig);
+
+
     // Local variables used for UDP communication
     int sock, slen=sizeof(AddrMachineA);
     char buf[BUFLEN];
@@ -615,13 +2116,32 @@ main(void)
     int FREQ=0, VERT_AMPL=0, HORIZ_AMPL=0, PHASE_OFFSET=0, FPS_Side=0, NUMIMAGES_Side=0, PULSETIME=0, currentSample=0, SAVEDSIGNAL=0;
     float DELAYTIME=0;
     char IDENTIFIER=0, FirstChar=0;
+    struct TrialOptions opts;
 
-    int statusFrameGrabber;
+    const FormatProfile *profile;
+    const char *formatfile, *defaultformat;
 
 
     // Initialize UDP socket
     sock = InitializeUDP(sock);
 
+    // Open camera serial port - capture still works with the format file's settings if this fails
+    if (SerialOpen(&camera, serialdevice, CAMERA_BAUD) < 0) {
+        printf("Camera serial control disabled.\r\n\n");
+    }
+
+    // Parse every format file once - trials then only look profiles up by name
+    FormatProfilesLoad(formatdir);
+    FormatProfilesPrint();
+
+    TelemetryOpen(telemetrylog);
+    CatalogOpen(catalogpath);
+
+    // Preview publisher runs on the worker cpus this thread was just pinned to
+    if (previewport > 0) {
+        PreviewStart(previewport, PREVIEWEVERY, PREVIEWSCALE);
+    }
+
 
 
     // Continue to capture sequence AVI's while Run_Flag is ON (1)
@@ -632,8 +2152,27 @@ main(void)
 
         printf("Received packet from %s: %d\n", inet_ntoa(AddrMachineA.sin_addr), ntohs(AddrMachineA.sin_port));
 
+        trialreceivedms = TelemetryNowMs();
         sscanf(buf, "%c", &FirstChar);
 
+        // "Q [trial]" asks for a telemetry record instead of starting a trial
+        if (FirstChar == 'Q') {
+            long trial = 0;
+            char record[1024];
+            sscanf(buf, "%*c %ld", &trial);
+            if (TelemetryQuery(trial, record, sizeof(record)) < 0) {
+                snprintf(record, sizeof(record), "No telemetry for trial %ld.", trial);
+            }
+            AddrMachineA.sin_port = htons(PORTA);    // specify PortA to send message back to
+            SendSocket(sock, record, slen);
+            continue;
+        }
+        // "M <FPS> [key=value]..." monitors live with two frame buffers until the next message
+        // "C <FPS> [key=value]..." calibrates the exposure profile and drop threshold
+        if (FirstChar != 'M' && FirstChar != 'C') {
+            TelemetryBegin(&telemetry, FirstChar);
+        }
+
         if(FirstChar == 'S') {
             sscanf(buf, "%c%*c %d%*c %d%*c %d%*c %d%*c %f%*c %d", &IDENTIFIER, &SAVEDSIGNAL, &FREQ, &FPS_Side, &NUMIMAGES_Side, &PULSETIME, &DELAYTIME);
             printf("IDENTIFIER, SAVEDSIGNAL, FREQ, FPS_Side, NUMIMAGES_Side, PULSETIME, DELAYTIME: %c %d %d %d %d %f %d\r\n",IDENTIFIER, SAVEDSIGNAL, FREQ, FPS_Side, NUMIMAGES_Side, PULSETIME, DELAYTIME);
@@ -642,29 +2181,77 @@ main(void)
             sscanf(buf, "%c%*c %d%*c %d%*c %d%*c %d%*c %d%*c %d%*c %d%*c %f", &IDENTIFIER, &FREQ, &VERT_AMPL, &HORIZ_AMPL, &PHASE_OFFSET, &FPS_Side, &NUMIMAGES_Side, &PULSETIME, &DELAYTIME);
             printf("IDENTIFIER, FREQ, VERT_AMPL, HORIZ_AMPL, PHASE_OFFSET, FPS_Side, NUMIMAGES_Side, PULSETIME, DELAYTIME: %c %d %d %d %d %d %d %d %f\r\n",IDENTIFIER, FREQ, VERT_AMPL, HORIZ_AMPL, PHASE_OFFSET, FPS_Side, NUMIMAGES_Side, PULSETIME, DELAYTIME);
         }
+        else if(FirstChar == 'M' || FirstChar == 'C') {
+            sscanf(buf, "%*c%*c %d", &FPS_Side);
+            printf("%s FPS_Side: %d\r\n", FirstChar == 'M' ? "Monitor" : "Calibration", FPS_Side);
+        }
+        ParseTrialOptions(buf, &opts);
 
+        if (FirstChar == 'C') {
+            Calibrate(FPS_Side, sock, &opts);
+            continue;
+        }
 
-        // Open and initialize frame grabber
-        statusFrameGrabber = InitializationFrameGrabber();
 
-        // Try opening again if did not work the first time - happens every once in a while
-        if (statusFrameGrabber < 0) {
-            printf("\nTrying to open frame grabber one more time.\r\n\n");
-            statusFrameGrabber = InitializationFrameGrabber();
+        // Pick the trial's format profile, falling back to the calibrated one, then FORMATFILE
+        defaultformat = calibratedformat[0] ? calibratedformat : FORMATFILE;
+        profile = FormatProfileFind(opts.format[0] ? opts.format : defaultformat);
+        if (profile == NULL && opts.format[0]) {
+            printf("Unknown format profile '%s' -- using '%s'.\r\n", opts.format, defaultformat);
+            profile = FormatProfileFind(defaultformat);
         }
+        formatfile = profile ? profile->path : FORMATFILE;
+        snprintf(telemetry.format, sizeof(telemetry.format), "%s", profile ? profile->name : FORMATFILE);
 
-        // If did not work after the second time, close the program
-        if (statusFrameGrabber < 0) {
+        // If the frame grabber did not open after the second time, close the program
+        if (LoadFormat(formatfile) < 0) {
             printf("\nFrame grabber did not open after two attempts -- closing program.\r\n");
             return(1);
         }
 
+        // Opening the frame grabber sends the format file's camera settings - override them from here on
+        // (re-sent every trial, since a trial that kept the format may have changed them)
+        ConfigureCamera(FPS_Side, &opts);
+
+
+        if (FirstChar == 'M') {
+            MonitorLive(FPS_Side, sock);
+            continue;
+        }
+
+        // Catalog the trial before capturing it, so it is there even if it never finishes
+        CatalogTrial entry;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.start = telemetry.start;
+        entry.identifier = IDENTIFIER;
+        entry.savedsignal = SAVEDSIGNAL;
+        entry.freq = FREQ;
+        entry.vertampl = VERT_AMPL;
+        entry.horizampl = HORIZ_AMPL;
+        entry.phaseoffset = PHASE_OFFSET;
+        entry.fps = FPS_Side;
+        entry.frames = NUMIMAGES_Side;
+        entry.pulsetime = PULSETIME;
+        entry.delaytime = DELAYTIME;
+        entry.format = telemetry.format;
+        entry.message = buf;
+        catalogtrial = CatalogBegin(&entry);
+
+        // Capture sequence AVI - a trial that was never armed is recorded as rejected, with the reason
+        if (!CaptureSequenceAVI(NUMIMAGES_Side, FPS_Side, PULSETIME, DELAYTIME, HORIZ_AMPL, VERT_AMPL, FREQ, PHASE_OFFSET, IDENTIFIER, SAVEDSIGNAL, sock, &opts)) {
+            printf("Trial not armed: %s\r\n\n", telemetry.rejected);
+        }
+        TelemetryAppend(&telemetry);
+        CatalogFinish(catalogtrial, &telemetry);
+        catalogtrial = 0;
 
-        // Capture sequence AVI
-        CaptureSequenceAVI(NUMIMAGES_Side, FPS_Side, PULSETIME, DELAYTIME, HORIZ_AMPL, VERT_AMPL, FREQ, PHASE_OFFSET, IDENTIFIER, SAVEDSIGNAL, sock);
+        // CTRL+C stopped the trial and it has been written - now quit
+        if (interrupted) {
+            printf("Interrupted - trial finished, closing.\r\n");
+            break;
+        }
 
-        // Close frame grabber255
-	CloseFrameGrabber();
         // Check to see if still running tests from Machine A
         ReceiveSocket(sock, buf, slen);
         sscanf(buf, "%d", &Run_Flag);
@@ -683,8 +2270,15 @@ main(void)
     }
 
 
-    // Close UDP socket
+    // Close frame grabber, UDP socket and camera serial port
+    if (grabberopen) {
+        CloseFrameGrabber();
+    }
     CloseSocket(sock);
+    SerialClose(&camera);
+    TelemetryClose();
+    CatalogClose();
+    PreviewStop();
 
 
     return(0);
@@ -0,0 +1,151 @@
+/*
+ *  catalog_query.c
+ *
+ *  Selecting trials from the catalog - see catalog_query.h.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "catalog_query.h"
+
+#define MAXTERMS    32
+#define MAXSQL      4096
+
+static const char *columns[] = {
+    "id", "start", "identifier", "savedsignal", "freq", "vert_ampl", "horiz_ampl", "phase_offset", "fps",
+    "frames", "pulse_time", "delay_time", "format", "status", "captured", "drops", "bytes", "fault",
+};
+
+static const char *aliases[][2] = {
+    { "phase", "phase_offset" }, { "vert", "vert_ampl" }, { "horiz", "horiz_ampl" }, { "signal", "savedsignal" },
+    { "delay", "delay_time" }, { "pulse", "pulse_time" },
+};
+
+// A value to bind: part of a term
+typedef struct {
+    const char  *text;
+    int         len;
+} Value;
+
+static const char *Column(const char *name, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+        if (strlen(aliases[i][0]) == len && strncmp(name, aliases[i][0], len) == 0) {
+            return aliases[i][1];
+        }
+    }
+    for (i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+        if (strlen(columns[i]) == len && strncmp(name, columns[i], len) == 0) {
+            return columns[i];
+        }
+    }
+    return NULL;
+}
+
+// One term onto the WHERE clause and its values onto values[]
+static int AddTerm(const char *term, char *where, size_t len, Value *values, int *nvalues)
+{
+    static const char *ops[] = { "!=", "<=", ">=", "=", "<", ">" };
+    const char *column, *value, *range;
+    size_t at = strcspn(term, "!<>="), i;
+
+    if (strcmp(term, "S") == 0 || strcmp(term, "E") == 0) {
+        values[*nvalues].text = term;
+        values[(*nvalues)++].len = 1;
+        snprintf(where + strlen(where), len - strlen(where), " AND identifier = ?");
+        return(0);
+    }
+    if ((column = Column(term, at)) == NULL) {
+        fprintf(stderr, "unknown column in %s\n", term);
+        return(-1);
+    }
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strncmp(term + at, ops[i], strlen(ops[i])) == 0) {
+            break;
+        }
+    }
+    if (i == sizeof(ops) / sizeof(ops[0])) {
+        fprintf(stderr, "can't read condition %s\n", term);
+        return(-1);
+    }
+    value = term + at + strlen(ops[i]);
+    if (strcmp(ops[i], "=") == 0 && (range = strstr(value, "..")) != NULL) {
+        values[*nvalues].text = value;
+        values[(*nvalues)++].len = (int)(range - value);
+        values[*nvalues].text = range + 2;
+        values[(*nvalues)++].len = -1;
+        snprintf(where + strlen(where), len - strlen(where), " AND %s BETWEEN ? AND ?", column);
+    }
+    else {
+        values[*nvalues].text = value;
+        values[(*nvalues)++].len = -1;
+        snprintf(where + strlen(where), len - strlen(where), " AND %s %s ?", column, ops[i]);
+    }
+    return(0);
+}
+
+sqlite3 *CatalogOpenRead(const char *path)
+{
+    sqlite3 *db;
+
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+    sqlite3_busy_timeout(db, 1000);
+    return db;
+}
+
+sqlite3_stmt *CatalogSelect(sqlite3 *db, const char *select, char *const terms[], int nterms, const char *condition)
+{
+    Value values[2*MAXTERMS];
+    char where[MAXSQL] = "1", sql[2*MAXSQL];
+    sqlite3_stmt *st;
+    int i, nvalues = 0;
+
+    if (nterms > MAXTERMS) {
+        fprintf(stderr, "at most %d terms\n", MAXTERMS);
+        return NULL;
+    }
+    for (i = 0; i < nterms; i++) {
+        if (AddTerm(terms[i], where, sizeof(where), values, &nvalues) < 0) {
+            return NULL;
+        }
+    }
+    if (condition != NULL) {
+        snprintf(where + strlen(where), sizeof(where) - strlen(where), " AND (%s)", condition);
+    }
+    snprintf(sql, sizeof(sql), "SELECT %s FROM trials WHERE %s ORDER BY id", select, where);
+    if (sqlite3_prepare_v2(db, sql, -1, &st, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s\n", sqlite3_errmsg(db));
+        return NULL;
+    }
+    for (i = 0; i < nvalues; i++) {
+        sqlite3_bind_text(st, i + 1, values[i].text, values[i].len, SQLITE_TRANSIENT);
+    }
+    return st;
+}
+
+const char *CatalogFile(sqlite3 *db, sqlite3_int64 trial, const char *kind, char *path, size_t len)
+{
+    sqlite3_stmt *st;
+    const char *found = NULL;
+
+    if (sqlite3_prepare_v2(db, "SELECT path FROM files WHERE trial=? AND kind=? ORDER BY rowid LIMIT 1", -1, &st, NULL) != SQLITE_OK) {
+        return NULL;
+    }
+    sqlite3_bind_int64(st, 1, trial);
+    sqlite3_bind_text(st, 2, kind, -1, SQLITE_STATIC);
+    if (sqlite3_step(st) == SQLITE_ROW) {
+        snprintf(path, len, "%s", (const char *)sqlite3_column_text(st, 0));
+        found = path;
+    }
+    sqlite3_finalize(st);
+    return found;
+}
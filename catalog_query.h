@@ -0,0 +1,38 @@
+/*
+ *  catalog_query.h
+ *
+ *  Reading the trial catalog (trial_catalog.h) - the selection shared by
+ *  trial_query.c and trial_browse.c.
+ *
+ *  A selection is a list of terms: a lone S or E for the identifier, or a
+ *  trials column, an operator = != < <= > >= and a value, or column=lo..hi
+ *  for a range. phase, vert, horiz, signal, delay and pulse are short for
+ *  phase_offset, vert_ampl, horiz_ampl, savedsignal, delay_time and
+ *  pulse_time. Values are bound, not pasted into the SQL.
+ */
+#ifndef CATALOG_QUERY_H
+#define CATALOG_QUERY_H
+
+#include <stddef.h>
+
+#include <sqlite3.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Read only, so it can be read while the capture program adds trials; NULL with a message if it can't
+sqlite3 *CatalogOpenRead(const char *path);
+
+// "SELECT <columns> FROM trials WHERE <terms> AND (<condition>) ORDER BY id", ready to step;
+// condition may be NULL. NULL with a message if a term can't be read
+sqlite3_stmt *CatalogSelect(sqlite3 *db, const char *columns, char *const terms[], int nterms, const char *condition);
+
+// The trial's first file of this kind (files.kind), or NULL if it has none
+const char *CatalogFile(sqlite3 *db, sqlite3_int64 trial, const char *kind, char *path, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ *  color_convert.c
+ *
+ *  RGB to RGB, YCrCb, BSH and grey planes at scalar, SSE, AVX2 and AVX-512
+ *  widths - see color_convert.h.
+ *
+ *  The conversions are written once and compiled at each width for the
+ *  compiler to vectorize, rather than in intrinsics: the RGB split and
+ *  YCrCb are byte and word arithmetic, BSH divides and so is done in float.
+ *  The hue's sextant select only vectorizes when float compares are known
+ *  not to trap, hence no-trapping-math for the file.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC optimize ("no-trapping-math")
+#endif
+
+// C library
+#include <stdlib.h>
+#include <string.h>
+
+#include "color_convert.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__clang__)
+    #define CC_X86  1
+    #define TARGET(isa)     __attribute__((target(isa), optimize("tree-vectorize")))
+#else
+    #define CC_X86  0
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+    #define SCALAR  __attribute__((optimize("no-tree-vectorize")))
+    #define INLINE  static inline __attribute__((always_inline))
+#else
+    #define SCALAR
+    #define INLINE  static
+#endif
+
+#if defined(__GNUC__) || defined(_MSC_VER)
+    #define RESTRICT    __restrict
+#else
+    #define RESTRICT
+#endif
+
+// Pixels per pass, so the HSB pass reads the RGB planes back from L1
+#define BLOCK   512
+
+typedef unsigned char uchar8;
+
+INLINE uchar8 Clamp(int v)
+{
+    return (uchar8)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+INLINE float Max(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+INLINE float Min(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+INLINE void SplitYCrCb(const uchar8 *RESTRICT rgb, uchar8 *RESTRICT r, uchar8 *RESTRICT g, uchar8 *RESTRICT b,
+                       uchar8 *RESTRICT y, uchar8 *RESTRICT cr, uchar8 *RESTRICT cb, uchar8 *RESTRICT bri, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        int R = rgb[3*i], G = rgb[3*i+1], B = rgb[3*i+2];
+        int max = R > G ? R : G;
+
+        r[i] = (uchar8)R;
+        g[i] = (uchar8)G;
+        b[i] = (uchar8)B;
+        y[i] = (uchar8)((77*R + 150*G + 29*B + 128) >> 8);
+        cr[i] = Clamp(128 + ((128*R - 107*G - 21*B + 128) >> 8));
+        cb[i] = Clamp(128 + ((-43*R - 85*G + 128*B + 128) >> 8));
+        bri[i] = (uchar8)(max > B ? max : B);
+    }
+}
+
+INLINE void SatHue(const uchar8 *RESTRICT r, const uchar8 *RESTRICT g, const uchar8 *RESTRICT b,
+                   uchar8 *RESTRICT sat, uchar8 *RESTRICT hue, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        float R = r[i], G = g[i], B = b[i];
+        float max = Max(Max(R, G), B);
+        float delta = max - Min(Min(R, G), B);
+        float inv = 1.0f / Max(delta, 1.0f);
+        float hr = (G - B) * inv, hg = 2.0f + (B - R) * inv, hb = 4.0f + (R - G) * inv;
+        float h = max == R ? hr : max == G ? hg : hb;
+
+        h = h < 0 ? h + 6.0f : h;
+        sat[i] = (uchar8)(int)(delta * 255.0f / Max(max, 1.0f) + 0.5f);
+        hue[i] = (uchar8)((int)(h * (256.0f / 6.0f) + 0.5f) & 255);
+    }
+}
+
+INLINE void Split(const uchar8 *rgb, ColorPlanes *p)
+{
+    size_t n = (size_t)p->xdim * p->ydim, i, m;
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < BLOCK ? n - i : BLOCK;
+        SplitYCrCb(rgb + 3*i, p->r + i, p->g + i, p->b + i, p->y + i, p->cr + i, p->cb + i, p->bri + i, m);
+        SatHue(p->r + i, p->g + i, p->b + i, p->sat + i, p->hue + i, m);
+    }
+}
+
+SCALAR static void SplitScalar(const uchar8 *rgb, ColorPlanes *p)
+{
+    Split(rgb, p);
+}
+
+#if CC_X86
+TARGET("ssse3") static void SplitSSE(const uchar8 *rgb, ColorPlanes *p)
+{
+    Split(rgb, p);
+}
+
+TARGET("avx2") static void SplitAVX2(const uchar8 *rgb, ColorPlanes *p)
+{
+    Split(rgb, p);
+}
+
+TARGET("avx512f,avx512bw") static void SplitAVX512(const uchar8 *rgb, ColorPlanes *p)
+{
+    Split(rgb, p);
+}
+
+static void (*const splits[PX_LEVELS])(const uchar8 *, ColorPlanes *) = { SplitScalar, SplitSSE, SplitAVX2, SplitAVX512 };
+#else
+static void (*const splits[PX_LEVELS])(const uchar8 *, ColorPlanes *) = { SplitScalar, SplitScalar, SplitScalar, SplitScalar };
+#endif
+
+
+
+// ================================================================================================
+// Planes
+// ================================================================================================
+int ColorPlanesAlloc(ColorPlanes *p, int xdim, int ydim)
+{
+    size_t n = (size_t)xdim * ydim;
+
+    memset(p, 0, sizeof(*p));
+    if (xdim <= 0 || ydim <= 0 || (p->r = (uchar8 *)malloc(9 * n)) == NULL) {
+        return(-1);
+    }
+    p->xdim = xdim;
+    p->ydim = ydim;
+    p->g = p->r + n;
+    p->b = p->g + n;
+    p->y = p->b + n;
+    p->cr = p->y + n;
+    p->cb = p->cr + n;
+    p->bri = p->cb + n;
+    p->sat = p->bri + n;
+    p->hue = p->sat + n;
+    p->grey = p->y;
+    return(0);
+}
+
+void ColorPlanesFree(ColorPlanes *p)
+{
+    free(p->r);
+    memset(p, 0, sizeof(*p));
+}
+
+int ColorSplitAt(PxLevel level, const unsigned char *rgb, ColorPlanes *p)
+{
+    if (PxKernelsAt(level) == NULL) {
+        return(-1);
+    }
+    splits[level](rgb, p);
+    return(0);
+}
+
+void ColorSplit(const unsigned char *rgb, ColorPlanes *p)
+{
+    splits[PxBest()->level](rgb, p);
+}
+
+const unsigned char *ColorPlane(const ColorPlanes *p, const char *colorspace)
+{
+    static const struct { const char *name; size_t offset; } names[] = {
+        { "RofRGB", offsetof(ColorPlanes, r) },     { "GofRGB", offsetof(ColorPlanes, g) },
+        { "BofRGB", offsetof(ColorPlanes, b) },     { "BofBSH", offsetof(ColorPlanes, bri) },
+        { "SofBSH", offsetof(ColorPlanes, sat) },   { "HofBSH", offsetof(ColorPlanes, hue) },
+        { "Grey", offsetof(ColorPlanes, grey) },    { "Gray", offsetof(ColorPlanes, grey) },
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(colorspace, names[i].name) == 0) {
+            return *(unsigned char *const *)((const char *)p + names[i].offset);
+        }
+    }
+    return NULL;
+}
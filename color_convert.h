@@ -0,0 +1,51 @@
+/*
+ *  color_convert.h
+ *
+ *  Every colour space the examples ask XCLIB for, derived on the host from
+ *  one RGB transfer instead of one pxd_readuchar() per space:
+ *
+ *	    r, g, b         the RGB transfer, split into planes
+ *	    y, cr, cb       YCrCb, BT.601 full range; y is also the grey plane
+ *	    bri, sat, hue   BSH as XCLIB scales it: B and S 0..255, H 0..255
+ *	                    for 0..360 degrees
+ *
+ *  The values follow the textbook formulas and may differ by a count from
+ *  XCLIB's own conversions of the same pixels.
+ *
+ *  The kernels are built at the pixel_kernels.h levels and ColorSplit()
+ *  runs the level PxBest() dispatches, PIXEL_KERNELS cap included.
+ */
+#ifndef COLOR_CONVERT_H
+#define COLOR_CONVERT_H
+
+#include <stddef.h>
+
+#include "pixel_kernels.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int             xdim, ydim;
+    unsigned char   *r, *g, *b;
+    unsigned char   *y, *cr, *cb;
+    unsigned char   *bri, *sat, *hue;
+    unsigned char   *grey;              // == y
+} ColorPlanes;
+
+int ColorPlanesAlloc(ColorPlanes *p, int xdim, int ydim);
+void ColorPlanesFree(ColorPlanes *p);
+
+// xdim*ydim RGB triplets, as pxd_readuchar(..., "RGB") returns them, into the planes
+void ColorSplit(const unsigned char *rgb, ColorPlanes *p);
+int ColorSplitAt(PxLevel level, const unsigned char *rgb, ColorPlanes *p);
+
+// The plane for an XCLIB single component colour space name, e.g. "HofBSH" or "Grey"
+const unsigned char *ColorPlane(const ColorPlanes *p, const char *colorspace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,551 @@
+/*
+ *  disk_writer.c
+ *
+ *  Preallocated, chunked, asynchronous file writing - see disk_writer.h.
+ *
+ *  Chunk buffers are used round-robin: chunk n is filled in buffer
+ *  n % depth, which must first have been written. The appending thread
+ *  submits and, with io_uring, also reaps the completions; the pwrite pool
+ *  takes chunks from a queue in submission order. Counters are shared with
+ *  DiskWriterStatus() under one mutex.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#define _FILE_OFFSET_BITS   64
+
+// C library
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Linux
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "disk_writer.h"
+
+#if !defined(USE_URING)
+    #define USE_URING   1
+#endif
+
+#if USE_URING
+    #include <liburing.h>
+#endif
+
+#define MAX_DEPTH   64
+
+struct DiskWriter {
+    char            path[256];
+    int             fd;
+    DiskSettings    settings;
+    int             direct;
+    int             preallocated;
+    int             uring;
+#if USE_URING
+    struct io_uring ring;
+#endif
+
+    unsigned char   *chunks[MAX_DEPTH];
+    int             busy[MAX_DEPTH];    // chunk submitted and not yet written
+    uint64_t        offsets[MAX_DEPTH];
+    size_t          lengths[MAX_DEPTH];
+    long            chunk;              // chunks submitted, = the one being filled
+    size_t          used;               // bytes in the chunk being filled
+
+    pthread_t       threads[MAX_DEPTH];
+    int             nthreads;
+    int             queue[MAX_DEPTH];   // pwrite pool: submitted chunks, oldest first
+    int             queued, head;
+    int             closing;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    int             inflight, maxinflight;
+    double          suminflight;
+    long            stalls;
+    double          bytes;
+    double          start, stop;
+    int             status;
+};
+
+
+
+static double Seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void DiskSettingsDefaults(DiskSettings *s)
+{
+    s->chunkbytes = DISK_CHUNK;
+    s->depth = DISK_DEPTH;
+    s->direct = 1;
+    s->uring = 1;
+}
+
+// The whole of [data, data+len) at 'offset'; -1 with errno on failure
+static int WriteAll(int fd, const unsigned char *data, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return(-1);
+        }
+        data += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return(0);
+}
+
+// A chunk has been written (or failed); called with the lock held
+static void Completed(DiskWriter *w, int i, int ok)
+{
+    if (!ok && w->status == 0) {
+        fprintf(stderr, "%s: write of %lu bytes at %llu: %s\n", w->path, (unsigned long)w->lengths[i],
+                (unsigned long long)w->offsets[i], strerror(errno));
+        w->status = -1;
+    }
+    w->busy[i] = 0;
+    w->inflight--;
+    pthread_cond_broadcast(&w->changed);
+}
+
+// A write done on the appending thread has failed
+static void Failed(DiskWriter *w)
+{
+    perror(w->path);
+    pthread_mutex_lock(&w->lock);
+    w->status = -1;
+    pthread_mutex_unlock(&w->lock);
+}
+
+static int Status(DiskWriter *w)
+{
+    int status;
+
+    pthread_mutex_lock(&w->lock);
+    status = w->status;
+    pthread_mutex_unlock(&w->lock);
+    return(status);
+}
+
+
+
+// ================================================================================================
+// pwrite pool: each thread writes the oldest queued chunk
+// ================================================================================================
+static void *WriteThread(void *arg)
+{
+    DiskWriter *w = (DiskWriter *)arg;
+    int i, ok;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->queued == 0 && !w->closing) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+        if (w->queued == 0) {
+            break;
+        }
+        i = w->queue[w->head];
+        w->head = (w->head + 1) % MAX_DEPTH;
+        w->queued--;
+        pthread_mutex_unlock(&w->lock);
+
+        ok = WriteAll(w->fd, w->chunks[i], w->lengths[i], w->offsets[i]) == 0;
+
+        pthread_mutex_lock(&w->lock);
+        Completed(w, i, ok);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+
+
+// ================================================================================================
+// io_uring: completions are reaped by the appending thread whenever it needs a chunk back
+// ================================================================================================
+#if USE_URING
+static void Reap(DiskWriter *w, struct io_uring_cqe *cqe)
+{
+    int i = (int)(uintptr_t)io_uring_cqe_get_data(cqe);
+    int res = cqe->res, ok = 1;
+
+    io_uring_cqe_seen(&w->ring, cqe);
+    if (res < 0) {
+        errno = -res;
+        ok = 0;
+    }
+    else if ((size_t)res < w->lengths[i]) {
+        // Short write - finish it here
+        ok = WriteAll(w->fd, w->chunks[i] + res, w->lengths[i] - res, w->offsets[i] + res) == 0;
+    }
+    pthread_mutex_lock(&w->lock);
+    Completed(w, i, ok);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void ReapReady(DiskWriter *w)
+{
+    struct io_uring_cqe *cqe;
+
+    while (io_uring_peek_cqe(&w->ring, &cqe) == 0) {
+        Reap(w, cqe);
+    }
+}
+
+static int ReapOne(DiskWriter *w)
+{
+    struct io_uring_cqe *cqe;
+    int err;
+
+    while ((err = io_uring_wait_cqe(&w->ring, &cqe)) == -EINTR) {
+        ;
+    }
+    if (err < 0) {
+        return(-1);
+    }
+    Reap(w, cqe);
+    return(0);
+}
+#endif
+
+// Wait until chunk i may be filled again
+static int WaitChunk(DiskWriter *w, int i)
+{
+    int stalled = 0;
+
+#if USE_URING
+    if (w->uring) {
+        ReapReady(w);
+        while (w->busy[i]) {
+            stalled = 1;
+            if (ReapOne(w) < 0) {
+                return(-1);
+            }
+        }
+        if (stalled) {
+            pthread_mutex_lock(&w->lock);
+            w->stalls++;
+            pthread_mutex_unlock(&w->lock);
+        }
+        return(0);
+    }
+#endif
+    pthread_mutex_lock(&w->lock);
+    while (w->busy[i]) {
+        stalled = 1;
+        pthread_cond_wait(&w->changed, &w->lock);
+    }
+    w->stalls += stalled;
+    pthread_mutex_unlock(&w->lock);
+    return(0);
+}
+
+// Write the chunk being filled, 'len' bytes of it, at its place in the file
+static int Submit(DiskWriter *w, size_t len)
+{
+    int i = (int)(w->chunk % w->settings.depth);
+
+    w->offsets[i] = (uint64_t)w->chunk * w->settings.chunkbytes;
+    w->lengths[i] = len;
+
+    pthread_mutex_lock(&w->lock);
+#if USE_URING
+    // After a failed io_uring_submit() its entry is still queued - a later one would send it
+    if (w->uring && w->status != 0) {
+        pthread_mutex_unlock(&w->lock);
+        return(-1);
+    }
+#endif
+    w->busy[i] = 1;
+    w->inflight++;
+    if (w->inflight > w->maxinflight) {
+        w->maxinflight = w->inflight;
+    }
+    w->suminflight += w->inflight;
+#if USE_URING
+    if (w->uring) {
+        struct io_uring_sqe *sqe;
+        int err = 0;
+
+        pthread_mutex_unlock(&w->lock);
+        if ((sqe = io_uring_get_sqe(&w->ring)) == NULL && (err = io_uring_submit(&w->ring)) >= 0) {
+            sqe = io_uring_get_sqe(&w->ring);
+        }
+        if (sqe == NULL) {
+            pthread_mutex_lock(&w->lock);
+            errno = err < 0 ? -err : EBUSY;
+            Completed(w, i, 0);
+            pthread_mutex_unlock(&w->lock);
+            return(-1);
+        }
+        io_uring_prep_write(sqe, w->fd, w->chunks[i], (unsigned)len, w->offsets[i]);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+        if ((err = io_uring_submit(&w->ring)) < 0) {
+            // Never sent, so no completion will come for it
+            pthread_mutex_lock(&w->lock);
+            errno = -err;
+            Completed(w, i, 0);
+            pthread_mutex_unlock(&w->lock);
+            return(-1);
+        }
+        w->chunk++;
+        w->used = 0;
+        return(0);
+    }
+#endif
+    w->queue[(w->head + w->queued) % MAX_DEPTH] = i;
+    w->queued++;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    w->chunk++;
+    w->used = 0;
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Open 'path' for writing, preallocated to 'plannedbytes'; NULL on failure
+// ================================================================================================
+DiskWriter *DiskWriterOpen(const char *path, uint64_t plannedbytes, const DiskSettings *settings)
+{
+    DiskWriter *w = (DiskWriter *)calloc(1, sizeof(DiskWriter));
+    int i;
+
+    if (w == NULL) {
+        return NULL;
+    }
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    if (settings != NULL) {
+        w->settings = *settings;
+    }
+    else {
+        DiskSettingsDefaults(&w->settings);
+    }
+    if (w->settings.chunkbytes == 0) {
+        w->settings.chunkbytes = DISK_CHUNK;
+    }
+    w->settings.chunkbytes = (w->settings.chunkbytes + DISK_ALIGN - 1) & ~(size_t)(DISK_ALIGN - 1);
+    if (w->settings.depth <= 0) {
+        w->settings.depth = DISK_DEPTH;
+    }
+    if (w->settings.depth > MAX_DEPTH) {
+        w->settings.depth = MAX_DEPTH;
+    }
+
+    // O_DIRECT where the filesystem takes it (not tmpfs, for one)
+    w->fd = -1;
+    if (w->settings.direct) {
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        w->direct = (w->fd >= 0);
+    }
+    if (w->fd < 0) {
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (w->fd < 0) {
+        perror(path);
+        free(w);
+        return NULL;
+    }
+
+    // Reserve the whole sequence now; a disk that can't hold it fails here rather than mid-trial
+    if (plannedbytes > 0) {
+        uint64_t reserve = (plannedbytes + DISK_ALIGN - 1) & ~(uint64_t)(DISK_ALIGN - 1);
+        if (fallocate(w->fd, 0, 0, (off_t)reserve) == 0) {
+            w->preallocated = 1;
+        }
+        else if (errno == ENOSPC) {
+            fprintf(stderr, "%s: no room for %.1f MB\n", path, plannedbytes / 1e6);
+            close(w->fd);
+            unlink(path);
+            free(w);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < w->settings.depth; i++) {
+        if (posix_memalign((void **)&w->chunks[i], DISK_ALIGN, w->settings.chunkbytes) != 0) {
+            w->chunks[i] = NULL;
+            break;
+        }
+    }
+    if (i < w->settings.depth) {
+        fprintf(stderr, "%s: out of memory for %d x %lu byte chunks\n", path, w->settings.depth,
+                (unsigned long)w->settings.chunkbytes);
+        while (--i >= 0) {
+            free(w->chunks[i]);
+        }
+        close(w->fd);
+        free(w);
+        return NULL;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->changed, NULL);
+
+#if USE_URING
+    if (w->settings.uring && io_uring_queue_init((unsigned)w->settings.depth, &w->ring, 0) == 0) {
+        w->uring = 1;
+    }
+#endif
+    if (!w->uring) {
+        for (i = 0; i < w->settings.depth; i++) {
+            if (pthread_create(&w->threads[i], NULL, WriteThread, w) != 0) {
+                break;
+            }
+        }
+        w->nthreads = i;
+    }
+    w->start = Seconds();
+    return w;
+}
+
+
+
+// ================================================================================================
+// Copy 'len' bytes into the chunk being filled, submitting every chunk that fills up
+// ================================================================================================
+int DiskWriterAppend(DiskWriter *w, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    while (len > 0) {
+        size_t room = w->settings.chunkbytes - w->used, n = len < room ? len : room;
+        int i = (int)(w->chunk % w->settings.depth);
+
+        if (w->used == 0 && WaitChunk(w, i) < 0) {
+            return(-1);
+        }
+        memcpy(w->chunks[i] + w->used, p, n);
+        w->used += n;
+        p += n;
+        len -= n;
+        if (w->used == w->settings.chunkbytes) {
+            // Without a thread to take it, write it here
+            if (!w->uring && w->nthreads == 0) {
+                if (WriteAll(w->fd, w->chunks[i], w->used, (uint64_t)w->chunk * w->settings.chunkbytes) < 0) {
+                    Failed(w);
+                }
+                w->chunk++;
+                w->used = 0;
+            }
+            else if (Submit(w, w->used) < 0) {
+                return(-1);
+            }
+        }
+        pthread_mutex_lock(&w->lock);
+        w->bytes += n;
+        pthread_mutex_unlock(&w->lock);
+    }
+    return Status(w);
+}
+
+
+
+// ================================================================================================
+// Counters so far - may be called from any thread
+// ================================================================================================
+void DiskWriterStatus(DiskWriter *w, DiskReport *r)
+{
+    pthread_mutex_lock(&w->lock);
+    r->engine = w->uring ? "io_uring" : "pwrite";
+    r->direct = w->direct;
+    r->preallocated = w->preallocated;
+    r->depth = w->settings.depth;
+    r->inflight = w->inflight;
+    r->maxinflight = w->maxinflight;
+    r->meaninflight = w->chunk > 0 ? w->suminflight / w->chunk : 0;
+    r->stalls = w->stalls;
+    r->bytes = w->bytes;
+    r->seconds = (w->stop > 0 ? w->stop : Seconds()) - w->start;
+    r->mbps = r->seconds > 0 ? r->bytes / 1e6 / r->seconds : 0;
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+
+// ================================================================================================
+// Write the partly filled chunk, wait for everything, sync and trim; -1 if any write failed
+// ================================================================================================
+int DiskWriterClose(DiskWriter *w, DiskReport *report)
+{
+    size_t tail = w->used;
+    int i, status;
+
+    if (tail > 0) {
+        // O_DIRECT lengths are whole blocks - pad, and trim the padding off below
+        size_t len = w->direct ? (tail + DISK_ALIGN - 1) & ~(size_t)(DISK_ALIGN - 1) : tail;
+
+        i = (int)(w->chunk % w->settings.depth);
+        memset(w->chunks[i] + tail, 0, len - tail);
+        if (!w->uring && w->nthreads == 0) {
+            if (WriteAll(w->fd, w->chunks[i], len, (uint64_t)w->chunk * w->settings.chunkbytes) < 0) {
+                Failed(w);
+            }
+        }
+        else {
+            Submit(w, len);
+        }
+    }
+    for (i = 0; i < w->settings.depth; i++) {
+        WaitChunk(w, i);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    for (i = 0; i < w->nthreads; i++) {
+        pthread_join(w->threads[i], NULL);
+    }
+#if USE_URING
+    if (w->uring) {
+        io_uring_queue_exit(&w->ring);
+    }
+#endif
+
+    if (ftruncate(w->fd, (off_t)w->bytes) < 0 || fdatasync(w->fd) < 0) {
+        Failed(w);
+    }
+    if (close(w->fd) < 0) {
+        Failed(w);
+    }
+    w->stop = Seconds();
+    if (report != NULL) {
+        DiskWriterStatus(w, report);
+    }
+    status = Status(w);
+
+    for (i = 0; i < w->settings.depth; i++) {
+        free(w->chunks[i]);
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->changed);
+    free(w);
+    return(status);
+}
+
+
+
+// ================================================================================================
+// One line summary for the console and Machine A
+// ================================================================================================
+void DiskReportFormat(const DiskReport *r, char *out, size_t len)
+{
+    snprintf(out, len, "%.1f MB in %.2f s, %.0f MB/s through %s%s%s, queue depth %.1f mean %d max of %d, %ld stall(s)",
+             r->bytes / 1e6, r->seconds, r->mbps, r->engine, r->direct ? ", O_DIRECT" : "",
+             r->preallocated ? ", preallocated" : "", r->meaninflight, r->maxinflight, r->depth, r->stalls);
+}
@@ -0,0 +1,73 @@
+/*
+ *  disk_writer.h
+ *
+ *  Sequential file writer that keeps the disk busy: appends are gathered
+ *  into large page-aligned chunks and each full chunk is written in the
+ *  background while the next one fills, so the writer runs at the disk's
+ *  sequential bandwidth instead of stdio's.
+ *
+ *  The file is preallocated with fallocate() to the planned size, so the
+ *  filesystem lays it out in few extents and a full disk shows up when the
+ *  file is opened rather than halfway through the trial; it is trimmed to
+ *  what was written on close. Where the filesystem allows it the file is
+ *  opened O_DIRECT, keeping a sequence the size of RAM out of the page
+ *  cache.
+ *
+ *  Chunks go to the kernel through io_uring, up to 'depth' at once. Where
+ *  io_uring isn't available - built with -DUSE_URING=0 because liburing
+ *  isn't installed, or refused by the kernel - a pool of threads pwrite()s
+ *  them instead. Either way DiskWriterAppend() only waits when all 'depth'
+ *  chunks are in flight, which DiskReport counts as stalls.
+ */
+#ifndef DISK_WRITER_H
+#define DISK_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DISK_CHUNK      (4 << 20)       // bytes per write
+#define DISK_DEPTH      8               // writes in flight
+#define DISK_ALIGN      4096            // O_DIRECT buffer, offset and length alignment
+
+typedef struct {
+    size_t  chunkbytes;         // bytes per write, rounded up to DISK_ALIGN; 0 = DISK_CHUNK
+    int     depth;              // writes in flight, 0 = DISK_DEPTH
+    int     direct;             // 1 = O_DIRECT where the filesystem takes it, 0 = through the page cache
+    int     uring;              // 1 = io_uring where available, 0 = always the pwrite pool
+} DiskSettings;
+
+typedef struct {
+    const char *engine;         // "io_uring" or "pwrite"
+    int     direct;             // 1 if the file was opened O_DIRECT
+    int     preallocated;       // 1 if fallocate() reserved the planned size
+    int     depth;              // writes in flight allowed
+    int     inflight;           // writes in flight now
+    int     maxinflight;        // most writes in flight at once
+    double  meaninflight;       // writes in flight when each chunk was submitted, averaged
+    long    stalls;             // appends that waited for a chunk to complete
+    double  bytes;              // appended so far
+    double  seconds;            // open to now, or to closed
+    double  mbps;               // bytes / seconds
+} DiskReport;
+
+typedef struct DiskWriter DiskWriter;
+
+void DiskSettingsDefaults(DiskSettings *s);
+
+// 'plannedbytes' is preallocated, 0 = don't; NULL settings = the defaults
+DiskWriter *DiskWriterOpen(const char *path, uint64_t plannedbytes, const DiskSettings *settings);
+int  DiskWriterAppend(DiskWriter *w, const void *data, size_t len);
+void DiskWriterStatus(DiskWriter *w, DiskReport *report);
+// Writes the last chunk, waits for every write, syncs and trims the file; report may be NULL
+int  DiskWriterClose(DiskWriter *w, DiskReport *report);
+void DiskReportFormat(const DiskReport *report, char *out, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
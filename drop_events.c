@@ -0,0 +1,185 @@
+/*
+ *  drop_events.c
+ *
+ *  Impact, rebound and coalescence detection on drop tracks - see drop_events.h.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "drop_events.h"
+
+#define NSLOTS  (int)(sizeof(((EventDetector *)0)->tracks) / sizeof(EventTrack))
+
+static const char *eventnames[EVENT_KINDS] = { "impact", "rebound", "coalescence" };
+
+const char *EventName(int kind)
+{
+    return kind >= 0 && kind < EVENT_KINDS ? eventnames[kind] : "unknown";
+}
+
+void EventDetectorInit(EventDetector *d, int pre, int post)
+{
+    memset(d, 0, sizeof(*d));
+    d->pre = pre;
+    d->post = post;
+}
+
+void EventDetectorFree(EventDetector *d)
+{
+    free(d->events);
+    d->events = NULL;
+    d->nevents = d->maxevents = 0;
+}
+
+static void Mark(EventDetector *d, int kind, const EventTrack *s, int frame, double t, double value)
+{
+    DropEvent *e;
+
+    if (d->nevents == d->maxevents) {
+        int grow = d->maxevents ? 2*d->maxevents : 256;
+        DropEvent *more = (DropEvent *)realloc(d->events, grow * sizeof(DropEvent));
+        if (more == NULL) {
+            return;
+        }
+        d->events = more;
+        d->maxevents = grow;
+    }
+    e = &d->events[d->nevents++];
+    e->kind = kind;
+    e->frame = frame;
+    e->first = frame - d->pre > 1 ? frame - d->pre : 1;
+    e->last = frame + d->post;
+    e->t = t;
+    e->track = s->track;
+    e->x = s->x;
+    e->y = s->y;
+    e->value = value;
+    d->counts[kind]++;
+}
+
+
+
+// ================================================================================================
+// One frame's linked blobs: update each track's motion and mark the events it shows
+// ================================================================================================
+void EventDetectorAdd(EventDetector *d, const TrackPoint *points, int n, int frame, double t)
+{
+    int i, k;
+
+    // Forget tracks the tracker has ended
+    for (k = 0; k < NSLOTS; k++) {
+        if (d->tracks[k].track != 0 && frame - d->tracks[k].frame > TRACK_MAXMISSED) {
+            d->tracks[k].track = 0;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        const TrackPoint *p = &points[i];
+        EventTrack *s = NULL;
+        int motion, gap;
+        double vy;
+
+        for (k = 0; k < NSLOTS && s == NULL; k++) {
+            if (d->tracks[k].track == p->track) {
+                s = &d->tracks[k];
+            }
+        }
+        if (s == NULL) {
+            for (k = 0; k < NSLOTS && s == NULL; k++) {
+                if (d->tracks[k].track == 0) {
+                    s = &d->tracks[k];
+                    memset(s, 0, sizeof(*s));
+                    s->track = p->track;
+                    s->frame = frame;
+                    s->t = t;
+                    s->x = p->x;
+                    s->y = p->y;
+                    s->area = p->area;
+                }
+            }
+            continue;
+        }
+
+        gap = frame - s->frame > 0 ? frame - s->frame : 1;
+        vy = (p->y - s->y) / gap;
+        motion = vy > EVENT_MINSPEED ? 1 : vy < -EVENT_MINSPEED ? -1 : s->motion;
+
+        // Turning points belong to the frame before - the lowest or highest one seen
+        if (s->motion == 1 && motion == -1) {
+            Mark(d, EVENT_IMPACT, s, s->frame, s->t, s->fallspeed);
+            s->impacty = s->y;
+            s->bounced = 1;
+        }
+        else if (s->motion == -1 && motion == 1 && s->bounced) {
+            Mark(d, EVENT_REBOUND, s, s->frame, s->t, s->impacty - s->y);
+            s->bounced = 0;
+        }
+        if (s->area >= TRACK_MINAREA && p->area >= EVENT_AREAJUMP * s->area) {
+            EventTrack now = *s;
+            now.x = p->x;
+            now.y = p->y;
+            Mark(d, EVENT_COALESCENCE, &now, frame, t, (double)p->area / s->area);
+        }
+
+        if (motion == 1) {
+            s->fallspeed = t > s->t ? (p->y - s->y) / (t - s->t) : vy;
+        }
+        s->motion = motion;
+        s->frame = frame;
+        s->t = t;
+        s->x = p->x;
+        s->y = p->y;
+        s->area = p->area;
+    }
+}
+
+
+
+// ================================================================================================
+// Names of the events whose windows cover 'frame', joined by '+'; returns how many
+// ================================================================================================
+int EventTags(const EventDetector *d, int frame, char *out, size_t len)
+{
+    int i, n = 0, seen[EVENT_KINDS] = { 0 };
+    size_t used = 0;
+
+    out[0] = '\0';
+    for (i = 0; i < d->nevents; i++) {
+        const DropEvent *e = &d->events[i];
+        if (frame < e->first || frame > e->last) {
+            continue;
+        }
+        n++;
+        if (!seen[e->kind]) {
+            seen[e->kind] = 1;
+            used += snprintf(out + used, used < len ? len - used : 0, "%s%s", used ? "+" : "", EventName(e->kind));
+        }
+    }
+    return(n);
+}
+
+
+
+// ================================================================================================
+// Save the events with their frame ranges, clipped to the sequence
+// ================================================================================================
+int EventsWrite(const EventDetector *d, const char *path, int nframes)
+{
+    FILE *fp = fopen(path, "w");
+    int i;
+
+    if (fp == NULL) {
+        perror(path);
+        return(-1);
+    }
+    fprintf(fp, "kind,frame,first,last,t,track,x,y,value\n");
+    for (i = 0; i < d->nevents; i++) {
+        const DropEvent *e = &d->events[i];
+        fprintf(fp, "%s,%d,%d,%d,%.6f,%d,%.2f,%.2f,%.3f\n", EventName(e->kind), e->frame, e->first,
+                e->last < nframes ? e->last : nframes, e->t, e->track, e->x, e->y, e->value);
+    }
+    return (ferror(fp) | fclose(fp)) ? -1 : 0;
+}
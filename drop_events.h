@@ -0,0 +1,85 @@
+/*
+ *  drop_events.h
+ *
+ *  Impacts, rebounds and coalescences of tracked drops, detected as the
+ *  tracker links each frame's blobs (trajectory.h).
+ *
+ *  A track's vertical motion is falling or rising once its speed passes
+ *  EVENT_MINSPEED pixels per frame (image y grows downwards), so centroid
+ *  jitter on a drop at rest doesn't flip it:
+ *
+ *      impact       falling turns to rising - the lowest point of a bounce;
+ *                   value = fall speed just before, pixels/s
+ *      rebound      rising turns to falling after an impact - the apex of
+ *                   the bounce; value = height above the impact, pixels
+ *      coalescence  the blob grows by EVENT_AREAJUMP or more in one frame -
+ *                   two drops merging; value = area ratio
+ *
+ *  Each event tags the frame range [frame - pre, frame + post]. The ranges
+ *  go to <base>.events.csv, "kind,frame,first,last,t,track,x,y,value", and
+ *  the sequence index gets an "events" column naming the events whose
+ *  windows cover each buffer, so reader and export tools can pull just
+ *  those frames.
+ */
+#ifndef DROP_EVENTS_H
+#define DROP_EVENTS_H
+
+#include <stddef.h>
+
+#include "trajectory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVENT_MINSPEED      0.5         // pixels per frame before a track counts as falling or rising
+#define EVENT_AREAJUMP      1.5         // one-frame area growth taken as a coalescence
+#define EVENT_PRE           20          // default frames tagged before an event
+#define EVENT_POST          40          // and after it
+
+enum { EVENT_IMPACT, EVENT_REBOUND, EVENT_COALESCENCE, EVENT_KINDS };
+
+typedef struct {
+    int     kind;
+    int     frame;                      // buffer number, from 1
+    int     first, last;                // tagged range, inclusive
+    double  t;
+    int     track;
+    double  x, y;
+    double  value;                      // see above, per kind
+} DropEvent;
+
+// What the detector remembers of each live track
+typedef struct {
+    int     track;                      // 0 = free slot
+    int     frame;
+    double  t;
+    double  x, y;
+    int     area;
+    int     motion;                     // 1 falling, -1 rising, 0 not yet known
+    double  fallspeed;                  // pixels/s, last frame while falling
+    double  impacty;                    // y of the last impact
+    int     bounced;                    // an impact since the last rebound
+} EventTrack;
+
+typedef struct {
+    EventTrack  tracks[2*TRACK_MAXBLOBS];
+    DropEvent   *events;
+    int         nevents, maxevents;
+    int         pre, post;
+    int         counts[EVENT_KINDS];
+} EventDetector;
+
+void EventDetectorInit(EventDetector *d, int pre, int post);
+void EventDetectorAdd(EventDetector *d, const TrackPoint *points, int n, int frame, double t);
+void EventDetectorFree(EventDetector *d);
+
+const char *EventName(int kind);
+int  EventTags(const EventDetector *d, int frame, char *out, size_t len);
+int  EventsWrite(const EventDetector *d, const char *path, int nframes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,430 @@
+/*
+ *  encode_pool.c
+ *
+ *  Sparse sequence encoding on worker threads - see encode_pool.h.
+ *
+ *  One writer thread builds the background, starts the workers and appends
+ *  their records in order. Workers and writer share one mutex and one
+ *  condition variable; the only thing polled is the drain thread's frame
+ *  count, which it updates without taking any lock - stored with release
+ *  and loaded here with acquire, so a frame's pixels are seen before the
+ *  count that covers them.
+ */
+#define _FILE_OFFSET_BITS   64
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "encode_pool.h"
+
+#define SLOTS_PER_WORKER    2
+#define MAX_WORKERS         RT_MAX_CPUS
+#define DECODE_SAMPLE       200         // frames read back to measure decode speed
+#define AVAILABLE_POLL_US   500
+
+typedef struct {
+    SparseEncoder   encoder;
+    size_t          length;
+    int             frame;              // frame whose record is in encoder.record, -1 = none yet
+} EncodeSlot;
+
+struct EncodePool {
+    char                path[256];
+    unsigned char *const *frames;
+    int                 nframes;        // lowered by EncodePoolStop()
+    volatile const int  *available;
+    EncodeSettings      settings;
+    const RtConfig      *rt;
+
+    unsigned char       *black;
+    SparseWriter        *writer;
+    EncodeSlot          *slots;
+    int                 nslots;
+
+    pthread_t           thread;
+    int                 threaded;
+    pthread_mutex_t     lock;
+    pthread_cond_t      changed;
+    int                 next;           // next frame for a worker to take
+    int                 written;        // frames appended to the file
+    double              encodecpus;     // cpu seconds spent in SparseEncodeFrame(), all workers
+    double              start;
+
+    int                 status;
+    EncodeReport        report;
+};
+
+typedef struct {
+    EncodePool  *pool;
+    int         index;
+} WorkerArg;
+
+
+
+static double Seconds(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int PoolFrames(EncodePool *p)
+{
+    return __atomic_load_n(&p->nframes, __ATOMIC_ACQUIRE);
+}
+
+// Frame k, once the drain thread has read it out; NULL if the sequence was stopped before it
+static const unsigned char *WaitFrame(EncodePool *p, int k)
+{
+    if (p->available != NULL) {
+        while (__atomic_load_n(p->available, __ATOMIC_ACQUIRE) <= k) {
+            if (k >= PoolFrames(p)) {
+                return NULL;
+            }
+            usleep(AVAILABLE_POLL_US);
+        }
+    }
+    return p->frames[k] != NULL ? p->frames[k] : p->black;
+}
+
+static const unsigned char *PreviousFrame(EncodePool *p, int k)
+{
+    return (k > 0 && p->frames[k-1] != NULL) ? p->frames[k-1] : p->black;
+}
+
+static void EncodeInto(EncodePool *p, EncodeSlot *slot, int k, double *cpus)
+{
+    const unsigned char *frame = WaitFrame(p, k);
+    double t0 = Seconds(CLOCK_THREAD_CPUTIME_ID);
+
+    // Past the end of a stopped sequence - the writer never appends it
+    if (frame == NULL) {
+        slot->length = 0;
+        return;
+    }
+    slot->length = SparseEncodeFrame(p->writer, &slot->encoder, k, frame, PreviousFrame(p, k));
+    *cpus += Seconds(CLOCK_THREAD_CPUTIME_ID) - t0;
+}
+
+
+
+// ================================================================================================
+// Worker: take the next frame, encode it into its slot of the ring, hand it to the writer
+// ================================================================================================
+static void *EncodeWorker(void *arg)
+{
+    WorkerArg *wa = (WorkerArg *)arg;
+    EncodePool *p = wa->pool;
+    double cpus = 0;
+    int k;
+
+    if (p->rt != NULL) {
+        RtPinWorker(p->rt, wa->index);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        k = p->next;
+        if (k >= PoolFrames(p)) {
+            break;
+        }
+        // Slot k % nslots still holds a record the writer hasn't appended
+        if (k - p->written >= p->nslots) {
+            pthread_cond_wait(&p->changed, &p->lock);
+            continue;
+        }
+        p->next++;
+        pthread_mutex_unlock(&p->lock);
+
+        EncodeInto(p, &p->slots[k % p->nslots], k, &cpus);
+
+        pthread_mutex_lock(&p->lock);
+        p->slots[k % p->nslots].frame = k;
+        pthread_cond_broadcast(&p->changed);
+    }
+    p->encodecpus += cpus;
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+
+
+// ================================================================================================
+// Read the file back on this thread: frame MB per second
+// ================================================================================================
+static double DecodeSpeed(const char *path, int nframes)
+{
+    SparseReader *r = SparseOpen(path);
+    unsigned char *frame;
+    double t0, seconds, npixels;
+    int k, n = nframes < DECODE_SAMPLE ? nframes : DECODE_SAMPLE;
+
+    if (r == NULL) {
+        return(0);
+    }
+    npixels = (double)r->header.xdim * r->header.ydim;
+    if ((frame = (unsigned char *)malloc((size_t)npixels)) == NULL) {
+        SparseCloseRead(r);
+        return(0);
+    }
+    t0 = Seconds(CLOCK_MONOTONIC);
+    for (k = 0; k < n; k++) {
+        if (SparseReadFrame(r, k, frame) < 0) {
+            fprintf(stderr, "%s: frame %d does not decode\n", path, k+1);
+            break;
+        }
+    }
+    seconds = Seconds(CLOCK_MONOTONIC) - t0;
+
+    free(frame);
+    SparseCloseRead(r);
+    return seconds > 0 ? k * npixels / 1e6 / seconds : 0;
+}
+
+
+
+// ================================================================================================
+// Writer thread: background, workers, then records in frame order
+// ================================================================================================
+static void *EncodeWriter(void *arg)
+{
+    EncodePool *p = (EncodePool *)arg;
+    const EncodeSettings *s = &p->settings;
+    size_t npixels = (size_t)s->xdim * s->ydim;
+    unsigned char *background = (unsigned char *)malloc(npixels);
+    unsigned char **model = (unsigned char **)malloc((s->bgframes > 0 ? s->bgframes : 1) * sizeof(unsigned char *));
+    pthread_t workers[MAX_WORKERS];
+    WorkerArg args[MAX_WORKERS];
+    double serialcpus = 0;
+    int i, k, nmodel = 0, started = 0, codec;
+    SparseStats stats;
+
+    if (p->rt != NULL) {
+        RtPinWorkers(p->rt);
+    }
+    if (background == NULL || model == NULL) {
+        fprintf(stderr, "%s: out of memory for the background model\n", p->path);
+        free(model);
+        free(background);
+        p->status = -1;
+        return NULL;
+    }
+
+    // Background: median of the first bgframes frames actually captured
+    for (k = 0; k < PoolFrames(p) && nmodel < s->bgframes; k++) {
+        if (WaitFrame(p, k) == NULL) {
+            break;
+        }
+        if (p->frames[k] != NULL) {
+            model[nmodel++] = p->frames[k];
+        }
+    }
+    BackgroundMedian(model, nmodel, npixels, background);
+    p->writer = SparseCreate(p->path, s->xdim, s->ydim, s->threshold, background, nmodel, PoolFrames(p), s->codec, s->level);
+    free(model);
+    free(background);
+    if (p->writer == NULL) {
+        p->status = -1;
+        return NULL;
+    }
+
+    for (i = 0; i < p->nslots; i++) {
+        if (SparseEncoderInit(&p->slots[i].encoder, p->writer) < 0) {
+            break;
+        }
+        p->slots[i].frame = -1;
+    }
+    if (i < p->nslots) {
+        fprintf(stderr, "%s: out of memory for %d encoder slots\n", p->path, p->nslots);
+        p->nslots = i;
+    }
+
+    for (i = 0; i < s->workers && p->nslots >= s->workers; i++) {
+        args[i].pool = p;
+        args[i].index = i;
+        if (pthread_create(&workers[i], NULL, EncodeWorker, &args[i]) != 0) {
+            perror("EncodeWriter: pthread_create");
+            break;
+        }
+    }
+    started = i;
+
+    // Without workers, encode here one frame at a time
+    for (k = 0; k < PoolFrames(p) && p->nslots > 0; k++) {
+        EncodeSlot *slot = &p->slots[k % p->nslots];
+
+        if (started == 0) {
+            EncodeInto(p, slot, k, &serialcpus);
+        }
+        else {
+            pthread_mutex_lock(&p->lock);
+            while (slot->frame != k && k < PoolFrames(p)) {
+                pthread_cond_wait(&p->changed, &p->lock);
+            }
+            pthread_mutex_unlock(&p->lock);
+        }
+        if (k >= PoolFrames(p)) {
+            break;
+        }
+        if (SparseAppendRecord(p->writer, slot->encoder.record, slot->length) < 0) {
+            p->status = -1;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        p->written = k + 1;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+    }
+    if (k < PoolFrames(p)) {
+        p->status = -1;
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (i = 0; i < p->nslots; i++) {
+        for (k = 0; k < 3; k++) {
+            p->writer->stats.tiles[k] += p->slots[i].encoder.tiles[k];
+        }
+        SparseEncoderFree(&p->slots[i].encoder);
+    }
+    codec = (int)p->writer->header.codec;      // SPARSE_CODEC_NONE if the codec isn't built in
+    if (SparseClose(p->writer, &stats) < 0) {
+        p->status = -1;
+    }
+    p->writer = NULL;
+
+    p->report.stats = stats;
+    p->report.frames = (int)(stats.rawbytes / npixels + 0.5);
+    p->report.workers = started;
+    p->report.codec = codec;
+    p->report.ratio = stats.storedbytes > 0 ? stats.rawbytes / stats.storedbytes : 0;
+    p->encodecpus += serialcpus;
+    p->report.encodembpscore = p->encodecpus > 0 ? stats.rawbytes / 1e6 / p->encodecpus : 0;
+    p->report.seconds = Seconds(CLOCK_MONOTONIC) - p->start;
+    p->report.decodembps = DecodeSpeed(p->path, p->report.frames);
+    return NULL;
+}
+
+
+
+// ================================================================================================
+// Start writing 'path'; returns NULL only when out of memory
+// ================================================================================================
+EncodePool *EncodePoolStart(const char *path, unsigned char *const frames[], int nframes,
+                            volatile const int *available, const EncodeSettings *settings, const RtConfig *rt)
+{
+    EncodePool *p = (EncodePool *)calloc(1, sizeof(EncodePool));
+    long cores;
+
+    if (p == NULL) {
+        return NULL;
+    }
+    snprintf(p->path, sizeof(p->path), "%s", path);
+    p->frames = frames;
+    p->nframes = nframes;
+    p->available = available;
+    p->settings = *settings;
+    p->rt = rt;
+    p->start = Seconds(CLOCK_MONOTONIC);
+
+    // One worker per worker cpu, or every core but the one capturing
+    if (p->settings.workers <= 0) {
+        cores = sysconf(_SC_NPROCESSORS_ONLN);
+        p->settings.workers = (rt != NULL && rt->nworkercpus > 0) ? rt->nworkercpus : (int)(cores > 1 ? cores - 1 : 1);
+    }
+    if (p->settings.workers > MAX_WORKERS) {
+        p->settings.workers = MAX_WORKERS;
+    }
+    p->nslots = SLOTS_PER_WORKER * p->settings.workers;
+
+    p->black = (unsigned char *)calloc((size_t)settings->xdim * settings->ydim, 1);
+    p->slots = (EncodeSlot *)calloc(p->nslots, sizeof(EncodeSlot));
+    if (p->black == NULL || p->slots == NULL) {
+        free(p->black);
+        free(p->slots);
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+
+    // If the thread can't start, EncodePoolFinish() does the work instead
+    p->threaded = (pthread_create(&p->thread, NULL, EncodeWriter, p) == 0);
+    if (!p->threaded) {
+        perror("EncodePoolStart: pthread_create");
+    }
+    return p;
+}
+
+
+
+// ================================================================================================
+// Capture stopped early: the file ends after 'frames' frames. Workers and writer waiting on frames
+// past that are woken to finish
+// ================================================================================================
+void EncodePoolStop(EncodePool *p, int frames)
+{
+    if (p == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    if (frames < p->nframes) {
+        __atomic_store_n(&p->nframes, frames > 0 ? frames : 0, __ATOMIC_RELEASE);
+    }
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+
+
+// ================================================================================================
+// Wait for the file to be closed; report may be NULL. Returns -1 if the file is incomplete
+// ================================================================================================
+int EncodePoolFinish(EncodePool *p, EncodeReport *report)
+{
+    int status;
+
+    if (p == NULL) {
+        return(-1);
+    }
+    if (p->threaded) {
+        pthread_join(p->thread, NULL);
+    }
+    else {
+        EncodeWriter(p);
+    }
+    status = p->status;
+    if (report != NULL) {
+        *report = p->report;
+    }
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->changed);
+    free(p->black);
+    free(p->slots);
+    free(p);
+    return(status);
+}
+
+
+
+// ================================================================================================
+// One line summary for the console and Machine A
+// ================================================================================================
+void EncodeReportFormat(const EncodeReport *r, char *out, size_t len)
+{
+    snprintf(out, len, "%d frames, %s on %d worker(s): %ld same, %ld residual, %ld raw tiles, "
+             "%.1f MB for %.1f MB (%.1fx), encode %.0f MB/s per core, decode %.0f MB/s, %.2f s",
+             r->frames, SparseCodecName(r->codec), r->workers,
+             r->stats.tiles[SPARSE_SAME], r->stats.tiles[SPARSE_SMALL], r->stats.tiles[SPARSE_RAW],
+             r->stats.storedbytes/1048576, r->stats.rawbytes/1048576, r->ratio,
+             r->encodembpscore, r->decodembps, r->seconds);
+}
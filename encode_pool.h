@@ -0,0 +1,64 @@
+/*
+ *  encode_pool.h
+ *
+ *  Writes a sparse sequence (.bgs, see sparse_store.h) with the frames
+ *  encoded on a pool of worker threads.
+ *
+ *  The pool can be started while the trial is still being captured: frame k
+ *  is only touched once *available > k, and the drain thread advances that
+ *  count as it reads frames out, so encoding keeps pace with capture rather
+ *  than starting when it ends. The count must be stored with
+ *  __ATOMIC_RELEASE after the frame; it is loaded with acquire. Pass
+ *  available = NULL when every frame is already in memory.
+ *
+ *  The background is the median of the first bgframes frames. After that
+ *  each worker takes the next frame number, encodes it into a ring of
+ *  record slots (two per worker) and a writer thread appends the slots to
+ *  the file in frame order, so workers run at most a ring ahead of the disk.
+ *  A NULL frame is written black.
+ */
+#ifndef ENCODE_POOL_H
+#define ENCODE_POOL_H
+
+#include <stddef.h>
+
+#include "sparse_store.h"
+#include "rt_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int     xdim, ydim;
+    int     threshold;          // tiles within +-threshold of the background are SPARSE_SMALL
+    int     bgframes;           // background median over this many frames
+    int     codec, level;       // SPARSE_CODEC_..., zstd level
+    int     workers;            // encoding threads, 0 = one per worker cpu (or per core less one)
+} EncodeSettings;
+
+typedef struct {
+    SparseStats stats;
+    int     frames;
+    int     workers;
+    int     codec;
+    double  ratio;              // frame bytes / file bytes
+    double  encodembpscore;     // frame MB encoded per second of one worker's cpu time
+    double  decodembps;         // frame MB per second reading the file back on one thread
+    double  seconds;            // start to file closed
+} EncodeReport;
+
+typedef struct EncodePool EncodePool;
+
+EncodePool *EncodePoolStart(const char *path, unsigned char *const frames[], int nframes,
+                            volatile const int *available, const EncodeSettings *settings, const RtConfig *rt);
+// Capture stopped early: the file ends after 'frames' frames, as many as were read out
+void EncodePoolStop(EncodePool *pool, int frames);
+int  EncodePoolFinish(EncodePool *pool, EncodeReport *report);
+void EncodeReportFormat(const EncodeReport *report, char *out, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ *  fake_camera.c
+ *
+ *  Stand-in for the Mikrotron camera's serial control port, for testing
+ *  Serial_Communication.c and the capture program without hardware.
+ *
+ *  Opens a pseudo-terminal, prints the name of its slave side, and answers
+ *  every ":<letter><hex>\r" command with ACK (0x06), or NAK (0x15) for
+ *  unknown letters or malformed values, printing the camera state it would
+ *  now be in. An optional reply delay in milliseconds simulates a slow camera.
+ *
+ *  Compile and run as:
+ *
+ *	    gcc fake_camera.c -o fake_camera
+ *	    ./fake_camera [delay_ms]
+ *
+ *  then start the capture program with "-s <printed /dev/pts/N>".
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <ctype.h>
+
+void error(const char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+// Expected number of hex digits after each command letter the capture program may send
+int ValueDigits(char letter)
+{
+    switch (letter) {
+      case 'q':	return 6;	// frame rate, frames per second
+      case 't':	return 6;	// exposure time, microseconds
+      case 'd':	return 12;	// ROI, x/y/width/height as 3 hex digits each
+      default:	return -1;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int master, slave, delayms = 0;
+    char command[64];
+    int len = 0;
+    struct termios options;
+
+    if (argc > 1)
+        delayms = atoi(argv[1]);
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+        error("ERROR opening pseudo-terminal");
+
+    // Keep the slave open and raw so the line discipline never echoes or
+    // translates "\r" before the capture program configures the port itself
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0)
+        error("ERROR opening pseudo-terminal slave");
+    tcgetattr(slave, &options);
+    cfmakeraw(&options);
+    tcsetattr(slave, TCSANOW, &options);
+
+    printf("Fake camera listening on %s\n", ptsname(master));
+    fflush(stdout);
+
+    for (;;) {
+        char c;
+        int n = read(master, &c, 1);
+        if (n <= 0)
+            error("ERROR reading from pseudo-terminal");
+
+        if (c != '\r') {
+            if (len < (int)sizeof(command)-1)
+                command[len++] = c;
+            continue;
+        }
+        command[len] = 0;
+        len = 0;
+
+        // Validate ":<letter><hex digits>"
+        int digits = (command[0] == ':') ? ValueDigits(command[1]) : -1;
+        int ok = digits > 0 && (int)strlen(command) == 2 + digits;
+        int i;
+        for (i = 2; ok && command[i]; i++)
+            ok = isxdigit((unsigned char)command[i]);
+
+        if (ok && command[1] == 'q')
+            printf("Frame rate    = %ld FPS\n", strtol(command+2, NULL, 16));
+        else if (ok && command[1] == 't')
+            printf("Exposure time = %ld us\n", strtol(command+2, NULL, 16));
+        else if (ok && command[1] == 'd') {
+            char field[4] = {0};
+            long roi[4];
+            for (i = 0; i < 4; i++) {
+                memcpy(field, command+2+i*3, 3);
+                roi[i] = strtol(field, NULL, 16);
+            }
+            printf("ROI           = %ld,%ld %ldx%ld\n", roi[0], roi[1], roi[2], roi[3]);
+        }
+        else
+            printf("Rejected      : '%s'\n", command);
+        fflush(stdout);
+
+        if (delayms > 0)
+            usleep(delayms*1000);
+
+        c = ok ? 0x06 : 0x15;
+        if (write(master, &c, 1) != 1)
+            error("ERROR writing to pseudo-terminal");
+    }
+
+    close(slave);
+    close(master);
+    return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ *  format_profiles.c
+ *
+ *  Loads every .fmt file in a directory into a compact table of format profiles.
+ *  See format_profiles.h.
+ *
+ *  The files are C initializers written by XCAP: a "struct <type> <name> ="
+ *  line opens each section, then every line holds the values of one field
+ *  followed by a comment naming it (x.vidsamples, framebuffers, ...).
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Directory listing
+#include <dirent.h>
+
+#include "format_profiles.h"
+
+
+static FormatProfile profiles[MAX_PROFILES];
+static int nprofiles = 0;
+
+
+
+// ================================================================================================
+// Split an XCAP line into its leading numbers and the field name in the trailing comment
+// Returns the count of numbers read (at most maxvalues), or 0 if the line has no field comment
+// ================================================================================================
+static int ParseFieldLine(char *line, char field[64], unsigned long values[], int maxvalues)
+{
+    char *comment = strstr(line, "/*");
+    int n = 0;
+
+    if (comment == NULL || strstr(comment, "*/") == NULL) {
+        return(0);
+    }
+    if (sscanf(comment + 2, " %63s", field) != 1) {
+        return(0);
+    }
+
+    char *p = line;
+    while (p < comment && n < maxvalues) {
+        char *next;
+        unsigned long v = strtoul(p, &next, 0);
+        if (next == p) {
+            p++;
+            continue;
+        }
+        values[n++] = v;
+        p = next;
+    }
+    return(n);
+}
+
+
+
+// ================================================================================================
+// Pull frame rate (":q") and exposure (":t") out of the camera init string in pxcamcntl.cntldata
+// The 32 bit words hold the string's bytes little-endian first
+// ================================================================================================
+static void ParseCameraInit(FormatProfile *prof, unsigned long words[], int nwords)
+{
+    char init[512];
+    int i, n = 0;
+
+    for (i = 0; i < nwords && n < (int)sizeof(init) - 4; i++) {
+        init[n++] = (char)(words[i] & 0xFF);
+        init[n++] = (char)((words[i] >> 8) & 0xFF);
+        init[n++] = (char)((words[i] >> 16) & 0xFF);
+        init[n++] = (char)((words[i] >> 24) & 0xFF);
+    }
+    init[n] = 0;
+
+    char *cmd;
+    for (cmd = init; cmd < init + n; cmd++) {
+        if (cmd[0] != ':') {
+            continue;
+        }
+        if (cmd[1] == 'q') {
+            prof->camerafps = (int)strtol(cmd + 2, NULL, 16);
+        }
+        else if (cmd[1] == 't') {
+            prof->exposure = (int)strtol(cmd + 2, NULL, 16);
+        }
+    }
+}
+
+
+
+// ================================================================================================
+// Parse one .fmt file into a profile
+// ================================================================================================
+static int ParseFormatFile(const char *path, FormatProfile *prof)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return(-1);
+    }
+
+    char line[1024], section[64] = "", field[64];
+    unsigned long values[8];
+    unsigned long cntldata[256];
+    int ncntldata = 0, n;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+
+        // "struct pxvidres pxvidres_125_id31232 =" starts a new section
+        if (sscanf(line, "struct %63s", section) == 1) {
+            continue;
+        }
+
+        // cntldata spans many lines, only the last of which carries the comment
+        if (strcmp(section, "pxcamcntl") == 0 && strstr(line, "0x") != NULL) {
+            char *p = line;
+            while ((p = strstr(p, "0x")) != NULL && ncntldata < 256) {
+                cntldata[ncntldata++] = strtoul(p, &p, 16);
+            }
+            continue;
+        }
+
+        if ((n = ParseFieldLine(line, field, values, 8)) == 0) {
+            continue;
+        }
+
+        if (strcmp(section, "pxvidres") == 0) {
+            if      (strcmp(field, "x.vidsamples") == 0)     prof->xdim = (int)values[0];
+            else if (strcmp(field, "y.vidsamples") == 0)     prof->ydim = (int)values[0];
+            else if (strcmp(field, "dat.pixiebits") == 0)    prof->bits = (int)values[0];
+            else if (strcmp(field, "frame.pdodalsf") == 0)   prof->framebytes = (long)values[0];
+            else if (strcmp(field, "framebuffers") == 0)     prof->framebuffers = (long)values[0];
+        }
+        else if (strcmp(section, "pxvidformat") == 0 && n >= 2 && values[1] != 0) {
+            if      (strcmp(field, "is.pixelclkfreq") == 0)  prof->pixelclock = (double)values[0] / values[1];
+            else if (strcmp(field, "is.framerate") == 0)     prof->framerate = (double)values[0] / values[1];
+        }
+    }
+    fclose(fp);
+
+    ParseCameraInit(prof, cntldata, ncntldata);
+
+    if (prof->xdim <= 0 || prof->ydim <= 0) {
+        fprintf(stderr, "%s: no image resolution found, skipped\n", path);
+        return(-1);
+    }
+    return(0);
+}
+
+
+
+static int CompareProfiles(const void *a, const void *b)
+{
+    return strcmp(((const FormatProfile *)a)->name, ((const FormatProfile *)b)->name);
+}
+
+
+
+// ================================================================================================
+// Parse all .fmt files in dir; returns the number of profiles loaded
+// ================================================================================================
+int FormatProfilesLoad(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+
+    nprofiles = 0;
+    if (d == NULL) {
+        perror(dir);
+        return(0);
+    }
+
+    while ((entry = readdir(d)) != NULL && nprofiles < MAX_PROFILES) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || strcmp(entry->d_name + len - 4, ".fmt") != 0 || len - 4 >= sizeof(profiles[0].name)) {
+            continue;
+        }
+
+        FormatProfile *prof = &profiles[nprofiles];
+        memset(prof, 0, sizeof(*prof));
+        snprintf(prof->name, sizeof(prof->name), "%.*s", (int)(len - 4), entry->d_name);
+        if (snprintf(prof->path, sizeof(prof->path), "%s/%s", dir, entry->d_name) >= (int)sizeof(prof->path)) {
+            continue;
+        }
+
+        if (ParseFormatFile(prof->path, prof) == 0) {
+            nprofiles++;
+        }
+    }
+    closedir(d);
+
+    // Sorted by name so lookups are a binary search
+    qsort(profiles, nprofiles, sizeof(FormatProfile), CompareProfiles);
+    return(nprofiles);
+}
+
+
+
+// ================================================================================================
+// Look up a profile by name, with or without the ".fmt" suffix; NULL if unknown
+// ================================================================================================
+const FormatProfile *FormatProfileFind(const char *name)
+{
+    FormatProfile key;
+    size_t len = strlen(name);
+
+    if (len > 4 && strcmp(name + len - 4, ".fmt") == 0) {
+        len -= 4;
+    }
+    snprintf(key.name, sizeof(key.name), "%.*s", (int)len, name);
+
+    return (const FormatProfile *)bsearch(&key, profiles, nprofiles, sizeof(FormatProfile), CompareProfiles);
+}
+
+
+
+// ================================================================================================
+// Profiles in name order, for walking the whole table; NULL past the end
+// ================================================================================================
+const FormatProfile *FormatProfileAt(int index)
+{
+    return (index >= 0 && index < nprofiles) ? &profiles[index] : NULL;
+}
+
+
+
+// ================================================================================================
+// List loaded profiles
+// ================================================================================================
+void FormatProfilesPrint(void)
+{
+    int i;
+
+    printf("%d format profiles loaded:\r\n", nprofiles);
+    for (i = 0; i < nprofiles; i++) {
+        const FormatProfile *prof = &profiles[i];
+        printf("  %-32s %4d x %-4d %2d bit  %5.1f MHz  %4d FPS  %5d us  %ld buffers\r\n",
+               prof->name, prof->xdim, prof->ydim, prof->bits, prof->pixelclock,
+               prof->camerafps, prof->exposure, prof->framebuffers);
+    }
+    printf("\r\n");
+}
@@ -0,0 +1,42 @@
+/*
+ *  format_profiles.h
+ *
+ *  Table of XCAP-saved video format (.fmt) files, parsed once at start-up.
+ *
+ *  Each .fmt file is a ~650 line pxvidformat/pxvidres/pxcamcntl dump; only the
+ *  handful of values the capture program needs are kept, indexed by the file
+ *  name without ".fmt" (e.g. "ExTrigger_1024_150_0_05ms"). Machine A names a
+ *  profile per trial and the frame grabber is reopened only when it changes.
+ */
+#ifndef FORMAT_PROFILES_H
+#define FORMAT_PROFILES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_PROFILES    64
+
+typedef struct {
+    char    name[64];           // file name without ".fmt"
+    char    path[256];          // path passed to pxd_PIXCIopen()
+    int     xdim, ydim;         // pxvidres x.vidsamples, y.vidsamples
+    int     bits;               // pxvidres dat.pixiebits - bits per pixel
+    double  pixelclock;         // pxvidformat is.pixelclkfreq - MHz
+    double  framerate;          // pxvidformat is.framerate - frames per second
+    long    framebytes;         // pxvidres frame.pdodalsf - bytes per frame buffer, with padding
+    long    framebuffers;       // pxvidres framebuffers - buffers available when XCAP saved the file
+    int     camerafps;          // camera frame rate from the ":q" init command, 0 if absent
+    int     exposure;           // camera exposure in microseconds from the ":t" init command, 0 if absent
+} FormatProfile;
+
+int  FormatProfilesLoad(const char *dir);
+const FormatProfile *FormatProfileFind(const char *name);
+const FormatProfile *FormatProfileAt(int index);
+void FormatProfilesPrint(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
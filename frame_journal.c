@@ -0,0 +1,291 @@
+/*
+ *  frame_journal.c
+ *
+ *  Journaled frame index of sequence files - see frame_journal.h.
+ */
+#define _FILE_OFFSET_BITS   64
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Linux
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "frame_journal.h"
+
+#define POLY        0x82f63b78      // CRC-32C, reflected
+#define READBATCH   4096            // records read at a time
+
+struct FrameJournal {
+    int         fd;
+    char        name[512];
+    double      lastsync;           // ms
+};
+
+static double NowMs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+
+
+// ================================================================================================
+// CRC-32C - the SSE4.2 crc32 instruction where there is one, else eight tables a byte at a time
+// ================================================================================================
+static uint32_t table[8][256];
+static pthread_once_t tableonce = PTHREAD_ONCE_INIT;
+
+static void MakeTable(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = (uint32_t)i;
+        for (k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+        }
+        table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++) {
+        for (k = 1; k < 8; k++) {
+            table[k][i] = (table[k-1][i] >> 8) ^ table[0][table[k-1][i] & 255];
+        }
+    }
+}
+
+static uint32_t CrcTables(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t v;
+
+    pthread_once(&tableonce, MakeTable);
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = table[7][v & 255] ^ table[6][(v >> 8) & 255] ^ table[5][(v >> 16) & 255] ^ table[4][(v >> 24) & 255]
+            ^ table[3][(v >> 32) & 255] ^ table[2][(v >> 40) & 255] ^ table[1][(v >> 48) & 255] ^ table[0][v >> 56];
+    }
+    for (; len > 0; len--) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 255];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+__attribute__((target("sse4.2"))) static uint32_t CrcSSE42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t c = crc, v;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&v, p, 8);
+        c = __builtin_ia32_crc32di(c, v);
+    }
+    crc = (uint32_t)c;
+    for (; len > 0; len--) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    }
+    return crc;
+}
+
+uint32_t JournalCrc(uint32_t crc, const void *data, size_t len)
+{
+    static int hardware = -1;
+
+    if (hardware < 0) {
+        hardware = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+    }
+    crc = ~crc;
+    crc = hardware ? CrcSSE42(crc, (const unsigned char *)data, len) : CrcTables(crc, (const unsigned char *)data, len);
+    return ~crc;
+}
+#else
+uint32_t JournalCrc(uint32_t crc, const void *data, size_t len)
+{
+    return ~CrcTables(~crc, (const unsigned char *)data, len);
+}
+#endif
+
+void JournalName(const char *path, char *name, size_t len)
+{
+    snprintf(name, len, "%s%s", path, JOURNAL_SUFFIX);
+}
+
+
+
+// ================================================================================================
+// Writing
+// ================================================================================================
+FrameJournal *JournalCreate(const char *path, const void *header, size_t headerbytes,
+                            const void *preamble, size_t preamblebytes)
+{
+    FrameJournal *j = (FrameJournal *)calloc(1, sizeof(FrameJournal));
+    JournalHeader h;
+
+    if (j == NULL || headerbytes > JOURNAL_MAXHEADER) {
+        free(j);
+        return NULL;
+    }
+    memset(&h, 0, sizeof(h));
+    h.magic = JOURNAL_MAGIC;
+    h.version = JOURNAL_VERSION;
+    h.headerbytes = (uint32_t)headerbytes;
+    h.preamblebytes = (uint32_t)preamblebytes;
+    h.preamblecrc = preamble != NULL ? JournalCrc(0, preamble, preamblebytes) : 0;
+    memcpy(h.header, header, headerbytes);
+    h.crc = JournalCrc(0, &h, sizeof(h));
+
+    JournalName(path, j->name, sizeof(j->name));
+    if ((j->fd = open(j->name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+        perror(j->name);
+        free(j);
+        return NULL;
+    }
+    if (write(j->fd, &h, sizeof(h)) != (ssize_t)sizeof(h) || fdatasync(j->fd) != 0) {
+        perror(j->name);
+        close(j->fd);
+        unlink(j->name);
+        free(j);
+        return NULL;
+    }
+    j->lastsync = NowMs();
+    return j;
+}
+
+int JournalAppend(FrameJournal *j, uint32_t frame, uint64_t offset, uint32_t length, uint32_t datacrc)
+{
+    JournalRecord r;
+    double now;
+
+    if (j == NULL) {
+        return(0);
+    }
+    memset(&r, 0, sizeof(r));
+    r.magic = JOURNAL_RECORD;
+    r.frame = frame;
+    r.offset = offset;
+    r.length = length;
+    r.datacrc = datacrc;
+    r.crc = JournalCrc(0, &r, sizeof(r));
+    if (write(j->fd, &r, sizeof(r)) != (ssize_t)sizeof(r)) {
+        return(-1);
+    }
+    if ((now = NowMs()) - j->lastsync >= JOURNAL_SYNCMS) {
+        fdatasync(j->fd);
+        j->lastsync = now;
+    }
+    return(0);
+}
+
+int JournalClose(FrameJournal *j, int complete)
+{
+    int status = 0;
+
+    if (j == NULL) {
+        return(0);
+    }
+    if (!complete && fdatasync(j->fd) != 0) {
+        status = -1;
+    }
+    if (close(j->fd) != 0) {
+        status = -1;
+    }
+    if (complete && unlink(j->name) != 0) {
+        perror(j->name);
+        status = -1;
+    }
+    free(j);
+    return(status);
+}
+
+
+
+// ================================================================================================
+// Recovery
+// ================================================================================================
+int JournalRead(const char *path, JournalContents *c)
+{
+    char name[512];
+    JournalRecord batch[64];
+    FILE *fp;
+    uint32_t crc;
+    size_t n, i;
+    int max = 0;
+
+    memset(c, 0, sizeof(*c));
+    JournalName(path, name, sizeof(name));
+    if ((fp = fopen(name, "rb")) == NULL) {
+        if (errno == ENOENT) {
+            return(1);
+        }
+        perror(name);
+        return(-1);
+    }
+    crc = 0;
+    if (fread(&c->header, sizeof(c->header), 1, fp) == 1) {
+        crc = c->header.crc;
+        c->header.crc = 0;
+    }
+    if (c->header.magic != JOURNAL_MAGIC || c->header.version != JOURNAL_VERSION
+     || c->header.headerbytes > JOURNAL_MAXHEADER || JournalCrc(0, &c->header, sizeof(c->header)) != crc) {
+        fprintf(stderr, "%s: not a frame journal, or its header is damaged\n", name);
+        fclose(fp);
+        return(-1);
+    }
+    c->header.crc = crc;
+
+    // Records up to the first torn, damaged or out of order one
+    while ((n = fread(batch, sizeof(JournalRecord), sizeof(batch) / sizeof(batch[0]), fp)) > 0) {
+        for (i = 0; i < n; i++) {
+            JournalRecord r = batch[i];
+
+            crc = r.crc;
+            r.crc = 0;
+            if (r.magic != JOURNAL_RECORD || r.frame != (uint32_t)c->nrecords || JournalCrc(0, &r, sizeof(r)) != crc) {
+                fclose(fp);
+                return(0);
+            }
+            if (c->nrecords == max) {
+                JournalRecord *more = (JournalRecord *)realloc(c->records, (max + READBATCH) * sizeof(JournalRecord));
+                if (more == NULL) {
+                    fclose(fp);
+                    return(0);
+                }
+                c->records = more;
+                max += READBATCH;
+            }
+            c->records[c->nrecords++] = batch[i];
+        }
+    }
+    fclose(fp);
+    return(0);
+}
+
+void JournalFree(JournalContents *c)
+{
+    free(c->records);
+    memset(c, 0, sizeof(*c));
+}
+
+int JournalRetire(const char *path, int fd)
+{
+    char name[512];
+
+    if (fsync(fd) != 0) {
+        perror(path);
+        return(-1);
+    }
+    JournalName(path, name, sizeof(name));
+    if (unlink(name) != 0) {
+        perror(name);
+        return(-1);
+    }
+    return(0);
+}
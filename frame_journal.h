@@ -0,0 +1,97 @@
+/*
+ *  frame_journal.h
+ *
+ *  Crash-safe frame index for sequence files written while a trial runs
+ *  (.raw, raw_store.h, and .bgs, sparse_store.h), whose own header and
+ *  index are only finished on close - a Ctrl+C, a crash or a power cut
+ *  before then used to leave a file that couldn't be read.
+ *
+ *  Beside <file> the writer keeps <file>.jrn: a JournalHeader holding a copy
+ *  of the file's header as created, then one JournalRecord per frame,
+ *  appended with write() as the frame is handed to the file, so a killed
+ *  process loses none, and synced every JOURNAL_SYNCMS against a power cut.
+ *  Every record carries the CRC-32C of its frame's bytes as well as its
+ *  own, so a record whose frame never reached the disk, or a torn record at
+ *  the end, is caught rather than trusted. The journal is deleted once the
+ *  file is closed and synced, so a .jrn left behind means an interrupted
+ *  file.
+ *
+ *  Recovery (RawRecover(), SparseRecover(), seq_recover.c) keeps the frames
+ *  from the first on whose records and bytes check out, and finishes the
+ *  file with those as if it had been closed after the last of them.
+ */
+#ifndef FRAME_JOURNAL_H
+#define FRAME_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JOURNAL_MAGIC       0x484a4b4d      // "MKJH"
+#define JOURNAL_RECORD      0x524a4b4d      // "MKJR"
+#define JOURNAL_VERSION     1
+#define JOURNAL_MAXHEADER   96              // bytes of the sequence file's header kept
+#define JOURNAL_SYNCMS      100             // journal synced at most this often
+#define JOURNAL_SUFFIX      ".jrn"
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    headerbytes;        // of header[]
+    uint32_t    preamblebytes;      // file bytes after the header and before the first frame
+    uint32_t    preamblecrc;        // their CRC-32C - the .bgs background
+    uint32_t    crc;                // of this struct, with crc = 0
+    unsigned char header[JOURNAL_MAXHEADER];    // the sequence file's header as created
+} JournalHeader;
+
+typedef struct {
+    uint32_t    magic;              // JOURNAL_RECORD
+    uint32_t    frame;              // index in the file, from 0
+    uint64_t    offset;             // where the frame's bytes start in the file
+    uint32_t    length;             // and how many there are
+    uint32_t    datacrc;            // CRC-32C of those bytes
+    uint32_t    reserved;
+    uint32_t    crc;                // of this record, with crc = 0
+} JournalRecord;
+
+// What an interrupted file's journal said and how much of it was kept
+typedef struct {
+    int     journaled;              // 0 = no journal, the file was closed cleanly
+    int     records;                // intact journal records
+    int     frames;                 // frames whose bytes checked out, kept
+    double  bytes;                  // size of the recovered file
+} JournalRecovery;
+
+// The journal's contents, up to the first record that doesn't check out
+typedef struct {
+    JournalHeader   header;
+    JournalRecord   *records;
+    int             nrecords;
+} JournalContents;
+
+typedef struct FrameJournal FrameJournal;
+
+uint32_t JournalCrc(uint32_t crc, const void *data, size_t len);
+void JournalName(const char *path, char *name, size_t len);
+
+// 'preamble' is what follows the header in the file, NULL if nothing does
+FrameJournal *JournalCreate(const char *path, const void *header, size_t headerbytes,
+                            const void *preamble, size_t preamblebytes);
+int  JournalAppend(FrameJournal *j, uint32_t frame, uint64_t offset, uint32_t length, uint32_t datacrc);
+// Call once the file is complete and synced: 'complete' = 1 deletes the journal, 0 keeps it
+int  JournalClose(FrameJournal *j, int complete);
+
+// 0 with c->nrecords set, 1 if there is no journal, -1 if it can't be read
+int  JournalRead(const char *path, JournalContents *c);
+void JournalFree(JournalContents *c);
+// After a recovery has finished the file: sync it and delete the journal
+int  JournalRetire(const char *path, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ *  frame_ranges.c
+ *
+ *  Frame ranges to export - see frame_ranges.h.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_ranges.h"
+
+void FrameRangesInit(FrameRanges *fr)
+{
+    memset(fr, 0, sizeof(*fr));
+}
+
+void FrameRangesFree(FrameRanges *fr)
+{
+    free(fr->ranges);
+    FrameRangesInit(fr);
+}
+
+int FrameRangesAdd(FrameRanges *fr, int first, int last)
+{
+    if (last < first) {
+        return(-1);
+    }
+    if (fr->n == fr->max) {
+        int grow = fr->max ? 2*fr->max : 64;
+        FrameRange *more = (FrameRange *)realloc(fr->ranges, grow * sizeof(FrameRange));
+        if (more == NULL) {
+            return(-1);
+        }
+        fr->ranges = more;
+        fr->max = grow;
+    }
+    fr->ranges[fr->n].first = first;
+    fr->ranges[fr->n].last = last;
+    fr->n++;
+    return(0);
+}
+
+
+
+// ================================================================================================
+// "a-b,c,d-e": returns the number of ranges added, or -1 at the first one that doesn't parse
+// ================================================================================================
+int FrameRangesParse(FrameRanges *fr, const char *text)
+{
+    const char *p = text;
+    int added = 0;
+
+    while (*p != '\0' && *p != ' ' && *p != '\r' && *p != '\n') {
+        int first, last, used = 0;
+
+        if (sscanf(p, "%d-%d%n", &first, &last, &used) == 2 && used > 0) {
+            p += used;
+        }
+        else if (sscanf(p, "%d%n", &first, &used) == 1 && used > 0) {
+            last = first;
+            p += used;
+        }
+        else {
+            return(-1);
+        }
+        if (FrameRangesAdd(fr, first, last) < 0) {
+            return(-1);
+        }
+        added++;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return(added);
+}
+
+
+
+// ================================================================================================
+// The windows of the events in an events.csv: each event's frame +-margin, or the window it
+// was tagged with when margin < 0. Returns the number of events, -1 if the file can't be read
+// ================================================================================================
+int FrameRangesLoadEvents(FrameRanges *fr, const char *path, int margin)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    int frame, first, last, events = 0;
+
+    if (fp == NULL) {
+        perror(path);
+        return(-1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%*[^,],%d,%d,%d", &frame, &first, &last) != 3) {
+            continue;                   // the header
+        }
+        if (margin >= 0) {
+            first = frame - margin;
+            last = frame + margin;
+        }
+        FrameRangesAdd(fr, first, last);
+        events++;
+    }
+    fclose(fp);
+    return(events);
+}
+
+
+
+// ================================================================================================
+// Sort, clip to 1..nframes and merge overlapping or adjacent ranges
+// ================================================================================================
+static int CompareRanges(const void *a, const void *b)
+{
+    return ((const FrameRange *)a)->first - ((const FrameRange *)b)->first;
+}
+
+void FrameRangesNormalize(FrameRanges *fr, int nframes)
+{
+    int i, n = 0;
+
+    qsort(fr->ranges, fr->n, sizeof(FrameRange), CompareRanges);
+    for (i = 0; i < fr->n; i++) {
+        FrameRange r = fr->ranges[i];
+
+        if (r.first < 1) {
+            r.first = 1;
+        }
+        if (r.last > nframes) {
+            r.last = nframes;
+        }
+        if (r.last < r.first) {
+            continue;
+        }
+        if (n > 0 && r.first <= fr->ranges[n-1].last + 1) {
+            if (r.last > fr->ranges[n-1].last) {
+                fr->ranges[n-1].last = r.last;
+            }
+            continue;
+        }
+        fr->ranges[n++] = r;
+    }
+    fr->n = n;
+}
+
+int FrameRangesCount(const FrameRanges *fr)
+{
+    int i, count = 0;
+
+    for (i = 0; i < fr->n; i++) {
+        count += fr->ranges[i].last - fr->ranges[i].first + 1;
+    }
+    return(count);
+}
+
+int FrameRangesWrite(const FrameRanges *fr, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    int i, output = 1;
+
+    if (fp == NULL) {
+        perror(path);
+        return(-1);
+    }
+    fprintf(fp, "first,last,output\n");
+    for (i = 0; i < fr->n; i++) {
+        fprintf(fp, "%d,%d,%d\n", fr->ranges[i].first, fr->ranges[i].last, output);
+        output += fr->ranges[i].last - fr->ranges[i].first + 1;
+    }
+    return (ferror(fp) | fclose(fp)) ? -1 : 0;
+}
@@ -0,0 +1,43 @@
+/*
+ *  frame_ranges.h
+ *
+ *  Sets of frame ranges to export instead of a whole sequence: the windows
+ *  around detected drop events (<base>.events.csv, drop_events.h), or a list
+ *  sent with the trial such as "120-400,900-1100,2500".
+ *
+ *  Frames are buffer numbers counted from 1, ranges inclusive. After
+ *  FrameRangesNormalize() the ranges are sorted, merged where they overlap or
+ *  touch and clipped to the sequence, so each frame is exported once and in
+ *  order. FrameRangesWrite() saves "first,last,output" - where each range
+ *  starts in the exported file - as <base>.ranges.csv.
+ */
+#ifndef FRAME_RANGES_H
+#define FRAME_RANGES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int     first, last;
+} FrameRange;
+
+typedef struct {
+    FrameRange  *ranges;
+    int         n, max;
+} FrameRanges;
+
+void FrameRangesInit(FrameRanges *fr);
+int  FrameRangesAdd(FrameRanges *fr, int first, int last);
+int  FrameRangesParse(FrameRanges *fr, const char *text);
+int  FrameRangesLoadEvents(FrameRanges *fr, const char *path, int margin);
+void FrameRangesNormalize(FrameRanges *fr, int nframes);
+int  FrameRangesCount(const FrameRanges *fr);
+int  FrameRangesWrite(const FrameRanges *fr, const char *path);
+void FrameRangesFree(FrameRanges *fr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ *  frame_stats.c
+ *
+ *  Per-frame histogram and exposure statistics - see frame_stats.h.
+ */
+
+// C library
+#include <stdio.h>
+#include <string.h>
+
+#include "frame_stats.h"
+
+
+
+void FrameHistogramClear(FrameHistogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+
+
+// ================================================================================================
+// Count n pixels - eight at a time from one 64 bit load, spread over the four tables
+// A histogram is a scatter, which SSE2 has no instruction for; the wide loads are what pay
+// ================================================================================================
+void FrameHistogramAdd(FrameHistogram *h, const unsigned char *pixels, size_t n)
+{
+    uint32_t *h0 = h->hist[0], *h1 = h->hist[1], *h2 = h->hist[2], *h3 = h->hist[3];
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v;
+        memcpy(&v, pixels + i, sizeof(v));
+        h0[v & 0xff]++;
+        h1[(v >> 8) & 0xff]++;
+        h2[(v >> 16) & 0xff]++;
+        h3[(v >> 24) & 0xff]++;
+        h0[(v >> 32) & 0xff]++;
+        h1[(v >> 40) & 0xff]++;
+        h2[(v >> 48) & 0xff]++;
+        h3[v >> 56]++;
+    }
+    for (; i < n; i++) {
+        h0[pixels[i]]++;
+    }
+}
+
+
+
+// ================================================================================================
+// Fold the tables and read everything else off the histogram
+// ================================================================================================
+void FrameHistogramFold(const FrameHistogram *h, uint32_t hist[256])
+{
+    int v;
+
+    for (v = 0; v < 256; v++) {
+        hist[v] = h->hist[0][v] + h->hist[1][v] + h->hist[2][v] + h->hist[3][v];
+    }
+}
+
+void FrameHistogramStats(const FrameHistogram *h, FrameStats *stats)
+{
+    uint32_t hist[256];
+    double sum = 0, total = 0, below = 0;
+    int v, p1 = -1, p99 = -1;
+
+    memset(stats, 0, sizeof(*stats));
+    FrameHistogramFold(h, hist);
+    for (v = 0; v < 256; v++) {
+        sum += (double)v * hist[v];
+        total += hist[v];
+    }
+    if (total == 0) {
+        return;
+    }
+
+    stats->min = 255;
+    for (v = 0; v < 256; v++) {
+        if (hist[v] == 0) {
+            continue;
+        }
+        if (v < stats->min) {
+            stats->min = (uint8_t)v;
+        }
+        stats->max = (uint8_t)v;
+        below += hist[v];
+        if (p1 < 0 && below >= 0.01 * total) {
+            p1 = v;
+        }
+        if (p99 < 0 && below >= 0.99 * total) {
+            p99 = v;
+        }
+    }
+    stats->mean = (float)(sum / total);
+    stats->p1 = (uint8_t)p1;
+    stats->p99 = (uint8_t)p99;
+    stats->saturated = hist[FRAME_SATURATED];
+}
+
+
+
+// ================================================================================================
+// Score an exposure: drops are the brightest 0.1% of the pixels, the median is the background
+// ================================================================================================
+static int Percentile(const uint32_t hist[256], double total, double fraction)
+{
+    double below = 0;
+    int v;
+
+    for (v = 0; v < 256; v++) {
+        below += hist[v];
+        if (below >= fraction * total) {
+            return(v);
+        }
+    }
+    return(255);
+}
+
+void FrameHistogramScore(const FrameHistogram *h, ExposureScore *score)
+{
+    uint32_t hist[256];
+    double total = 0;
+    int v;
+
+    memset(score, 0, sizeof(*score));
+    FrameHistogramFold(h, hist);
+    for (v = 0; v < 256; v++) {
+        total += hist[v];
+    }
+    if (total == 0) {
+        return;
+    }
+    score->background = Percentile(hist, total, 0.5);
+    score->bright = Percentile(hist, total, 0.999);
+    score->contrast = score->bright - score->background;
+    score->saturatedpct = 100 * hist[FRAME_SATURATED] / total;
+    score->threshold = (int)((score->background + score->bright) / 2 + 0.5);
+}
+
+
+
+// ================================================================================================
+// One frame's FRAME_STATS_COLUMNS, for the frame index
+// ================================================================================================
+int FrameStatsFormat(const FrameStats *s, char *out, size_t len)
+{
+    return snprintf(out, len, "%.2f,%u,%u,%u,%u,%u", s->mean, s->min, s->max, s->p1, s->p99, s->saturated);
+}
+
+
+
+// ================================================================================================
+// Trial summary, with a warning when the exposure looks wrong
+// ================================================================================================
+void FrameStatsSummary(const FrameStats *stats, int n, size_t npixels, char *out, size_t len,
+                       double *meanlevel, int *saturatedframes)
+{
+    double sum = 0, saturated = 0;
+    float lowest = 255, highest = 0;
+    int i, p99 = 0, flagged = 0;
+    const char *warning = "";
+
+    for (i = 0; i < n; i++) {
+        sum += stats[i].mean;
+        saturated += stats[i].saturated;
+        lowest = stats[i].mean < lowest ? stats[i].mean : lowest;
+        highest = stats[i].mean > highest ? stats[i].mean : highest;
+        p99 = stats[i].p99 > p99 ? stats[i].p99 : p99;
+        if (stats[i].saturated > FRAME_SATURATED_PCT / 100 * npixels) {
+            flagged++;
+        }
+    }
+    *meanlevel = n > 0 ? sum / n : 0;
+    *saturatedframes = flagged;
+
+    if (flagged > 0) {
+        warning = " - OVEREXPOSED";
+    }
+    else if (n > 0 && p99 < 64) {
+        warning = " - UNDEREXPOSED";
+    }
+    snprintf(out, len, "Exposure: mean level %.1f (frames %.1f to %.1f), 99th percentile up to %d, "
+             "%.3f%% of pixels saturated, %d of %d frames over %.0f%%%s",
+             *meanlevel, n > 0 ? lowest : 0, highest, p99,
+             n > 0 && npixels > 0 ? 100 * saturated / ((double)n * npixels) : 0,
+             flagged, n, FRAME_SATURATED_PCT, warning);
+}
@@ -0,0 +1,62 @@
+/*
+ *  frame_stats.h
+ *
+ *  Exposure statistics of every frame, gathered while it is read out.
+ *
+ *  The drain thread reads each frame out of grabber memory a band of rows
+ *  at a time and passes every band to FrameHistogramAdd() while it is still
+ *  in cache, so the statistics cost no second pass over the frame in RAM.
+ *  Only the histogram is built per pixel; mean, min, max, percentiles and
+ *  the saturated count all follow from its 256 bins in FrameHistogramStats().
+ */
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_SATURATED     255         // grey level counted as saturated
+#define FRAME_SATURATED_PCT 1.0         // a frame with more saturated pixels than this is flagged
+
+// Four interleaved tables, so consecutive equal pixels don't serialize on one counter
+typedef struct {
+    uint32_t    hist[4][256];
+} FrameHistogram;
+
+typedef struct {
+    float       mean;
+    uint8_t     min, max;
+    uint8_t     p1, p99;                // 1st and 99th percentile grey levels
+    uint32_t    saturated;              // pixels at FRAME_SATURATED
+} FrameStats;
+
+void FrameHistogramClear(FrameHistogram *h);
+void FrameHistogramAdd(FrameHistogram *h, const unsigned char *pixels, size_t n);
+void FrameHistogramStats(const FrameHistogram *h, FrameStats *stats);
+
+// Exposure of a scene of bright drops on a darker background, judged from its histogram
+typedef struct {
+    double      background;             // median grey level - the scene behind the drops
+    double      bright;                 // 99.9th percentile - the drops
+    double      contrast;               // bright - background
+    double      saturatedpct;           // % of pixels at FRAME_SATURATED
+    int         threshold;              // halfway from background to bright, for segmenting drops
+} ExposureScore;
+
+void FrameHistogramFold(const FrameHistogram *h, uint32_t hist[256]);
+void FrameHistogramScore(const FrameHistogram *h, ExposureScore *score);
+
+#define FRAME_STATS_COLUMNS "mean,min,max,p1,p99,saturated"
+int  FrameStatsFormat(const FrameStats *stats, char *out, size_t len);
+void FrameStatsSummary(const FrameStats *stats, int n, size_t npixels, char *out, size_t len,
+                       double *meanlevel, int *saturatedframes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
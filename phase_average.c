@@ -0,0 +1,157 @@
+/*
+ *  phase_average.c
+ *
+ *  Per-phase running mean and variance images - see phase_average.h.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "phase_average.h"
+
+
+
+// ================================================================================================
+// Allocate 'bins' mean and variance accumulators
+// ================================================================================================
+int PhaseAverageInit(PhaseAverage *pa, int bins, int xdim, int ydim, double freq, double phaseoffset)
+{
+    size_t n = (size_t)bins * xdim * ydim;
+
+    memset(pa, 0, sizeof(*pa));
+    if (bins <= 0 || freq <= 0) {
+        return(-1);
+    }
+    pa->bins = bins;
+    pa->xdim = xdim;
+    pa->ydim = ydim;
+    pa->freq = freq;
+    pa->phaseoffset = phaseoffset;
+    pa->count = (long *)calloc(bins, sizeof(long));
+    pa->mean = (float *)calloc(n, sizeof(float));
+    pa->m2 = (float *)calloc(n, sizeof(float));
+    if (pa->count == NULL || pa->mean == NULL || pa->m2 == NULL) {
+        PhaseAverageFree(pa);
+        return(-1);
+    }
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Bin of the drive phase 'seconds' after the first frame
+// ================================================================================================
+int PhaseBin(const PhaseAverage *pa, double seconds)
+{
+    double phase = pa->freq * seconds + pa->phaseoffset / 360.0;
+    int bin;
+
+    phase -= floor(phase);
+    bin = (int)(phase * pa->bins);
+    return bin < pa->bins ? bin : pa->bins - 1;
+}
+
+
+
+// ================================================================================================
+// Add one frame to its phase bin
+// ================================================================================================
+void PhaseAverageAdd(PhaseAverage *pa, const unsigned char *frame, double seconds)
+{
+    size_t npixels = (size_t)pa->xdim * pa->ydim;
+    int bin = PhaseBin(pa, seconds);
+    float *mean = pa->mean + bin * npixels;
+    float *m2 = pa->m2 + bin * npixels;
+    float inv;
+    size_t p;
+
+    inv = 1.0f / (float)(++pa->count[bin]);
+    pa->frames++;
+
+    // Welford's update - a plain loop the compiler vectorizes
+    for (p = 0; p < npixels; p++) {
+        float x = frame[p];
+        float d = x - mean[p];
+        mean[p] += d * inv;
+        m2[p] += d * (x - mean[p]);
+    }
+}
+
+
+
+// ================================================================================================
+// Save the mean and variance of every bin, and the frame counts
+// ================================================================================================
+static int WritePGM16(const char *path, const float *image, float scale, int xdim, int ydim)
+{
+    FILE *fp = fopen(path, "wb");
+    size_t npixels = (size_t)xdim * ydim, p;
+
+    if (fp == NULL) {
+        perror(path);
+        return(-1);
+    }
+    fprintf(fp, "P5\n%d %d\n65535\n", xdim, ydim);
+    for (p = 0; p < npixels; p++) {
+        float v = image[p] * scale + 0.5f;
+        unsigned int u = v <= 0 ? 0 : v >= 65535 ? 65535 : (unsigned int)v;
+        fputc(u >> 8, fp);              // PGM samples are big endian
+        fputc(u & 0xff, fp);
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+int PhaseAverageWrite(const PhaseAverage *pa, const char *base)
+{
+    size_t npixels = (size_t)pa->xdim * pa->ydim, p;
+    float *variance = (float *)malloc(npixels * sizeof(float));
+    char path[512];
+    FILE *fp;
+    int b, status = 0;
+
+    if (variance == NULL) {
+        return(-1);
+    }
+    snprintf(path, sizeof(path), "%s.phase.csv", base);
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        free(variance);
+        return(-1);
+    }
+    fprintf(fp, "bin,phase_deg,frames\n");
+
+    for (b = 0; b < pa->bins; b++) {
+        const float *m2 = pa->m2 + b * npixels;
+        long n = pa->count[b];
+
+        fprintf(fp, "%d,%.1f,%ld\n", b, 360.0 * b / pa->bins, n);
+        if (n == 0) {
+            continue;
+        }
+        for (p = 0; p < npixels; p++) {
+            variance[p] = n > 1 ? m2[p] / (n - 1) : 0;
+        }
+        snprintf(path, sizeof(path), "%s.phase%02d.mean.pgm", base, b);
+        status |= WritePGM16(path, pa->mean + b * npixels, 256.0f, pa->xdim, pa->ydim);
+        snprintf(path, sizeof(path), "%s.phase%02d.var.pgm", base, b);
+        status |= WritePGM16(path, variance, 1.0f, pa->xdim, pa->ydim);
+    }
+    if (fclose(fp) != 0) {
+        status = -1;
+    }
+    free(variance);
+    return(status);
+}
+
+void PhaseAverageFree(PhaseAverage *pa)
+{
+    free(pa->count);
+    free(pa->mean);
+    free(pa->m2);
+    pa->count = NULL;
+    pa->mean = pa->m2 = NULL;
+}
@@ -0,0 +1,45 @@
+/*
+ *  phase_average.h
+ *
+ *  Phase-locked (stroboscopic) averaging of a trial against the shaker drive.
+ *
+ *  Each frame's time since the first frame of the sequence is turned into a
+ *  phase of the drive signal, phase = FREQ * t + PHASE_OFFSET / 360 (mod 1),
+ *  and the frame is added to one of 'bins' equal phase bins. Every bin keeps
+ *  a running per-pixel mean and sum of squared deviations (Welford), so the
+ *  images are ready the moment capture ends and memory does not grow with
+ *  the number of cycles.
+ *
+ *  PhaseAverageWrite() saves, for bin b, <base>.phaseBB.mean.pgm (mean x 256)
+ *  and <base>.phaseBB.var.pgm (sample variance, at most 16256 for 8 bit
+ *  pixels), both 16 bit PGMs, and <base>.phase.csv with the frames per bin.
+ */
+#ifndef PHASE_AVERAGE_H
+#define PHASE_AVERAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int     bins;
+    int     xdim, ydim;
+    double  freq;               // drive frequency, Hz
+    double  phaseoffset;        // degrees added to every frame's phase
+    long    *count;             // frames in each bin
+    float   *mean;              // bins x ydim x xdim
+    float   *m2;                // sum of squared deviations from the mean
+    long    frames;
+} PhaseAverage;
+
+int  PhaseAverageInit(PhaseAverage *pa, int bins, int xdim, int ydim, double freq, double phaseoffset);
+int  PhaseBin(const PhaseAverage *pa, double seconds);
+void PhaseAverageAdd(PhaseAverage *pa, const unsigned char *frame, double seconds);
+int  PhaseAverageWrite(const PhaseAverage *pa, const char *base);
+void PhaseAverageFree(PhaseAverage *pa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,544 @@
+/*
+ *  pipeline_bench.c
+ *
+ *  Benchmark of the capture program's stages against a synthetic frame
+ *  source, so a change to any stage can be measured without a camera or a
+ *  frame grabber, and regressions tracked from run to run.
+ *
+ *  A source thread paints frames of bouncing drops on a noisy background
+ *  into a ring of "grabber" buffers at the requested frame rate (0 = as
+ *  fast as it can), 8 bit or, like a 10 bit camera, 16 bit words read out
+ *  as their top 8 bits. The stages then run as CaptureSequenceAVI() runs
+ *  them:
+ *
+ *	    readout     copy each frame out of the ring in READBANDBYTES bands,
+ *	                building its exposure histogram (frame_stats.h)
+ *	    analysis    track the drops and look for events (trajectory.h,
+ *	                drop_events.h), following the readout
+ *	    encode      a sparse .bgs on the encoder pool (encode_pool.h), also
+ *	                following the readout
+ *	    write       the whole sequence uncompressed to a .raw file through the
+ *	                disk writer (raw_store.h, disk_writer.h), in place of the
+ *	                AVI writer, with its queue depth - striped over -s dirs,
+ *	                one per disk, with each stripe's throughput
+ *
+ *  For every geometry x bit depth x frame rate x length it reports each
+ *  stage's throughput, the per-frame latency percentiles of readout and
+ *  analysis from the moment the source finished the frame, the frames the
+ *  readout lost to the ring wrapping around, the peak RSS and the bytes
+ *  written - as JSON, to stdout or -o file.
+ *
+ *  Compile and run as:
+ *
+ *	    gcc -O2 pipeline_bench.c frame_stats.c trajectory.c drop_events.c sparse_store.c encode_pool.c rt_config.c pixel_kernels.c raw_store.c disk_writer.c frame_journal.c -llz4 -lzstd -luring -lm -lpthread -o pipeline_bench
+ *	    ./pipeline_bench [-g 104x174,1024x150] [-b 8,10] [-f 0,1000] [-n 500,2000] [-c lz4|zstd[:level]|none]
+ *	                     [-w workers] [-d scratch_dir] [-s stripe_dir,...] [-o results.json]
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Linux
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "frame_stats.h"
+#include "trajectory.h"
+#include "drop_events.h"
+#include "sparse_store.h"
+#include "encode_pool.h"
+#include "rt_config.h"
+#include "pixel_kernels.h"
+#include "raw_store.h"
+
+#define READBANDBYTES   65536       // as in the capture program
+#define RINGFRAMES      64          // synthetic grabber buffers
+#define DROPS           3
+#define THRESHOLD       200
+#define MAXLIST         16
+
+// The geometries of the .fmt files
+static const char *defaultgeometries = "104x174,256x140,848x150,1024x150,1024x1024";
+static const char *stripedirs[RAW_MAXSTRIPES];
+static int nstripedirs;
+
+typedef struct {
+    int             xdim, ydim, bits, fps, frames;
+
+    // source
+    unsigned char   *ring;          // RINGFRAMES frames of 1 or 2 bytes a pixel
+    unsigned char   *background;
+    double          *finished;      // us, when the source finished frame k
+    volatile int    captured;
+    double          sourceseconds;
+
+    // readout
+    unsigned char   **buf;
+    FrameStats      *stats;
+    volatile int    readout;
+    int             lost;           // overwritten in the ring before they were read out
+    double          readoutbusy;    // us spent reading out
+    JitterStats     readoutlatency;
+
+    // analysis
+    Tracker         *tracker;
+    EventDetector   events;
+    double          analysisbusy;
+    JitterStats     analysislatency;
+} Bench;
+
+
+
+// ================================================================================================
+// Synthetic source: drops bouncing on a parabola over a fixed noisy gradient
+// ================================================================================================
+static void PaintFrame(const Bench *b, int k, unsigned char *out)
+{
+    size_t npixels = (size_t)b->xdim * b->ydim, p;
+    size_t shift = k % 8;                   // a little movement of the noise from frame to frame
+    int d, x, y;
+    double radius = b->ydim / 30.0 + 2;
+
+    if (b->bits > 8) {
+        unsigned short *o = (unsigned short *)out;
+        for (p = 0; p < npixels; p++) {
+            o[p] = (unsigned short)(b->background[(p + shift) % npixels] << 2);
+        }
+    }
+    else {
+        memcpy(out, b->background + shift, npixels - shift);
+        memcpy(out + npixels - shift, b->background, shift);
+    }
+
+    for (d = 0; d < DROPS; d++) {
+        double phase = fmod(k / (40.0 + 13*d) + d / 3.0, 1.0);
+        double cx = b->xdim * (d + 1) / (DROPS + 1.0);
+        double cy = radius + (b->ydim - 2*radius - 1) * (1 - 4*(phase - 0.5)*(phase - 0.5));
+        int x0 = (int)(cx - radius), x1 = (int)(cx + radius) + 1;
+        int y0 = (int)(cy - radius), y1 = (int)(cy + radius) + 1;
+
+        for (y = y0 < 0 ? 0 : y0; y <= y1 && y < b->ydim; y++) {
+            for (x = x0 < 0 ? 0 : x0; x <= x1 && x < b->xdim; x++) {
+                double r = hypot(x - cx, y - cy);
+                int v;
+                if (r > radius) {
+                    continue;
+                }
+                v = 255 - (int)(40 * r / radius);
+                if (b->bits > 8) {
+                    ((unsigned short *)out)[(size_t)y*b->xdim + x] = (unsigned short)(v << 2);
+                }
+                else {
+                    out[(size_t)y*b->xdim + x] = (unsigned char)v;
+                }
+            }
+        }
+    }
+}
+
+static void *SourceThread(void *arg)
+{
+    Bench *b = (Bench *)arg;
+    size_t framebytes = (size_t)b->xdim * b->ydim * (b->bits > 8 ? 2 : 1);
+    struct timespec next;
+    double start = RtNowUs();
+    int k;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (k = 0; k < b->frames; k++) {
+        if (b->fps > 0) {
+            next.tv_nsec += 1000000000L / b->fps;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+        PaintFrame(b, k, b->ring + (k % RINGFRAMES) * framebytes);
+        b->finished[k] = RtNowUs();
+        __sync_synchronize();
+        b->captured = k + 1;
+    }
+    b->sourceseconds = (RtNowUs() - start) / 1e6;
+    return NULL;
+}
+
+
+
+// ================================================================================================
+// Readout: as ReadFrame() in the capture program, band by band with the histogram
+// ================================================================================================
+static void *ReadoutThread(void *arg)
+{
+    Bench *b = (Bench *)arg;
+    size_t npixels = (size_t)b->xdim * b->ydim;
+    size_t bytesperpixel = b->bits > 8 ? 2 : 1;
+    int bandrows = READBANDBYTES / b->xdim > 0 ? READBANDBYTES / b->xdim : 1;
+    const PxKernels *kernels = PxBest();
+    FrameHistogram histogram;
+    int k, y, rows;
+
+    for (k = 0; k < b->frames; k++) {
+        const unsigned char *src = b->ring + (k % RINGFRAMES) * npixels * bytesperpixel;
+        double start;
+
+        while (b->captured <= k) {
+            usleep(100);
+        }
+        start = RtNowUs();
+
+        FrameHistogramClear(&histogram);
+        for (y = 0; y < b->ydim; y += bandrows) {
+            unsigned char *dst = b->buf[k] + (size_t)y * b->xdim;
+            size_t offset = (size_t)y * b->xdim;
+            size_t n;
+
+            rows = y + bandrows <= b->ydim ? bandrows : b->ydim - y;
+            n = (size_t)rows * b->xdim;
+            if (bytesperpixel == 2) {
+                kernels->pack16((const unsigned short *)src + offset, dst, n, 2);
+            }
+            else {
+                memcpy(dst, src + offset, n);
+            }
+            FrameHistogramAdd(&histogram, dst, n);
+        }
+        FrameHistogramStats(&histogram, &b->stats[k]);
+
+        // The source has lapped the ring - this frame was painted over while it was read
+        if (b->captured - k > RINGFRAMES) {
+            b->lost++;
+        }
+        b->readoutbusy += RtNowUs() - start;
+        JitterAdd(&b->readoutlatency, RtNowUs() - b->finished[k]);
+        __sync_synchronize();
+        __atomic_store_n(&b->readout, k + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+
+
+// ================================================================================================
+// Analysis: the drop tracker and event detector, following the readout
+// ================================================================================================
+static void *AnalysisThread(void *arg)
+{
+    Bench *b = (Bench *)arg;
+    TrackPoint linked[TRACK_MAXBLOBS];
+    int k, n;
+
+    for (k = 0; k < b->frames; k++) {
+        double start, seconds = k / (b->fps > 0 ? (double)b->fps : 1000.0);
+
+        while (__atomic_load_n(&b->readout, __ATOMIC_ACQUIRE) <= k) {
+            usleep(100);
+        }
+        start = RtNowUs();
+        n = TrackerAdd(b->tracker, b->buf[k], b->xdim, b->ydim, k+1, seconds, linked);
+        EventDetectorAdd(&b->events, linked, n, k+1, seconds);
+        b->analysisbusy += RtNowUs() - start;
+        JitterAdd(&b->analysislatency, RtNowUs() - b->finished[k]);
+    }
+    return NULL;
+}
+
+
+
+// ================================================================================================
+// Uncompressed .raw of every frame through the disk writer, standing in for the AVI writer
+// ================================================================================================
+static int WriteRaw(const char *path, unsigned char **frames, int nframes, int xdim, int ydim, DiskReport *report,
+                    DiskReport *stripes, char stripepaths[][256], int *nstripes)
+{
+    RawWriter *w = RawCreateStriped(path, stripedirs, nstripedirs, 0, xdim, ydim, 0, nframes, NULL);
+    int k, status = 0;
+
+    memset(report, 0, sizeof(*report));
+    *nstripes = 0;
+    if (w == NULL) {
+        return(-1);
+    }
+    for (k = 0; k < w->nstripes && w->header.stripeframes > 0; k++) {
+        snprintf(stripepaths[k], 256, "%s", w->stripes[k].path);
+    }
+    *nstripes = w->header.stripeframes > 0 ? w->nstripes : 0;
+    for (k = 0; k < nframes && status == 0; k++) {
+        status = RawWriteFrame(w, frames[k]);
+    }
+    if (RawClose(w, report, stripes) < 0) {
+        status = -1;
+    }
+    return(status);
+}
+
+static double FileBytes(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (double)st.st_size : 0;
+}
+
+// Peak RSS since the last ResetPeakRSS(), MB - VmHWM, which clear_refs "5" resets
+static void ResetPeakRSS(void)
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (fp != NULL) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+static double PeakRSS(void)
+{
+    FILE *fp = fopen("/proc/self/status", "r");
+    char line[128];
+    long kb = 0;
+
+    if (fp == NULL) {
+        return(0);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "VmHWM: %ld", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return kb / 1024.0;
+}
+
+static void PrintLatency(FILE *out, JitterStats *js)
+{
+    double p50, p99, p999, worst;
+
+    JitterPercentiles(js, &p50, &p99, &p999, &worst);
+    fprintf(out, "\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}", p50, p99, p999, worst);
+}
+
+
+
+// ================================================================================================
+// One configuration: run the stages, print its JSON object; returns -1 if it could not run
+// ================================================================================================
+static int RunBench(int xdim, int ydim, int bits, int fps, int frames, const EncodeSettings *encode,
+                    const char *dir, FILE *out, int first)
+{
+    Bench b;
+    size_t npixels = (size_t)xdim * ydim;
+    size_t framebytes = npixels * (bits > 8 ? 2 : 1);
+    char bgs[512], raw[512], traj[512];
+    pthread_t source, readout, analysis;
+    EncodeSettings settings = *encode;
+    EncodeReport report;
+    DiskReport disk, stripes[RAW_MAXSTRIPES];
+    char stripepaths[RAW_MAXSTRIPES][256];
+    EncodePool *pool;
+    double wallstart, readoutseconds, encodetail, mb, bytes = 0;
+    long points;
+    int tracks, nstripes, k;
+    unsigned int seed = 12345;
+
+    memset(&b, 0, sizeof(b));
+    b.xdim = xdim;
+    b.ydim = ydim;
+    b.bits = bits;
+    b.fps = fps;
+    b.frames = frames;
+
+    // The sequence must fit in RAM, as the capture program's plan insists
+    if ((double)npixels * frames > (double)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2) {
+        fprintf(stderr, "%dx%d x %d frames: skipped, more than half the free RAM\n", xdim, ydim, frames);
+        fprintf(out, "%s    {\"geometry\": \"%dx%d\", \"bits\": %d, \"fps\": %d, \"frames\": %d, \"skipped\": \"RAM\"}",
+                first ? "" : ",\n", xdim, ydim, bits, fps, frames);
+        return(-1);
+    }
+
+    ResetPeakRSS();
+    b.ring = (unsigned char *)malloc(RINGFRAMES * framebytes);
+    b.background = (unsigned char *)malloc(npixels);
+    b.finished = (double *)calloc(frames, sizeof(double));
+    b.buf = (unsigned char **)malloc(frames * sizeof(unsigned char *));
+    b.stats = (FrameStats *)calloc(frames, sizeof(FrameStats));
+    unsigned char *framedata = (unsigned char *)malloc(npixels * frames);
+    if (b.ring == NULL || b.background == NULL || b.finished == NULL || b.buf == NULL || b.stats == NULL ||
+        framedata == NULL || JitterInit(&b.readoutlatency, frames) < 0 || JitterInit(&b.analysislatency, frames) < 0) {
+        fprintf(stderr, "%dx%d x %d frames: out of memory\n", xdim, ydim, frames);
+        exit(1);
+    }
+    for (k = 0; k < frames; k++) {
+        b.buf[k] = framedata + (size_t)k * npixels;
+    }
+    for (k = 0; k < (int)npixels; k++) {
+        seed = seed * 1103515245 + 12345;
+        b.background[k] = (unsigned char)(40 + 60 * (k % xdim) / xdim + ((seed >> 16) & 7));
+    }
+    // Touch the sequence now, as the capture program's mlock() would, so page faults aren't timed
+    memset(framedata, 0, npixels * frames);
+
+    snprintf(bgs, sizeof(bgs), "%s/pipeline_bench.bgs", dir);
+    snprintf(raw, sizeof(raw), "%s/pipeline_bench.raw", dir);
+    snprintf(traj, sizeof(traj), "%s/pipeline_bench.traj.csv", dir);
+    if ((b.tracker = TrackerOpen(traj, THRESHOLD)) == NULL) {
+        exit(1);
+    }
+    EventDetectorInit(&b.events, EVENT_PRE, EVENT_POST);
+    settings.xdim = xdim;
+    settings.ydim = ydim;
+
+    // Capture, readout, analysis and encoding all overlap, as in a trial
+    wallstart = RtNowUs();
+    pool = EncodePoolStart(bgs, b.buf, frames, &b.readout, &settings, NULL);
+    pthread_create(&analysis, NULL, AnalysisThread, &b);
+    pthread_create(&readout, NULL, ReadoutThread, &b);
+    pthread_create(&source, NULL, SourceThread, &b);
+    pthread_join(source, NULL);
+    pthread_join(readout, NULL);
+    readoutseconds = (RtNowUs() - wallstart) / 1e6;
+    pthread_join(analysis, NULL);
+    encodetail = RtNowUs();
+    if (pool == NULL || EncodePoolFinish(pool, &report) < 0) {
+        memset(&report, 0, sizeof(report));
+    }
+    encodetail = (RtNowUs() - encodetail) / 1e6;
+    TrackerClose(b.tracker, &points, &tracks);
+
+    WriteRaw(raw, b.buf, frames, xdim, ydim, &disk, stripes, stripepaths, &nstripes);
+    mb = npixels * (double)frames / 1e6;
+
+    fprintf(out, "%s    {\"geometry\": \"%dx%d\", \"bits\": %d, \"fps\": %d, \"frames\": %d,\n", first ? "" : ",\n",
+            xdim, ydim, bits, fps, frames);
+    fprintf(out, "     \"source\": {\"fps\": %.1f, \"lost\": %d},\n",
+            b.sourceseconds > 0 ? frames / b.sourceseconds : 0, b.lost);
+    fprintf(out, "     \"readout\": {\"mbps\": %.1f, \"fps\": %.1f, ",
+            b.readoutbusy > 0 ? framebytes * (double)frames / b.readoutbusy : 0,
+            b.readoutbusy > 0 ? frames * 1e6 / b.readoutbusy : 0);
+    PrintLatency(out, &b.readoutlatency);
+    fprintf(out, "},\n     \"analysis\": {\"fps\": %.1f, \"points\": %ld, \"tracks\": %d, \"events\": %d, ",
+            b.analysisbusy > 0 ? frames * 1e6 / b.analysisbusy : 0, points, tracks, b.events.nevents);
+    PrintLatency(out, &b.analysislatency);
+    fprintf(out, "},\n     \"encode\": {\"codec\": \"%s\", \"workers\": %d, \"mbps\": %.1f, \"mbps_core\": %.1f, "
+                 "\"ratio\": %.2f, \"decode_mbps\": %.1f, \"tail_ms\": %.1f},\n",
+            SparseCodecName(report.codec), report.workers, report.seconds > 0 ? mb / report.seconds : 0,
+            report.encodembpscore, report.ratio, report.decodembps, encodetail * 1e3);
+    fprintf(out, "     \"write\": {\"engine\": \"%s\", \"direct\": %d, \"mbps\": %.1f, \"depth\": %.1f, \"max_depth\": %d, \"stalls\": %ld",
+            disk.engine != NULL ? disk.engine : "none", disk.direct, disk.mbps, disk.meaninflight, disk.maxinflight, disk.stalls);
+    for (k = 0; k < nstripes; k++) {
+        fprintf(out, "%s{\"path\": \"%s\", \"mbps\": %.1f, \"stalls\": %ld}", k == 0 ? ", \"stripes\": [" : ", ",
+                stripepaths[k], stripes[k].mbps, stripes[k].stalls);
+        bytes += FileBytes(stripepaths[k]);
+    }
+    fprintf(out, "%s},\n", nstripes > 0 ? "]" : "");
+    fprintf(out, "     \"capture_seconds\": %.3f, \"peak_rss_mb\": %.1f, \"bytes_written\": %.0f}",
+            readoutseconds, PeakRSS(), bytes + FileBytes(bgs) + FileBytes(raw) + FileBytes(traj));
+    fflush(out);
+
+    fprintf(stderr, "%dx%d %d bit %d fps x %d: readout %.0f fps, analysis %.0f fps, encode %.0f MB/s, %d lost\n",
+            xdim, ydim, bits, fps, frames, b.readoutbusy > 0 ? frames * 1e6 / b.readoutbusy : 0,
+            b.analysisbusy > 0 ? frames * 1e6 / b.analysisbusy : 0, report.seconds > 0 ? mb / report.seconds : 0, b.lost);
+
+    unlink(bgs);
+    unlink(raw);
+    unlink(traj);
+    for (k = 0; k < nstripes; k++) {
+        unlink(stripepaths[k]);
+    }
+    EventDetectorFree(&b.events);
+    JitterFree(&b.readoutlatency);
+    JitterFree(&b.analysislatency);
+    free(framedata);
+    free(b.stats);
+    free(b.buf);
+    free(b.finished);
+    free(b.background);
+    free(b.ring);
+    return(0);
+}
+
+static int ParseList(const char *text, int *values)
+{
+    int n = 0, used;
+
+    while (n < MAXLIST && sscanf(text, "%d%n", &values[n], &used) == 1) {
+        n++;
+        text += used;
+        if (*text++ != ',') {
+            break;
+        }
+    }
+    return(n);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *geometries = defaultgeometries, *dir = "/tmp", *outpath = NULL, *p;
+    int bits[MAXLIST] = { 8, 10 }, fps[MAXLIST] = { 0, 1000 }, lengths[MAXLIST] = { 500, 2000 };
+    int nbits = 2, nfps = 2, nlengths = 2;
+    int xdim, ydim, used, i, j, k, c, first = 1;
+    EncodeSettings encode;
+    FILE *out = stdout;
+    time_t now = time(NULL);
+    char stamp[32];
+
+    memset(&encode, 0, sizeof(encode));
+    encode.threshold = SPARSE_MAX_THRESHOLD;
+    encode.bgframes = 15;
+    encode.codec = SPARSE_CODEC_LZ4DELTA;
+
+    while ((c = getopt(argc, argv, "g:b:f:n:c:w:d:s:o:")) != -1) {
+        switch (c) {
+        case 'g':   geometries = optarg;                        break;
+        case 'b':   nbits = ParseList(optarg, bits);            break;
+        case 'f':   nfps = ParseList(optarg, fps);              break;
+        case 'n':   nlengths = ParseList(optarg, lengths);      break;
+        case 'c':
+            if (SparseParseCodec(optarg, &encode.codec, &encode.level) < 0) {
+                fprintf(stderr, "unknown codec %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'w':   encode.workers = atoi(optarg);              break;
+        case 'd':   dir = optarg;                               break;
+        case 's':   nstripedirs = RawParseStripes(optarg, stripedirs, RAW_MAXSTRIPES);  break;
+        case 'o':   outpath = optarg;                           break;
+        default:
+            fprintf(stderr, "usage %s [-g WxH,...] [-b 8,10] [-f fps,...] [-n frames,...] [-c codec] [-w workers] "
+                            "[-d scratch_dir] [-s stripe_dir,...] [-o results.json]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (outpath != NULL && (out = fopen(outpath, "w")) == NULL) {
+        perror(outpath);
+        exit(1);
+    }
+
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    fprintf(out, "{\"benchmark\": \"pipeline\", \"time\": \"%s\", \"cpus\": %ld, \"codec\": \"%s\", \"level\": %d,\n \"runs\": [\n",
+            stamp, sysconf(_SC_NPROCESSORS_ONLN), SparseCodecName(encode.codec), encode.level);
+
+    for (p = geometries; sscanf(p, "%dx%d%n", &xdim, &ydim, &used) == 2; p++) {
+        for (i = 0; i < nbits; i++) {
+            for (j = 0; j < nfps; j++) {
+                for (k = 0; k < nlengths; k++) {
+                    RunBench(xdim, ydim, bits[i], fps[j], lengths[k], &encode, dir, out, first);
+                    first = 0;
+                }
+            }
+        }
+        p += used;
+        if (*p != ',') {
+            break;
+        }
+    }
+    fprintf(out, "\n ]}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return(0);
+}
@@ -0,0 +1,185 @@
+/*
+ *  pixel_bench.c
+ *
+ *  Microbenchmark of the pixel-transfer kernels (pixel_kernels.h) and the
+ *  colour split (color_convert.h) at every vector width this CPU runs, so a kernel change can be judged in GB/s and
+ *  the run-time dispatch checked against what is actually fastest.
+ *
+ *  Each kernel is run over a frame of the given size until it has taken a
+ *  quarter of a second; GB/s counts the bytes read plus the bytes written.
+ *  Every level's output is compared with the scalar kernel's first. The
+ *  frame is small enough by default to stay in L2 like a readout band; give
+ *  a full frame, e.g. -s 1024x1024, to measure from memory.
+ *
+ *  Compile and run as:
+ *
+ *	    gcc -O2 pixel_bench.c pixel_kernels.c color_convert.c -o pixel_bench
+ *	    ./pixel_bench [-s 1024x64] [-r repeat_seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pixel_kernels.h"
+#include "color_convert.h"
+
+enum { K_COPY, K_IPL, K_RGB, K_PACK, K_UNPACK, K_COLOR, KERNELS };
+
+static const char *kernelnames[KERNELS] = { "copy", "grey_to_ipl", "grey_to_rgb", "pack16", "unpack8", "color_split" };
+
+static int xdim = 1024, ydim = 64, stride;
+static unsigned char *grey, *rgb, *out, *ref;
+static unsigned short *words;
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The colour planes laid out back to back in 'dst', so they compare as one buffer
+static void Planes(unsigned char *dst, ColorPlanes *p)
+{
+    size_t n = (size_t)xdim * ydim;
+
+    p->xdim = xdim;
+    p->ydim = ydim;
+    p->r = dst;
+    p->g = p->r + n;
+    p->b = p->g + n;
+    p->y = p->grey = p->b + n;
+    p->cr = p->y + n;
+    p->cb = p->cr + n;
+    p->bri = p->cb + n;
+    p->sat = p->bri + n;
+    p->hue = p->sat + n;
+}
+
+// Run kernel 'kernel' once at 'k' into 'dst'; returns the bytes it moved
+static double Run(const PxKernels *k, int kernel, unsigned char *dst)
+{
+    size_t n = (size_t)xdim * ydim;
+    ColorPlanes planes;
+
+    switch (kernel) {
+    case K_COPY:
+        k->copy(grey, dst, n);
+        return 2.0 * n;
+    case K_IPL:
+        PxCopyRows(k, grey, xdim, ydim, dst, stride);
+        return 2.0 * n;
+    case K_RGB:
+        k->greytorgb(grey, dst, n);
+        return 4.0 * n;
+    case K_PACK:
+        k->pack16(words, dst, n, 2);
+        return 3.0 * n;
+    case K_UNPACK:
+        k->unpack8(grey, (unsigned short *)dst, n, 2);
+        return 3.0 * n;
+    default:
+        Planes(dst, &planes);
+        ColorSplitAt(k->level, rgb, &planes);
+        return 12.0 * n;
+    }
+}
+
+static size_t OutputBytes(int kernel)
+{
+    size_t n = (size_t)xdim * ydim;
+
+    switch (kernel) {
+    case K_IPL:     return (size_t)stride * ydim;
+    case K_RGB:     return 3 * n;
+    case K_UNPACK:  return 2 * n;
+    case K_COLOR:   return 9 * n;
+    default:        return n;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const PxKernels *best = PxBest();
+    double seconds = 0.25, gbps[KERNELS][PX_LEVELS];
+    size_t n, i;
+    int c, kernel, level, errors = 0;
+
+    while ((c = getopt(argc, argv, "s:r:")) != -1) {
+        switch (c) {
+        case 's':   sscanf(optarg, "%dx%d", &xdim, &ydim);     break;
+        case 'r':   seconds = atof(optarg);                     break;
+        default:
+            fprintf(stderr, "usage %s [-s WxH] [-r repeat_seconds]\n", argv[0]);
+            exit(1);
+        }
+    }
+    n = (size_t)xdim * ydim;
+    stride = (xdim + 3) & ~3;                   // IplImage rows are 4 byte aligned
+    grey = (unsigned char *)malloc(n);
+    rgb = (unsigned char *)malloc(3 * n);
+    words = (unsigned short *)malloc(2 * n);
+    out = (unsigned char *)malloc(9 * n + (size_t)(stride - xdim) * ydim + 64);
+    ref = (unsigned char *)malloc(9 * n + (size_t)(stride - xdim) * ydim + 64);
+    if (grey == NULL || rgb == NULL || words == NULL || out == NULL || ref == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    srand(1);
+    for (i = 0; i < n; i++) {
+        grey[i] = (unsigned char)rand();
+        words[i] = (unsigned short)(rand() & 0x3ff);
+    }
+    for (i = 0; i < 3 * n; i++) {
+        rgb[i] = (unsigned char)rand();
+    }
+
+    printf("%dx%d pixels, CPU level %s, dispatching %s\n\n", xdim, ydim, PxLevelName(PxCpuLevel()), PxLevelName(best->level));
+    printf("%-12s", "GB/s");
+    for (level = 0; level < PX_LEVELS; level++) {
+        printf("%10s", PxLevelName((PxLevel)level));
+    }
+    printf("%10s\n", "fastest");
+
+    for (kernel = 0; kernel < KERNELS; kernel++) {
+        int fastest = PX_SCALAR;
+
+        memset(ref, 0, OutputBytes(kernel));
+        Run(PxKernelsAt(PX_SCALAR), kernel, ref);
+
+        printf("%-12s", kernelnames[kernel]);
+        for (level = 0; level < PX_LEVELS; level++) {
+            const PxKernels *k = PxKernelsAt((PxLevel)level);
+            double bytes = 0, start, elapsed;
+            int runs = 0;
+
+            gbps[kernel][level] = 0;
+            if (k == NULL) {
+                printf("%10s", "-");
+                continue;
+            }
+            memset(out, 0, OutputBytes(kernel));
+            Run(k, kernel, out);
+            if (memcmp(out, ref, OutputBytes(kernel)) != 0) {
+                printf("%10s", "WRONG");
+                errors++;
+                continue;
+            }
+            start = Now();
+            do {
+                bytes += Run(k, kernel, out);
+                runs++;
+            } while ((elapsed = Now() - start) < seconds || runs < 3);
+            gbps[kernel][level] = bytes / elapsed / 1e9;
+            if (gbps[kernel][level] > gbps[kernel][fastest]) {
+                fastest = level;
+            }
+            printf("%10.2f", gbps[kernel][level]);
+        }
+        printf("%10s%s\n", PxLevelName((PxLevel)fastest), fastest != (int)best->level ? " *" : "");
+    }
+    printf("\n* = faster than the dispatched level on this machine - PIXEL_KERNELS=<level> dispatches it\n");
+    return(errors ? 1 : 0);
+}
@@ -0,0 +1,380 @@
+/*
+ *  pixel_kernels.c
+ *
+ *  Pixel-transfer kernels at scalar, SSE, AVX2 and AVX-512 widths - see pixel_kernels.h.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pixel_kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__clang__)
+    #define PX_X86  1
+    #include <immintrin.h>
+    #define TARGET(isa)     __attribute__((target(isa)))
+#else
+    #define PX_X86  0
+#endif
+
+// The scalar level is the yardstick, so keep the compiler from vectorizing it
+#if defined(__GNUC__) && !defined(__clang__)
+    #define SCALAR  __attribute__((optimize("no-tree-vectorize")))
+#else
+    #define SCALAR
+#endif
+
+static const char *levelnames[PX_LEVELS] = { "scalar", "sse", "avx2", "avx512" };
+
+const char *PxLevelName(PxLevel level)
+{
+    return level >= 0 && level < PX_LEVELS ? levelnames[level] : "unknown";
+}
+
+
+
+// ================================================================================================
+// Scalar
+// ================================================================================================
+SCALAR static void CopyScalar(const unsigned char *src, unsigned char *dst, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = src[i];
+    }
+}
+
+SCALAR static void GreyToRGBScalar(const unsigned char *grey, unsigned char *rgb, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        rgb[3*i] = rgb[3*i+1] = rgb[3*i+2] = grey[i];
+    }
+}
+
+SCALAR static void Pack16Scalar(const unsigned short *src, unsigned char *dst, size_t n, int shift)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned int v = src[i] >> shift;
+        dst[i] = (unsigned char)(v > 255 ? 255 : v);
+    }
+}
+
+SCALAR static void Unpack8Scalar(const unsigned char *src, unsigned short *dst, size_t n, int shift)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = (unsigned short)(src[i] << shift);
+    }
+}
+
+static const PxKernels scalar = { PX_SCALAR, CopyScalar, GreyToRGBScalar, Pack16Scalar, Unpack8Scalar };
+
+
+
+#if PX_X86
+// ================================================================================================
+// SSE - 16 bytes at a time; the tails go to the scalar kernels
+// ================================================================================================
+TARGET("sse2") static void CopySSE(const unsigned char *src, unsigned char *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+        _mm_storeu_si128((__m128i *)(dst + i), a);
+        _mm_storeu_si128((__m128i *)(dst + i + 16), b);
+        _mm_storeu_si128((__m128i *)(dst + i + 32), c);
+        _mm_storeu_si128((__m128i *)(dst + i + 48), d);
+    }
+    CopyScalar(src + i, dst + i, n - i);
+}
+
+// 16 grey pixels -> 48 bytes of RGB per three shuffles
+TARGET("ssse3") static void GreyToRGBSSE(const unsigned char *grey, unsigned char *rgb, size_t n)
+{
+    const __m128i s0 = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i s1 = _mm_setr_epi8( 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10);
+    const __m128i s2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i g = _mm_loadu_si128((const __m128i *)(grey + i));
+        _mm_storeu_si128((__m128i *)(rgb + 3*i),      _mm_shuffle_epi8(g, s0));
+        _mm_storeu_si128((__m128i *)(rgb + 3*i + 16), _mm_shuffle_epi8(g, s1));
+        _mm_storeu_si128((__m128i *)(rgb + 3*i + 32), _mm_shuffle_epi8(g, s2));
+    }
+    GreyToRGBScalar(grey + i, rgb + 3*i, n - i);
+}
+
+TARGET("sse2") static void Pack16SSE(const unsigned short *src, unsigned char *dst, size_t n, int shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(src + i)), count);
+        __m128i b = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(src + i + 8)), count);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+    Pack16Scalar(src + i, dst + i, n - i, shift);
+}
+
+TARGET("sse2") static void Unpack8SSE(const unsigned char *src, unsigned short *dst, size_t n, int shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i),     _mm_sll_epi16(_mm_unpacklo_epi8(p, zero), count));
+        _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_sll_epi16(_mm_unpackhi_epi8(p, zero), count));
+    }
+    Unpack8Scalar(src + i, dst + i, n - i, shift);
+}
+
+static const PxKernels sse = { PX_SSE, CopySSE, GreyToRGBSSE, Pack16SSE, Unpack8SSE };
+
+
+
+// ================================================================================================
+// AVX2 - 32 bytes at a time. Shuffles and packs work within 128 bit lanes, so the lanes are
+// loaded, or the results permuted, to suit
+// ================================================================================================
+TARGET("avx2") static void CopyAVX2(const unsigned char *src, unsigned char *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 128 <= n; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(src + i + 96));
+        _mm256_storeu_si256((__m256i *)(dst + i), a);
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), b);
+        _mm256_storeu_si256((__m256i *)(dst + i + 64), c);
+        _mm256_storeu_si256((__m256i *)(dst + i + 96), d);
+    }
+    CopySSE(src + i, dst + i, n - i);
+}
+
+TARGET("avx2") static __m256i Lanes(__m128i low, __m128i high)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+}
+
+// 32 grey pixels -> 96 bytes of RGB: each lane shuffles the 16 pixels its 16 bytes come from
+TARGET("avx2") static void GreyToRGBAVX2(const unsigned char *grey, unsigned char *rgb, size_t n)
+{
+    const __m128i s0 = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i s1 = _mm_setr_epi8( 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10);
+    const __m128i s2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
+    const __m256i m01 = Lanes(s0, s1), m20 = Lanes(s2, s0), m12 = Lanes(s1, s2);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m128i g0 = _mm_loadu_si128((const __m128i *)(grey + i));
+        __m128i g1 = _mm_loadu_si128((const __m128i *)(grey + i + 16));
+        _mm256_storeu_si256((__m256i *)(rgb + 3*i),      _mm256_shuffle_epi8(Lanes(g0, g0), m01));
+        _mm256_storeu_si256((__m256i *)(rgb + 3*i + 32), _mm256_shuffle_epi8(Lanes(g0, g1), m20));
+        _mm256_storeu_si256((__m256i *)(rgb + 3*i + 64), _mm256_shuffle_epi8(Lanes(g1, g1), m12));
+    }
+    GreyToRGBSSE(grey + i, rgb + 3*i, n - i);
+}
+
+TARGET("avx2") static void Pack16AVX2(const unsigned short *src, unsigned char *dst, size_t n, int shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *)(src + i)), count);
+        __m256i b = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *)(src + i + 16)), count);
+        __m256i p = _mm256_packus_epi16(a, b);          // a0 b0 a1 b1 in 64 bit quarters
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(p, 0xd8));
+    }
+    Pack16SSE(src + i, dst + i, n - i, shift);
+}
+
+TARGET("avx2") static void Unpack8AVX2(const unsigned char *src, unsigned short *dst, size_t n, int shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i)));
+        __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i + 16)));
+        _mm256_storeu_si256((__m256i *)(dst + i),      _mm256_sll_epi16(a, count));
+        _mm256_storeu_si256((__m256i *)(dst + i + 16), _mm256_sll_epi16(b, count));
+    }
+    Unpack8SSE(src + i, dst + i, n - i, shift);
+}
+
+static const PxKernels avx2 = { PX_AVX2, CopyAVX2, GreyToRGBAVX2, Pack16AVX2, Unpack8AVX2 };
+
+
+
+// ================================================================================================
+// AVX-512 (BW) - 64 bytes at a time
+// ================================================================================================
+TARGET("avx512f,avx512bw") static void CopyAVX512(const unsigned char *src, unsigned char *dst, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 256 <= n; i += 256) {
+        __m512i a = _mm512_loadu_si512((const void *)(src + i));
+        __m512i b = _mm512_loadu_si512((const void *)(src + i + 64));
+        __m512i c = _mm512_loadu_si512((const void *)(src + i + 128));
+        __m512i d = _mm512_loadu_si512((const void *)(src + i + 192));
+        _mm512_storeu_si512((void *)(dst + i), a);
+        _mm512_storeu_si512((void *)(dst + i + 64), b);
+        _mm512_storeu_si512((void *)(dst + i + 128), c);
+        _mm512_storeu_si512((void *)(dst + i + 192), d);
+    }
+    CopyAVX2(src + i, dst + i, n - i);
+}
+
+TARGET("avx512f,avx512bw") static __m512i Lanes4(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    __m512i v = _mm512_castsi128_si512(a);
+    v = _mm512_inserti32x4(v, b, 1);
+    v = _mm512_inserti32x4(v, c, 2);
+    return _mm512_inserti32x4(v, d, 3);
+}
+
+// 64 grey pixels -> 192 bytes of RGB, lane by lane as in the AVX2 kernel
+TARGET("avx512f,avx512bw") static void GreyToRGBAVX512(const unsigned char *grey, unsigned char *rgb, size_t n)
+{
+    const __m128i s0 = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i s1 = _mm_setr_epi8( 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10);
+    const __m128i s2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
+    const __m512i m0 = Lanes4(s0, s1, s2, s0), m1 = Lanes4(s1, s2, s0, s1), m2 = Lanes4(s2, s0, s1, s2);
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m128i g0 = _mm_loadu_si128((const __m128i *)(grey + i));
+        __m128i g1 = _mm_loadu_si128((const __m128i *)(grey + i + 16));
+        __m128i g2 = _mm_loadu_si128((const __m128i *)(grey + i + 32));
+        __m128i g3 = _mm_loadu_si128((const __m128i *)(grey + i + 48));
+        _mm512_storeu_si512((void *)(rgb + 3*i),       _mm512_shuffle_epi8(Lanes4(g0, g0, g0, g1), m0));
+        _mm512_storeu_si512((void *)(rgb + 3*i + 64),  _mm512_shuffle_epi8(Lanes4(g1, g1, g2, g2), m1));
+        _mm512_storeu_si512((void *)(rgb + 3*i + 128), _mm512_shuffle_epi8(Lanes4(g2, g3, g3, g3), m2));
+    }
+    GreyToRGBAVX2(grey + i, rgb + 3*i, n - i);
+}
+
+// Unsigned saturating narrow - no lane fix-up needed
+TARGET("avx512f,avx512bw") static void Pack16AVX512(const unsigned short *src, unsigned char *dst, size_t n, int shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m512i a = _mm512_srl_epi16(_mm512_loadu_si512((const void *)(src + i)), count);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm512_cvtusepi16_epi8(a));
+    }
+    Pack16AVX2(src + i, dst + i, n - i, shift);
+}
+
+TARGET("avx512f,avx512bw") static void Unpack8AVX512(const unsigned char *src, unsigned short *dst, size_t n, int shift)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m512i a = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(src + i)));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_sll_epi16(a, count));
+    }
+    Unpack8AVX2(src + i, dst + i, n - i, shift);
+}
+
+static const PxKernels avx512 = { PX_AVX512, CopyAVX512, GreyToRGBAVX512, Pack16AVX512, Unpack8AVX512 };
+#endif
+
+
+
+// ================================================================================================
+// Dispatch
+// ================================================================================================
+PxLevel PxCpuLevel(void)
+{
+#if PX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        return PX_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return PX_AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return PX_SSE;
+    }
+#endif
+    return PX_SCALAR;
+}
+
+const PxKernels *PxKernelsAt(PxLevel level)
+{
+    if (level < PX_SCALAR || level > PxCpuLevel()) {
+        return NULL;
+    }
+#if PX_X86
+    switch (level) {
+    case PX_SSE:        return &sse;
+    case PX_AVX2:       return &avx2;
+    case PX_AVX512:     return &avx512;
+    default:            break;
+    }
+#endif
+    return &scalar;
+}
+
+const PxKernels *PxBest(void)
+{
+    static const PxKernels *best = NULL;
+    const char *cap = getenv("PIXEL_KERNELS");
+    int level, named;
+
+    if (best == NULL) {
+        level = PxCpuLevel();
+        for (named = PX_SCALAR; cap != NULL && named < PX_LEVELS && strcmp(cap, PxLevelName((PxLevel)named)) != 0; named++)
+            ;
+        if (cap != NULL && named == PX_LEVELS) {
+            // A typo - the narrowest level is the one certain to be no wider than was meant
+            level = PX_SCALAR;
+            fprintf(stderr, "PIXEL_KERNELS=%s is not a level (scalar, sse, avx2, avx512) - using %s\n", cap, PxLevelName((PxLevel)level));
+        }
+        else if (cap != NULL && named > level) {
+            fprintf(stderr, "PIXEL_KERNELS=%s is wider than this cpu supports - using %s\n", cap, PxLevelName((PxLevel)level));
+        }
+        else if (cap != NULL) {
+            level = named;
+        }
+        best = PxKernelsAt((PxLevel)level);
+    }
+    return best;
+}
+
+void PxCopyRows(const PxKernels *k, const unsigned char *src, int xdim, int ydim, unsigned char *dst, int dststride)
+{
+    int y;
+
+    if (dststride == xdim) {
+        k->copy(src, dst, (size_t)xdim * ydim);
+        return;
+    }
+    for (y = 0; y < ydim; y++) {
+        k->copy(src + (size_t)y * xdim, dst + (size_t)y * dststride, xdim);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ *  pixel_kernels.h
+ *
+ *  The pixel-transfer loops of the capture program and the examples, as
+ *  kernels built at every x86 vector width and picked for the CPU at run
+ *  time, so one binary runs anywhere and still uses the widest registers
+ *  the machine has:
+ *
+ *	    copy        grey bytes, e.g. a frame into an IplImage row
+ *	    greytorgb   grey to the RGB triplets GTK draws
+ *	    pack16      16 bit words (10/12 bit cameras) to 8 bit, src >> shift
+ *	                saturated at 255; src >> shift must fit in 15 bits
+ *	    unpack8     8 bit to 16 bit words, src << shift
+ *
+ *  Every level is compiled in with GCC's target attributes - no -m flags
+ *  are needed - and PxKernelsAt() only hands out a level the CPU and OS
+ *  support. The SSE level needs SSSE3 (for greytorgb), AVX-512 needs
+ *  AVX512BW. PxBest() takes the widest, or no wider than the level named
+ *  by the PIXEL_KERNELS environment variable (scalar, sse, avx2, avx512)
+ *  where pixel_bench shows a narrower one to be faster on a machine; a
+ *  name it doesn't know gets the scalar level, with a warning on stderr.
+ */
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum { PX_SCALAR, PX_SSE, PX_AVX2, PX_AVX512, PX_LEVELS } PxLevel;
+
+typedef struct {
+    PxLevel level;
+    void    (*copy)(const unsigned char *src, unsigned char *dst, size_t n);
+    void    (*greytorgb)(const unsigned char *grey, unsigned char *rgb, size_t n);
+    void    (*pack16)(const unsigned short *src, unsigned char *dst, size_t n, int shift);
+    void    (*unpack8)(const unsigned char *src, unsigned short *dst, size_t n, int shift);
+} PxKernels;
+
+PxLevel PxCpuLevel(void);
+const char *PxLevelName(PxLevel level);
+const PxKernels *PxKernelsAt(PxLevel level);
+const PxKernels *PxBest(void);
+
+// xdim x ydim grey pixels into rows 'dststride' bytes apart (IplImage widthStep)
+void PxCopyRows(const PxKernels *k, const unsigned char *src, int xdim, int ydim, unsigned char *dst, int dststride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
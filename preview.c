@@ -0,0 +1,415 @@
+/*
+ *  preview.c
+ *
+ *  Decimated live preview over TCP - see preview.h.
+ *
+ *  One publisher thread owns the listening socket and the viewer connection,
+ *  in the same socket()/bind()/listen()/accept() pattern as server.c. The
+ *  drain thread only ever touches the one-frame mailbox, with a trylock, so
+ *  neither a slow viewer nor the box filter can hold up capture.
+ *
+ *  Frames are sent as raw grey bytes. Build with -DPREVIEW_JPEG_QUALITY=<q>
+ *  (and -ljpeg) to send JPEG instead.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Sockets
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <pthread.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#if defined(PREVIEW_JPEG_QUALITY)
+    #include <jpeglib.h>
+#endif
+
+#include "preview.h"
+
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t offered = PTHREAD_COND_INITIALIZER;
+static volatile int running = 0;
+static volatile int viewerfd = -1;
+static int listenfd = -1;
+static int every = 10, scale = 4;
+
+// Mailbox - the frame most recently offered and not yet taken by the publisher
+static const unsigned char *pending = NULL;
+static int pendingx, pendingy;
+static long pendingnumber;
+
+static long sent = 0, dropped = 0;
+
+
+
+// ================================================================================================
+// 2x2 box filter - the common case gets its own SSE2 path
+// ================================================================================================
+static void Halve(const unsigned char *src, int xdim, int ydim, unsigned char *dst)
+{
+    int ox = xdim / 2, oy = ydim / 2;
+    int x, y;
+
+    for (y = 0; y < oy; y++) {
+        const unsigned char *r0 = src + (size_t)2*y*xdim;
+        const unsigned char *r1 = r0 + xdim;
+        unsigned char *out = dst + (size_t)y*ox;
+        x = 0;
+
+#if defined(__SSE2__)
+        // Sum each even/odd byte pair of both rows in 16 bits and round once, as the scalar loop
+        // does, 16 output pixels at a time
+        const __m128i low = _mm_set1_epi16(0x00ff), two = _mm_set1_epi16(2);
+        for (; x + 16 <= ox; x += 16) {
+            __m128i a0 = _mm_loadu_si128((const __m128i *)(r0 + 2*x));
+            __m128i a1 = _mm_loadu_si128((const __m128i *)(r0 + 2*x + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i *)(r1 + 2*x));
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(r1 + 2*x + 16));
+            __m128i s0 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, low), _mm_srli_epi16(a0, 8)),
+                                       _mm_add_epi16(_mm_and_si128(b0, low), _mm_srli_epi16(b0, 8)));
+            __m128i s1 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, low), _mm_srli_epi16(a1, 8)),
+                                       _mm_add_epi16(_mm_and_si128(b1, low), _mm_srli_epi16(b1, 8)));
+            s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+            s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+            _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(s0, s1));
+        }
+#endif
+        for (; x < ox; x++) {
+            out[x] = (unsigned char)((r0[2*x] + r0[2*x+1] + r1[2*x] + r1[2*x+1] + 2) / 4);
+        }
+    }
+}
+
+
+
+// ================================================================================================
+// Box filter: average each factor x factor block of src into one pixel of dst
+// dst is (xdim/factor) x (ydim/factor); pixels past the last whole block are ignored
+// ================================================================================================
+void PreviewDownsample(const unsigned char *src, int xdim, int ydim, int factor, unsigned char *dst)
+{
+    int ox = xdim / factor, oy = ydim / factor;
+    unsigned short *colsum;
+    int x, y, r, i;
+
+    if (factor <= 1) {
+        memcpy(dst, src, (size_t)xdim*ydim);
+        return;
+    }
+    if (factor == 2) {
+        Halve(src, xdim, ydim, dst);
+        return;
+    }
+
+    // Sum 'factor' rows into colsum[], then 'factor' columns of that into each output pixel
+    if ((colsum = (unsigned short *)malloc((size_t)xdim * sizeof(unsigned short))) == NULL) {
+        return;
+    }
+    for (y = 0; y < oy; y++) {
+        memset(colsum, 0, (size_t)xdim * sizeof(unsigned short));
+        for (r = 0; r < factor; r++) {
+            const unsigned char *row = src + (size_t)(y*factor + r)*xdim;
+            x = 0;
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            for (; x + 16 <= xdim; x += 16) {
+                __m128i p = _mm_loadu_si128((const __m128i *)(row + x));
+                __m128i *c = (__m128i *)(colsum + x);
+                _mm_storeu_si128(c,     _mm_add_epi16(_mm_loadu_si128(c),     _mm_unpacklo_epi8(p, zero)));
+                _mm_storeu_si128(c + 1, _mm_add_epi16(_mm_loadu_si128(c + 1), _mm_unpackhi_epi8(p, zero)));
+            }
+#endif
+            for (; x < xdim; x++) {
+                colsum[x] += row[x];
+            }
+        }
+        for (x = 0; x < ox; x++) {
+            unsigned int sum = 0;
+            for (i = 0; i < factor; i++) {
+                sum += colsum[x*factor + i];
+            }
+            dst[(size_t)y*ox + x] = (unsigned char)((sum + factor*factor/2) / (factor*factor));
+        }
+    }
+    free(colsum);
+}
+
+
+
+// ================================================================================================
+// JPEG encoding, when built in; returns the JPEG size, or 0 to send the frame raw
+// ================================================================================================
+static size_t Encode(const unsigned char *grey, int width, int height, unsigned char **jpeg)
+{
+#if defined(PREVIEW_JPEG_QUALITY)
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned long size = 0;
+    int y;
+
+    *jpeg = NULL;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, jpeg, &size);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 1;
+    cinfo.in_color_space = JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, PREVIEW_JPEG_QUALITY, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    for (y = 0; y < height; y++) {
+        JSAMPROW row = (JSAMPROW)(grey + (size_t)y*width);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return (size_t)size;
+#else
+    (void)grey; (void)width; (void)height;
+    *jpeg = NULL;
+    return(0);
+#endif
+}
+
+
+
+// ================================================================================================
+// Send all of buf; -1 if the viewer has gone
+// ================================================================================================
+static int SendAll(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return(-1);
+        }
+        p += n;
+        len -= n;
+    }
+    return(0);
+}
+
+static void CloseViewer(void)
+{
+    if (viewerfd >= 0) {
+        close(viewerfd);
+        printf("Preview viewer disconnected (%ld frames sent, %ld skipped).\r\n", sent, dropped);
+    }
+    viewerfd = -1;
+}
+
+
+
+// ================================================================================================
+// Publisher thread: accept a viewer, then downsample and send whatever is in the mailbox
+// ================================================================================================
+static void *PreviewThread(void *arg)
+{
+    unsigned char *small = NULL;
+    size_t smallsize = 0;
+    (void)arg;
+
+    while (running) {
+
+        // No viewer - wait for one
+        if (viewerfd < 0) {
+            struct pollfd pfd;
+            pfd.fd = listenfd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 200) > 0) {
+                struct sockaddr_in cli_addr;
+                socklen_t clilen = sizeof(cli_addr);
+                int fd = accept(listenfd, (struct sockaddr *) &cli_addr, &clilen);
+                if (fd >= 0) {
+                    sent = dropped = 0;
+                    viewerfd = fd;
+                    printf("Preview viewer connected from %s.\r\n", inet_ntoa(cli_addr.sin_addr));
+                }
+            }
+            continue;
+        }
+
+        // Take the offered frame; the box filter runs under the lock so the frame can't be freed meanwhile
+        PreviewHeader header;
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += 200000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&lock);
+        while (running && pending == NULL) {
+            if (pthread_cond_timedwait(&offered, &lock, &until) == ETIMEDOUT) {
+                break;
+            }
+        }
+        if (pending == NULL) {
+            pthread_mutex_unlock(&lock);
+
+            // Notice a viewer that has gone away while nothing is being captured
+            char c;
+            if (recv(viewerfd, &c, 1, MSG_DONTWAIT) == 0) {
+                CloseViewer();
+            }
+            continue;
+        }
+        header.width = pendingx / scale;
+        header.height = pendingy / scale;
+        header.frame = (uint32_t)pendingnumber;
+        if ((size_t)header.width * header.height > smallsize) {
+            free(small);
+            smallsize = (size_t)header.width * header.height;
+            small = (unsigned char *)malloc(smallsize);
+        }
+        if (small != NULL) {
+            PreviewDownsample(pending, pendingx, pendingy, scale, small);
+        }
+        pending = NULL;
+        pthread_mutex_unlock(&lock);
+        if (small == NULL) {
+            smallsize = 0;
+            continue;
+        }
+
+        // Encode and send - only this thread waits on a slow viewer
+        unsigned char *jpeg;
+        size_t jpegsize = Encode(small, header.width, header.height, &jpeg);
+        const unsigned char *payload = jpegsize ? jpeg : small;
+        size_t length = jpegsize ? jpegsize : (size_t)header.width * header.height;
+
+        header.encoding = htonl(jpegsize ? PREVIEW_JPEG : PREVIEW_RAW);
+        header.length = htonl((uint32_t)length);
+        header.magic = htonl(PREVIEW_MAGIC);
+        header.frame = htonl(header.frame);
+        header.width = htonl(header.width);
+        header.height = htonl(header.height);
+        if (SendAll(viewerfd, &header, sizeof(header)) < 0 || SendAll(viewerfd, payload, length) < 0) {
+            CloseViewer();
+        }
+        else {
+            sent++;
+        }
+        free(jpeg);
+    }
+
+    CloseViewer();
+    free(small);
+    return NULL;
+}
+
+
+
+// ================================================================================================
+// Listen for a viewer on 'port' and start the publisher; every Nth frame, scaled down by 'scale'
+// ================================================================================================
+int PreviewStart(int port, int everyn, int scalen)
+{
+    struct sockaddr_in serv_addr;
+    int on = 1;
+
+    every = everyn > 0 ? everyn : 1;
+    scale = scalen > 0 ? scalen : 1;
+
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0) {
+        perror("PreviewStart: socket");
+        return(-1);
+    }
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset((char *) &serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons(port);
+    if (bind(listenfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+        perror("PreviewStart: bind");
+        close(listenfd);
+        listenfd = -1;
+        return(-1);
+    }
+    listen(listenfd, 1);
+
+    running = 1;
+    if (pthread_create(&thread, NULL, PreviewThread, NULL) != 0) {
+        perror("PreviewStart: pthread_create");
+        running = 0;
+        close(listenfd);
+        listenfd = -1;
+        return(-1);
+    }
+    printf("Live preview on TCP port %d: every %d frames, 1/%d scale.\r\n\n", port, every, scale);
+    return(0);
+}
+
+void PreviewStop(void)
+{
+    if (!running) {
+        return;
+    }
+    running = 0;
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&offered);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    close(listenfd);
+    listenfd = -1;
+}
+
+
+
+// ================================================================================================
+// Called by the drain thread for every frame read out - returns at once
+// ================================================================================================
+void PreviewOffer(const unsigned char *frame, int xdim, int ydim, long number)
+{
+    if (!running || viewerfd < 0 || number % every != 0) {
+        return;
+    }
+    if (pthread_mutex_trylock(&lock) != 0) {
+        dropped++;          // publisher is busy filtering the previous one
+        return;
+    }
+    if (pending != NULL) {
+        dropped++;          // previous one never got picked up - viewer is slow
+    }
+    pending = frame;
+    pendingx = xdim;
+    pendingy = ydim;
+    pendingnumber = number;
+    pthread_cond_signal(&offered);
+    pthread_mutex_unlock(&lock);
+}
+
+
+
+// ================================================================================================
+// The sequence is about to be freed - forget any frame still in the mailbox
+// ================================================================================================
+void PreviewEndSequence(void)
+{
+    pthread_mutex_lock(&lock);
+    pending = NULL;
+    pthread_mutex_unlock(&lock);
+}
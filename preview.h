@@ -0,0 +1,49 @@
+/*
+ *  preview.h
+ *
+ *  Live preview of a trial while it is being captured. The drain thread
+ *  offers every frame it reads out; every Nth one is box filtered down by
+ *  'scale' in each direction and streamed over TCP to one viewer at a time
+ *  (see preview_viewer.c).
+ *
+ *  PreviewOffer() never waits: if the publisher is still busy with the last
+ *  preview frame, or the viewer is reading slowly, the frame is skipped.
+ *
+ *  Each preview frame is sent as a 24 byte header of six network order
+ *  uint32's - magic PREVIEW_MAGIC, frame number, width, height, encoding
+ *  (PREVIEW_RAW grey bytes or PREVIEW_JPEG) and payload length - followed
+ *  by the payload.
+ */
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PREVIEW_MAGIC   0x4d4b5056      // "MKPV"
+#define PREVIEW_RAW     0
+#define PREVIEW_JPEG    1
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    frame;
+    uint32_t    width, height;
+    uint32_t    encoding;
+    uint32_t    length;
+} PreviewHeader;
+
+int  PreviewStart(int port, int every, int scale);
+void PreviewOffer(const unsigned char *frame, int xdim, int ydim, long number);
+void PreviewEndSequence(void);
+void PreviewStop(void);
+
+void PreviewDownsample(const unsigned char *src, int xdim, int ydim, int factor, unsigned char *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ *  preview_viewer.c
+ *
+ *  Viewer for the capture program's live preview (see preview.h).
+ *
+ *  Connects to Machine B the same way client.c does, and rewrites the
+ *  newest preview frame to a file - preview.pgm, or preview.jpg when the
+ *  capture program sends JPEG - for an image viewer that reloads on change
+ *  (e.g. "feh --reload 0.2 preview.pgm").
+ *
+ *  Compile and run as:
+ *
+ *	    gcc preview_viewer.c -o preview_viewer
+ *	    ./preview_viewer hostname port [basename]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "preview.h"
+
+void error(const char *msg)
+{
+    perror(msg);
+    exit(0);
+}
+
+// Read exactly len bytes; 0 when the capture program closes the connection
+int ReadAll(int sockfd, void *buf, size_t len)
+{
+    char *p = (char *)buf;
+
+    while (len > 0) {
+        ssize_t n = read(sockfd, p, len);
+        if (n < 0)
+            error("ERROR reading from socket");
+        if (n == 0)
+            return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int sockfd, portno;
+    struct sockaddr_in serv_addr;
+    struct hostent *server;
+    const char *base = "preview";
+    char filename[256], tempname[270];
+    PreviewHeader header;
+    unsigned char *payload = NULL;
+    size_t payloadsize = 0;
+    long frames = 0;
+
+    if (argc < 3) {
+        fprintf(stderr,"usage %s hostname port [basename]\n", argv[0]);
+        exit(0);
+    }
+    if (argc > 3)
+        base = argv[3];
+    portno = atoi(argv[2]);
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0)
+        error("ERROR opening socket");
+    server = gethostbyname(argv[1]);
+    if (server == NULL) {
+        fprintf(stderr,"ERROR, no such host\n");
+        exit(0);
+    }
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
+    serv_addr.sin_port = htons(portno);
+    if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0)
+        error("ERROR connecting");
+    printf("Waiting for preview frames from %s:%d\n", argv[1], portno);
+
+    while (ReadAll(sockfd, &header, sizeof(header))) {
+        uint32_t width = ntohl(header.width), height = ntohl(header.height);
+        uint32_t encoding = ntohl(header.encoding), length = ntohl(header.length);
+        FILE *fp;
+
+        if (ntohl(header.magic) != PREVIEW_MAGIC) {
+            fprintf(stderr,"ERROR, not a preview stream\n");
+            break;
+        }
+        if (length > payloadsize) {
+            free(payload);
+            payloadsize = length;
+            payload = (unsigned char *)malloc(payloadsize);
+            if (payload == NULL)
+                error("ERROR allocating frame");
+        }
+        if (!ReadAll(sockfd, payload, length))
+            break;
+
+        // Write to a temporary file and rename, so the image viewer never loads half a frame
+        snprintf(filename, sizeof(filename), "%s.%s", base, encoding == PREVIEW_JPEG ? "jpg" : "pgm");
+        snprintf(tempname, sizeof(tempname), "%s.tmp", filename);
+        if ((fp = fopen(tempname, "wb")) == NULL)
+            error(tempname);
+        if (encoding != PREVIEW_JPEG)
+            fprintf(fp, "P5\n%u %u\n255\n", width, height);
+        fwrite(payload, 1, length, fp);
+        fclose(fp);
+        rename(tempname, filename);
+
+        frames++;
+        printf("\rFrame %u  %ux%u  (%ld received)", ntohl(header.frame), width, height, frames);
+        fflush(stdout);
+    }
+    printf("\nPreview stream closed.\n");
+    free(payload);
+    close(sockfd);
+    return 0;
+}
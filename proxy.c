@@ -0,0 +1,201 @@
+/*
+ *  proxy.c
+ *
+ *  Proxy and contact sheet of a trial - see proxy.h.
+ *
+ *  ProxyAdd() is called from the analysis thread, so it only downsamples
+ *  and appends to a buffered file; at 4x down a 1280x1024 frame is 80 KB,
+ *  and every 10th frame of 1000 fps is 8 MB/s. The sheet is kept in memory
+ *  until ProxyClose().
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "proxy.h"
+#include "preview.h"
+
+#define PROXYBUFFER (1 << 20)
+
+struct ProxyWriter {
+    FILE            *fp;
+    char            path[256], sheetpath[256];
+    int             xdim, ydim, scale, every;
+    int             width, height;          // of a proxy frame
+    int             expected, written;      // proxy frames
+    unsigned char   *small, *thumb;
+    unsigned char   *sheet;
+    int             sheetwidth, sheetheight;
+    int             thumbs, columns, factor, tw, th, next;
+};
+
+// The proxy frame thumbnail j is taken from
+static int Pick(const ProxyWriter *p, int j)
+{
+    return (int)((long)j * p->expected / p->thumbs);
+}
+
+ProxyWriter *ProxyCreate(const char *base, int xdim, int ydim, int scale, int every, int frames)
+{
+    ProxyWriter *p;
+
+    if (scale < 1 || every < 1 || xdim / scale < 1 || ydim / scale < 1
+     || (p = (ProxyWriter *)calloc(1, sizeof(ProxyWriter))) == NULL) {
+        return NULL;
+    }
+    p->xdim = xdim, p->ydim = ydim, p->scale = scale, p->every = every;
+    p->width = xdim / scale, p->height = ydim / scale;
+    p->expected = frames > 0 ? (frames + every - 1) / every : 1;
+    p->thumbs = p->expected < PROXY_THUMBS ? p->expected : PROXY_THUMBS;
+    p->columns = p->thumbs < PROXY_COLUMNS ? p->thumbs : PROXY_COLUMNS;
+    for (p->factor = 1; p->columns*(p->width / p->factor + PROXY_GAP) + PROXY_GAP > PROXY_SHEETWIDTH
+                     && p->width / (p->factor + 1) > 0 && p->height / (p->factor + 1) > 0; p->factor++)
+        ;
+    p->tw = p->width / p->factor, p->th = p->height / p->factor;
+    p->sheetwidth = p->columns*(p->tw + PROXY_GAP) + PROXY_GAP;
+    p->sheetheight = (p->thumbs + p->columns - 1) / p->columns * (p->th + PROXY_GAP) + PROXY_GAP;
+
+    snprintf(p->path, sizeof(p->path), "%s.proxy.pgm", base);
+    snprintf(p->sheetpath, sizeof(p->sheetpath), "%s.sheet.pgm", base);
+    p->small = (unsigned char *)malloc((size_t)p->width*p->height);
+    p->thumb = (unsigned char *)malloc((size_t)p->tw*p->th);
+    p->sheet = (unsigned char *)calloc((size_t)p->sheetwidth*p->sheetheight, 1);
+    if (p->small == NULL || p->thumb == NULL || p->sheet == NULL || (p->fp = fopen(p->path, "wb")) == NULL) {
+        printf("Proxy %s can't be created.\r\n", p->path);
+        free(p->small), free(p->thumb), free(p->sheet), free(p);
+        return NULL;
+    }
+    setvbuf(p->fp, NULL, _IOFBF, PROXYBUFFER);
+    return p;
+}
+
+int ProxyAdd(ProxyWriter *p, const unsigned char *frame, int number)
+{
+    int index, y, x0, y0;
+
+    if (p == NULL || number % p->every != 0) {
+        return(0);
+    }
+    index = number / p->every;
+    PreviewDownsample(frame, p->xdim, p->ydim, p->scale, p->small);
+    if (fprintf(p->fp, "P5\n# frame %d\n%d %d\n255\n", number + 1, p->width, p->height) < 0
+     || fwrite(p->small, (size_t)p->width*p->height, 1, p->fp) != 1) {
+        return(-1);
+    }
+    p->written++;
+
+    // The thumbnails due by now - a frame the drain skipped leaves its thumbnail to the next one
+    for (; p->next < p->thumbs && Pick(p, p->next) <= index; p->next++) {
+        PreviewDownsample(p->small, p->width, p->height, p->factor, p->thumb);
+        x0 = PROXY_GAP + p->next % p->columns * (p->tw + PROXY_GAP);
+        y0 = PROXY_GAP + p->next / p->columns * (p->th + PROXY_GAP);
+        for (y = 0; y < p->th; y++) {
+            memcpy(p->sheet + (size_t)(y0 + y)*p->sheetwidth + x0, p->thumb + (size_t)y*p->tw, (size_t)p->tw);
+        }
+    }
+    return(0);
+}
+
+int ProxyClose(ProxyWriter *p, char *proxypath, char *sheetpath, size_t len)
+{
+    FILE *fp;
+    int err = 0;
+
+    if (p == NULL) {
+        return(-1);
+    }
+    // A write that failed in ProxyAdd() - disk full, say - is still flagged on the stream
+    if (ferror(p->fp)) {
+        err = -1;
+    }
+    if (fclose(p->fp) != 0) {
+        err = -1;
+    }
+    if ((fp = fopen(p->sheetpath, "wb")) == NULL) {
+        err = -1;
+    }
+    else {
+        fprintf(fp, "P5\n# sheet %d frames, every %d, %d thumbnails\n%d %d\n255\n",
+                p->written, p->every, p->next, p->sheetwidth, p->sheetheight);
+        if (fwrite(p->sheet, (size_t)p->sheetwidth*p->sheetheight, 1, fp) != 1) {
+            err = -1;
+        }
+        if (fclose(fp) != 0) {
+            err = -1;
+        }
+    }
+    if (err == 0) {
+        printf("Proxy: %d frames of %dx%d in %s, contact sheet %s.\r\n", p->written, p->width, p->height, p->path, p->sheetpath);
+    }
+    else {
+        printf("Proxy %s or %s couldn't be written.\r\n", p->path, p->sheetpath);
+    }
+    if (proxypath != NULL) {
+        snprintf(proxypath, len, "%s", p->path);
+    }
+    if (sheetpath != NULL) {
+        snprintf(sheetpath, len, "%s", p->sheetpath);
+    }
+    free(p->small), free(p->thumb), free(p->sheet), free(p);
+    return(err);
+}
+
+
+
+// ================================================================================================
+// Reading them back
+// ================================================================================================
+
+// Skips whitespace and comments, noting a "# frame <n>" one
+static void Skip(FILE *fp, int *frame)
+{
+    char comment[128];
+    int c;
+
+    while ((c = getc(fp)) != EOF) {
+        if (c == '#') {
+            if (fgets(comment, sizeof(comment), fp) != NULL) {
+                sscanf(comment, " frame %d", frame);
+            }
+        }
+        else if (!isspace(c)) {
+            ungetc(c, fp);
+            return;
+        }
+    }
+}
+
+unsigned char *ProxyRead(FILE *fp, int *width, int *height, int *frame)
+{
+    unsigned char *image;
+    int maxval;
+
+    *frame = -1;
+    Skip(fp, frame);
+    if (getc(fp) != 'P' || getc(fp) != '5') {
+        return NULL;
+    }
+    Skip(fp, frame);
+    if (fscanf(fp, "%d", width) != 1) {
+        return NULL;
+    }
+    Skip(fp, frame);
+    if (fscanf(fp, "%d", height) != 1) {
+        return NULL;
+    }
+    Skip(fp, frame);
+    if (fscanf(fp, "%d", &maxval) != 1 || maxval != 255 || *width <= 0 || *height <= 0 || !isspace(getc(fp))) {
+        return NULL;
+    }
+    if ((image = (unsigned char *)malloc((size_t)*width * *height)) == NULL) {
+        return NULL;
+    }
+    if (fread(image, (size_t)*width * *height, 1, fp) != 1) {
+        free(image);
+        return NULL;
+    }
+    return image;
+}
@@ -0,0 +1,55 @@
+/*
+ *  proxy.h
+ *
+ *  Low resolution proxy of a trial, written while it is drained, so a
+ *  sweep can be reviewed without opening any full resolution sequence.
+ *  Every Nth frame is box filtered down by 'scale' in each direction
+ *  (PreviewDownsample) and appended to
+ *
+ *	    <base>.proxy.pgm    one binary PGM image per proxy frame, each
+ *	                        with a "# frame <n>" comment, counted from 1
+ *	                        as in the trajectories and events - a
+ *	                        multi-image PGM that netpbm tools read as is
+ *
+ *  and up to PROXY_THUMBS of them, spread evenly over the trial, are laid
+ *  out PROXY_COLUMNS to a row in
+ *
+ *	    <base>.sheet.pgm    the contact sheet, at most PROXY_SHEETWIDTH
+ *	                        pixels wide
+ *
+ *  written by ProxyClose(). trial_browse.c shows both from the catalog.
+ */
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROXY_THUMBS        48
+#define PROXY_COLUMNS       8
+#define PROXY_SHEETWIDTH    1024
+#define PROXY_GAP           2
+
+typedef struct ProxyWriter ProxyWriter;
+
+// 'frames' is how many frames the trial has, to spread the thumbnails over it; NULL if the proxy can't be created
+ProxyWriter *ProxyCreate(const char *base, int xdim, int ydim, int scale, int every, int frames);
+
+// Frame 'number' of the trial, counted from 0, if it is one of every Nth - the caller need not check;
+// -1 if it couldn't be written, which ProxyClose() reports too
+int  ProxyAdd(ProxyWriter *p, const unsigned char *frame, int number);
+
+// Writes the contact sheet and frees 'p'; the paths of the two files are copied out if not NULL
+int  ProxyClose(ProxyWriter *p, char *proxypath, char *sheetpath, size_t len);
+
+// The next image of a proxy or sheet file (malloc'd), with the frame number of its comment or -1; NULL at the end
+unsigned char *ProxyRead(FILE *fp, int *width, int *height, int *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,652 @@
+/*
+ *  raw_store.c
+ *
+ *  Uncompressed .raw sequences, single file or striped - see raw_store.h.
+ */
+#define _FILE_OFFSET_BITS   64
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Linux
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "raw_store.h"
+
+#define AVAILABLE_POLL_US   500
+
+// Frame k of a set of 'n' stripes, runs of 'sf' frames: its stripe, and its index in that stripe's file
+static int StripeOf(int k, int n, int sf)
+{
+    return (k / sf) % n;
+}
+
+static int LocalIndex(int k, int n, int sf)
+{
+    return (k / sf / n) * sf + k % sf;
+}
+
+static const char *BaseName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+
+
+// ================================================================================================
+// Writing
+// ================================================================================================
+static int OpenStripe(RawStripe *s, const RawFileHeader *header, int maxframes, const DiskSettings *settings)
+{
+    unsigned char block[RAW_HEADERBYTES];
+
+    s->header = *header;
+    s->header.frames = 0;
+    s->disk = DiskWriterOpen(s->path, RAW_HEADERBYTES + (uint64_t)maxframes * header->framebytes, settings);
+    if (s->disk == NULL) {
+        return(-1);
+    }
+    memset(block, 0, sizeof(block));
+    memcpy(block, &s->header, sizeof(s->header));
+    if (DiskWriterAppend(s->disk, block, sizeof(block)) < 0) {
+        DiskWriterClose(s->disk, NULL);
+        s->disk = NULL;
+        return(-1);
+    }
+
+    // Without a journal the stripe is still written, it just can't be recovered
+    s->journal = JournalCreate(s->path, &s->header, sizeof(s->header), NULL, 0);
+    return(0);
+}
+
+// The manifest, rewritten on close with the frame count
+static int WriteManifest(const RawWriter *w)
+{
+    FILE *fp = fopen(w->path, "w");
+    int i;
+
+    if (fp == NULL) {
+        perror(w->path);
+        return(-1);
+    }
+    fprintf(fp, "%s %d\n", RAW_MANIFEST, 1);
+    fprintf(fp, "geometry %u %u %u\n", w->header.xdim, w->header.ydim, w->header.fps);
+    fprintf(fp, "frames %u stripeframes %u\n", w->header.frames, w->header.stripeframes);
+    for (i = 0; i < w->nstripes; i++) {
+        fprintf(fp, "stripe %d %s\n", i, w->stripes[i].path);
+    }
+    fflush(fp);
+    fsync(fileno(fp));
+    return (ferror(fp) | fclose(fp)) ? -1 : 0;
+}
+
+RawWriter *RawCreateStriped(const char *path, const char *const dirs[], int ndirs, int stripeframes,
+                            int xdim, int ydim, int fps, int maxframes, const DiskSettings *settings)
+{
+    RawWriter *w = (RawWriter *)calloc(1, sizeof(RawWriter));
+    int i, striped = ndirs > 0, n = striped ? ndirs : 1;
+
+    if (w == NULL) {
+        return NULL;
+    }
+    if (n > RAW_MAXSTRIPES) {
+        fprintf(stderr, "%s: striping over the first %d of %d directories\n", path, RAW_MAXSTRIPES, n);
+        n = RAW_MAXSTRIPES;
+    }
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->header.magic = RAW_MAGIC;
+    w->header.version = RAW_VERSION;
+    w->header.xdim = (uint32_t)xdim;
+    w->header.ydim = (uint32_t)ydim;
+    w->header.fps = (uint32_t)(fps > 0 ? fps : 0);
+    w->header.framebytes = (uint64_t)xdim * ydim;
+    w->header.dataoffset = RAW_HEADERBYTES;
+    w->header.stripes = (uint32_t)n;
+    if (stripeframes <= 0) {
+        stripeframes = (int)((DISK_CHUNK + w->header.framebytes - 1) / w->header.framebytes);
+    }
+    w->header.stripeframes = (uint32_t)(striped ? stripeframes : 0);
+    w->nstripes = n;
+
+    for (i = 0; i < n; i++) {
+        RawStripe *s = &w->stripes[i];
+        int runs = (maxframes + stripeframes - 1) / stripeframes;
+
+        if (!striped) {
+            snprintf(s->path, sizeof(s->path), "%s", path);
+        }
+        else {
+            snprintf(s->path, sizeof(s->path), "%s/%s.%d", dirs[i], BaseName(path), i);
+        }
+        w->header.stripe = (uint32_t)i;
+        if (OpenStripe(s, &w->header, !striped ? maxframes : (runs + n - 1) / n * stripeframes, settings) < 0) {
+            break;
+        }
+    }
+    w->header.stripe = 0;
+    if (i < n || (striped && WriteManifest(w) < 0)) {
+        while (--i >= 0) {
+            DiskWriterClose(w->stripes[i].disk, NULL);
+            JournalClose(w->stripes[i].journal, 1);
+            unlink(w->stripes[i].path);
+        }
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+RawWriter *RawCreate(const char *path, int xdim, int ydim, int fps, int maxframes, const DiskSettings *settings)
+{
+    return RawCreateStriped(path, NULL, 0, 0, xdim, ydim, fps, maxframes, settings);
+}
+
+int RawWriteFrame(RawWriter *w, const unsigned char *frame)
+{
+    RawStripe *s = &w->stripes[w->header.stripeframes > 0 ? StripeOf((int)w->header.frames, w->nstripes, (int)w->header.stripeframes) : 0];
+
+    if (DiskWriterAppend(s->disk, frame, (size_t)w->header.framebytes) < 0) {
+        return(-1);
+    }
+    if (s->journal != NULL) {
+        JournalAppend(s->journal, s->header.frames, s->header.dataoffset + s->header.frames * s->header.framebytes,
+                      (uint32_t)w->header.framebytes, JournalCrc(0, frame, (size_t)w->header.framebytes));
+    }
+    s->header.frames++;
+    w->header.frames++;
+    return(0);
+}
+
+// The stripes' reports summed: bytes add up, the slowest stripe sets the time
+static void SumReports(const RawWriter *w, const DiskReport *each, DiskReport *report)
+{
+    int i;
+
+    memset(report, 0, sizeof(*report));
+    for (i = 0; i < w->nstripes; i++) {
+        const DiskReport *r = &each[i];
+
+        if (i == 0) {
+            *report = *r;
+            continue;
+        }
+        report->direct &= r->direct;
+        report->preallocated &= r->preallocated;
+        report->depth += r->depth;
+        report->inflight += r->inflight;
+        report->maxinflight += r->maxinflight;
+        report->meaninflight += r->meaninflight;
+        report->stalls += r->stalls;
+        report->bytes += r->bytes;
+        if (r->seconds > report->seconds) {
+            report->seconds = r->seconds;
+        }
+    }
+    report->mbps = report->seconds > 0 ? report->bytes / 1e6 / report->seconds : 0;
+}
+
+void RawWriterStatus(RawWriter *w, DiskReport *report, DiskReport *stripes)
+{
+    DiskReport each[RAW_MAXSTRIPES];
+    int i;
+
+    for (i = 0; i < w->nstripes; i++) {
+        DiskWriterStatus(w->stripes[i].disk, &each[i]);
+    }
+    if (report != NULL) {
+        SumReports(w, each, report);
+    }
+    if (stripes != NULL) {
+        memcpy(stripes, each, w->nstripes * sizeof(DiskReport));
+    }
+}
+
+// Close the data, then put the frame counts in the headers through an ordinary descriptor;
+// the journals go once all of that is on the disk
+int RawClose(RawWriter *w, DiskReport *report, DiskReport *stripes)
+{
+    DiskReport each[RAW_MAXSTRIPES];
+    int i, status = 0;
+
+    for (i = 0; i < w->nstripes; i++) {
+        RawStripe *s = &w->stripes[i];
+        FILE *fp;
+
+        if (DiskWriterClose(s->disk, &each[i]) < 0) {
+            status = -1;
+        }
+        fp = fopen(s->path, "r+b");
+        if (fp == NULL || fwrite(&s->header, sizeof(s->header), 1, fp) != 1 || fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+            perror(s->path);
+            status = -1;
+        }
+        if (fp != NULL && fclose(fp) != 0) {
+            status = -1;
+        }
+    }
+    if (w->header.stripeframes > 0 && WriteManifest(w) < 0) {
+        status = -1;
+    }
+    for (i = 0; i < w->nstripes; i++) {
+        JournalClose(w->stripes[i].journal, status == 0);
+    }
+    if (report != NULL) {
+        SumReports(w, each, report);
+    }
+    if (stripes != NULL) {
+        memcpy(stripes, each, w->nstripes * sizeof(DiskReport));
+    }
+    free(w);
+    return(status);
+}
+
+int RawParseStripes(char *list, const char *dirs[], int max)
+{
+    char *dir, *next;
+    int n = 0;
+
+    for (dir = list; dir != NULL && *dir != '\0' && n < max; dir = next) {
+        if ((next = strchr(dir, ',')) != NULL) {
+            *next++ = '\0';
+        }
+        if (*dir != '\0') {
+            dirs[n++] = dir;
+        }
+    }
+    return(n);
+}
+
+
+
+// ================================================================================================
+// Reading
+// ================================================================================================
+// A journal left beside the file: its writer never closed it
+static int Unfinished(const char *path)
+{
+    char name[600];
+
+    snprintf(name, sizeof(name), "%s%s", path, JOURNAL_SUFFIX);
+    return access(name, F_OK) == 0;
+}
+
+static int ReadHeader(FILE *fp, RawFileHeader *h, const char *path)
+{
+    long long size;
+
+    if (Unfinished(path)) {
+        fprintf(stderr, "%s: never closed - finish it with seq_recover first\n", path);
+        return(-1);
+    }
+    if (fread(h, sizeof(*h), 1, fp) != 1 || h->magic != RAW_MAGIC || h->version > RAW_VERSION || h->framebytes == 0) {
+        fprintf(stderr, "%s: not a raw sequence\n", path);
+        return(-1);
+    }
+    if (h->version < 2) {
+        h->stripe = h->stripes = h->stripeframes = 0;
+    }
+
+    // Never closed, with no journal to recover it from: the size is the preallocation, not the frames written
+    if (h->frames == 0 && fseeko(fp, 0, SEEK_END) == 0 && (size = (long long)ftello(fp)) > (long long)h->dataoffset) {
+        fprintf(stderr, "%s: never closed, and there is no journal to recover it from\n", path);
+        return(-1);
+    }
+    return(0);
+}
+
+// A manifest: open every stripe and check it belongs to the set
+static int OpenManifest(RawReader *r, FILE *mf, const char *path)
+{
+    char line[512], stripepath[512];
+    unsigned frames = 0, stripeframes = 0;
+    uint32_t counts[RAW_MAXSTRIPES];
+    int i, k, n = 0, index;
+
+    while (fgets(line, sizeof(line), mf) != NULL) {
+        if (sscanf(line, "frames %u stripeframes %u", &frames, &stripeframes) == 2) {
+            continue;
+        }
+        if (sscanf(line, "stripe %d %511[^\n]", &index, stripepath) == 2 && index == n && n < RAW_MAXSTRIPES) {
+            RawFileHeader h;
+
+            // A stripe's header may never have reached the disk - the set is recovered as a whole
+            if (Unfinished(stripepath)) {
+                fprintf(stderr, "%s: never closed - finish it with seq_recover %s first\n", path, path);
+                return(-1);
+            }
+            if ((r->fp[n] = fopen(stripepath, "rb")) == NULL) {
+                perror(stripepath);
+                return(-1);
+            }
+            if (ReadHeader(r->fp[n], &h, stripepath) < 0 || (int)h.stripe != n || h.stripeframes != stripeframes
+             || (n > 0 && (h.xdim != r->header.xdim || h.ydim != r->header.ydim))) {
+                fprintf(stderr, "%s: %s is not stripe %d of this sequence\n", path, stripepath, n);
+                return(-1);
+            }
+            if (n == 0) {
+                r->header = h;
+            }
+            r->dataoffset[n] = h.dataoffset;
+            counts[n++] = h.frames;
+        }
+    }
+    if (n == 0 || stripeframes == 0) {
+        fprintf(stderr, "%s: no stripes in the manifest\n", path);
+        return(-1);
+    }
+    r->nstripes = n;
+    r->header.stripes = (uint32_t)n;
+    r->header.stripeframes = stripeframes;
+    r->header.stripe = 0;
+
+    // Frames in the sequence: the manifest's count, or up to the first frame a stripe doesn't have
+    if (frames == 0) {
+        for (k = 0; ; k++) {
+            i = StripeOf(k, n, (int)stripeframes);
+            if ((uint32_t)LocalIndex(k, n, (int)stripeframes) >= counts[i]) {
+                break;
+            }
+        }
+        frames = (unsigned)k;
+    }
+    r->header.frames = frames;
+    return(0);
+}
+
+RawReader *RawOpen(const char *path)
+{
+    RawReader *r = (RawReader *)calloc(1, sizeof(RawReader));
+    char magic[sizeof(RAW_MANIFEST)];
+    int status;
+
+    if (r == NULL) {
+        return NULL;
+    }
+    if ((r->fp[0] = fopen(path, "rb")) == NULL) {
+        perror(path);
+        free(r);
+        return NULL;
+    }
+    r->nstripes = 1;
+    if (fread(magic, 1, sizeof(magic) - 1, r->fp[0]) == sizeof(magic) - 1 && memcmp(magic, RAW_MANIFEST, sizeof(magic) - 1) == 0) {
+        FILE *mf = r->fp[0];
+
+        rewind(mf);
+        r->fp[0] = NULL;
+        r->nstripes = 0;
+        status = OpenManifest(r, mf, path);
+        fclose(mf);
+    }
+    else {
+        rewind(r->fp[0]);
+        status = ReadHeader(r->fp[0], &r->header, path);
+        r->dataoffset[0] = r->header.dataoffset;
+        r->header.stripes = 1;
+    }
+    if (status < 0) {
+        r->nstripes = RAW_MAXSTRIPES;
+        RawCloseRead(r);
+        return NULL;
+    }
+    return r;
+}
+
+int RawReadFrame(RawReader *r, int index, unsigned char *frame)
+{
+    int stripe = 0, local = index;
+
+    if (index < 0 || index >= (int)r->header.frames) {
+        return(-1);
+    }
+    if (r->nstripes > 1) {
+        stripe = StripeOf(index, r->nstripes, (int)r->header.stripeframes);
+        local = LocalIndex(index, r->nstripes, (int)r->header.stripeframes);
+    }
+    if (fseeko(r->fp[stripe], (off_t)(r->dataoffset[stripe] + (uint64_t)local * r->header.framebytes), SEEK_SET) != 0
+     || fread(frame, 1, (size_t)r->header.framebytes, r->fp[stripe]) != r->header.framebytes) {
+        return(-1);
+    }
+    return(0);
+}
+
+void RawCloseRead(RawReader *r)
+{
+    int i;
+
+    if (r != NULL) {
+        for (i = 0; i < r->nstripes && i < RAW_MAXSTRIPES; i++) {
+            if (r->fp[i] != NULL) {
+                fclose(r->fp[i]);
+            }
+        }
+        free(r);
+    }
+}
+
+
+
+// ================================================================================================
+// Recovery of a file, or a striped set, that was never closed - see frame_journal.h
+// ================================================================================================
+static int RecoverStripe(const char *path, JournalRecovery *result)
+{
+    JournalContents c;
+    RawFileHeader h;
+    unsigned char *frame = NULL;
+    uint64_t end;
+    int fd = -1, n, status;
+
+    memset(result, 0, sizeof(*result));
+    if ((status = JournalRead(path, &c)) != 0) {
+        return status > 0 ? 0 : -1;
+    }
+    result->journaled = 1;
+    result->records = c.nrecords;
+    memcpy(&h, c.header.header, sizeof(h));
+    if (c.header.headerbytes != sizeof(h) || h.magic != RAW_MAGIC || h.framebytes == 0) {
+        fprintf(stderr, "%s: the journal isn't a raw sequence's\n", path);
+        JournalFree(&c);
+        return(-1);
+    }
+    if ((fd = open(path, O_RDWR)) < 0 || (frame = (unsigned char *)malloc((size_t)h.framebytes)) == NULL) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        JournalFree(&c);
+        return(-1);
+    }
+
+    // Frames in order, up to the first whose bytes aren't what the journal says
+    for (n = 0; n < c.nrecords; n++) {
+        const JournalRecord *r = &c.records[n];
+
+        if (r->offset != h.dataoffset + (uint64_t)n * h.framebytes || r->length != h.framebytes
+         || pread(fd, frame, (size_t)h.framebytes, (off_t)r->offset) != (ssize_t)h.framebytes
+         || JournalCrc(0, frame, (size_t)h.framebytes) != r->datacrc) {
+            break;
+        }
+    }
+    h.frames = (uint32_t)n;
+    end = h.dataoffset + (uint64_t)n * h.framebytes;
+    status = 0;
+    if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || ftruncate(fd, (off_t)end) != 0) {
+        perror(path);
+        status = -1;
+    }
+    if (status == 0 && JournalRetire(path, fd) < 0) {
+        status = -1;
+    }
+    close(fd);
+    free(frame);
+    JournalFree(&c);
+    result->frames = n;
+    result->bytes = (double)end;
+    return(status);
+}
+
+int RawRecover(const char *path, JournalRecovery *result)
+{
+    char line[512], stripepath[512];
+    JournalRecovery stripe;
+    RawReader *r;
+    FILE *mf;
+    int index, status = 0;
+
+    memset(result, 0, sizeof(*result));
+    if ((mf = fopen(path, "r")) == NULL) {
+        perror(path);
+        return(-1);
+    }
+    if (fgets(line, sizeof(line), mf) == NULL || strncmp(line, RAW_MANIFEST, strlen(RAW_MANIFEST)) != 0) {
+        fclose(mf);
+        return RecoverStripe(path, result);
+    }
+
+    // Striped: every stripe on its own, then the sequence is as many frames as they hold in order
+    while (fgets(line, sizeof(line), mf) != NULL) {
+        if (sscanf(line, "stripe %d %511[^\n]", &index, stripepath) == 2) {
+            if (RecoverStripe(stripepath, &stripe) < 0) {
+                status = -1;
+            }
+            result->journaled |= stripe.journaled;
+            result->records += stripe.records;
+            result->bytes += stripe.bytes;
+        }
+    }
+    fclose(mf);
+    if (status == 0 && (r = RawOpen(path)) != NULL) {
+        result->frames = (int)r->header.frames;
+        RawCloseRead(r);
+    }
+    return(status);
+}
+
+
+
+// ================================================================================================
+// Streaming a sequence out while it is captured
+// ================================================================================================
+struct RawStream {
+    RawWriter           *writer;
+    unsigned char *const *frames;
+    int                 nframes;        // lowered by RawStreamStop()
+    volatile const int  *available;
+    unsigned char       *black;
+    const RtConfig      *rt;
+    pthread_t           thread;
+    int                 threaded;
+    int                 status;
+};
+
+static int StreamFrames(RawStream *s)
+{
+    return __atomic_load_n(&s->nframes, __ATOMIC_ACQUIRE);
+}
+
+static void *StreamThread(void *arg)
+{
+    RawStream *s = (RawStream *)arg;
+    int k;
+
+    if (s->rt != NULL) {
+        RtPinWorkers(s->rt);
+    }
+    for (k = 0; k < StreamFrames(s); k++) {
+        if (s->available != NULL) {
+            while (__atomic_load_n(s->available, __ATOMIC_ACQUIRE) <= k && k < StreamFrames(s)) {
+                usleep(AVAILABLE_POLL_US);
+            }
+            if (k >= StreamFrames(s)) {
+                break;
+            }
+        }
+        if (RawWriteFrame(s->writer, s->frames[k] != NULL ? s->frames[k] : s->black) < 0) {
+            s->status = -1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+// The files are created and preallocated here, before capture starts; NULL if they can't be
+RawStream *RawStreamStart(const char *path, unsigned char *const frames[], int nframes, volatile const int *available,
+                          int xdim, int ydim, int fps, const char *const dirs[], int ndirs,
+                          const DiskSettings *settings, const RtConfig *rt)
+{
+    RawStream *s = (RawStream *)calloc(1, sizeof(RawStream));
+
+    if (s == NULL) {
+        return NULL;
+    }
+    s->frames = frames;
+    s->nframes = nframes;
+    s->available = available;
+    s->rt = rt;
+    s->black = (unsigned char *)calloc((size_t)xdim * ydim, 1);
+    if (s->black == NULL
+     || (s->writer = RawCreateStriped(path, dirs, ndirs, 0, xdim, ydim, fps, nframes, settings)) == NULL) {
+        free(s->black);
+        free(s);
+        return NULL;
+    }
+
+    // If the thread can't start, RawStreamFinish() does the writing instead
+    s->threaded = (pthread_create(&s->thread, NULL, StreamThread, s) == 0);
+    if (!s->threaded) {
+        perror("RawStreamStart: pthread_create");
+    }
+    return s;
+}
+
+int RawStreamStripes(RawStream *s)
+{
+    return s->writer->header.stripeframes > 0 ? s->writer->nstripes : 0;
+}
+
+const char *RawStreamStripePath(RawStream *s, int stripe)
+{
+    return stripe >= 0 && stripe < s->writer->nstripes ? s->writer->stripes[stripe].path : "";
+}
+
+// Queue depth and MB/s so far, in all and per stripe
+void RawStreamStatus(RawStream *s, DiskReport *report, DiskReport *stripes)
+{
+    RawWriterStatus(s->writer, report, stripes);
+}
+
+// The sequence ends after 'frames' frames rather than the planned count - capture stopped early
+void RawStreamStop(RawStream *s, int frames)
+{
+    if (s != NULL && frames < StreamFrames(s)) {
+        __atomic_store_n(&s->nframes, frames > 0 ? frames : 0, __ATOMIC_RELEASE);
+    }
+}
+
+// Wait for the last frame and close the files; -1 if the sequence is incomplete
+int RawStreamFinish(RawStream *s, DiskReport *report, DiskReport *stripes)
+{
+    int status;
+
+    if (s == NULL) {
+        return(-1);
+    }
+    if (s->threaded) {
+        pthread_join(s->thread, NULL);
+    }
+    else {
+        StreamThread(s);
+    }
+    status = s->status;
+    if (RawClose(s->writer, report, stripes) < 0) {
+        status = -1;
+    }
+    free(s->black);
+    free(s);
+    return(status);
+}
@@ -0,0 +1,133 @@
+/*
+ *  raw_store.h
+ *
+ *  Uncompressed sequence files (.raw) for continuous capture, where the
+ *  disk rather than an encoder has to be the limit: 8 bit grey frames back
+ *  to back, written through disk_writer.h.
+ *
+ *  A .raw file is a RawFileHeader padded to RAW_HEADERBYTES, so the frames
+ *  start on an O_DIRECT boundary, then frame 1, 2, ... of framebytes each,
+ *  in host byte order. 'frames' is filled in on close. The file is
+ *  preallocated, so a file whose writer never closed it says nothing of
+ *  how many frames it holds: RawOpen() refuses it until RawRecover()
+ *  (seq_recover) has finished it from its journal.
+ *
+ *  Where one disk can't keep up, the sequence can be striped over several
+ *  directories, one per disk: runs of 'stripeframes' frames go to each
+ *  directory's stripe file in turn, every stripe file being a .raw of its
+ *  own (with its place in the stripe set in the header), each written by
+ *  its own DiskWriter so the disks work in parallel. The .raw path itself
+ *  then holds a text manifest:
+ *
+ *	    MKRAW-STRIPES 1
+ *	    geometry <xdim> <ydim> <fps>
+ *	    frames <n> stripeframes <k>
+ *	    stripe 0 <path of stripe file 0>
+ *	    stripe 1 <path of stripe file 1>
+ *	    ...
+ *
+ *  and RawOpen() on it reads the stripes back as the one sequence.
+ *
+ *  Every file written has a journal (frame_journal.h) until it is closed;
+ *  RawRecover() finishes a file or a striped set left by a writer that
+ *  never closed it with the frames that made it to the disk.
+ *
+ *  RawStreamStart() writes a sequence from a thread of its own while it is
+ *  still being captured, following the drain thread's count of frames read
+ *  out like encode_pool.h does; a NULL frame is written black.
+ */
+#ifndef RAW_STORE_H
+#define RAW_STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "disk_writer.h"
+#include "frame_journal.h"
+#include "rt_config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RAW_MAGIC           0x57524b4d      // "MKRW"
+#define RAW_VERSION         2
+#define RAW_HEADERBYTES     4096
+#define RAW_MAXSTRIPES      16
+#define RAW_MANIFEST        "MKRAW-STRIPES"
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    xdim, ydim;
+    uint32_t    frames;             // filled in on close - frames in this file
+    uint32_t    fps;
+    uint64_t    framebytes;
+    uint64_t    dataoffset;         // RAW_HEADERBYTES
+    uint32_t    stripe;             // version 2: this file's place in its stripe set
+    uint32_t    stripes;            // files in the set
+    uint32_t    stripeframes;       // frames in a run, 0 = not striped
+    uint32_t    reserved;
+} RawFileHeader;
+
+typedef struct {
+    char            path[256];
+    RawFileHeader   header;
+    DiskWriter      *disk;
+    FrameJournal    *journal;       // NULL if it couldn't be created
+} RawStripe;
+
+typedef struct {
+    char            path[256];      // the .raw, or the manifest when striped
+    RawFileHeader   header;         // frames = the whole sequence
+    int             nstripes;
+    RawStripe       stripes[RAW_MAXSTRIPES];
+} RawWriter;
+
+typedef struct {
+    RawFileHeader   header;         // frames = the whole sequence
+    int             nstripes;
+    FILE            *fp[RAW_MAXSTRIPES];
+    uint64_t        dataoffset[RAW_MAXSTRIPES];
+} RawReader;
+
+// 'maxframes' sizes the preallocation; NULL settings = disk_writer.h's defaults
+RawWriter *RawCreate(const char *path, int xdim, int ydim, int fps, int maxframes, const DiskSettings *settings);
+// Striped over 'dirs', one stripe file each, runs of 'stripeframes' frames (0 = a DISK_CHUNK's worth);
+// one dir is a set of one, so the frames still go to that disk; no dirs is RawCreate()
+RawWriter *RawCreateStriped(const char *path, const char *const dirs[], int ndirs, int stripeframes,
+                            int xdim, int ydim, int fps, int maxframes, const DiskSettings *settings);
+int  RawWriteFrame(RawWriter *w, const unsigned char *frame);
+// 'report' sums the stripes, 'stripes' (RAW_MAXSTRIPES of them) gets each one's; either may be NULL
+int  RawClose(RawWriter *w, DiskReport *report, DiskReport *stripes);
+void RawWriterStatus(RawWriter *w, DiskReport *report, DiskReport *stripes);
+
+// A .raw or manifest whose writer never closed it, from its journals; nothing to do if there are none
+int  RawRecover(const char *path, JournalRecovery *result);
+
+RawReader *RawOpen(const char *path);
+int  RawReadFrame(RawReader *r, int index, unsigned char *frame);
+void RawCloseRead(RawReader *r);
+
+// Comma separated directories, as a trial option gives them, into dirs[]; returns how many
+int  RawParseStripes(char *list, const char *dirs[], int max);
+
+typedef struct RawStream RawStream;
+
+RawStream *RawStreamStart(const char *path, unsigned char *const frames[], int nframes, volatile const int *available,
+                          int xdim, int ydim, int fps, const char *const dirs[], int ndirs,
+                          const DiskSettings *settings, const RtConfig *rt);
+// Stripe files, 0 when the sequence is a single .raw
+int  RawStreamStripes(RawStream *s);
+const char *RawStreamStripePath(RawStream *s, int stripe);
+void RawStreamStatus(RawStream *s, DiskReport *report, DiskReport *stripes);
+// Capture stopped early: the files end after 'frames' frames, as many as were read out
+void RawStreamStop(RawStream *s, int frames);
+int  RawStreamFinish(RawStream *s, DiskReport *report, DiskReport *stripes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ *  rt_config.c
+ *
+ *  Real-time scheduling profile and jitter statistics - see rt_config.h.
+ *
+ *  SCHED_FIFO and mlock() need root or CAP_SYS_NICE/CAP_IPC_LOCK; the capture
+ *  program already runs with sudo for the PIXCI(R) driver. Failures are
+ *  reported and capture carries on with normal scheduling.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+// Scheduling, affinity and memory locking
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "rt_config.h"
+
+
+
+// ================================================================================================
+// Defaults: no pinning, normal scheduling, no locking - same behaviour as before the profile existed
+// ================================================================================================
+void RtConfigDefaults(RtConfig *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+}
+
+
+
+// ================================================================================================
+// Parse a comma separated cpu list; negative cpus are dropped so "-1" means none
+// ================================================================================================
+static void ParseCpuList(const char *value, int *cpus, int *ncpus)
+{
+    char *end;
+
+    *ncpus = 0;
+    while (*ncpus < RT_MAX_CPUS) {
+        long cpu = strtol(value, &end, 10);
+        if (end == value) {
+            break;
+        }
+        if (cpu >= 0) {
+            cpus[(*ncpus)++] = (int)cpu;
+        }
+        value = end;
+        while (*value == ',' || isspace((unsigned char)*value)) {
+            value++;
+        }
+    }
+}
+
+
+
+// ================================================================================================
+// Apply one "key=value" setting; returns -1 for an unknown key
+// ================================================================================================
+int RtConfigOption(RtConfig *cfg, const char *keyvalue)
+{
+    char key[64];
+    const char *value = strchr(keyvalue, '=');
+    size_t len;
+
+    if (value == NULL) {
+        fprintf(stderr, "RtConfigOption: expected key=value, got '%s'\n", keyvalue);
+        return(-1);
+    }
+
+    // Key without surrounding blanks
+    while (isspace((unsigned char)*keyvalue)) {
+        keyvalue++;
+    }
+    len = value - keyvalue;
+    while (len > 0 && isspace((unsigned char)keyvalue[len-1])) {
+        len--;
+    }
+    snprintf(key, sizeof(key), "%.*s", (int)len, keyvalue);
+    value++;
+
+    if (strcmp(key, "capture_cpu") == 0 || strcmp(key, "capture_cpus") == 0) {
+        ParseCpuList(value, cfg->capturecpus, &cfg->ncapturecpus);
+    }
+    else if (strcmp(key, "capture_priority") == 0) {
+        cfg->capturepriority = atoi(value);
+    }
+    else if (strcmp(key, "lock_memory") == 0) {
+        cfg->lockmemory = atoi(value);
+    }
+    else if (strcmp(key, "worker_cpus") == 0) {
+        ParseCpuList(value, cfg->workercpus, &cfg->nworkercpus);
+    }
+    else {
+        fprintf(stderr, "RtConfigOption: unknown setting '%s'\n", key);
+        return(-1);
+    }
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Read "key = value" lines from a config file; '#' starts a comment
+// ================================================================================================
+int RtConfigLoad(RtConfig *cfg, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    int errors = 0;
+
+    if (fp == NULL) {
+        perror(path);
+        return(-1);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p = strchr(line, '#');
+        if (p != NULL) {
+            *p = 0;
+        }
+        for (p = line; isspace((unsigned char)*p); p++) {
+            ;
+        }
+        if (*p && RtConfigOption(cfg, p) < 0) {
+            errors++;
+        }
+    }
+    fclose(fp);
+    return(errors ? -1 : 0);
+}
+
+
+
+void RtConfigPrint(const RtConfig *cfg)
+{
+    int i;
+
+    printf("Real-time profile: capture cpus");
+    if (cfg->ncapturecpus == 0) {
+        printf(" any");
+    }
+    for (i = 0; i < cfg->ncapturecpus; i++) {
+        printf("%s%d", i ? "," : " ", cfg->capturecpus[i]);
+    }
+    printf(", SCHED_FIFO priority %d, memory %s, worker cpus",
+           cfg->capturepriority, cfg->lockmemory ? "locked" : "pageable");
+    if (cfg->nworkercpus == 0) {
+        printf(" any");
+    }
+    for (i = 0; i < cfg->nworkercpus; i++) {
+        printf("%s%d", i ? "," : " ", cfg->workercpus[i]);
+    }
+    printf("\r\n\n");
+}
+
+
+
+// ================================================================================================
+// Make the calling thread a capture/drain thread: pin it and switch to SCHED_FIFO
+// Drain thread 'index' (one per unit) gets capture cpu index, round-robin
+// What the thread had before is kept for RtLeaveCapture()
+// ================================================================================================
+static __thread cpu_set_t       savedcpus;
+static __thread int             savedpolicy, saved = 0;
+static __thread struct sched_param savedparam;
+
+int RtEnterCapture(const RtConfig *cfg, int index)
+{
+    int err, status = 0;
+
+    if (!saved) {
+        saved = pthread_getaffinity_np(pthread_self(), sizeof(savedcpus), &savedcpus) == 0
+             && pthread_getschedparam(pthread_self(), &savedpolicy, &savedparam) == 0;
+    }
+
+    if (cfg->ncapturecpus > 0) {
+        int cpu = cfg->capturecpus[index % cfg->ncapturecpus];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+            fprintf(stderr, "RtEnterCapture: can't pin to cpu %d: %s\n", cpu, strerror(err));
+            status = -1;
+        }
+    }
+
+    if (cfg->capturepriority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = cfg->capturepriority;
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0) {
+            fprintf(stderr, "RtEnterCapture: can't set SCHED_FIFO %d: %s\n", cfg->capturepriority, strerror(err));
+            status = -1;
+        }
+    }
+    return(status);
+}
+
+// Put the calling thread back as it was before RtEnterCapture() - for a thread that stood in for a
+// drain thread and carries on with other work
+void RtLeaveCapture(void)
+{
+    int err;
+
+    if (!saved) {
+        return;
+    }
+    if ((err = pthread_setschedparam(pthread_self(), savedpolicy, &savedparam)) != 0) {
+        fprintf(stderr, "RtLeaveCapture: can't restore scheduling: %s\n", strerror(err));
+    }
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(savedcpus), &savedcpus)) != 0) {
+        fprintf(stderr, "RtLeaveCapture: can't restore cpu affinity: %s\n", strerror(err));
+    }
+    saved = 0;
+}
+
+
+
+// ================================================================================================
+// Restrict the calling thread to the worker cpus (all of them)
+// ================================================================================================
+int RtPinWorkers(const RtConfig *cfg)
+{
+    cpu_set_t set;
+    int i, err;
+
+    if (cfg->nworkercpus == 0) {
+        return(0);
+    }
+    CPU_ZERO(&set);
+    for (i = 0; i < cfg->nworkercpus; i++) {
+        CPU_SET(cfg->workercpus[i], &set);
+    }
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+        fprintf(stderr, "RtPinWorkers: %s\n", strerror(err));
+        return(-1);
+    }
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Pin the calling thread to one worker cpu, chosen round-robin by worker index
+// ================================================================================================
+int RtPinWorker(const RtConfig *cfg, int index)
+{
+    cpu_set_t set;
+    int err;
+
+    if (cfg->nworkercpus == 0) {
+        return(0);
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cfg->workercpus[index % cfg->nworkercpus], &set);
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+        fprintf(stderr, "RtPinWorker: %s\n", strerror(err));
+        return(-1);
+    }
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Lock frame memory into RAM - also faults every page in before capture starts
+// ================================================================================================
+int RtLockMemory(const RtConfig *cfg, void *addr, size_t len)
+{
+    if (!cfg->lockmemory || addr == NULL || len == 0) {
+        return(0);
+    }
+    if (mlock(addr, len) == -1) {
+        perror("RtLockMemory: mlock");
+        return(-1);
+    }
+    return(0);
+}
+
+void RtUnlockMemory(const RtConfig *cfg, void *addr, size_t len)
+{
+    if (cfg->lockmemory && addr != NULL && len != 0) {
+        munlock(addr, len);
+    }
+}
+
+
+
+// ================================================================================================
+// Monotonic clock in microseconds
+// ================================================================================================
+double RtNowUs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e6 + t.tv_nsec/1e3;
+}
+
+
+
+// ================================================================================================
+// Jitter statistics - samples are kept so exact percentiles can be taken after the trial
+// ================================================================================================
+int JitterInit(JitterStats *js, int max)
+{
+    js->count = 0;
+    js->max = max > 0 ? max : 0;
+    js->samples = (double *)malloc((js->max ? js->max : 1) * sizeof(double));
+    if (js->samples == NULL) {
+        js->max = 0;
+        return(-1);
+    }
+    return(0);
+}
+
+void JitterAdd(JitterStats *js, double us)
+{
+    if (js->count < js->max) {
+        js->samples[js->count++] = us;
+    }
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void JitterPercentiles(JitterStats *js, double *p50, double *p99, double *p999, double *worst)
+{
+    *p50 = *p99 = *p999 = *worst = 0;
+    if (js->count == 0) {
+        return;
+    }
+    qsort(js->samples, js->count, sizeof(double), CompareDoubles);
+    *p50   = js->samples[(int)(0.50  * (js->count - 1))];
+    *p99   = js->samples[(int)(0.99  * (js->count - 1))];
+    *p999  = js->samples[(int)(0.999 * (js->count - 1))];
+    *worst = js->samples[js->count - 1];
+}
+
+void JitterReport(JitterStats *js, double expectedus, char *out, size_t len)
+{
+    double p50, p99, p999, worst;
+
+    JitterPercentiles(js, &p50, &p99, &p999, &worst);
+    snprintf(out, len, "Drain interval (us, expected %.0f): p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0f  over %d samples",
+             expectedus, p50, p99, p999, worst, js->count);
+}
+
+void JitterReset(JitterStats *js)
+{
+    js->count = 0;
+}
+
+void JitterFree(JitterStats *js)
+{
+    free(js->samples);
+    js->samples = NULL;
+    js->count = js->max = 0;
+}
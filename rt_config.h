@@ -0,0 +1,71 @@
+/*
+ *  rt_config.h
+ *
+ *  Real-time scheduling profile for the capture program, and the inter-frame
+ *  jitter statistics used to judge whether it is working.
+ *
+ *  The drain thread, which polls the frame grabber and copies each frame out
+ *  as it is captured, runs SCHED_FIFO on its own (ideally isolcpus'ed) core;
+ *  everything else - UDP handling, AVI encoding, later worker pools - is kept
+ *  on the worker cores. Settings come from "key = value" lines in a config
+ *  file (-c) or single "key=value" command line options (-r):
+ *
+ *	    capture_cpu      = 3        core(s) for the drain threads, one per unit
+ *	                                (e.g. 3,4 with two units), -1 = don't pin
+ *	    capture_priority = 80       SCHED_FIFO priority, 0 = normal scheduling
+ *	    worker_cpus      = 0,1,2    cores for everything else, empty = any
+ *	    lock_memory      = 1        mlock() frame memory so it never pages out
+ */
+#ifndef RT_CONFIG_H
+#define RT_CONFIG_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RT_MAX_CPUS     64
+
+typedef struct {
+    int     capturecpus[RT_MAX_CPUS];
+    int     ncapturecpus;
+    int     capturepriority;
+    int     workercpus[RT_MAX_CPUS];
+    int     nworkercpus;
+    int     lockmemory;
+} RtConfig;
+
+void RtConfigDefaults(RtConfig *cfg);
+int  RtConfigOption(RtConfig *cfg, const char *keyvalue);
+int  RtConfigLoad(RtConfig *cfg, const char *path);
+void RtConfigPrint(const RtConfig *cfg);
+
+int  RtEnterCapture(const RtConfig *cfg, int index);
+void RtLeaveCapture(void);
+int  RtPinWorkers(const RtConfig *cfg);
+int  RtPinWorker(const RtConfig *cfg, int index);
+int  RtLockMemory(const RtConfig *cfg, void *addr, size_t len);
+void RtUnlockMemory(const RtConfig *cfg, void *addr, size_t len);
+
+
+// Inter-frame drain latency, in microseconds, one sample per frame
+typedef struct {
+    double  *samples;
+    int     count, max;
+} JitterStats;
+
+int  JitterInit(JitterStats *js, int max);
+void JitterAdd(JitterStats *js, double us);
+void JitterPercentiles(JitterStats *js, double *p50, double *p99, double *p999, double *worst);
+void JitterReport(JitterStats *js, double expectedus, char *out, size_t len);
+void JitterReset(JitterStats *js);
+void JitterFree(JitterStats *js);
+
+double RtNowUs(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
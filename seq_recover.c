@@ -0,0 +1,158 @@
+/*
+ *  seq_recover.c
+ *
+ *  Finishes sequence files whose writer never closed them - the capture
+ *  program stopped with Ctrl+C, killed or crashed mid-trial - from the
+ *  journal each one has beside it until it is closed (<file>.jrn, see
+ *  frame_journal.h): a .bgs from "store=sparse", or a .raw or striped .raw
+ *  manifest from "store=raw".
+ *
+ *  Each file keeps the frames from the first on that reached the disk
+ *  intact and is rewritten, in place, as if it had been closed after the
+ *  last of them; its journal is then deleted. A file without a journal was
+ *  closed cleanly and is left alone. With -d every sequence in a directory
+ *  that has a journal left is recovered.
+ *
+ *  Compile and run as:
+ *
+ *	    gcc seq_recover.c raw_store.c sparse_store.c disk_writer.c frame_journal.c rt_config.c -llz4 -lzstd -luring -lpthread -o seq_recover
+ *	    ./seq_recover file.raw|file.bgs ...
+ *	    ./seq_recover -d output_dir
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "raw_store.h"
+#include "sparse_store.h"
+#include "frame_journal.h"
+
+static int IsSparse(const char *path)
+{
+    size_t n = strlen(path);
+    return n >= 4 && strcmp(path + n - 4, ".bgs") == 0;
+}
+
+static int Report(const char *path, int status, const JournalRecovery *result)
+{
+    if (status < 0) {
+        printf("%s: not recovered\n", path);
+        return(-1);
+    }
+    if (!result->journaled) {
+        printf("%s: closed cleanly, nothing to recover\n", path);
+        return(0);
+    }
+    printf("%s: %d of %d journaled frames recovered, %.1f MB\n", path, result->frames, result->records, result->bytes / 1e6);
+    return(0);
+}
+
+int Recover(const char *path)
+{
+    JournalRecovery result;
+
+    if (access(path, F_OK) != 0) {
+        perror(path);
+        return(-1);
+    }
+    return Report(path, IsSparse(path) ? SparseRecover(path, &result) : RawRecover(path, &result), &result);
+}
+
+static int IsManifest(const char *path)
+{
+    char line[64];
+    FILE *fp = fopen(path, "r");
+    int manifest = 0;
+
+    if (fp != NULL) {
+        manifest = fgets(line, sizeof(line), fp) != NULL && strncmp(line, RAW_MANIFEST, strlen(RAW_MANIFEST)) == 0;
+        fclose(fp);
+    }
+    return(manifest);
+}
+
+// A stripe file is <manifest name>.<i>
+static int IsStripe(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return dot != NULL && dot[1] != '\0' && strspn(dot + 1, "0123456789") == strlen(dot + 1);
+}
+
+// Every sequence in 'dir' with a journal left beside it, and every striped set whose manifest is there
+int RecoverDirectory(const char *dir)
+{
+    char path[512], name[256];
+    JournalRecovery result;
+    struct dirent *e;
+    DIR *d;
+    size_t n, suffix = strlen(JOURNAL_SUFFIX);
+    int found = 0, errors = 0, status;
+
+    if ((d = opendir(dir)) == NULL) {
+        perror(dir);
+        return(-1);
+    }
+    while ((e = readdir(d)) != NULL) {
+        n = strlen(e->d_name);
+        if (n > suffix && strcmp(e->d_name + n - suffix, JOURNAL_SUFFIX) == 0) {
+            snprintf(name, sizeof(name), "%.*s", (int)(n - suffix), e->d_name);
+            if (IsStripe(name)) {
+                printf("%s/%s: a stripe - recovered through its manifest\n", dir, name);
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s", dir, name);
+            found++;
+            if (Recover(path) < 0) {
+                errors++;
+            }
+            continue;
+        }
+
+        // A manifest has no journal, its stripes have theirs in the stripe directories
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (IsManifest(path)) {
+            status = RawRecover(path, &result);
+            if (status < 0 || result.journaled) {
+                found++;
+                if (Report(path, status, &result) < 0) {
+                    errors++;
+                }
+            }
+        }
+    }
+    closedir(d);
+    if (found == 0) {
+        printf("%s: no interrupted sequences\n", dir);
+    }
+    return errors ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = NULL;
+    int c, i, errors = 0;
+
+    while ((c = getopt(argc, argv, "d:")) != -1) {
+        switch (c) {
+        case 'd':   dir = optarg;                   break;
+        default:
+            fprintf(stderr, "usage: %s file.raw|file.bgs ... | -d output_dir\n", argv[0]);
+            return(1);
+        }
+    }
+    if (dir == NULL && optind >= argc) {
+        fprintf(stderr, "usage: %s file.raw|file.bgs ... | -d output_dir\n", argv[0]);
+        return(1);
+    }
+    if (dir != NULL && RecoverDirectory(dir) < 0) {
+        errors++;
+    }
+    for (i = optind; i < argc; i++) {
+        if (Recover(argv[i]) < 0) {
+            errors++;
+        }
+    }
+    return errors ? 1 : 0;
+}
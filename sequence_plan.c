@@ -0,0 +1,133 @@
+/*
+ *  sequence_plan.c
+ *
+ *  Sequence length planning - see sequence_plan.h.
+ */
+
+// C library
+#include <stdio.h>
+#include <string.h>
+
+// UNIX standard function definitions
+#include <unistd.h>
+#include <sys/statvfs.h>
+
+#include "sequence_plan.h"
+
+#define MB              (1024.0*1024.0)
+#define HOST_RAM_SHARE  0.8     // leave some of the free RAM to the OS and the AVI encoder
+
+
+
+// ================================================================================================
+// Bytes of host RAM currently available
+// ================================================================================================
+static double HostFreeBytes(void)
+{
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long pagesize = sysconf(_SC_PAGESIZE);
+
+    if (pages < 0 || pagesize < 0) {
+        return(0);
+    }
+    return (double)pages * pagesize;
+}
+
+
+
+// ================================================================================================
+// Bytes free on the file system holding outputdir, or -1 if unknown
+// ================================================================================================
+static double DiskFreeBytes(const char *outputdir)
+{
+    struct statvfs fs;
+
+    if (outputdir == NULL || statvfs(outputdir, &fs) == -1) {
+        return(-1);
+    }
+    return (double)fs.f_bavail * fs.f_frsize;
+}
+
+
+
+// ================================================================================================
+// Fill in plan for a request of 'requested' frames of xdim x ydim at 'bits' per pixel from each of 'units' boards
+// zdim and grabbermemsize are pxd_imageZdim() and pxd_infoMemsize() of one unit; adapt=0 rejects oversized requests
+// Returns the number of frames to capture, 0 if the trial is rejected
+// ================================================================================================
+int PlanSequence(SequencePlan *plan, int requested, int fps, int xdim, int ydim, int bits,
+                 long zdim, double grabbermemsize, int units, const char *outputdir, int adapt)
+{
+    memset(plan, 0, sizeof(*plan));
+    if (units < 1) {
+        units = 1;
+    }
+    plan->requested = requested;
+    plan->units = units;
+    plan->xdim = xdim;
+    plan->ydim = ydim;
+    plan->bits = bits;
+    plan->grabberbytes = (size_t)xdim * ydim * ((bits + 7) / 8);
+    plan->hostbytes = (size_t)xdim * ydim;
+
+    if (requested <= 0 || plan->hostbytes == 0) {
+        plan->rejected = 1;
+        strcpy(plan->limit, "empty request");
+        return(0);
+    }
+
+    // Frame grabber: pxd_imageZdim() already reflects memory, but a format file
+    // loaded after the driver sized its buffers may not - take the smaller
+    long maxframes = zdim;
+    strcpy(plan->limit, "frame buffers");
+    if (grabbermemsize > 0 && grabbermemsize / plan->grabberbytes < maxframes) {
+        maxframes = (long)(grabbermemsize / plan->grabberbytes);
+        strcpy(plan->limit, "grabber memory");
+    }
+
+    // Host RAM: the whole sequence of every unit is read out before it is written
+    double hostframes = HostFreeBytes() * HOST_RAM_SHARE / plan->hostbytes / units;
+    if (hostframes < maxframes) {
+        maxframes = (long)hostframes;
+        strcpy(plan->limit, "host RAM");
+    }
+
+    // Disk: uncompressed size is the worst case for the writer
+    double diskfree = DiskFreeBytes(outputdir);
+    if (diskfree >= 0 && diskfree / plan->hostbytes / units < maxframes) {
+        maxframes = (long)(diskfree / plan->hostbytes / units);
+        strcpy(plan->limit, "disk space");
+    }
+    plan->maxframes = (int)maxframes;
+
+    plan->frames = requested;
+    if (requested > plan->maxframes) {
+        if (adapt && plan->maxframes > 0) {
+            plan->frames = plan->maxframes;
+            plan->adapted = 1;
+        }
+        else {
+            plan->frames = 0;
+            plan->rejected = 1;
+        }
+    }
+
+    plan->hostmb = (double)plan->frames * plan->hostbytes * units / MB;
+    plan->diskmb = plan->hostmb;
+    plan->diskmbps = (double)fps * plan->hostbytes * units / MB;
+
+    return(plan->frames);
+}
+
+
+
+// ================================================================================================
+// One line description of the plan for the console and Machine A
+// ================================================================================================
+void PlanSummary(const SequencePlan *plan, char *out, size_t len)
+{
+    snprintf(out, len, "Plan: %d/%d frames (max %d, %s), %dx%d %d bit x %d unit%s, host %.1f MB, disk %.1f MB at %.1f MB/s%s",
+             plan->frames, plan->requested, plan->maxframes, plan->limit,
+             plan->xdim, plan->ydim, plan->bits, plan->units, plan->units > 1 ? "s" : "", plan->hostmb, plan->diskmb, plan->diskmbps,
+             plan->rejected ? " -- REJECTED" : plan->adapted ? " -- SHORTENED" : "");
+}
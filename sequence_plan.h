@@ -0,0 +1,45 @@
+/*
+ *  sequence_plan.h
+ *
+ *  Checks a requested sequence length against frame grabber memory, host RAM
+ *  and disk space before the capture is armed.
+ *
+ *  pxd_goLiveSeq() captures into frame buffers 1..frames, so a request for
+ *  more frames than pxd_imageZdim() wraps around and overwrites the start of
+ *  the trial. The planner either shortens such a request to what fits or
+ *  rejects it, and reports the memory and disk bandwidth the trial will need.
+ */
+#ifndef SEQUENCE_PLAN_H
+#define SEQUENCE_PLAN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int     requested;          // frames asked for by Machine A
+    int     frames;             // frames that will be captured, 0 if rejected
+    int     maxframes;          // most frames per unit the grabber, host RAM and disk all allow
+    int     xdim, ydim, bits;   // geometry of one frame
+    int     units;              // boards capturing the same number of frames each
+    size_t  grabberbytes;       // frame buffer size in grabber memory
+    size_t  hostbytes;          // frame size once read out as 8 bit grey
+    double  hostmb;             // host RAM for the read out sequence, all units
+    double  diskmb;             // bytes the trial writes, uncompressed, all units
+    double  diskmbps;           // write rate needed to keep up with the camera at FPS
+    int     adapted;            // 1 if frames < requested
+    int     rejected;           // 1 if the trial must not be armed
+    char    limit[32];          // what bounds maxframes: "frame buffers", "host RAM", "disk space"
+} SequencePlan;
+
+int  PlanSequence(SequencePlan *plan, int requested, int fps, int xdim, int ydim, int bits,
+                  long zdim, double grabbermemsize, int units, const char *outputdir, int adapt);
+void PlanSummary(const SequencePlan *plan, char *out, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ *  sparse_decode.c
+ *
+ *  Reconstructs the frames of a background-subtracted sparse sequence (.bgs)
+ *  written by the capture program with "store=sparse" - see sparse_store.h.
+ *
+ *  Without an output directory it only reads every frame and prints the
+ *  file's statistics and decode speed; with one it writes frame_00001.pgm, ... and
+ *  background.pgm there.
+ *
+ *  -r 120-400,900-1100 or -e <base>.events.csv (the event windows, or each
+ *  event's frame +-K with -k K) limits that to the frames in those ranges.
+ *  Frames are found through the file's record index, so frames outside the
+ *  ranges are not decoded, apart from those since the last keyframe of an
+ *  lz4 delta sequence.
+ *
+ *  Compile and run as:
+ *
+ *	    gcc sparse_decode.c sparse_store.c frame_journal.c frame_ranges.c -llz4 -lzstd -lpthread -o sparse_decode
+ *	    ./sparse_decode [-r ranges | -e events.csv [-k K]] file.bgs [output_dir]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sparse_store.h"
+#include "frame_ranges.h"
+
+int WritePGM(const char *path, const unsigned char *image, int xdim, int ydim)
+{
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL) {
+        perror(path);
+        return(-1);
+    }
+    fprintf(fp, "P5\n%d %d\n255\n", xdim, ydim);
+    fwrite(image, 1, (size_t)xdim * ydim, fp);
+    fclose(fp);
+    return(0);
+}
+
+int main(int argc, char *argv[])
+{
+    SparseReader *r;
+    unsigned char *frame;
+    char path[512];
+    const char *rangelist = NULL, *eventfile = NULL, *outdir;
+    FrameRanges ranges;
+    int i, k, c, xdim, ydim, nframes, margin = -1, errors = 0;
+    struct timespec t0, t1;
+    double seconds;
+
+    while ((c = getopt(argc, argv, "r:e:k:")) != -1) {
+        switch (c) {
+        case 'r':   rangelist = optarg;             break;
+        case 'e':   eventfile = optarg;             break;
+        case 'k':   margin = atoi(optarg);          break;
+        default:    argc = 0;                       break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage %s [-r ranges | -e events.csv [-k K]] file.bgs [output_dir]\n", argv[0]);
+        exit(1);
+    }
+    outdir = optind + 1 < argc ? argv[optind + 1] : NULL;
+    if ((r = SparseOpen(argv[optind])) == NULL) {
+        exit(1);
+    }
+    xdim = r->header.xdim;
+    ydim = r->header.ydim;
+    printf("%s: %u frames of %dx%d, %ux%u tiles, threshold %u, background over %u frames, codec %s",
+           argv[optind], r->header.frames, xdim, ydim, r->header.tile, r->header.tile,
+           r->header.threshold, r->header.backgroundframes, SparseCodecName(r->header.codec));
+    if (r->header.codec == SPARSE_CODEC_ZSTD) {
+        printf(" level %u", r->header.level);
+    }
+    printf("\n");
+
+    if ((frame = (unsigned char *)malloc((size_t)xdim * ydim)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    if (outdir != NULL) {
+        snprintf(path, sizeof(path), "%s/background.pgm", outdir);
+        WritePGM(path, r->background, xdim, ydim);
+    }
+
+    // The frames asked for, or all of them
+    FrameRangesInit(&ranges);
+    if (rangelist != NULL && FrameRangesParse(&ranges, rangelist) < 0) {
+        fprintf(stderr, "bad ranges '%s'\n", rangelist);
+        exit(1);
+    }
+    if (eventfile != NULL && FrameRangesLoadEvents(&ranges, eventfile, margin) < 0) {
+        exit(1);
+    }
+    if (rangelist == NULL && eventfile == NULL) {
+        FrameRangesAdd(&ranges, 1, (int)r->header.frames);
+    }
+    FrameRangesNormalize(&ranges, (int)r->header.frames);
+    nframes = FrameRangesCount(&ranges);
+    if (nframes < (int)r->header.frames) {
+        printf("%d frames in %d ranges\n", nframes, ranges.n);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (k = 0; k < ranges.n; k++) {
+        for (i = ranges.ranges[k].first - 1; i < ranges.ranges[k].last; i++) {
+            if (SparseReadFrame(r, i, frame) < 0) {
+                fprintf(stderr, "frame %d: unreadable\n", i+1);
+                errors++;
+                continue;
+            }
+            if (outdir != NULL) {
+                snprintf(path, sizeof(path), "%s/frame_%05d.pgm", outdir, i+1);
+                if (WritePGM(path, frame, xdim, ydim) < 0) {
+                    errors++;
+                    k = ranges.n;
+                    break;
+                }
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%d frames reconstructed, %d errors", nframes - errors, errors);
+    if (outdir == NULL && seconds > 0) {
+        printf(", %.0f MB/s", (double)nframes * xdim * ydim / 1e6 / seconds);
+    }
+    printf("\n");
+
+    FrameRangesFree(&ranges);
+    free(frame);
+    SparseCloseRead(r);
+    return(errors ? 1 : 0);
+}
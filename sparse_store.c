@@ -0,0 +1,792 @@
+/*
+ *  sparse_store.c
+ *
+ *  Background model and tile-sparse sequence files - see sparse_store.h.
+ */
+#define _FILE_OFFSET_BITS   64      // sequences can pass 2 GB on the 32 bit builds
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Linux
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "sparse_store.h"
+
+#if !defined(USE_LZ4)
+    #define USE_LZ4     1
+#endif
+#if !defined(USE_ZSTD)
+    #define USE_ZSTD    1
+#endif
+
+#if USE_LZ4
+  #include <lz4.h>
+#endif
+#if USE_ZSTD
+  #include <zstd.h>
+#endif
+
+#define MAX_MEDIAN_FRAMES   255
+#define MIN_COMPRESS_BYTES  64      // rows smaller than this are stored as is
+
+
+
+// ================================================================================================
+// Per-pixel median of frames[0..nframes-1] - the background model
+// ================================================================================================
+void BackgroundMedian(unsigned char *const frames[], int nframes, size_t npixels, unsigned char *background)
+{
+    unsigned char v[MAX_MEDIAN_FRAMES];
+    size_t p;
+    int i, j;
+
+    if (nframes > MAX_MEDIAN_FRAMES) {
+        nframes = MAX_MEDIAN_FRAMES;
+    }
+    if (nframes <= 0) {
+        memset(background, 0, npixels);
+        return;
+    }
+
+    for (p = 0; p < npixels; p++) {
+        // Insertion sort - K is small
+        for (i = 0; i < nframes; i++) {
+            unsigned char x = frames[i][p];
+            for (j = i; j > 0 && v[j-1] > x; j--) {
+                v[j] = v[j-1];
+            }
+            v[j] = x;
+        }
+        background[p] = v[nframes/2];
+    }
+}
+
+
+
+// ================================================================================================
+// Tile geometry - tiles on the right and bottom edges may be partial
+// ================================================================================================
+static void TileRect(const SparseFileHeader *h, int tx, int ty, int *x0, int *y0, int *w, int *ht)
+{
+    *x0 = tx * h->tile;
+    *y0 = ty * h->tile;
+    *w = (int)h->xdim - *x0 < (int)h->tile ? (int)h->xdim - *x0 : (int)h->tile;
+    *ht = (int)h->ydim - *y0 < (int)h->tile ? (int)h->ydim - *y0 : (int)h->tile;
+}
+
+
+// Largest a row of tile payloads can be, and a whole record
+static size_t RowBytes(const SparseFileHeader *h, int tilesx)
+{
+    return (size_t)tilesx * h->tile * h->tile;
+}
+
+static size_t MaxRecordBytes(const SparseFileHeader *h, int tilesx, int tilesy)
+{
+    return (size_t)(tilesx * tilesy + 3) / 4 + (size_t)tilesy * (2*sizeof(uint32_t) + RowBytes(h, tilesx));
+}
+
+// SPARSE_CODEC_LZ4DELTA frames that are coded without the previous frame
+static int IsKeyFrame(const SparseFileHeader *h, int index)
+{
+    return h->codec != SPARSE_CODEC_LZ4DELTA || h->keyinterval == 0 || index % h->keyinterval == 0;
+}
+
+
+
+// ================================================================================================
+// Codec names for trial options and reports: "none", "lz4" (delta + LZ4), "zstd" or "zstd:<level>"
+// ================================================================================================
+int SparseParseCodec(const char *name, int *codec, int *level)
+{
+    *level = 0;
+    if (strncmp(name, "none", 4) == 0) {
+        *codec = SPARSE_CODEC_NONE;
+    }
+    else if (strncmp(name, "lz4", 3) == 0) {
+        *codec = SPARSE_CODEC_LZ4DELTA;
+    }
+    else if (strncmp(name, "zstd", 4) == 0) {
+        *codec = SPARSE_CODEC_ZSTD;
+        *level = 3;
+        if (name[4] == ':') {
+            sscanf(name + 5, "%d", level);
+        }
+    }
+    else {
+        return(-1);
+    }
+    return(0);
+}
+
+const char *SparseCodecName(int codec)
+{
+    switch (codec) {
+    case SPARSE_CODEC_LZ4DELTA: return "lz4";
+    case SPARSE_CODEC_ZSTD:     return "zstd";
+    default:                    return "none";
+    }
+}
+
+
+
+// ================================================================================================
+// Compress one row of tile payloads into dst; 0 when it doesn't get smaller
+// ================================================================================================
+static size_t CompressRow(const SparseFileHeader *h, SparseEncoder *e, const unsigned char *src, size_t n, unsigned char *dst)
+{
+    if (n < MIN_COMPRESS_BYTES) {
+        return(0);
+    }
+#if USE_LZ4
+    if (h->codec == SPARSE_CODEC_LZ4DELTA) {
+        int c = LZ4_compress_default((const char *)src, (char *)dst, (int)n, (int)n - 1);
+        return c > 0 ? (size_t)c : 0;
+    }
+#endif
+#if USE_ZSTD
+    if (h->codec == SPARSE_CODEC_ZSTD) {
+        size_t c = ZSTD_compressCCtx((ZSTD_CCtx *)e->zstd, dst, n - 1, src, n, (int)h->level);
+        return ZSTD_isError(c) ? 0 : c;
+    }
+#else
+    (void)e;
+#endif
+#if !USE_LZ4 && !USE_ZSTD
+    (void)h, (void)src, (void)dst;
+#endif
+    return(0);
+}
+
+static int DecompressRow(SparseReader *r, const unsigned char *src, size_t stored, unsigned char *dst, size_t raw)
+{
+#if USE_LZ4
+    if (r->header.codec == SPARSE_CODEC_LZ4DELTA) {
+        return LZ4_decompress_safe((const char *)src, (char *)dst, (int)stored, (int)raw) == (int)raw ? 0 : -1;
+    }
+#endif
+#if USE_ZSTD
+    if (r->header.codec == SPARSE_CODEC_ZSTD) {
+        return ZSTD_decompressDCtx((ZSTD_DCtx *)r->zstd, dst, raw, src, stored) == raw ? 0 : -1;
+    }
+#endif
+#if !USE_LZ4 && !USE_ZSTD
+    (void)r, (void)src, (void)stored, (void)dst, (void)raw;
+#endif
+    return(-1);
+}
+
+
+
+// ================================================================================================
+// Create a .bgs file; maxframes bounds the frames that will be written
+// ================================================================================================
+SparseWriter *SparseCreate(const char *path, int xdim, int ydim, int threshold,
+                           const unsigned char *background, int backgroundframes, int maxframes,
+                           int codec, int level)
+{
+    SparseWriter *w = (SparseWriter *)calloc(1, sizeof(SparseWriter));
+
+    if (w == NULL) {
+        return NULL;
+    }
+    if (threshold < 0) {
+        threshold = 0;
+    }
+    if (threshold > SPARSE_MAX_THRESHOLD) {
+        threshold = SPARSE_MAX_THRESHOLD;
+    }
+#if !USE_LZ4
+    if (codec == SPARSE_CODEC_LZ4DELTA) {
+        fprintf(stderr, "%s: built without LZ4 - frames stored uncompressed\n", path);
+        codec = SPARSE_CODEC_NONE;
+    }
+#endif
+#if !USE_ZSTD
+    if (codec == SPARSE_CODEC_ZSTD) {
+        fprintf(stderr, "%s: built without zstd - frames stored uncompressed\n", path);
+        codec = SPARSE_CODEC_NONE;
+    }
+#endif
+    if (codec != SPARSE_CODEC_LZ4DELTA && codec != SPARSE_CODEC_ZSTD) {
+        codec = SPARSE_CODEC_NONE;
+    }
+    w->header.magic = SPARSE_MAGIC;
+    w->header.version = SPARSE_VERSION;
+    w->header.xdim = xdim;
+    w->header.ydim = ydim;
+    w->header.tile = SPARSE_TILE;
+    w->header.threshold = threshold;
+    w->header.backgroundframes = backgroundframes;
+    w->header.codec = codec;
+    w->header.level = codec == SPARSE_CODEC_ZSTD ? level : 0;
+    w->header.keyinterval = codec == SPARSE_CODEC_LZ4DELTA ? SPARSE_KEYINTERVAL : 0;
+    w->tilesx = (xdim + SPARSE_TILE - 1) / SPARSE_TILE;
+    w->tilesy = (ydim + SPARSE_TILE - 1) / SPARSE_TILE;
+    w->maxframes = maxframes;
+
+    w->background = (unsigned char *)malloc((size_t)xdim * ydim);
+    w->offsets = (uint64_t *)malloc((maxframes > 0 ? maxframes : 1) * sizeof(uint64_t));
+    if (codec == SPARSE_CODEC_LZ4DELTA) {
+        w->previous = (unsigned char *)calloc((size_t)xdim * ydim, 1);
+    }
+    if (w->background == NULL || w->offsets == NULL || SparseEncoderInit(&w->encoder, w) < 0
+        || (codec == SPARSE_CODEC_LZ4DELTA && w->previous == NULL)) {
+        SparseClose(w, NULL);
+        return NULL;
+    }
+    memcpy(w->background, background, (size_t)xdim * ydim);
+
+    if ((w->fp = fopen(path, "wb")) == NULL) {
+        perror(path);
+        SparseClose(w, NULL);
+        return NULL;
+    }
+    setvbuf(w->fp, NULL, _IOFBF, 1 << 20);
+    fwrite(&w->header, sizeof(w->header), 1, w->fp);
+    fwrite(w->background, 1, (size_t)xdim * ydim, w->fp);
+    w->stats.storedbytes = sizeof(w->header) + (double)xdim * ydim;
+
+    // Without a journal the file is still written, it just can't be recovered
+    w->journal = JournalCreate(path, &w->header, sizeof(w->header), w->background, (size_t)xdim * ydim);
+    return w;
+}
+
+
+
+// ================================================================================================
+// Encoder scratch for the writer's geometry and codec
+// ================================================================================================
+int SparseEncoderInit(SparseEncoder *e, const SparseWriter *w)
+{
+    memset(e, 0, sizeof(*e));
+    e->record = (unsigned char *)malloc(MaxRecordBytes(&w->header, w->tilesx, w->tilesy));
+    e->row = (unsigned char *)malloc(RowBytes(&w->header, w->tilesx));
+#if USE_ZSTD
+    if (w->header.codec == SPARSE_CODEC_ZSTD) {
+        e->zstd = ZSTD_createCCtx();
+    }
+#endif
+    if (e->record == NULL || e->row == NULL || (w->header.codec == SPARSE_CODEC_ZSTD && e->zstd == NULL)) {
+        SparseEncoderFree(e);
+        return(-1);
+    }
+    return(0);
+}
+
+void SparseEncoderFree(SparseEncoder *e)
+{
+#if USE_ZSTD
+    ZSTD_freeCCtx((ZSTD_CCtx *)e->zstd);
+#endif
+    free(e->record);
+    free(e->row);
+    e->record = e->row = NULL;
+    e->zstd = NULL;
+}
+
+
+
+// ================================================================================================
+// Encode frame 'index' into e->record; returns the record length
+// ================================================================================================
+size_t SparseEncodeFrame(const SparseWriter *w, SparseEncoder *e, int index,
+                         const unsigned char *frame, const unsigned char *previous)
+{
+    const SparseFileHeader *h = &w->header;
+    int ntiles = w->tilesx * w->tilesy;
+    size_t classbytes = (size_t)(ntiles + 3) / 4;
+    unsigned char *classes = e->record;
+    unsigned char *out = e->record + classbytes;
+    int threshold = (int)h->threshold;
+    int delta = !IsKeyFrame(h, index);
+    int tx, ty, t = 0, x, y;
+
+    memset(classes, 0, classbytes);
+
+    for (ty = 0; ty < w->tilesy; ty++) {
+        unsigned char *row = e->row;
+        uint32_t rawsize, storedsize;
+
+        for (tx = 0; tx < w->tilesx; tx++, t++) {
+            int x0, y0, tw, th, maxdiff = 0;
+            TileRect(h, tx, ty, &x0, &y0, &tw, &th);
+
+            // Largest difference from the background, stopping as soon as the tile must be raw
+            for (y = y0; y < y0 + th && maxdiff <= threshold; y++) {
+                const unsigned char *f = frame + (size_t)y * h->xdim;
+                const unsigned char *b = w->background + (size_t)y * h->xdim;
+                for (x = x0; x < x0 + tw; x++) {
+                    int d = f[x] - b[x];
+                    d = d < 0 ? -d : d;
+                    maxdiff = d > maxdiff ? d : maxdiff;
+                }
+            }
+
+            if (maxdiff == 0) {
+                e->tiles[SPARSE_SAME]++;
+                continue;
+            }
+            if (maxdiff <= threshold) {
+                // Residuals + 8 as nibbles, low nibble first, tile raster order
+                int n = 0;
+                for (y = y0; y < y0 + th; y++) {
+                    const unsigned char *f = frame + (size_t)y * h->xdim;
+                    const unsigned char *b = w->background + (size_t)y * h->xdim;
+                    for (x = x0; x < x0 + tw; x++, n++) {
+                        unsigned char r = (unsigned char)(f[x] - b[x] + 8) & 0x0f;
+                        if (n & 1) {
+                            *row++ |= r << 4;
+                        }
+                        else {
+                            *row = r;
+                        }
+                    }
+                }
+                if (n & 1) {
+                    row++;
+                }
+                classes[t/4] |= SPARSE_SMALL << (2*(t%4));
+                e->tiles[SPARSE_SMALL]++;
+            }
+            else {
+                for (y = y0; y < y0 + th; y++) {
+                    const unsigned char *f = frame + (size_t)y * h->xdim + x0;
+                    if (delta) {
+                        // A drop moving over a static patch leaves most of the tile unchanged - zeros for LZ4
+                        const unsigned char *p = previous + (size_t)y * h->xdim + x0;
+                        for (x = 0; x < tw; x++) {
+                            *row++ = (unsigned char)(f[x] - p[x]);
+                        }
+                    }
+                    else {
+                        memcpy(row, f, tw);
+                        row += tw;
+                    }
+                }
+                classes[t/4] |= SPARSE_RAW << (2*(t%4));
+                e->tiles[SPARSE_RAW]++;
+            }
+        }
+
+        // Row block: raw size, stored size, payloads - compressed only if that helped
+        rawsize = (uint32_t)(row - e->row);
+        storedsize = (uint32_t)CompressRow(h, e, e->row, rawsize, out + 2*sizeof(uint32_t));
+        if (storedsize == 0) {
+            storedsize = rawsize;
+            memcpy(out + 2*sizeof(uint32_t), e->row, rawsize);
+        }
+        memcpy(out, &rawsize, sizeof(uint32_t));
+        memcpy(out + sizeof(uint32_t), &storedsize, sizeof(uint32_t));
+        out += 2*sizeof(uint32_t) + storedsize;
+    }
+    return (size_t)(out - e->record);
+}
+
+
+
+// ================================================================================================
+// Append an encoded frame record - records must arrive in frame order
+// ================================================================================================
+int SparseAppendRecord(SparseWriter *w, const unsigned char *record, size_t length)
+{
+    uint32_t length32 = (uint32_t)length;
+
+    if ((int)w->header.frames >= w->maxframes) {
+        return(-1);
+    }
+    w->offsets[w->header.frames++] = (uint64_t)ftello(w->fp);
+    if (fwrite(&length32, sizeof(length32), 1, w->fp) != 1 || fwrite(record, 1, length, w->fp) != length) {
+        return(-1);
+    }
+    if (w->journal != NULL) {
+        JournalAppend(w->journal, w->header.frames - 1, w->offsets[w->header.frames - 1], (uint32_t)(sizeof(length32) + length),
+                      JournalCrc(JournalCrc(0, &length32, sizeof(length32)), record, length));
+    }
+    w->stats.rawbytes += (double)w->header.xdim * w->header.ydim;
+    w->stats.storedbytes += sizeof(length32) + length;
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Append one frame
+// ================================================================================================
+int SparseWriteFrame(SparseWriter *w, const unsigned char *frame)
+{
+    size_t length;
+
+    if ((int)w->header.frames >= w->maxframes) {
+        return(-1);
+    }
+    length = SparseEncodeFrame(w, &w->encoder, (int)w->header.frames, frame, w->previous);
+    if (w->previous != NULL) {
+        memcpy(w->previous, frame, (size_t)w->header.xdim * w->header.ydim);
+    }
+    return SparseAppendRecord(w, w->encoder.record, length);
+}
+
+
+
+// ================================================================================================
+// Write the frame index, finish the header and close - the journal goes once the file is on the disk;
+// stats may be NULL
+// ================================================================================================
+int SparseClose(SparseWriter *w, SparseStats *stats)
+{
+    int status = 0, i;
+
+    if (w == NULL) {
+        return(-1);
+    }
+    if (w->fp != NULL) {
+        w->header.indexoffset = (uint64_t)ftello(w->fp);
+        fwrite(w->offsets, sizeof(uint64_t), w->header.frames, w->fp);
+        w->stats.storedbytes += (double)w->header.frames * sizeof(uint64_t);
+        fseeko(w->fp, 0, SEEK_SET);
+        fwrite(&w->header, sizeof(w->header), 1, w->fp);
+        if (fflush(w->fp) != 0 || fsync(fileno(w->fp)) != 0 || ferror(w->fp)) {
+            status = -1;
+        }
+        if (fclose(w->fp) != 0) {
+            status = -1;
+        }
+    }
+    JournalClose(w->journal, status == 0);
+    for (i = 0; i < 3; i++) {
+        w->stats.tiles[i] += w->encoder.tiles[i];
+    }
+    if (stats != NULL) {
+        *stats = w->stats;
+    }
+    SparseEncoderFree(&w->encoder);
+    free(w->background);
+    free(w->previous);
+    free(w->offsets);
+    free(w);
+    return(status);
+}
+
+
+
+// ================================================================================================
+// Open a .bgs file for reading
+// ================================================================================================
+SparseReader *SparseOpen(const char *path)
+{
+    SparseReader *r = (SparseReader *)calloc(1, sizeof(SparseReader));
+    const SparseFileHeader *h;
+    size_t npixels;
+    int delta;
+
+    if (r == NULL) {
+        return NULL;
+    }
+    h = &r->header;
+    r->previousindex = -1;
+    if ((r->fp = fopen(path, "rb")) == NULL) {
+        perror(path);
+        free(r);
+        return NULL;
+    }
+    if (fread(&r->header, sizeof(r->header), 1, r->fp) != 1 || h->magic != SPARSE_MAGIC
+        || h->version != SPARSE_VERSION || h->tile == 0 || h->tile > 256) {
+        fprintf(stderr, "%s: not a version %d sparse sequence file\n", path, SPARSE_VERSION);
+        SparseCloseRead(r);
+        return NULL;
+    }
+    if ((h->codec == SPARSE_CODEC_LZ4DELTA && !USE_LZ4) || (h->codec == SPARSE_CODEC_ZSTD && !USE_ZSTD)
+        || h->codec > SPARSE_CODEC_ZSTD) {
+        fprintf(stderr, "%s: frames compressed with %s, which this build can't decode\n", path, SparseCodecName(h->codec));
+        SparseCloseRead(r);
+        return NULL;
+    }
+    npixels = (size_t)h->xdim * h->ydim;
+    delta = h->codec == SPARSE_CODEC_LZ4DELTA;
+    r->tilesx = (h->xdim + h->tile - 1) / h->tile;
+    r->tilesy = (h->ydim + h->tile - 1) / h->tile;
+    r->background = (unsigned char *)malloc(npixels);
+    r->record = (unsigned char *)malloc(MaxRecordBytes(h, r->tilesx, r->tilesy));
+    r->row = (unsigned char *)malloc(RowBytes(h, r->tilesx));
+    r->offsets = (uint64_t *)malloc((h->frames ? h->frames : 1) * sizeof(uint64_t));
+    if (delta) {
+        r->previous = (unsigned char *)malloc(npixels);
+        r->chain = (unsigned char *)malloc(npixels);
+    }
+#if USE_ZSTD
+    if (h->codec == SPARSE_CODEC_ZSTD) {
+        r->zstd = ZSTD_createDCtx();
+    }
+#endif
+    if (r->background == NULL || r->record == NULL || r->row == NULL || r->offsets == NULL
+        || (delta && (r->previous == NULL || r->chain == NULL))
+        || (h->codec == SPARSE_CODEC_ZSTD && r->zstd == NULL)
+        || fread(r->background, 1, npixels, r->fp) != npixels
+        || fseeko(r->fp, (off_t)h->indexoffset, SEEK_SET) != 0
+        || fread(r->offsets, sizeof(uint64_t), h->frames, r->fp) != h->frames) {
+        fprintf(stderr, "%s: truncated sparse sequence file\n", path);
+        SparseCloseRead(r);
+        return NULL;
+    }
+    return r;
+}
+
+
+
+// ================================================================================================
+// Recovery of a file whose writer never closed it - see frame_journal.h
+// The records that check out in order are kept, and the index and header written after them
+// ================================================================================================
+// Records that check out, in order, from the end of the background; -1 if the background doesn't
+static int CheckRecords(int fd, const SparseFileHeader *h, const JournalContents *c, uint64_t *offsets, uint64_t *end)
+{
+    size_t npixels = (size_t)h->xdim * h->ydim, bufbytes = npixels;
+    unsigned char *buf = (unsigned char *)malloc(bufbytes);
+    uint32_t length32;
+    int n;
+
+    *end = sizeof(*h) + npixels;
+    if (buf == NULL || pread(fd, buf, npixels, sizeof(*h)) != (ssize_t)npixels
+     || JournalCrc(0, buf, npixels) != c->header.preamblecrc) {
+        free(buf);
+        return(-1);
+    }
+    for (n = 0; n < c->nrecords; n++) {
+        const JournalRecord *r = &c->records[n];
+
+        if (r->offset != *end || r->length < sizeof(length32)) {
+            break;
+        }
+        if (r->length > bufbytes) {
+            unsigned char *more = (unsigned char *)realloc(buf, r->length);
+            if (more == NULL) {
+                break;
+            }
+            buf = more;
+            bufbytes = r->length;
+        }
+        if (pread(fd, buf, r->length, (off_t)r->offset) != (ssize_t)r->length || JournalCrc(0, buf, r->length) != r->datacrc) {
+            break;
+        }
+        memcpy(&length32, buf, sizeof(length32));
+        if (length32 != r->length - sizeof(length32)) {
+            break;
+        }
+        offsets[n] = r->offset;
+        *end += r->length;
+    }
+    free(buf);
+    return(n);
+}
+
+int SparseRecover(const char *path, JournalRecovery *result)
+{
+    JournalContents c;
+    SparseFileHeader h;
+    uint64_t *offsets, end;
+    size_t indexbytes;
+    int fd, n, status;
+
+    memset(result, 0, sizeof(*result));
+    if ((status = JournalRead(path, &c)) != 0) {
+        return status > 0 ? 0 : -1;
+    }
+    result->journaled = 1;
+    result->records = c.nrecords;
+    memcpy(&h, c.header.header, sizeof(h));
+    if (c.header.headerbytes != sizeof(h) || h.magic != SPARSE_MAGIC) {
+        fprintf(stderr, "%s: the journal isn't a sparse sequence's\n", path);
+        JournalFree(&c);
+        return(-1);
+    }
+    offsets = (uint64_t *)malloc((c.nrecords + 1) * sizeof(uint64_t));
+    if (offsets == NULL || (fd = open(path, O_RDWR)) < 0) {
+        perror(path);
+        free(offsets);
+        JournalFree(&c);
+        return(-1);
+    }
+    if ((n = CheckRecords(fd, &h, &c, offsets, &end)) < 0) {
+        fprintf(stderr, "%s: the background never reached the disk - nothing to recover\n", path);
+        status = -1;
+    }
+    else {
+        // The index after the last good record, the header, and the file cut back to them
+        indexbytes = n * sizeof(uint64_t);
+        h.frames = (uint32_t)n;
+        h.indexoffset = end;
+        if (pwrite(fd, offsets, indexbytes, (off_t)end) != (ssize_t)indexbytes || pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)
+         || ftruncate(fd, (off_t)(end + indexbytes)) != 0) {
+            perror(path);
+            status = -1;
+        }
+        else {
+            status = JournalRetire(path, fd);
+        }
+        result->frames = n;
+        result->bytes = (double)(end + indexbytes);
+    }
+    close(fd);
+    free(offsets);
+    JournalFree(&c);
+    return(status);
+}
+
+
+
+// ================================================================================================
+// Decode one record; 'previous' is frame index-1, used only by SPARSE_CODEC_LZ4DELTA
+// ================================================================================================
+static int DecodeRecord(SparseReader *r, int index, unsigned char *frame, const unsigned char *previous)
+{
+    const SparseFileHeader *h = &r->header;
+    int ntiles = r->tilesx * r->tilesy;
+    int delta = !IsKeyFrame(h, index);
+    const unsigned char *in, *end;
+    int tx, ty, t = 0, x, y;
+    uint32_t length;
+
+    if (fseeko(r->fp, (off_t)r->offsets[index], SEEK_SET) != 0
+        || fread(&length, sizeof(length), 1, r->fp) != 1
+        || length > MaxRecordBytes(h, r->tilesx, r->tilesy)
+        || fread(r->record, 1, length, r->fp) != length) {
+        return(-1);
+    }
+    in = r->record + (ntiles + 3) / 4;
+    end = r->record + length;
+
+    memcpy(frame, r->background, (size_t)h->xdim * h->ydim);
+    for (ty = 0; ty < r->tilesy; ty++) {
+        const unsigned char *row, *rowend;
+        uint32_t rawsize, storedsize;
+
+        if (end - in < (long)(2*sizeof(uint32_t))) {
+            return(-1);
+        }
+        memcpy(&rawsize, in, sizeof(uint32_t));
+        memcpy(&storedsize, in + sizeof(uint32_t), sizeof(uint32_t));
+        in += 2*sizeof(uint32_t);
+        if (storedsize > (size_t)(end - in) || rawsize > RowBytes(h, r->tilesx)) {
+            return(-1);
+        }
+        if (storedsize == rawsize) {
+            row = in;
+        }
+        else if (DecompressRow(r, in, storedsize, r->row, rawsize) == 0) {
+            row = r->row;
+        }
+        else {
+            return(-1);
+        }
+        in += storedsize;
+        rowend = row + rawsize;
+
+        for (tx = 0; tx < r->tilesx; tx++, t++) {
+            int x0, y0, tw, th, n = 0;
+            int cls = (r->record[t/4] >> (2*(t%4))) & 3;
+            TileRect(h, tx, ty, &x0, &y0, &tw, &th);
+
+            if (cls == SPARSE_SMALL) {
+                if (rowend - row < (tw*th + 1) / 2) {
+                    return(-1);
+                }
+                for (y = y0; y < y0 + th; y++) {
+                    unsigned char *f = frame + (size_t)y * h->xdim;
+                    for (x = x0; x < x0 + tw; x++, n++) {
+                        int v = (n & 1) ? (row[n/2] >> 4) : (row[n/2] & 0x0f);
+                        f[x] = (unsigned char)(f[x] + v - 8);
+                    }
+                }
+                row += (n + 1) / 2;
+            }
+            else if (cls == SPARSE_RAW) {
+                if (rowend - row < tw*th) {
+                    return(-1);
+                }
+                for (y = y0; y < y0 + th; y++) {
+                    unsigned char *f = frame + (size_t)y * h->xdim + x0;
+                    if (delta) {
+                        const unsigned char *p = previous + (size_t)y * h->xdim + x0;
+                        for (x = 0; x < tw; x++) {
+                            f[x] = (unsigned char)(row[x] + p[x]);
+                        }
+                    }
+                    else {
+                        memcpy(f, row, tw);
+                    }
+                    row += tw;
+                }
+            }
+        }
+    }
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Reconstruct frame 'index' (0 based) exactly
+// SPARSE_CODEC_LZ4DELTA frames depend on the one before: reading in order costs one decode per
+// frame, a seek decodes forward from the key frame at or before 'index'
+// ================================================================================================
+int SparseReadFrame(SparseReader *r, int index, unsigned char *frame)
+{
+    const SparseFileHeader *h = &r->header;
+    size_t npixels = (size_t)h->xdim * h->ydim;
+    int i;
+
+    if (index < 0 || index >= (int)h->frames) {
+        return(-1);
+    }
+    if (h->codec != SPARSE_CODEC_LZ4DELTA) {
+        return DecodeRecord(r, index, frame, NULL);
+    }
+
+    if (!IsKeyFrame(h, index) && r->previousindex != index - 1) {
+        int key = index - index % (int)h->keyinterval;
+        i = (r->previousindex >= key && r->previousindex < index) ? r->previousindex + 1 : key;
+        for (; i < index; i++) {
+            unsigned char *swap;
+            if (DecodeRecord(r, i, r->chain, r->previous) < 0) {
+                r->previousindex = -1;
+                return(-1);
+            }
+            swap = r->previous;
+            r->previous = r->chain;
+            r->chain = swap;
+            r->previousindex = i;
+        }
+    }
+    if (DecodeRecord(r, index, frame, r->previous) < 0) {
+        r->previousindex = -1;
+        return(-1);
+    }
+    memcpy(r->previous, frame, npixels);
+    r->previousindex = index;
+    return(0);
+}
+
+void SparseCloseRead(SparseReader *r)
+{
+    if (r == NULL) {
+        return;
+    }
+    if (r->fp != NULL) {
+        fclose(r->fp);
+    }
+#if USE_ZSTD
+    ZSTD_freeDCtx((ZSTD_DCtx *)r->zstd);
+#endif
+    free(r->background);
+    free(r->record);
+    free(r->row);
+    free(r->previous);
+    free(r->chain);
+    free(r->offsets);
+    free(r);
+}
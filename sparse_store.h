@@ -0,0 +1,148 @@
+/*
+ *  sparse_store.h
+ *
+ *  Background-subtracted, tile-sparse storage for sequences of a mostly
+ *  static scene (e.g. the bouncing drop videos taken with BouncingGlass0.fmt).
+ *
+ *  The background is the per-pixel median of the first K frames. Each frame is
+ *  cut into SPARSE_TILE x SPARSE_TILE tiles and every tile is stored as one of
+ *
+ *	    SPARSE_SAME     identical to the background - nothing stored
+ *	    SPARSE_SMALL    every pixel within +-threshold (at most 7) of the
+ *	                    background - residuals stored as 4 bit nibbles
+ *	    SPARSE_RAW      changed beyond the threshold - pixels stored as is
+ *
+ *  so reconstruction is exact. A .bgs file holds a SparseFileHeader, the
+ *  background, one record per frame and, at indexoffset, a table of uint64
+ *  record offsets, all in host byte order. A record is a uint32 length, the
+ *  2 bit tile classes packed four to a byte, then one block per row of tiles:
+ *  uint32 raw size, uint32 stored size and the row's tile payloads, which are
+ *  compressed by the file's codec unless that didn't make them smaller
+ *  (stored size == raw size). The codec is chosen when the file is created:
+ *
+ *	    SPARSE_CODEC_NONE       payloads as is
+ *	    SPARSE_CODEC_LZ4DELTA   raw tiles stored as the difference from the
+ *	                            previous frame, then LZ4; every keyinterval'th
+ *	                            frame is coded without the previous one
+ *	    SPARSE_CODEC_ZSTD       zstd at 'level'
+ *
+ *  Each row of tiles is compressed on its own, so rows decode independently.
+ *  Records are journaled as they are appended (frame_journal.h), so a file
+ *  whose writer never closed it can be finished by SparseRecover().
+ *  Build with -DUSE_LZ4=0 or -DUSE_ZSTD=0 where the library isn't installed;
+ *  such a build writes SPARSE_CODEC_NONE instead and can't read those files.
+ */
+#ifndef SPARSE_STORE_H
+#define SPARSE_STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frame_journal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPARSE_MAGIC        0x47424b4d      // "MKBG"
+#define SPARSE_VERSION      2
+#define SPARSE_TILE         16
+#define SPARSE_MAX_THRESHOLD 7
+#define SPARSE_KEYINTERVAL  64
+
+#define SPARSE_CODEC_NONE       0
+#define SPARSE_CODEC_LZ4DELTA   1
+#define SPARSE_CODEC_ZSTD       2
+
+#define SPARSE_SAME         0
+#define SPARSE_SMALL        1
+#define SPARSE_RAW          2
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    xdim, ydim;
+    uint32_t    tile;
+    uint32_t    threshold;
+    uint32_t    backgroundframes;   // K - frames the median was taken over
+    uint32_t    frames;             // filled in on close
+    uint64_t    indexoffset;        // filled in on close
+    uint32_t    codec;              // SPARSE_CODEC_...
+    uint32_t    level;              // zstd compression level
+    uint32_t    keyinterval;        // SPARSE_CODEC_LZ4DELTA: frames 0, keyinterval, ... don't use the previous frame
+    uint32_t    reserved;
+} SparseFileHeader;
+
+typedef struct {
+    long    tiles[3];               // count of SPARSE_SAME, SPARSE_SMALL, SPARSE_RAW tiles
+    double  rawbytes;               // what the frames would take uncompressed
+    double  storedbytes;            // file size
+} SparseStats;
+
+// Scratch for encoding frames - one per thread, so several frames can be encoded at once
+typedef struct {
+    unsigned char   *record;        // the frame record being built
+    unsigned char   *row;           // one row of tile payloads before compression
+    void            *zstd;          // ZSTD_CCtx
+    long            tiles[3];       // tile classes of the frames encoded
+} SparseEncoder;
+
+typedef struct {
+    FILE            *fp;
+    SparseFileHeader header;
+    unsigned char   *background;
+    int             tilesx, tilesy;
+    SparseEncoder   encoder;        // for SparseWriteFrame()
+    unsigned char   *previous;      // last frame given to SparseWriteFrame(), SPARSE_CODEC_LZ4DELTA only
+    uint64_t        *offsets;
+    int             maxframes;
+    SparseStats     stats;
+    FrameJournal    *journal;       // NULL if it couldn't be created
+} SparseWriter;
+
+typedef struct {
+    FILE            *fp;
+    SparseFileHeader header;
+    unsigned char   *background;
+    int             tilesx, tilesy;
+    unsigned char   *record;
+    unsigned char   *row;
+    void            *zstd;          // ZSTD_DCtx
+    unsigned char   *previous;      // SPARSE_CODEC_LZ4DELTA: frame 'previousindex', decoded last
+    unsigned char   *chain;         // frames between the key frame and the one asked for
+    int             previousindex;
+    uint64_t        *offsets;
+} SparseReader;
+
+void BackgroundMedian(unsigned char *const frames[], int nframes, size_t npixels, unsigned char *background);
+
+int  SparseParseCodec(const char *name, int *codec, int *level);
+const char *SparseCodecName(int codec);
+
+SparseWriter *SparseCreate(const char *path, int xdim, int ydim, int threshold,
+                           const unsigned char *background, int backgroundframes, int maxframes,
+                           int codec, int level);
+int  SparseWriteFrame(SparseWriter *w, const unsigned char *frame);
+int  SparseClose(SparseWriter *w, SparseStats *stats);
+
+// Encoding and writing split apart, for encoding on several threads: 'previous' is frame index-1
+// as written (ignored for other codecs), and records must be appended in frame order
+int  SparseEncoderInit(SparseEncoder *e, const SparseWriter *w);
+void SparseEncoderFree(SparseEncoder *e);
+size_t SparseEncodeFrame(const SparseWriter *w, SparseEncoder *e, int index,
+                         const unsigned char *frame, const unsigned char *previous);
+int  SparseAppendRecord(SparseWriter *w, const unsigned char *record, size_t length);
+
+// A .bgs whose writer never closed it, from its journal; nothing to do if there is none
+int  SparseRecover(const char *path, JournalRecovery *result);
+
+SparseReader *SparseOpen(const char *path);
+int  SparseReadFrame(SparseReader *r, int index, unsigned char *frame);
+void SparseCloseRead(SparseReader *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
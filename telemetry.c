@@ -0,0 +1,179 @@
+/*
+ *  telemetry.c
+ *
+ *  Per-trial performance records - see telemetry.h.
+ *
+ *  The log is plain JSON lines, one record per trial, so it can be read with
+ *  any tool (jq, pandas.read_json(lines=True)) and survives the program
+ *  being killed between trials.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "telemetry.h"
+
+
+static FILE *logfp = NULL;
+static char logpath[256];
+static TrialTelemetry last;         // most recent record, for "Q" without a trial number
+static long ntrials = 0;
+
+
+
+// ================================================================================================
+// Monotonic clock in milliseconds
+// ================================================================================================
+double TelemetryNowMs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+
+
+// ================================================================================================
+// Open the log for appending; trial numbers continue from the records already in it
+// ================================================================================================
+int TelemetryOpen(const char *path)
+{
+    char line[1024];
+    FILE *fp;
+
+    snprintf(logpath, sizeof(logpath), "%s", path);
+
+    if ((fp = fopen(path, "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            long trial;
+            char *p = strstr(line, "\"trial\":");
+            if (p != NULL && sscanf(p + 8, "%ld", &trial) == 1 && trial > ntrials) {
+                ntrials = trial;
+            }
+        }
+        fclose(fp);
+    }
+
+    if ((logfp = fopen(path, "a")) == NULL) {
+        perror(path);
+        return(-1);
+    }
+    printf("Telemetry appended to %s (%ld earlier trials).\r\n\n", path, ntrials);
+    return(0);
+}
+
+void TelemetryClose(void)
+{
+    if (logfp != NULL) {
+        fclose(logfp);
+    }
+    logfp = NULL;
+}
+
+
+
+// ================================================================================================
+// Start a record for a new trial
+// ================================================================================================
+void TelemetryBegin(TrialTelemetry *t, char identifier)
+{
+    memset(t, 0, sizeof(*t));
+    t->trial = ++ntrials;
+    t->start = (double)time(NULL);
+    t->identifier = identifier ? identifier : '?';
+}
+
+
+
+// ================================================================================================
+// Record as one line of JSON; returns the length written (truncated to len-1)
+// ================================================================================================
+int TelemetryFormat(const TrialTelemetry *t, char *out, size_t len)
+{
+    int n;
+
+    n = snprintf(out, len,
+        "{\"trial\":%ld,\"start\":%.0f,\"id\":\"%c\",\"format\":\"%s\","
+        "\"open_ms\":%.1f,\"arm_ms\":%.1f,"
+        "\"expected\":%d,\"captured\":%d,\"drops\":%d,\"capture_s\":%.3f,"
+        "\"readout_mbps\":%.1f,\"encode_fps\":%.1f,\"bytes\":%.0f,\"disk_s\":%.3f,"
+        "\"compress_ratio\":%.2f,\"encode_mbps_core\":%.0f,\"decode_mbps\":%.0f,"
+        "\"write_mbps\":%.0f,\"write_depth\":%.1f,"
+        "\"jitter_us\":[%.0f,%.0f,%.0f],\"mean_level\":%.1f,\"saturated_frames\":%d,\"fault\":%d",
+        t->trial, t->start, t->identifier, t->format,
+        t->openms, t->armms,
+        t->expected, t->captured, t->drops, t->captures,
+        t->readoutmbps, t->encodefps, t->byteswritten, t->disks,
+        t->compressratio, t->encodembpscore, t->decodembps,
+        t->writembps, t->writedepth,
+        t->jitterp50, t->jitterp99, t->jittermax, t->meanlevel, t->saturatedframes, t->fault);
+    if (n < 0 || (size_t)n >= len) {
+        return n;
+    }
+    if (t->rejected[0]) {
+        return n + snprintf(out + n, len - n, ",\"rejected\":\"%s\"}", t->rejected);
+    }
+    return n + snprintf(out + n, len - n, "}");
+}
+
+
+
+// ================================================================================================
+// Append a finished record to the log
+// ================================================================================================
+void TelemetryAppend(const TrialTelemetry *t)
+{
+    char line[1024];
+
+    last = *t;
+    TelemetryFormat(t, line, sizeof(line));
+    printf("Telemetry: %s\r\n\n", line);
+
+    if (logfp != NULL) {
+        fprintf(logfp, "%s\n", line);
+        fflush(logfp);
+    }
+}
+
+
+
+// ================================================================================================
+// Look up a record: trial <= 0 is the most recent one. Returns -1 if there is no such trial.
+// ================================================================================================
+int TelemetryQuery(long trial, char *out, size_t len)
+{
+    char line[1024];
+    FILE *fp;
+
+    // Nothing recorded since start-up - the most recent trial is the last one in the log
+    if (trial <= 0 && last.trial == 0) {
+        trial = ntrials;
+    }
+    if (trial <= 0 || trial == last.trial) {
+        if (last.trial == 0) {
+            return(-1);
+        }
+        TelemetryFormat(&last, out, len);
+        return(0);
+    }
+
+    // Older trials come from the log
+    if ((fp = fopen(logpath, "r")) == NULL) {
+        return(-1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        long n;
+        char *p = strstr(line, "\"trial\":");
+        if (p != NULL && sscanf(p + 8, "%ld", &n) == 1 && n == trial) {
+            line[strcspn(line, "\n")] = 0;
+            snprintf(out, len, "%s", line);
+            fclose(fp);
+            return(0);
+        }
+    }
+    fclose(fp);
+    return(-1);
+}
@@ -0,0 +1,57 @@
+/*
+ *  telemetry.h
+ *
+ *  One structured performance record per trial, appended as a JSON line to a
+ *  log file and kept in memory so Machine A can query it over the UDP socket
+ *  ("Q" for the last trial, "Q <n>" for trial n).
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    long    trial;              // trial number, carrying on from the highest in the existing log
+    double  start;              // wall clock time the trial message arrived, seconds since the epoch
+    char    identifier;         // 'S' or 'E'
+    char    format[64];         // format profile
+    double  openms;             // pxd_PIXCIopen() time, 0 when the grabber stayed open
+    double  armms;              // trial message received -> pxd_goLiveSeq()
+    int     expected;           // frames planned
+    int     captured;           // frame buffers the grabber filled
+    int     drops;              // frames missing between the captured ones, from gaps in their field counts
+    double  captures;           // seconds the capture was live
+    double  readoutmbps;        // grabber -> host copy rate
+    double  encodefps;          // frames per second through the AVI encoder
+    double  byteswritten;       // size of the output file
+    double  disks;              // seconds from opening each output file to closing it, over all units
+    double  compressratio;      // sparse sequences: frame bytes / file bytes, worst unit
+    double  encodembpscore;     // sparse sequences: encoder MB/s per worker core, worst unit
+    double  decodembps;         // sparse sequences: single threaded read back MB/s, worst unit
+    double  writembps;          // raw sequences: MB/s through the disk writer, slowest unit
+    double  writedepth;         // raw sequences: mean writes in flight, slowest unit
+    double  jitterp50, jitterp99, jittermax;    // drain interval, microseconds
+    double  meanlevel;          // mean grey level over the trial's frames, darkest unit
+    int     saturatedframes;    // frames with more than FRAME_SATURATED_PCT of their pixels saturated
+    int     fault;              // pxd_mesgFault() result, 0 = no fault
+    char    rejected[256];      // why the trial was never armed (its plan, or out of memory); "" if it was
+} TrialTelemetry;
+
+int  TelemetryOpen(const char *path);
+void TelemetryClose(void);
+void TelemetryBegin(TrialTelemetry *t, char identifier);
+void TelemetryAppend(const TrialTelemetry *t);
+int  TelemetryFormat(const TrialTelemetry *t, char *out, size_t len);
+int  TelemetryQuery(long trial, char *out, size_t len);
+
+double TelemetryNowMs(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ *  trajectory.c
+ *
+ *  Blob centroids and nearest-neighbour tracks - see trajectory.h.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "trajectory.h"
+
+#define MAX_TRACKS          (2*TRACK_MAXBLOBS)
+
+// A run of above-threshold pixels on one row, and the blob sums gathered over it
+typedef struct {
+    int     x0, x1;                 // inclusive
+    int     parent;                 // union-find - the run with the smallest index is the root
+    double  w, wx, wy;
+    int     area;
+} Run;
+
+typedef struct {
+    Run     *runs;
+    int     nruns, maxruns;
+} RunScratch;
+
+typedef struct {
+    int     id;
+    double  x, y;
+    double  vx, vy;                 // pixels per frame
+    int     lastframe;
+} Track;
+
+typedef struct {
+    int     track, blob;
+    double  distance;
+} Pair;
+
+struct Tracker {
+    FILE        *fp;
+    int         threshold;
+    RunScratch  scratch;
+    Track       tracks[MAX_TRACKS];
+    Pair        pairs[MAX_TRACKS * TRACK_MAXBLOBS];
+    int         ntracks;
+    int         nextid;
+    long        points;
+};
+
+
+
+// ================================================================================================
+// Connected blobs above threshold, row by row
+// ================================================================================================
+static int Root(Run *runs, int i)
+{
+    while (runs[i].parent != i) {
+        runs[i].parent = runs[runs[i].parent].parent;
+        i = runs[i].parent;
+    }
+    return(i);
+}
+
+static void Join(Run *runs, int a, int b)
+{
+    a = Root(runs, a);
+    b = Root(runs, b);
+    if (a < b) {
+        runs[b].parent = a;
+    }
+    else if (b < a) {
+        runs[a].parent = b;
+    }
+}
+
+static int FindBlobsInto(RunScratch *s, const unsigned char *frame, int xdim, int ydim, int threshold,
+                         Blob *blobs, int maxblobs)
+{
+    int x, y, i, j, nblobs = 0;
+    int prevstart = 0, prevend = 0;
+
+    s->nruns = 0;
+    for (y = 0; y < ydim; y++) {
+        const unsigned char *row = frame + (size_t)y * xdim;
+        int rowstart = s->nruns;
+
+        for (x = 0; x < xdim; ) {
+            int start;
+            double w = 0, wx = 0;
+            Run *r;
+
+            if (row[x] <= threshold) {
+                x++;
+                continue;
+            }
+            for (start = x; x < xdim && row[x] > threshold; x++) {
+                double v = row[x] - threshold;
+                w += v;
+                wx += v * x;
+            }
+
+            if (s->nruns == s->maxruns) {
+                int grow = s->maxruns ? 2*s->maxruns : 1024;
+                Run *more = (Run *)realloc(s->runs, grow * sizeof(Run));
+                if (more == NULL) {
+                    return(-1);
+                }
+                s->runs = more;
+                s->maxruns = grow;
+            }
+            r = &s->runs[s->nruns];
+            r->x0 = start;
+            r->x1 = x - 1;
+            r->parent = s->nruns;
+            r->w = w;
+            r->wx = wx;
+            r->wy = w * y;
+            r->area = x - start;
+
+            // 8-connected to the runs of the row above that overlap it or touch it diagonally
+            for (j = prevstart; j < prevend && s->runs[j].x0 <= x; j++) {
+                if (s->runs[j].x1 >= start - 1) {
+                    Join(s->runs, j, s->nruns);
+                }
+            }
+            s->nruns++;
+        }
+        prevstart = rowstart;
+        prevend = s->nruns;
+    }
+
+    // Sum every run into its root - roots come before the runs joined to them
+    for (i = 0; i < s->nruns; i++) {
+        int root = Root(s->runs, i);
+        if (root != i) {
+            s->runs[root].w += s->runs[i].w;
+            s->runs[root].wx += s->runs[i].wx;
+            s->runs[root].wy += s->runs[i].wy;
+            s->runs[root].area += s->runs[i].area;
+        }
+    }
+
+    // Keep the largest maxblobs
+    for (i = 0; i < s->nruns; i++) {
+        const Run *r = &s->runs[i];
+        Blob b;
+        int slot = nblobs;
+
+        if (r->parent != i || r->area < TRACK_MINAREA) {
+            continue;
+        }
+        b.x = r->wx / r->w;
+        b.y = r->wy / r->w;
+        b.r = sqrt(r->area / M_PI);
+        b.weight = r->w;
+        b.area = r->area;
+
+        if (nblobs == maxblobs) {
+            for (j = 1, slot = 0; j < nblobs; j++) {
+                if (blobs[j].area < blobs[slot].area) {
+                    slot = j;
+                }
+            }
+            if (blobs[slot].area >= b.area) {
+                continue;
+            }
+        }
+        else {
+            nblobs++;
+        }
+        blobs[slot] = b;
+    }
+    return(nblobs);
+}
+
+int FindBlobs(const unsigned char *frame, int xdim, int ydim, int threshold, Blob *blobs, int maxblobs)
+{
+    RunScratch s;
+    int n;
+
+    memset(&s, 0, sizeof(s));
+    n = FindBlobsInto(&s, frame, xdim, ydim, threshold, blobs, maxblobs);
+    free(s.runs);
+    return(n);
+}
+
+
+
+// ================================================================================================
+// Tracker
+// ================================================================================================
+Tracker *TrackerOpen(const char *path, int threshold)
+{
+    Tracker *t = (Tracker *)calloc(1, sizeof(Tracker));
+
+    if (t == NULL) {
+        return NULL;
+    }
+    if ((t->fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        free(t);
+        return NULL;
+    }
+    t->threshold = threshold;
+    t->nextid = 1;
+    fprintf(t->fp, "frame,t,track,x,y,r\n");
+    return t;
+}
+
+static int ComparePairs(const void *a, const void *b)
+{
+    double d = ((const Pair *)a)->distance - ((const Pair *)b)->distance;
+    return d < 0 ? -1 : d > 0 ? 1 : 0;
+}
+
+// ================================================================================================
+// Find this frame's blobs and link them to the tracks, closest pairs first
+// Returns the number of blobs linked, copied to linked[] unless it is NULL
+// ================================================================================================
+int TrackerAdd(Tracker *t, const unsigned char *frame, int xdim, int ydim, int number, double seconds,
+               TrackPoint linked[TRACK_MAXBLOBS])
+{
+    Blob blobs[TRACK_MAXBLOBS];
+    Pair *pairs = t->pairs;
+    int blobtrack[TRACK_MAXBLOBS];
+    int tracktaken[MAX_TRACKS];
+    int nblobs, npairs = 0, nlinked = 0, i, j, n;
+
+    nblobs = FindBlobsInto(&t->scratch, frame, xdim, ydim, t->threshold, blobs, TRACK_MAXBLOBS);
+    if (nblobs < 0) {
+        nblobs = 0;
+    }
+
+    // Drop tracks that have gone unseen too long
+    for (i = n = 0; i < t->ntracks; i++) {
+        if (number - t->tracks[i].lastframe <= TRACK_MAXMISSED) {
+            t->tracks[n++] = t->tracks[i];
+        }
+    }
+    t->ntracks = n;
+
+    for (i = 0; i < t->ntracks; i++) {
+        const Track *tr = &t->tracks[i];
+        int gap = number - tr->lastframe;
+        double px = tr->x + tr->vx * gap, py = tr->y + tr->vy * gap;
+
+        tracktaken[i] = 0;
+        for (j = 0; j < nblobs; j++) {
+            double d = hypot(blobs[j].x - px, blobs[j].y - py);
+            if (d <= TRACK_GATE) {
+                pairs[npairs].track = i;
+                pairs[npairs].blob = j;
+                pairs[npairs].distance = d;
+                npairs++;
+            }
+        }
+    }
+    qsort(pairs, npairs, sizeof(Pair), ComparePairs);
+
+    for (j = 0; j < nblobs; j++) {
+        blobtrack[j] = -1;
+    }
+    for (i = 0; i < npairs; i++) {
+        Track *tr = &t->tracks[pairs[i].track];
+        const Blob *b = &blobs[pairs[i].blob];
+        int gap;
+
+        if (tracktaken[pairs[i].track] || blobtrack[pairs[i].blob] >= 0) {
+            continue;
+        }
+        tracktaken[pairs[i].track] = 1;
+        blobtrack[pairs[i].blob] = tr->id;
+        gap = number - tr->lastframe > 0 ? number - tr->lastframe : 1;
+        tr->vx = (b->x - tr->x) / gap;
+        tr->vy = (b->y - tr->y) / gap;
+        tr->x = b->x;
+        tr->y = b->y;
+        tr->lastframe = number;
+    }
+
+    // Blobs nothing claimed start new tracks
+    for (j = 0; j < nblobs; j++) {
+        if (blobtrack[j] < 0 && t->ntracks < MAX_TRACKS) {
+            Track *tr = &t->tracks[t->ntracks++];
+            tr->id = t->nextid++;
+            tr->x = blobs[j].x;
+            tr->y = blobs[j].y;
+            tr->vx = tr->vy = 0;
+            tr->lastframe = number;
+            blobtrack[j] = tr->id;
+        }
+        if (blobtrack[j] >= 0) {
+            fprintf(t->fp, "%d,%.6f,%d,%.2f,%.2f,%.2f\n", number, seconds, blobtrack[j], blobs[j].x, blobs[j].y, blobs[j].r);
+            t->points++;
+            if (linked != NULL) {
+                linked[nlinked].track = blobtrack[j];
+                linked[nlinked].x = blobs[j].x;
+                linked[nlinked].y = blobs[j].y;
+                linked[nlinked].r = blobs[j].r;
+                linked[nlinked].area = blobs[j].area;
+            }
+            nlinked++;
+        }
+    }
+    return(nlinked);
+}
+
+// Close the file; returns -1 if it could not be written
+int TrackerClose(Tracker *t, long *points, int *tracks)
+{
+    int status;
+
+    if (t == NULL) {
+        return(-1);
+    }
+    status = (ferror(t->fp) || fclose(t->fp) != 0) ? -1 : 0;
+    *points = t->points;
+    *tracks = t->nextid - 1;
+    free(t->scratch.runs);
+    free(t);
+    return(status);
+}
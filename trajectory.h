@@ -0,0 +1,60 @@
+/*
+ *  trajectory.h
+ *
+ *  Drop trajectories, extracted frame by frame while a trial is drained.
+ *
+ *  Pixels brighter than the drop threshold are joined into blobs, one row
+ *  of runs at a time (8-connected, union-find over the runs), so the cost
+ *  is one pass over the frame plus a little per run. Each blob gets an
+ *  intensity-weighted sub-pixel centroid (weights = grey level - threshold)
+ *  and an equivalent radius sqrt(area / pi).
+ *
+ *  Blobs are linked into tracks by nearest neighbour: every track predicts
+ *  its next position from its last velocity, and track/blob pairs within
+ *  the gate are taken closest first. A blob left over starts a new track; a
+ *  track unseen for TRACK_MAXMISSED frames ends.
+ *
+ *  Every linked blob is one "frame,t,track,x,y,r" line of <base>.traj.csv,
+ *  and TrackerAdd() also hands the frame's linked blobs back to the caller
+ *  for the event detector (drop_events.h).
+ */
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACK_MAXBLOBS      64          // blobs kept per frame, largest first
+#define TRACK_MINAREA       4           // smaller blobs are noise
+#define TRACK_GATE          40.0        // pixels a drop may move between frames
+#define TRACK_MAXMISSED     5           // frames a track survives without a blob
+
+typedef struct {
+    double  x, y;           // intensity-weighted centroid, pixels
+    double  r;              // equivalent radius, pixels
+    double  weight;         // sum of (grey level - threshold)
+    int     area;
+} Blob;
+
+// A blob linked to a track
+typedef struct {
+    int     track;
+    double  x, y, r;
+    int     area;
+} TrackPoint;
+
+typedef struct Tracker Tracker;
+
+int  FindBlobs(const unsigned char *frame, int xdim, int ydim, int threshold, Blob *blobs, int maxblobs);
+
+Tracker *TrackerOpen(const char *path, int threshold);
+int  TrackerAdd(Tracker *t, const unsigned char *frame, int xdim, int ydim, int number, double seconds,
+                 TrackPoint linked[TRACK_MAXBLOBS]);
+int  TrackerClose(Tracker *t, long *points, int *tracks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
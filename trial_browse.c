@@ -0,0 +1,190 @@
+/*
+ *  trial_browse.c
+ *
+ *  Browses the trials of the capture program's catalog (trial_catalog.h)
+ *  by their proxies (proxy.h), never opening a full resolution sequence:
+ *  each trial picked - with the same terms as trial_query, e.g.
+ *
+ *	    ./trial_browse E freq=40 phase=90..180
+ *
+ *  - is listed with its contact sheet drawn in the terminal, two pixels to
+ *  a character cell in 24 bit grey, scaled to the terminal's width. -p
+ *  plays each one's proxy instead, at -r proxy frames a second. Trials
+ *  captured with "proxy=0", or before there were proxies, are listed
+ *  without a picture. The sheets are plain PGM files for any image viewer
+ *  too (trial_query -f lists them).
+ *
+ *  Compile and run as:
+ *
+ *	    gcc trial_browse.c catalog_query.c proxy.c preview.c -lsqlite3 -lpthread -o trial_browse
+ *	    ./trial_browse [-c catalog] [-p] [-r fps] [-W columns] [-w sql_condition] [S|E] [column<op>value | column=lo..hi]...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <sqlite3.h>
+
+#include "trial_catalog.h"
+#include "catalog_query.h"
+#include "proxy.h"
+
+// Terminal size in character cells, 80x24 if it isn't a terminal
+static void TerminalSize(int *columns, int *rows)
+{
+    struct winsize ws;
+
+    *columns = 80, *rows = 24;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0) {
+        *columns = ws.ws_col, *rows = ws.ws_row;
+    }
+}
+
+// Mean of the pixels of image (w x h) under output pixel x, y of an ow x oh picture
+static int Cell(const unsigned char *image, int w, int h, int ow, int oh, int x, int y)
+{
+    int x0 = x * w / ow, x1 = (x + 1) * w / ow, y0 = y * h / oh, y1 = (y + 1) * h / oh;
+    int i, j;
+    long sum = 0;
+
+    if (x1 <= x0) {
+        x1 = x0 + 1;
+    }
+    if (y1 <= y0) {
+        y1 = y0 + 1;
+    }
+    for (j = y0; j < y1; j++) {
+        for (i = x0; i < x1; i++) {
+            sum += image[(size_t)j*w + i];
+        }
+    }
+    return (int)(sum / ((long)(x1 - x0) * (y1 - y0)));
+}
+
+// Draws image at most 'columns' cells wide and 'rows' high, an upper half block per two pixels
+static void Render(const unsigned char *image, int w, int h, int columns, int rows)
+{
+    int ow = w < columns ? w : columns, oh, x, y, top, bottom;
+
+    oh = (int)((long)h * ow / w);
+    if (oh > 2*rows) {
+        oh = 2*rows;
+        ow = (int)((long)w * oh / h);
+    }
+    if (ow < 1 || oh < 1) {
+        return;
+    }
+    for (y = 0; y < oh; y += 2) {
+        for (x = 0; x < ow; x++) {
+            top = Cell(image, w, h, ow, oh, x, y);
+            bottom = y + 1 < oh ? Cell(image, w, h, ow, oh, x, y + 1) : 0;
+            printf("\x1b[38;2;%d;%d;%dm\x1b[48;2;%d;%d;%dm\xe2\x96\x80", top, top, top, bottom, bottom, bottom);
+        }
+        printf("\x1b[0m\n");
+    }
+}
+
+static void ShowSheet(const char *path, int columns, int rows)
+{
+    unsigned char *image;
+    FILE *fp;
+    int w, h, frame;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        printf("        no contact sheet %s\n", path);
+        return;
+    }
+    if ((image = ProxyRead(fp, &w, &h, &frame)) == NULL) {
+        printf("        can't read %s\n", path);
+    }
+    else {
+        Render(image, w, h, columns, rows);
+        free(image);
+    }
+    fclose(fp);
+}
+
+static void PlayProxy(const char *path, sqlite3_int64 trial, double rate, int columns, int rows)
+{
+    unsigned char *image;
+    FILE *fp;
+    int w, h, frame, n = 0;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        printf("        no proxy %s\n", path);
+        return;
+    }
+    printf("\x1b[2J");
+    while ((image = ProxyRead(fp, &w, &h, &frame)) != NULL) {
+        printf("\x1b[H");
+        Render(image, w, h, columns, rows - 1);
+        printf("trial %lld  frame %d  (%d)  %s\x1b[K\n", (long long)trial, frame, ++n, path);
+        fflush(stdout);
+        free(image);
+        usleep((useconds_t)(1e6 / rate));
+    }
+    fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *catalog = CATALOG_FILE, *condition = NULL;
+    char path[512];
+    double rate = 10;
+    int c, play = 0, columns, rows, n = 0;
+    sqlite3 *db;
+    sqlite3_stmt *st;
+
+    TerminalSize(&columns, &rows);
+    while ((c = getopt(argc, argv, "c:pr:W:w:")) != -1) {
+        switch (c) {
+        case 'c':   catalog = optarg;               break;
+        case 'p':   play = 1;                       break;
+        case 'r':   rate = atof(optarg);            break;
+        case 'W':   columns = atoi(optarg);         break;
+        case 'w':   condition = optarg;             break;
+        default:
+            fprintf(stderr, "usage: %s [-c catalog] [-p] [-r fps] [-W columns] [-w sql_condition] [S|E] [column<op>value | column=lo..hi]...\n", argv[0]);
+            return(1);
+        }
+    }
+    if (rate <= 0 || columns < 1) {
+        fprintf(stderr, "-r and -W must be positive\n");
+        return(1);
+    }
+
+    if ((db = CatalogOpenRead(catalog)) == NULL) {
+        return(1);
+    }
+    st = CatalogSelect(db, "id, datetime(start, 'unixepoch', 'localtime'), identifier, freq, vert_ampl, horiz_ampl, phase_offset,"
+                           " fps, frames, status", argv + optind, argc - optind, condition);
+    if (st == NULL) {
+        sqlite3_close(db);
+        return(1);
+    }
+
+    while (sqlite3_step(st) == SQLITE_ROW) {
+        sqlite3_int64 trial = sqlite3_column_int64(st, 0);
+
+        printf("trial %lld  %s  %s  freq %d  vert %d  horiz %d  phase %d  %d fps  %d frames  %s\n", (long long)trial,
+               (const char *)sqlite3_column_text(st, 1), (const char *)sqlite3_column_text(st, 2),
+               sqlite3_column_int(st, 3), sqlite3_column_int(st, 4), sqlite3_column_int(st, 5), sqlite3_column_int(st, 6),
+               sqlite3_column_int(st, 7), sqlite3_column_int(st, 8), (const char *)sqlite3_column_text(st, 9));
+        if (CatalogFile(db, trial, play ? "proxy" : "sheet", path, sizeof(path)) == NULL) {
+            printf("        no proxy\n");
+        }
+        else if (play) {
+            PlayProxy(path, trial, rate, columns, rows);
+        }
+        else {
+            ShowSheet(path, columns, rows - 2);
+        }
+        n++;
+    }
+    printf("%d trials\n", n);
+    sqlite3_finalize(st);
+    sqlite3_close(db);
+    return(0);
+}
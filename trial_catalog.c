@@ -0,0 +1,235 @@
+/*
+ *  trial_catalog.c
+ *
+ *  SQLite catalog of trials - see trial_catalog.h.
+ *
+ *  The database is in WAL mode with synchronous=NORMAL, so a trial's
+ *  inserts cost no fsync of their own and readers such as trial_query can
+ *  run while trials are being added.
+ */
+
+// C library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trial_catalog.h"
+
+#if !defined(USE_SQLITE)
+    #define USE_SQLITE  1
+#endif
+
+#if USE_SQLITE
+#include <sqlite3.h>
+
+static sqlite3 *db = NULL;
+
+static const char *schema =
+    "PRAGMA journal_mode=WAL;"
+    "PRAGMA synchronous=NORMAL;"
+    "CREATE TABLE IF NOT EXISTS trials ("
+    "  id INTEGER PRIMARY KEY, start REAL, identifier TEXT, savedsignal INTEGER,"
+    "  freq INTEGER, vert_ampl INTEGER, horiz_ampl INTEGER, phase_offset INTEGER,"
+    "  fps INTEGER, frames INTEGER, pulse_time INTEGER, delay_time REAL,"
+    "  format TEXT, message TEXT, status TEXT,"
+    "  captured INTEGER, drops INTEGER, bytes REAL, fault INTEGER, telemetry TEXT);"
+    "CREATE INDEX IF NOT EXISTS trials_sweep ON trials(identifier, freq, phase_offset);"
+    "CREATE INDEX IF NOT EXISTS trials_start ON trials(start);"
+    "CREATE TABLE IF NOT EXISTS files (trial INTEGER, kind TEXT, path TEXT);"
+    "CREATE INDEX IF NOT EXISTS files_trial ON files(trial);"
+    "CREATE TABLE IF NOT EXISTS events ("
+    "  trial INTEGER, kind TEXT, frame INTEGER, first INTEGER, last INTEGER,"
+    "  t REAL, track INTEGER, x REAL, y REAL, value REAL);"
+    "CREATE INDEX IF NOT EXISTS events_trial ON events(trial, kind);";
+
+static int Failed(int rc, const char *what)
+{
+    if (rc != SQLITE_OK && rc != SQLITE_DONE && rc != SQLITE_ROW) {
+        printf("Trial catalog: %s: %s\r\n", what, sqlite3_errmsg(db));
+        return(1);
+    }
+    return(0);
+}
+
+
+
+// ================================================================================================
+// Open, creating the tables the first time
+// ================================================================================================
+int CatalogOpen(const char *path)
+{
+    sqlite3_stmt *st;
+    long n = 0;
+
+    if (sqlite3_open(path, &db) != SQLITE_OK || Failed(sqlite3_exec(db, schema, NULL, NULL, NULL), path)) {
+        printf("Trial catalog %s can't be opened: %s\r\n", path, db != NULL ? sqlite3_errmsg(db) : "out of memory");
+        sqlite3_close(db);
+        db = NULL;
+        return(-1);
+    }
+    sqlite3_busy_timeout(db, 1000);
+    if (sqlite3_prepare_v2(db, "SELECT count(*) FROM trials", -1, &st, NULL) == SQLITE_OK) {
+        if (sqlite3_step(st) == SQLITE_ROW) {
+            n = (long)sqlite3_column_int64(st, 0);
+        }
+        sqlite3_finalize(st);
+    }
+    printf("Trial catalog %s (%ld earlier trials).\r\n\n", path, n);
+    return(0);
+}
+
+void CatalogClose(void)
+{
+    sqlite3_close(db);
+    db = NULL;
+}
+
+
+
+// ================================================================================================
+// A trial's row, its files and events
+// ================================================================================================
+long CatalogBegin(const CatalogTrial *t)
+{
+    sqlite3_stmt *st;
+    char identifier[2] = { t->identifier, '\0' };
+    long id = 0;
+
+    if (db == NULL) {
+        return(0);
+    }
+    if (Failed(sqlite3_prepare_v2(db,
+            "INSERT INTO trials (start, identifier, savedsignal, freq, vert_ampl, horiz_ampl, phase_offset,"
+            " fps, frames, pulse_time, delay_time, format, message, status)"
+            " VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,'capturing')", -1, &st, NULL), "insert trial")) {
+        return(0);
+    }
+    sqlite3_bind_double(st, 1, t->start);
+    sqlite3_bind_text(st, 2, identifier, -1, SQLITE_TRANSIENT);
+    if (t->identifier == 'S') {
+        sqlite3_bind_int(st, 3, t->savedsignal);
+    }
+    sqlite3_bind_int(st, 4, t->freq);
+    if (t->identifier == 'E') {
+        sqlite3_bind_int(st, 5, t->vertampl);
+        sqlite3_bind_int(st, 6, t->horizampl);
+        sqlite3_bind_int(st, 7, t->phaseoffset);
+    }
+    sqlite3_bind_int(st, 8, t->fps);
+    sqlite3_bind_int(st, 9, t->frames);
+    sqlite3_bind_int(st, 10, t->pulsetime);
+    sqlite3_bind_double(st, 11, t->delaytime);
+    sqlite3_bind_text(st, 12, t->format != NULL ? t->format : "", -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 13, t->message != NULL ? t->message : "", -1, SQLITE_TRANSIENT);
+    if (!Failed(sqlite3_step(st), "insert trial")) {
+        id = (long)sqlite3_last_insert_rowid(db);
+    }
+    sqlite3_finalize(st);
+    return(id);
+}
+
+void CatalogAddFile(long trial, const char *kind, const char *path)
+{
+    sqlite3_stmt *st;
+
+    if (db == NULL || trial <= 0
+     || Failed(sqlite3_prepare_v2(db, "INSERT INTO files VALUES (?,?,?)", -1, &st, NULL), "insert file")) {
+        return;
+    }
+    sqlite3_bind_int64(st, 1, trial);
+    sqlite3_bind_text(st, 2, kind, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(st, 3, path, -1, SQLITE_TRANSIENT);
+    Failed(sqlite3_step(st), "insert file");
+    sqlite3_finalize(st);
+}
+
+// One transaction for all of them - a trial can have thousands
+void CatalogAddEvents(long trial, const EventDetector *events)
+{
+    sqlite3_stmt *st;
+    int i;
+
+    if (db == NULL || trial <= 0 || events->nevents == 0
+     || Failed(sqlite3_prepare_v2(db, "INSERT INTO events VALUES (?,?,?,?,?,?,?,?,?,?)", -1, &st, NULL), "insert events")) {
+        return;
+    }
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    for (i = 0; i < events->nevents; i++) {
+        const DropEvent *e = &events->events[i];
+
+        sqlite3_bind_int64(st, 1, trial);
+        sqlite3_bind_text(st, 2, EventName(e->kind), -1, SQLITE_STATIC);
+        sqlite3_bind_int(st, 3, e->frame);
+        sqlite3_bind_int(st, 4, e->first);
+        sqlite3_bind_int(st, 5, e->last);
+        sqlite3_bind_double(st, 6, e->t);
+        sqlite3_bind_int(st, 7, e->track);
+        sqlite3_bind_double(st, 8, e->x);
+        sqlite3_bind_double(st, 9, e->y);
+        sqlite3_bind_double(st, 10, e->value);
+        if (Failed(sqlite3_step(st), "insert event")) {
+            break;
+        }
+        sqlite3_reset(st);
+    }
+    sqlite3_finalize(st);
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+}
+
+void CatalogFinish(long trial, const TrialTelemetry *t)
+{
+    sqlite3_stmt *st;
+    char record[1024];
+
+    if (db == NULL || trial <= 0
+     || Failed(sqlite3_prepare_v2(db,
+            "UPDATE trials SET status=?, captured=?, drops=?, bytes=?, fault=?, telemetry=? WHERE id=?",
+            -1, &st, NULL), "finish trial")) {
+        return;
+    }
+    TelemetryFormat(t, record, sizeof(record));
+    sqlite3_bind_text(st, 1, t->rejected[0] ? "rejected" : t->fault ? "fault" : "complete", -1, SQLITE_STATIC);
+    sqlite3_bind_int(st, 2, t->captured);
+    sqlite3_bind_int(st, 3, t->drops);
+    sqlite3_bind_double(st, 4, t->byteswritten);
+    sqlite3_bind_int(st, 5, t->fault);
+    sqlite3_bind_text(st, 6, record, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(st, 7, trial);
+    Failed(sqlite3_step(st), "finish trial");
+    sqlite3_finalize(st);
+}
+
+#else
+
+int CatalogOpen(const char *path)
+{
+    printf("Built without SQLite - no trial catalog %s.\r\n\n", path);
+    return(-1);
+}
+
+void CatalogClose(void)
+{
+}
+
+long CatalogBegin(const CatalogTrial *t)
+{
+    (void)t;
+    return(0);
+}
+
+void CatalogAddFile(long trial, const char *kind, const char *path)
+{
+    (void)trial, (void)kind, (void)path;
+}
+
+void CatalogAddEvents(long trial, const EventDetector *events)
+{
+    (void)trial, (void)events;
+}
+
+void CatalogFinish(long trial, const TrialTelemetry *t)
+{
+    (void)trial, (void)t;
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ *  trial_catalog.h
+ *
+ *  Catalog of every trial, so the trials of a sweep can be found by their
+ *  parameters rather than by parsing file names. An SQLite database with
+ *
+ *	    trials  id, start, identifier, savedsignal, freq, vert_ampl,
+ *	            horiz_ampl, phase_offset, fps, frames, pulse_time,
+ *	            delay_time, format, message, status, captured, drops,
+ *	            bytes, fault, telemetry (the telemetry.h JSON record)
+ *	    files   trial, kind, path - every file the trial wrote
+ *	    events  trial, kind, frame, first, last, t, track, x, y, value -
+ *	            its drop events (drop_events.h)
+ *
+ *  indexed on (identifier, freq, phase_offset), start, and the trial of
+ *  each file and event, so "all E trials at 40 Hz with a phase offset of
+ *  90 to 180" is an index lookup however many trials there are - see
+ *  trial_query.c, trial_browse.c for their proxies (proxy.h), or open the
+ *  database with sqlite3.
+ *
+ *  A trial's row goes in as it starts, with status "capturing", and is
+ *  finished with its telemetry as "complete" or "fault", so a trial that
+ *  never finished still shows up. A trial that was never armed - its plan
+ *  didn't fit, or there was no memory for it - is finished as "rejected",
+ *  with the reason in its telemetry record. Build with -DUSE_SQLITE=0 where SQLite
+ *  isn't installed; such a build keeps no catalog.
+ */
+#ifndef TRIAL_CATALOG_H
+#define TRIAL_CATALOG_H
+
+#include "telemetry.h"
+#include "drop_events.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CATALOG_FILE    "mikrotron_trials.sqlite"
+
+typedef struct {
+    double      start;              // seconds since the epoch
+    char        identifier;         // 'S' or 'E'
+    int         savedsignal;
+    int         freq, vertampl, horizampl, phaseoffset;
+    int         fps, frames, pulsetime;
+    double      delaytime;
+    const char  *format;            // format profile
+    const char  *message;           // the trial message as received, options and all
+} CatalogTrial;
+
+int  CatalogOpen(const char *path);
+void CatalogClose(void);
+
+// Row id of the new trial, 0 without a catalog
+long CatalogBegin(const CatalogTrial *t);
+void CatalogAddFile(long trial, const char *kind, const char *path);
+void CatalogAddEvents(long trial, const EventDetector *events);
+void CatalogFinish(long trial, const TrialTelemetry *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ *  trial_query.c
+ *
+ *  Finds trials in the capture program's catalog (trial_catalog.h) by their
+ *  parameters, e.g. every E trial at 40 Hz with a phase offset of 90 to 180:
+ *
+ *	    ./trial_query E freq=40 phase=90..180
+ *
+ *  Each condition is a trials column (phase, vert, horiz, signal, delay and
+ *  pulse are short for phase_offset, vert_ampl, horiz_ampl, savedsignal,
+ *  delay_time and pulse_time), an operator = != < <= > >= and a value, or
+ *  column=lo..hi for a range; a lone S or E picks the identifier. -w adds
+ *  an SQL condition of your own. One line per trial with its sequence
+ *  file; -f lists every file the trial wrote, -e counts its drop events.
+ *
+ *  Compile and run as:
+ *
+ *	    gcc trial_query.c catalog_query.c -lsqlite3 -o trial_query
+ *	    ./trial_query [-c catalog] [-f] [-e] [-w sql_condition] [S|E] [column<op>value | column=lo..hi]...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "trial_catalog.h"
+#include "catalog_query.h"
+
+
+static void PrintFiles(sqlite3 *db, sqlite3_int64 trial)
+{
+    sqlite3_stmt *st;
+
+    if (sqlite3_prepare_v2(db, "SELECT kind, path FROM files WHERE trial=? ORDER BY rowid", -1, &st, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(st, 1, trial);
+        while (sqlite3_step(st) == SQLITE_ROW) {
+            printf("        %-10s %s\n", sqlite3_column_text(st, 0), sqlite3_column_text(st, 1));
+        }
+        sqlite3_finalize(st);
+    }
+}
+
+static void PrintEvents(sqlite3 *db, sqlite3_int64 trial)
+{
+    sqlite3_stmt *st;
+
+    if (sqlite3_prepare_v2(db, "SELECT kind, count(*), min(frame), max(frame) FROM events WHERE trial=? GROUP BY kind",
+                           -1, &st, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(st, 1, trial);
+        while (sqlite3_step(st) == SQLITE_ROW) {
+            printf("        %-12s %d, frames %d..%d\n", sqlite3_column_text(st, 0), sqlite3_column_int(st, 1),
+                   sqlite3_column_int(st, 2), sqlite3_column_int(st, 3));
+        }
+        sqlite3_finalize(st);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *catalog = CATALOG_FILE, *condition = NULL;
+    int c, files = 0, events = 0, n = 0;
+    sqlite3 *db;
+    sqlite3_stmt *st;
+
+    while ((c = getopt(argc, argv, "c:few:")) != -1) {
+        switch (c) {
+        case 'c':   catalog = optarg;               break;
+        case 'f':   files = 1;                      break;
+        case 'e':   events = 1;                     break;
+        case 'w':   condition = optarg;             break;
+        default:
+            fprintf(stderr, "usage: %s [-c catalog] [-f] [-e] [-w sql_condition] [S|E] [column<op>value | column=lo..hi]...\n", argv[0]);
+            return(1);
+        }
+    }
+
+    if ((db = CatalogOpenRead(catalog)) == NULL) {
+        return(1);
+    }
+    st = CatalogSelect(db, "id, datetime(start, 'unixepoch', 'localtime'), identifier, freq, vert_ampl, horiz_ampl, phase_offset,"
+                           " fps, frames, status, drops, (SELECT path FROM files WHERE trial=trials.id AND kind='sequence')",
+                       argv + optind, argc - optind, condition);
+    if (st == NULL) {
+        sqlite3_close(db);
+        return(1);
+    }
+
+    printf("%6s  %-19s  %-3s  %5s  %4s  %5s  %5s  %6s  %6s  %-9s  %5s  %s\n",
+           "id", "start", "S/E", "freq", "vert", "horiz", "phase", "fps", "frames", "status", "drops", "sequence");
+    while (sqlite3_step(st) == SQLITE_ROW) {
+        sqlite3_int64 trial = sqlite3_column_int64(st, 0);
+
+        printf("%6lld  %-19s  %-3s  %5d  %4d  %5d  %5d  %6d  %6d  %-9s  %5d  %s\n", (long long)trial,
+               (const char *)sqlite3_column_text(st, 1), (const char *)sqlite3_column_text(st, 2),
+               sqlite3_column_int(st, 3), sqlite3_column_int(st, 4), sqlite3_column_int(st, 5), sqlite3_column_int(st, 6),
+               sqlite3_column_int(st, 7), sqlite3_column_int(st, 8), (const char *)sqlite3_column_text(st, 9),
+               sqlite3_column_int(st, 10), sqlite3_column_type(st, 11) == SQLITE_NULL ? "-" : (const char *)sqlite3_column_text(st, 11));
+        if (files) {
+            PrintFiles(db, trial);
+        }
+        if (events) {
+            PrintEvents(db, trial);
+        }
+        n++;
+    }
+    if (sqlite3_errcode(db) != SQLITE_OK && sqlite3_errcode(db) != SQLITE_DONE && sqlite3_errcode(db) != SQLITE_ROW) {
+        fprintf(stderr, "%s: %s\n", catalog, sqlite3_errmsg(db));
+    }
+    printf("%d trials\n", n);
+    sqlite3_finalize(st);
+    sqlite3_close(db);
+    return(0);
+}
@@ -671,9 +671,8 @@ void do_savejpeg()
  *
  * Not expected to produce a nice looking image,
  * as it is limited to a text mode display.
- * Nor does it bother to try to do so efficiently; normally
- * the pxd_readuchar() would be called once for the entire
- * image, or perhaps once per line.
+ * pxd_readuchar() is called once per displayed line,
+ * rather than once per character.
  */
 void do_display()
 {
@@ -682,20 +681,28 @@ void do_display()
 			    'I', 'H', 'B', 'M',
 			  /* 0xB0, 0xB1, 0xB2, 0xDB */ };
     int     dx, dy, err = 0;
+    uchar   *line;
     #define DISPX   72
     #define DISPY   20
 
+    line = malloc(pxd_imageXdim());
+    if (!line) {
+	user("No memory for the display line");
+	return;
+    }
     for (dy = 0; dy < DISPY; dy++) {
+	int	iy = (dy*pxd_imageYdim())/DISPY;
+	int	r = pxd_readuchar(0x1, 1, 0, iy, -1, iy+1, line, pxd_imageXdim(), "Grey");
+	if (r < 0)
+	    err = r;
 	for (dx = 0; dx < DISPX; dx++) {
-	    uchar   value[1];
 	    int     ix = (dx*pxd_imageXdim())/DISPX;
-	    int     iy = (dy*pxd_imageYdim())/DISPY;
-	    err = pxd_readuchar(0x1, 1, ix, iy, ix+1, iy+1, value, 1, "Grey");
-	    value[0] = (value[0]*(sizeof(charcodes)-1))/255;
-	    printf("%c", charcodes[value[0]]);
+	    uchar   value = (r < 0) ? 0 : (line[ix]*(sizeof(charcodes)-1))/255;
+	    printf("%c", charcodes[value]);
 	}
 	printf("\n");
     }
+    free(line);
     if (err < 0)
 	printf("pxd_readuchar: %s\n", pxd_mesgErrorCode(err));
     user("Image buffer 'displayed'");
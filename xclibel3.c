@@ -127,19 +127,22 @@
 /*
  *  4)	Compile with GCC w/out PXIPL for 32 bit Linux as:
  *
- *	    gcc -DC_GNU32=400 -DOS_LINUX -I../.. xclibel3.c ../../xclib_i386.a -o xclibel3 -lm `pkg-config gtk+-2.0 --cflags --libs`
+ *	    gcc -DC_GNU32=400 -DOS_LINUX -I../.. xclibel3.c pixel_kernels.c ../../xclib_i386.a -o xclibel3 -lm `pkg-config gtk+-2.0 --cflags --libs`
  *    
  *	Compile with GCC with PXIPL for 32 bit Linux as:
  *
- *	    gcc -DC_GNU32=400 -DOS_LINUX -I../.. xclibel3.c ../../pxipl_i386.a ../../xclib_i386.a -o xclibel3 -lm `pkg-config gtk+-2.0 --cflags --libs`
+ *	    gcc -DC_GNU32=400 -DOS_LINUX -I../.. xclibel3.c pixel_kernels.c ../../pxipl_i386.a ../../xclib_i386.a -o xclibel3 -lm `pkg-config gtk+-2.0 --cflags --libs`
  *
  *	Compile with GCC w/out PXIPL for 64 bit Linux as:
  *
- *	    gcc -DC_GNU64=400 -DOS_LINUX -I../.. xclibel3.c ../../xclib_x86_64.a -o xclibel3 -lm `pkg-config gtk+-2.0 --cflags --libs`
+ *	    gcc -DC_GNU64=400 -DOS_LINUX -I../.. xclibel3.c pixel_kernels.c ../../xclib_x86_64.a -o xclibel3 -lm `pkg-config gtk+-2.0 --cflags --libs`
  *    
  *	Compile with GCC with PXIPL for 64 bit Linux as:
  *
- *	    gcc -DC_GNU64=400 -DOS_LINUX -I../.. xclibel3.c ../../pxipl_x86_64.a ../../xclib_x86_64.a -o xclibel3 -lm `pkg-config gtk+-2.0 --cflags --libs`
+ *	    gcc -DC_GNU64=400 -DOS_LINUX -I../.. xclibel3.c pixel_kernels.c ../../pxipl_x86_64.a ../../xclib_x86_64.a -o xclibel3 -lm `pkg-config gtk+-2.0 --cflags --libs`
+ *
+ *	The w/out PXIPL builds convert grey to RGB for the display with the
+ *	widest SSE/AVX2/AVX-512 kernel of pixel_kernels.c the cpu runs.
  *
  *	Run as:
  *	    ./xclibel3
@@ -154,12 +157,14 @@
 #include <signal.h>		// c library
 #include <stdlib.h>		// c library
 #include <stdarg.h>		// c library
+#include <string.h>		// c library
 #include "xcliball.h"		// function prototypes
 #if USE_PXIPL
 #include "pxipl.h"		// function prototypes
 #endif
 #include <gtk/gtk.h>		// GTK Window Library
 #include <gdk/gdkx.h>
+#include "pixel_kernels.h"	// grey to RGB, dispatched by cpu
 
 
 /* 
@@ -180,8 +185,13 @@ pxvbtime_t  lastcapttime = 0;		// when was image last captured
 struct pxywindow   pxywindow_display_size;
 struct pximage     *pximage;
 #else
-guchar	    *rgbbuf = NULL;	// GTK image buffer
+guchar	    *rgbbuf = NULL;	// GTK image buffer, image_width x image_height RGB
 size_t      rgbbufsize;         // Size of buffer
+guchar	    *linebuf = NULL;	// one full resolution line, as read from the frame buffer
+guchar	    *greybuf = NULL;	// displayed grey image, as last drawn
+guchar	    *greyline = NULL;	// one displayed line, before comparing with greybuf
+gint	    display_step;	// every display_step'th pixel and line is displayed
+gint	    image_width, image_height;	// displayed image size, fits in display_width x display_height
 #endif
 gboolean    PIXCI_is_SV234567 = FALSE;
 
@@ -287,6 +297,55 @@ void setGain(int b)
 }
 
 
+#if !USE_PXIPL
+/*
+ * Expand grey pixels to the RGB triplets gdk_draw_rgb_image() wants.
+ */
+void grey_to_rgb(const guchar *grey, guchar *rgb, int n)
+{
+    PxBest()->greytorgb(grey, rgb, n);
+}
+
+/*
+ * Read only the displayed lines of the frame buffer, one line each, and only
+ * every display_step'th pixel of them into the display image.
+ * Monochrome cameras are read as grey and compared with what is on screen;
+ * the band of lines that changed is returned in *top and *bottom, or -1 if none.
+ */
+void read_display(pxbuffer_t buf, int *top, int *bottom)
+{
+    int x, y, line;
+
+    *top = *bottom = -1;
+    for (y = 0; y < image_height; y++) {
+	line = y * display_step;
+	if (pxd_imageCdim() != 1) {
+	    guchar *rgb = rgbbuf + (size_t)y * image_width * 3;
+	    pxd_readuchar(UNITSMAP, buf, 0, line, pxd_imageXdim(), line+1, linebuf, pxd_imageXdim()*3, "RGB");
+	    for (x = 0; x < image_width; x++) {
+		rgb[3*x]   = linebuf[3*x*display_step];
+		rgb[3*x+1] = linebuf[3*x*display_step+1];
+		rgb[3*x+2] = linebuf[3*x*display_step+2];
+	    }
+	    if (*top < 0)
+		*top = y;
+	    *bottom = y;
+	    continue;
+	}
+	pxd_readuchar(UNITSMAP, buf, 0, line, pxd_imageXdim(), line+1, linebuf, pxd_imageXdim(), "Grey");
+	for (x = 0; x < image_width; x++)
+	    greyline[x] = linebuf[x*display_step];
+	if (memcmp(greyline, greybuf + (size_t)y*image_width, image_width) != 0) {
+	    memcpy(greybuf + (size_t)y*image_width, greyline, image_width);
+	    if (*top < 0)
+		*top = y;
+	    *bottom = y;
+	}
+    }
+}
+#endif
+
+
 /* Refreshes the display Window*/
 gboolean update_display(gpointer user_data)
 {
@@ -298,28 +357,43 @@ gboolean update_display(gpointer user_data)
 	}
     }
 
+    // Nothing new captured and nothing to repaint - skip the readout entirely
     if (lastcapttime != pxd_capturedFieldCount(1) || update_window) {
 	lastcapttime = pxd_capturedFieldCount(1);
-	update_window = FALSE;
 
 	#if USE_PXIPL
 	    /* Use PXIPL for Display - Requires PXIPL Library */
 	    /* Performs video scaling into display window. */
+	    update_window = FALSE;
 	    pximage = pxd_defineImage(1, 1 + buffer_toggle, 0, 0, -1, -1, "Display");
 	    pxio8_X11Display ( 0, pximage, 0, 0, 'n', 0, 0, GDK_WINDOW_XDISPLAY(display_area->window),
 		GDK_DRAWABLE_XID (display_area->window) , 0, 0, &pxywindow_display_size, 0, 0);
+	    display_count++;
 	#else
 	    /* Use GDK for Display */
-	    /* Performs a one to one display the size of the window. */
-	    pxd_readuchar(UNITSMAP, 1 + buffer_toggle, 0, 0, pxd_imageXdim(), pxd_imageYdim(), rgbbuf, rgbbufsize, "RGB");
-	    gdk_draw_rgb_image (display_area->window, display_area->style->fg_gc[GTK_STATE_NORMAL],
-		0, 0, display_width, display_height, GDK_RGB_DITHER_NONE, rgbbuf, pxd_imageXdim() * 3);
+	    /* Reads the image subsampled to fit the window, and redraws only the lines that changed. */
+	    int top, bottom;
+	    gboolean redraw_all = update_window;
+
+	    update_window = FALSE;
+	    read_display(1 + buffer_toggle, &top, &bottom);
+	    if (redraw_all) {
+		top = 0;
+		bottom = image_height - 1;
+	    }
+	    if (top >= 0) {
+		if (pxd_imageCdim() == 1)
+		    grey_to_rgb(greybuf + (size_t)top*image_width, rgbbuf + (size_t)top*image_width*3,
+				(bottom - top + 1) * image_width);
+		gdk_draw_rgb_image (display_area->window, display_area->style->fg_gc[GTK_STATE_NORMAL],
+		    0, top, image_width, bottom - top + 1, GDK_RGB_DITHER_NONE,
+		    rgbbuf + (size_t)top*image_width*3, image_width * 3);
+		display_count++;
+	    }
 	#endif
 
 	if (live_pair)
 		buffer_toggle=!buffer_toggle;
-
-	display_count++;
     }
   
     return TRUE;
@@ -579,7 +653,16 @@ int main (int argc, char *argv[])
 	pxywindow_display_size.se.x = display_width;
 	pxywindow_display_size.se.y = display_height;
     #else 
-	rgbbuf = malloc (rgbbufsize = pxd_imageXdim() * pxd_imageYdim() * 3 );
+	// Without PXIPL's scaling, show every display_step'th pixel so the whole image fits
+	display_step = MAX ( (pxd_imageXdim() + display_width  - 1) / display_width,
+			     (pxd_imageYdim() + display_height - 1) / display_height );
+	image_width  = pxd_imageXdim() / display_step;
+	image_height = pxd_imageYdim() / display_step;
+	rgbbuf = malloc (rgbbufsize = image_width * image_height * 3 );
+	linebuf = malloc ( pxd_imageXdim() * 3 );
+	greybuf = calloc ( image_width * image_height, 1 );
+	greyline = malloc ( image_width );
+	g_print ( "Display   Step: %d\n", display_step );
     #endif
 
     g_print ( "Display  Width: %d\n", display_width   );
@@ -705,6 +788,9 @@ int main (int argc, char *argv[])
     #if USE_PXIPL
     #else
 	free(rgbbuf);
+	free(linebuf);
+	free(greybuf);
+	free(greyline);
     #endif
     return 0;
 }
@@ -178,6 +178,9 @@
  *  6d) Compile with Microsoft Visual C/C++ for Windows XP/Vista/7/8 64-Bit as:
  *	    cl xclibex1.c -link  XCLIBW64.LIB
  *
+ *	In each case also compile in color_convert.c and pixel_kernels.c,
+ *	e.g. cl xclibex1.c color_convert.c pixel_kernels.c -link XCLIBW64.LIB
+ *
  *
  */
 
@@ -198,6 +201,7 @@
 #include "pxextras.h"           
 #endif
 #include "xcliball.h"		// function prototypes
+#include "color_convert.h"	// YCrCb, RGB, BSH and grey from one transfer
 
 
 /*
@@ -432,13 +436,19 @@ void do_extin2(void)
 
 /*
  * Pixels are transferred to a PC buffer, and numerically displayed.
+ *
+ * The AOI is transferred once, as RGB, and the YCrCb, BSH and grey
+ * values are derived from it on the PC (color_convert.h) rather
+ * than by a further pxd_readuchar() per color space.
  */
 #define AOI_XDIM    3
 #define AOI_YDIM    10
 #define COLORS	    3
 uchar	colorimage_buf[AOI_XDIM*AOI_YDIM*COLORS];
+ColorPlanes colorplanes;
+int	colorplanes_valid = 0;
 
-void color_display1(void)
+int color_transfer(void)
 {
     int     i;
     int     cx = (pxd_imageXdim()-AOI_XDIM)/2;	// left coordinate of centered AOI
@@ -447,19 +457,36 @@ void color_display1(void)
     //
     // Transfer the color data from a selected AOI of
     // the image buffer into the PC buffer in
-    // YCrCb (Intensity, Red Chroma and Blue Chroma)
-    // format.	The number of bytes to be transfered
+    // RGB format.	The number of bytes to be transfered
     // is 3 times the number of pixels.
     //
-    if ((i = pxd_readuchar(UNITSMAP, 1, cx, cy, cx+AOI_XDIM, cy+AOI_YDIM, colorimage_buf, sizeof(colorimage_buf)/sizeof(uchar), "YCRCB")) != AOI_XDIM*AOI_YDIM*3) {
+    colorplanes_valid = 0;
+    if ((i = pxd_readuchar(UNITSMAP, 1, cx, cy, cx+AOI_XDIM, cy+AOI_YDIM, colorimage_buf, sizeof(colorimage_buf)/sizeof(uchar), "RGB")) != AOI_XDIM*AOI_YDIM*3) {
 	if (i < 0)
 	    printf("pxd_readuchar: %s\n", pxd_mesgErrorCode(i));
 	else
 	    printf("pxd_readuchar error: %d != %d\n", i, AOI_XDIM*AOI_YDIM*3);
 	user("");
-	return;
+	return(-1);
     }
-    user("Image area of interest transfered for YCrCb");
+    //
+    // Split into RGB, YCrCb (Intensity, Red Chroma and Blue Chroma),
+    // BSH and grey planes, with the widest vector kernels this CPU has.
+    //
+    if (colorplanes.r == NULL && ColorPlanesAlloc(&colorplanes, AOI_XDIM, AOI_YDIM) != 0) {
+	printf("out of memory\n");
+	user("");
+	return(-1);
+    }
+    ColorSplit(colorimage_buf, &colorplanes);
+    colorplanes_valid = 1;
+    return(0);
+}
+
+void color_display1(void)
+{
+    if (color_transfer() == 0)
+	user("Image area of interest transfered once for YCrCb, RGB, BSH and Grey");
 }
 void color_display2(void)
 {
@@ -467,11 +494,13 @@ void color_display2(void)
     //
     // Display data from the PC buffer.
     //
+    if (!colorplanes_valid)
+	return;
     for (y = 0; y < AOI_YDIM; y++) {
 	for (x = 0; x < AOI_XDIM; x++) {
-	    printf(" Y=%3d  ", colorimage_buf[(y*AOI_XDIM+x)*3+0]);
-	    printf("Cr=%3d  ", colorimage_buf[(y*AOI_XDIM+x)*3+1]);
-	    printf("Cb=%3d  ", colorimage_buf[(y*AOI_XDIM+x)*3+2]);
+	    printf(" Y=%3d  ", colorplanes.y[y*AOI_XDIM+x]);
+	    printf("Cr=%3d  ", colorplanes.cr[y*AOI_XDIM+x]);
+	    printf("Cb=%3d  ", colorplanes.cb[y*AOI_XDIM+x]);
 	}
 	printf("\n");
     }
@@ -479,21 +508,13 @@ void color_display2(void)
 }
 void color_display3(void)
 {
-    int     i;
-    int     cx = (pxd_imageXdim()-AOI_XDIM)/2;	// left coordinate of centered AOI
-    int     cy = (pxd_imageYdim()-AOI_YDIM)/2;	// top	coordinate of centered AOI
-
     //
-    // Transfer the color data from a selected AOI
-    // in the image buffer into the PC buffer in
-    // RGB format.
+    // The RGB data came with the YCrCb transfer;
+    // only transfer again if that failed.
     //
-    if ((i = pxd_readuchar(UNITSMAP, 1, cx, cy, cx+AOI_XDIM, cy+AOI_YDIM, colorimage_buf, sizeof(colorimage_buf)/sizeof(uchar), "RGB")) != AOI_XDIM*AOI_YDIM*3) {
-	printf("pxd_readuchar error: %d != %d\n", i, AOI_XDIM*AOI_YDIM);
-	user("");
+    if (!colorplanes_valid && color_transfer() != 0)
 	return;
-    }
-    user("Image area of interest transfered for RGB");
+    user("Image area of interest available for RGB");
 }
 void color_display4(void)
 {
@@ -501,11 +522,13 @@ void color_display4(void)
     //
     // Display data from the PC buffer.
     //
+    if (!colorplanes_valid)
+	return;
     for (y = 0; y < AOI_YDIM; y++) {
 	for (x = 0; x < AOI_XDIM; x++) {
-	    printf("R=%3d ", colorimage_buf[(y*AOI_XDIM+x)*3+0]);
-	    printf("G=%3d ", colorimage_buf[(y*AOI_XDIM+x)*3+1]);
-	    printf("B=%3d ", colorimage_buf[(y*AOI_XDIM+x)*3+2]);
+	    printf("R=%3d ", colorplanes.r[y*AOI_XDIM+x]);
+	    printf("G=%3d ", colorplanes.g[y*AOI_XDIM+x]);
+	    printf("B=%3d ", colorplanes.b[y*AOI_XDIM+x]);
 	}
 	printf("\n");
     }
@@ -513,24 +536,12 @@ void color_display4(void)
 }
 void color_display5(void)
 {
-    int     i;
-    int     cx = (pxd_imageXdim()-AOI_XDIM)/2;	// left coordinate of centered AOI
-    int     cy = (pxd_imageYdim()-AOI_YDIM)/2;	// top	coordinate of centered AOI
-
     //
-    // Transfer the color data from a selected AOI
-    // in the image buffer into the PC buffer in
-    // BSH format.
+    // The BSH data is derived from the RGB transfer.
     //
-    if ((i = pxd_readuchar(UNITSMAP, 1, cx, cy, cx+AOI_XDIM, cy+AOI_YDIM, colorimage_buf, sizeof(colorimage_buf)/sizeof(uchar), "BSH")) != AOI_XDIM*AOI_YDIM*3) {
-	if (i < 0)
-	    printf("pxd_readuchar: %s\n", pxd_mesgErrorCode(i));
-	else
-	    printf("pxd_readuchar error: %d != %d\n", i, AOI_XDIM*AOI_YDIM*3);
-	user("");
+    if (!colorplanes_valid && color_transfer() != 0)
 	return;
-    }
-    user("Image area of interest transfered for BSH");
+    user("Image area of interest available for BSH");
 }
 void color_display6(void)
 {
@@ -541,81 +552,82 @@ void color_display6(void)
     // as displayed into the more typical 0 to 1 for S and B,
     // and 0 to 360 for H.
     //
+    if (!colorplanes_valid)
+	return;
     for (y = 0; y < AOI_YDIM; y++) {
 	for (x = 0; x < AOI_XDIM; x++) {
-	    printf("B=%5.2f ", colorimage_buf[(y*AOI_XDIM+x)*3+0]/255.);
-	    printf("S=%5.2f ", colorimage_buf[(y*AOI_XDIM+x)*3+1]/255.);
-	    printf("H=%3.0f ", colorimage_buf[(y*AOI_XDIM+x)*3+2]*360./256.);
+	    printf("B=%5.2f ", colorplanes.bri[y*AOI_XDIM+x]/255.);
+	    printf("S=%5.2f ", colorplanes.sat[y*AOI_XDIM+x]/255.);
+	    printf("H=%3.0f ", colorplanes.hue[y*AOI_XDIM+x]*360./256.);
 	}
 	printf("\n");
     }
     user("");
 }
 
-void color_display7(int component)
+char *color_component(int component)
 {
-    int     i;
-    int     cx = (pxd_imageXdim()-AOI_XDIM)/2;	// left coordinate of centered AOI
-    int     cy = (pxd_imageYdim()-AOI_YDIM)/2;	// top	coordinate of centered AOI
-    char    *colorspace = "";
+    switch (component) {
+      case 0:	return("RofRGB");
+      case 1:	return("GofRGB");
+      case 2:	return("BofRGB");
+      case 3:	return("BofBSH");
+      case 4:	return("SofBSH");
+      case 5:	return("HofBSH");
+      case 6:	return("Gray");
+      default:	return(NULL);
+    }
+}
 
+void color_display7(int component)
+{
     //
-    // Transfer one component of the color data from a selected AOI
-    // in the image buffer into the PC buffer in RGB or BSH format.
+    // One component of the color data, in RGB or BSH format,
+    // is one of the planes already derived from the RGB transfer.
     //
-    switch (component) {
-      case 0:	colorspace = "RofRGB";	break;
-      case 1:	colorspace = "GofRGB";	break;
-      case 2:	colorspace = "BofRGB";	break;
-      case 3:	colorspace = "BofBSH";	break;
-      case 4:	colorspace = "SofBSH";	break;
-      case 5:	colorspace = "HofBSH";	break;
-      case 6:	colorspace = "Gray";	break;
-      default:	return;
-    }
-    if ((i = pxd_readuchar(UNITSMAP, 1, cx, cy, cx+AOI_XDIM, cy+AOI_YDIM, colorimage_buf, sizeof(colorimage_buf)/sizeof(uchar), colorspace)) != AOI_XDIM*AOI_YDIM) {
-	if (i < 0)
-	    printf("pxd_readuchar: %s\n", pxd_mesgErrorCode(i));
-	else
-	    printf("pxd_readuchar error: %d != %d\n", i, AOI_XDIM*AOI_YDIM);
-	user("");
+    if (color_component(component) == NULL)
 	return;
-    }
-    user("Image area of interest transfered for one color component");
+    if (!colorplanes_valid && color_transfer() != 0)
+	return;
+    user("Image area of interest available for one color component");
 }
 
 void color_display8(int component)
 {
     int     x, y;
+    const uchar *plane;
     //
     // Display data from the PC buffer.
     // The HSB values, ranging from 0 to 255, are rescaled
     // as displayed into the more typical 0 to 1 for S and B,
     // and 0 to 360 for H.
     //
+    if (!colorplanes_valid || color_component(component) == NULL)
+	return;
+    plane = ColorPlane(&colorplanes, color_component(component));
     for (y = 0; y < AOI_YDIM; y++) {
 	for (x = 0; x < AOI_XDIM; x++) {
 	    switch (component) {
 	      case 0:
-		printf("RofRGB=%3d ", colorimage_buf[(y*AOI_XDIM+x)*1+0]);
+		printf("RofRGB=%3d ", plane[y*AOI_XDIM+x]);
 		break;
 	      case 1:
-		printf("GofRGB=%3d ", colorimage_buf[(y*AOI_XDIM+x)*1+0]);
+		printf("GofRGB=%3d ", plane[y*AOI_XDIM+x]);
 		break;
 	      case 2:
-		printf("BofRGB=%3d ", colorimage_buf[(y*AOI_XDIM+x)*1+0]);
+		printf("BofRGB=%3d ", plane[y*AOI_XDIM+x]);
 		break;
 	      case 3:
-		printf("BofBSH=%5.2f ", colorimage_buf[(y*AOI_XDIM+x)*1+0]/255.);
+		printf("BofBSH=%5.2f ", plane[y*AOI_XDIM+x]/255.);
 		break;
 	      case 4:
-		printf("SofBSH=%5.2f ", colorimage_buf[(y*AOI_XDIM+x)*1+0]/255.);
+		printf("SofBSH=%5.2f ", plane[y*AOI_XDIM+x]/255.);
 		break;
 	      case 5:
-		printf("HofBSH=%3.0f ", colorimage_buf[(y*AOI_XDIM+x)*1+0]*360./256.);
+		printf("HofBSH=%3.0f ", plane[y*AOI_XDIM+x]*360./256.);
 		break;
 	      case 6:
-		printf("Grey=%3d ", colorimage_buf[(y*AOI_XDIM+x)*1+0]);
+		printf("Grey=%3d ", plane[y*AOI_XDIM+x]);
 		break;
 	      default:
 		return;